@@ -28,47 +28,50 @@
 #include <config.h>
 
 #include <iostream>
+#include <vector>
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
+
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
+#include <ImfOutputFile.h>
+#include <ImfRgbaFile.h>
 
 #include <pfs.h>
 #include "exrio.h"
+#include "rawdata.h"
 
 using namespace Imf;
 using namespace Imath;
 
 
-OpenEXRReader::OpenEXRReader( const char* filename )
+OpenEXRReader::OpenEXRReader( const char* filename ) : fileName( filename )
 {
   //--- read image
-  file = new RgbaInputFile(filename);
-  dw = file->dataWindow();
+  file = new InputFile(filename);
+  dw = file->header().dataWindow();
 
   width  = dw.max.x - dw.min.x + 1;
   height = dw.max.y - dw.min.y + 1;
   
   if( width*height<=0 )
   {
+    delete file;
     throw pfs::Exception("EXR: illegal image size");
   }
 
   DEBUG_STR << "OpenEXR file \"" << filename << "\" ("
-	    << width << "x" << height << ")" << endl;
+	    << width << "x" << height << ")" << std::endl;
 }
 
 void OpenEXRReader::readImage( pfs::Array2D *R, pfs::Array2D *G,
 			       pfs::Array2D *B )
 {
   assert(file!=NULL);
-  DEBUG_STR << "Reading OpenEXR file... " << endl;
-  
-  Imf::Rgba* tmp_img = new Imf::Rgba[width*height];
-
-  assert( dw.min.x - dw.min.y * width<=0 );
-  file->setFrameBuffer(tmp_img - dw.min.x - dw.min.y * width, 1, width);
-  // read image to memory
-  file->readPixels(dw.min.y, dw.max.y);
+  DEBUG_STR << "Reading OpenEXR file... " << std::endl;
 
   // check if supplied matrixes have the same size as the image
   if( R->getCols()!=width || R->getRows()!=height ||
@@ -78,22 +81,64 @@ void OpenEXRReader::readImage( pfs::Array2D *R, pfs::Array2D *G,
     throw pfs::Exception("EXR: matrixes have different size than image");
   }
 
-  int idx=0;
-  for( int y=0 ; y<height ; y++ )
-    for( int x=0 ; x<width ; x++ )
+  pfs::Array2D *rgb[3] = { R, G, B };
+  static const char *rgb_names[3] = { "R", "G", "B" };
+  const size_t pix_count = (size_t)width*height;
+  
+  const ChannelList &channels = file->header().channels();
+  if( channels.findChannel( "R" ) != NULL &&
+    channels.findChannel( "G" ) != NULL &&
+    channels.findChannel( "B" ) != NULL )
+  {
+    // Decode directly into the arrays, the library converts HALF or
+    // UINT channels to float while decompressing
+    std::vector<float> tmp[3];
+    FrameBuffer frameBuffer;
+    for( int cc=0 ; cc<3 ; cc++ )
     {
-      (*R)(x,y) = tmp_img[idx].r;
-      (*G)(x,y) = tmp_img[idx].g;
-      (*B)(x,y) = tmp_img[idx].b;
-      idx++;
+      float *data = getRawData( rgb[cc] );
+      if( data == NULL )
+      {
+        tmp[cc].resize( pix_count );
+        data = &tmp[cc][0];
+      }
+      frameBuffer.insert( rgb_names[cc],
+        Slice( FLOAT,
+          (char*)(data - dw.min.x - dw.min.y * width),
+          sizeof(float),
+          sizeof(float) * width,
+          1, 1,
+          0.0 ) );
     }
-  delete tmp_img;
+    file->setFrameBuffer( frameBuffer );
+    file->readPixels( dw.min.y, dw.max.y );
+
+    for( int cc=0 ; cc<3 ; cc++ )
+      if( !tmp[cc].empty() )
+        for( size_t i=0 ; i<pix_count ; i++ )
+          (*rgb[cc])(i) = tmp[cc][i];
+    return;
+  }
+
+  // Luminance or luminance/chroma images are converted to RGB by the
+  // RGBA interface
+  RgbaInputFile rgbaFile( fileName.c_str() );
+  std::vector<Imf::Rgba> tmp_img( pix_count );
+  rgbaFile.setFrameBuffer( &tmp_img[0] - dw.min.x - dw.min.y * width, 1, width );
+  rgbaFile.readPixels( dw.min.y, dw.max.y );
+
+  for( size_t i=0 ; i<pix_count ; i++ )
+  {
+    (*R)(i) = tmp_img[i].r;
+    (*G)(i) = tmp_img[i].g;
+    (*B)(i) = tmp_img[i].b;
+  }
 }
 
 OpenEXRReader::~OpenEXRReader()
 {
   delete file;
-  file==NULL;
+  file=NULL;
 }
 
 OpenEXRWriter::OpenEXRWriter(const char* filename)
@@ -108,28 +153,44 @@ void OpenEXRWriter::writeImage( pfs::Array2D *R, pfs::Array2D *G,
   int width = R->getCols();
   int height = R->getRows();
 
-  Imf::Rgba* tmp_img = new Imf::Rgba[width*height];
-  int idx=0;
-  for( int y=0 ; y<height ; y++ )
-    for( int x=0 ; x<width ; x++ )
+  pfs::Array2D *rgb[3] = { R, G, B };
+  static const char *rgb_names[3] = { "R", "G", "B" };
+  const size_t pix_count = (size_t)width*height;
+
+  // The same file layout as RgbaOutputFile with WRITE_RGBA, but the
+  // float channel data is converted to half by the library while
+  // compressing, without an intermediate Rgba image
+  Header header( width, height );
+  FrameBuffer frameBuffer;
+  std::vector<float> tmp[3];
+  for( int cc=0 ; cc<3 ; cc++ )
+  {
+    const float *data = getRawData( rgb[cc] );
+    if( data == NULL )
     {
-      tmp_img[idx].r = (*R)(x,y);
-      tmp_img[idx].g = (*G)(x,y);
-      tmp_img[idx].b = (*B)(x,y);
-      tmp_img[idx].a = 1.0f;
-      idx++;
+      tmp[cc].resize( pix_count );
+      for( size_t i=0 ; i<pix_count ; i++ )
+        tmp[cc][i] = (*rgb[cc])(i);
+      data = &tmp[cc][0];
     }
+    header.channels().insert( rgb_names[cc], Channel(HALF) );
+    frameBuffer.insert( rgb_names[cc],
+      Slice( FLOAT, (char*)data, sizeof(float), sizeof(float) * width ) );
+  }
+
+  // Opaque alpha: zero strides repeat a single value
+  static const float alpha = 1.0f;
+  header.channels().insert( "A", Channel(HALF) );
+  frameBuffer.insert( "A", Slice( FLOAT, (char*)&alpha, 0, 0 ) );
 
   try
   {
-    RgbaOutputFile file( fileName, width, height, WRITE_RGBA );
-    file.setFrameBuffer( tmp_img, 1, width );
+    OutputFile file( fileName, header );
+    file.setFrameBuffer( frameBuffer );
     file.writePixels( height );
   }
   catch (const std::exception &exc)
   {
     throw pfs::Exception( exc.what() );
   }
-
-  delete tmp_img;
 }
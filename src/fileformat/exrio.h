@@ -28,13 +28,16 @@
 #ifndef _EXR_IO_H_
 #define _EXR_IO_H_
 
+#include <string>
+
 #include <array2d.h>
-#include <ImfRgbaFile.h>
+#include <ImfInputFile.h>
 
 
 class OpenEXRReader
 {
-  Imf::RgbaInputFile* file;		/// OpenEXR file object
+  Imf::InputFile* file;			/// OpenEXR file object
+  std::string fileName;			/// needed to reopen non-RGB files
   Imath::Box2i dw;			/// data window
   
   int width, height;
@@ -0,0 +1,143 @@
+/**
+ * @brief File patterns of pfsin and pfsout with the options passed to
+ * the pfsin* and pfsout* programs
+ *
+ * This file is a part of PFSTOOLS package.
+ * ----------------------------------------------------------------------
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "fileargs.h"
+
+std::string shellQuote( const char *str )
+{
+  std::string quoted = "'";
+  for( const char *c = str; *c != 0; c++ )
+    if( *c == '\'' )
+      quoted += "'\\''";
+    else
+      quoted += *c;
+  return quoted + "'";
+}
+
+/**
+ * @return number of arguments taken by the option if it is one of the
+ * program options (1 or 2 with its value), 0 otherwise
+ */
+static int programOption( const char *arg, const char *optstring,
+  const struct option *longopts )
+{
+  if( !strncmp( arg, "--", 2 ) ) {
+    const char *name = arg+2;
+    const char *eq = strchr( name, '=' );
+    const size_t len = eq == NULL ? strlen( name ) : eq-name;
+    for( const struct option *opt = longopts; opt->name != NULL; opt++ )
+      if( strlen( opt->name ) == len && !strncmp( opt->name, name, len ) )
+        return opt->has_arg == required_argument && eq == NULL ? 2 : 1;
+    return 0;
+  }
+  if( arg[1] == 0 || arg[1] == ':' )
+    return 0;
+  const char *opt = strchr( optstring, arg[1] );
+  if( opt == NULL )
+    return 0;
+  if( opt[1] == ':' )
+    return arg[2] == 0 ? 2 : 1;
+  return arg[2] == 0 ? 1 : 0;
+}
+
+FileArguments::FileArguments( int &argc, char *argv[], const char *fopenMode,
+  FILE *stdinout, const char *optstring, const struct option *longopts ) :
+  current( 0 ), stdinout( stdinout )
+{
+  std::vector<char*> program_args;
+  for( int i = 1; i < argc; i++ ) {
+    char *arg = argv[i];
+    const bool has_value = i+1 < argc;
+
+    if( arg[0] != '-' || !strcmp( arg, "-" ) ) {
+      Pattern pattern;
+      pattern.argv.push_back( argv[0] );
+      pattern.argv.push_back( arg );
+      pattern.it = NULL;
+      patterns.push_back( pattern );
+    }
+    else if( !strcmp( arg, "--frames" ) || !strcmp( arg, "-f" ) ||
+      !strcmp( arg, "--skip-missing" ) ) {
+      if( patterns.empty() )
+        throw pfs::Exception( "File pattern must be specified before '--frames' and '--skip-missing' switches" );
+      if( strcmp( arg, "--skip-missing" ) ) {
+        if( !has_value )
+          throw pfs::Exception( "Missing frame range after '--frames' switch" );
+        patterns.back().argv.push_back( (char*)"--frames" );
+        patterns.back().argv.push_back( argv[++i] );
+      } else
+        patterns.back().argv.push_back( arg );
+    }
+    else if( int n = programOption( arg, optstring, longopts ) ) {
+      program_args.push_back( arg );
+      if( n == 2 && has_value )
+        program_args.push_back( argv[++i] );
+    }
+    else {
+      std::string &args = patterns.empty() ? global_args : patterns.back().args;
+      args += " " + shellQuote( arg );
+      if( (!strcmp( arg, "--absolute" ) || !strcmp( arg, "-a" )) && has_value )
+        args += " " + shellQuote( argv[++i] );
+    }
+  }
+
+  for( size_t i = 0; i < patterns.size(); i++ ) {
+    int pattern_argc = (int)patterns[i].argv.size();
+    patterns[i].it = new pfs::FrameFileIterator( pattern_argc, &patterns[i].argv[0],
+      fopenMode, NULL, stdinout, NULL, NULL );
+  }
+
+  argc = 1 + (int)program_args.size();
+  for( size_t i = 0; i < program_args.size(); i++ )
+    argv[i+1] = program_args[i];
+  argv[argc] = NULL;
+}
+
+FileArguments::~FileArguments()
+{
+  for( size_t i = 0; i < patterns.size(); i++ )
+    delete patterns[i].it;
+}
+
+pfs::FrameFile FileArguments::getNextFrameFile( std::string &args )
+{
+  for( ; current < patterns.size(); current++ ) {
+    pfs::FrameFile ff = patterns[current].it->getNextFrameFile();
+    if( ff.fh != NULL ) {
+      args = global_args + patterns[current].args;
+      return ff;
+    }
+  }
+  args.clear();
+  return pfs::FrameFile( NULL, NULL );
+}
+
+void FileArguments::closeFrameFile( pfs::FrameFile &frameFile )
+{
+  if( frameFile.fh != NULL && frameFile.fh != stdinout )
+    fclose( frameFile.fh );
+  frameFile.fh = NULL;
+}
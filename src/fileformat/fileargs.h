@@ -0,0 +1,86 @@
+/**
+ * @brief File patterns of pfsin and pfsout with the options passed to
+ * the pfsin* and pfsout* programs
+ *
+ * This file is a part of PFSTOOLS package.
+ * ----------------------------------------------------------------------
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FILEARGS_H
+#define FILEARGS_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include <pfs.h>
+
+/**
+ * Iterates over the file patterns of the command line like
+ * pfs::FrameFileIterator and keeps the options that the program does
+ * not recognize, as the pfsin and pfsout scripts did: options given
+ * before the first file name are passed to the programs of all files,
+ * options given after a file name only to the program of that file.
+ * Such options take no value, except --absolute (-a); use the
+ * --name=value form otherwise.
+ */
+class FileArguments
+{
+public:
+  /**
+   * Only the options of the program (those in optstring and longopts)
+   * are left in argc/argv, to be parsed with getopt_long.
+   */
+  FileArguments( int &argc, char *argv[], const char *fopenMode,
+    FILE *stdinout, const char *optstring, const struct option *longopts );
+  ~FileArguments();
+
+  /**
+   * @param args [out] the options to pass for the file, each quoted
+   * for the shell and preceded by a space; empty if none
+   * @return next file, fh is NULL when there are no more files
+   */
+  pfs::FrameFile getNextFrameFile( std::string &args );
+
+  void closeFrameFile( pfs::FrameFile &frameFile );
+
+private:
+  struct Pattern
+  {
+    std::vector<char*> argv;    // file pattern with --frames, --skip-missing
+    std::string args;           // options given after the file name
+    pfs::FrameFileIterator *it;
+  };
+
+  std::string global_args;      // options given before the first file name
+  std::vector<Pattern> patterns;
+  size_t current;
+  FILE *stdinout;
+
+  FileArguments( const FileArguments& );
+  FileArguments& operator=( const FileArguments& );
+};
+
+/**
+ * @return the string quoted for the shell
+ */
+std::string shellQuote( const char *str );
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * @brief Pool of threads reading or writing frames in parallel
+ * 
+ * This file is a part of PFSTOOLS package.
+ * ---------------------------------------------------------------------- 
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ---------------------------------------------------------------------- 
+ */
+
+#include "framepool.h"
+
+#include <exception>
+
+FramePool::FramePool( int threads ) : finishing( false )
+{
+  pthread_mutex_init( &mutex, NULL );
+  pthread_cond_init( &job_added, NULL );
+  pthread_cond_init( &job_done, NULL );
+  for( int i = 0; i < threads; i++ ) {
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, workerMain, this ) != 0 )
+      break;
+    workers.push_back( thread );
+  }
+  if( workers.empty() )
+    throw pfs::Exception( "cannot create worker threads" );
+}
+
+FramePool::~FramePool()
+{
+  pthread_mutex_lock( &mutex );
+  finishing = true;
+  pthread_cond_broadcast( &job_added );
+  pthread_mutex_unlock( &mutex );
+  for( size_t i = 0; i < workers.size(); i++ )
+    pthread_join( workers[i], NULL );
+
+  // Jobs left after an error
+  for( size_t i = 0; i < jobs.size(); i++ )
+    delete jobs[i];
+
+  pthread_cond_destroy( &job_done );
+  pthread_cond_destroy( &job_added );
+  pthread_mutex_destroy( &mutex );
+}
+
+void FramePool::add( FrameJob *job )
+{
+  pthread_mutex_lock( &mutex );
+  jobs.push_back( job );
+  waiting.push_back( job );
+  pthread_cond_signal( &job_added );
+  pthread_mutex_unlock( &mutex );
+}
+
+FrameJob *FramePool::next()
+{
+  pthread_mutex_lock( &mutex );
+  FrameJob *job = jobs.front();
+  while( !job->done )
+    pthread_cond_wait( &job_done, &mutex );
+  jobs.pop_front();
+  pthread_mutex_unlock( &mutex );
+  return job;
+}
+
+void *FramePool::workerMain( void *arg )
+{
+  FramePool *pool = (FramePool*)arg;
+  pfs::DOMIO pfsio;
+  while( true ) {
+    pthread_mutex_lock( &pool->mutex );
+    while( pool->waiting.empty() && !pool->finishing )
+      pthread_cond_wait( &pool->job_added, &pool->mutex );
+    if( pool->finishing ) {
+      pthread_mutex_unlock( &pool->mutex );
+      break;
+    }
+    FrameJob *job = pool->waiting.front();
+    pool->waiting.pop_front();
+    pthread_mutex_unlock( &pool->mutex );
+
+    std::string error;
+    try {
+      job->run( pfsio );
+    }
+    catch( pfs::Exception ex ) {
+      error = ex.getMessage();
+    }
+    catch( std::exception &ex ) {
+      error = ex.what();
+    }
+
+    pthread_mutex_lock( &pool->mutex );
+    job->error = error;
+    job->done = true;
+    pthread_cond_broadcast( &pool->job_done );
+    pthread_mutex_unlock( &pool->mutex );
+  }
+  return NULL;
+}
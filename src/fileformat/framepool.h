@@ -0,0 +1,105 @@
+/**
+ * @brief Pool of threads reading or writing frames in parallel
+ * 
+ * This file is a part of PFSTOOLS package.
+ * ---------------------------------------------------------------------- 
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ---------------------------------------------------------------------- 
+ */
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+#include <pfs.h>
+
+/**
+ * Decoding or encoding of a single file, run by a worker thread of
+ * FramePool.
+ */
+class FrameJob
+{
+public:
+  FrameJob() : done( false )
+  {
+  }
+
+  virtual ~FrameJob()
+  {
+  }
+
+  /**
+   * Do the work. Errors are reported by throwing pfs::Exception.
+   */
+  virtual void run( pfs::DOMIO &pfsio ) = 0;
+
+  /**
+   * Error message if run() failed, empty otherwise.
+   */
+  std::string error;
+
+  bool done;
+};
+
+/**
+ * Pool of threads running jobs in parallel. The jobs are returned in
+ * the order in which they were added, so that the frames can be
+ * written in the order of the files. Jobs not returned from next() are
+ * deleted with the pool.
+ */
+class FramePool
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t job_added, job_done;
+  std::deque<FrameJob*> jobs;        // All jobs, in order
+  std::deque<FrameJob*> waiting;     // Jobs not taken by a worker yet
+  std::vector<pthread_t> workers;
+  bool finishing;
+
+  static void *workerMain( void *arg );
+
+public:
+  FramePool( int threads );
+  ~FramePool();
+
+  int getThreadCount() const
+    {
+      return (int)workers.size();
+    }
+
+  /**
+   * @return number of jobs added and not returned from next() yet
+   */
+  size_t getJobCount() const
+    {
+      return jobs.size();
+    }
+
+  void add( FrameJob *job );
+
+  /**
+   * Wait until the oldest job is done and remove it from the pool. The
+   * caller takes the ownership of the job.
+   */
+  FrameJob *next();
+};
+
+#endif
@@ -28,13 +28,23 @@
 #include <config.h>
 
 #include <iostream>
+#include <vector>
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include <pfs.h>
 
 #include "hdrtiffio.h"
+#include "rawdata.h"
 
 using namespace std;
 
@@ -44,21 +54,32 @@ int TIFFWriteIFD(FILE* file, unsigned short tag, unsigned short type,
 //---
 // HDR TIFF IO classes implementation
 
-HDRTiffReader::HDRTiffReader( const char* filename )
+HDRTiffReader::HDRTiffReader( const char* filename, int level ) :
+  file_name( filename ), directory( level )
 {
   // default values for constants
   exponential_mode = false;
   relative_values = false;
   xyz_colorspace = false;
+  sample_stride = 1;
 
   // read header containing width and height from file
   tif = TIFFOpen(filename, "r");
   if( !tif )
     throw pfs::Exception("TIFF: could not open file for reading.");
 
+  if( level > 0 && !TIFFSetDirectory(tif, (tdir_t)level) )
+  {
+    TIFFClose(tif);
+    throw pfs::Exception("TIFF: level does not exist in the file");
+  }
+
   //--- image size
   TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
   TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+  image_width = width;
+  image_height = height;
+  region_x = region_y = 0;
 
   if( width*height<=0 )
   {
@@ -92,7 +113,8 @@ HDRTiffReader::HDRTiffReader( const char* filename )
       // set decoder to output in float XYZ
       TIFFSetField(tif, TIFFTAG_SGILOGDATAFMT, SGILOGDATAFMT_FLOAT);
       xyz_colorspace = true;
-      TypeOfData = FLOAT;      
+      TypeOfData = FLOAT;
+      sample_stride = nSamples;      
       strcpy(format_string,"linear LogLuv XYZ");
       relative_values=true;
       break;
@@ -113,6 +135,7 @@ HDRTiffReader::HDRTiffReader( const char* filename )
 	TIFFClose(tif);
 	throw pfs::Exception("TIFF: unsupported samples per pixel for RGB");
       }
+      sample_stride = nSamples;
       if (!TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bps) || (bps!=8 && bps!=16 && bps!=32))
       {
 	TIFFClose(tif);
@@ -172,111 +195,372 @@ HDRTiffReader::HDRTiffReader( const char* filename )
     stonits = 1.;
 }
 
-void HDRTiffReader::readImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
+void HDRTiffReader::setRegion( int x, int y, int w, int h )
 {
-  //--- scanline buffer with pointers to different data types
-  union {
-    float* fp;
-    uint16* wp;
-    uint8* bp;
-    void* vp;
-  } buf;
-
-  //--- image length
-  uint32 imagelength;
-  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &imagelength);
-  DEBUG_STR << "Image length: " << imagelength << endl;
-
-  //--- image scanline size
-  uint32 scanlinesize = TIFFScanlineSize(tif);
-  buf.vp = _TIFFmalloc(scanlinesize);
-//    DEBUG_STR << "Scanline size: " << scanlinesize << endl;
-
-
-  //--- read scan lines
-  const int image_width = X->getCols();
-  for(uint32 row = 0; row < imagelength; row++)
+  if( x < 0 || y < 0 || w <= 0 || h <= 0 ||
+    (uint32)(x+w) > image_width || (uint32)(y+h) > image_height )
+    throw pfs::Exception("TIFF: region exceeds the image");
+  region_x = x;
+  region_y = y;
+  width = w;
+  height = h;
+}
+
+/**
+ * Converts count decoded pixels to float RGB (or XYZ) values. The
+ * loops work on plain arrays so that the compiler can vectorize them.
+ */
+void HDRTiffReader::convertPixels( const void *samples, int count,
+  float *x, float *y, float *z ) const
+{
+  const int s = sample_stride;
+  switch(TypeOfData)
   {
-    switch(TypeOfData)
+    case FLOAT:
     {
-      case FLOAT:
-	TIFFReadScanline(tif, buf.fp, row);
-	for( int i=0; i < image_width; i++ )
-	{
-	  (*X)(i,row) = buf.fp[i*nSamples];
-	  (*Y)(i,row) = buf.fp[i*nSamples+1];
-	  (*Z)(i,row) = buf.fp[i*nSamples+2];
-	}
-	break;
-      case WORD:
-	TIFFReadScanline(tif, buf.wp, row);
-	for( int i=0; i<image_width; i++ )
-	{
-	  (*X)(i,row) = buf.wp[i*nSamples]/65536.f;
-	  (*Y)(i,row) = buf.wp[i*nSamples+1]/65536.f;
-	  (*Z)(i,row) = buf.wp[i*nSamples+2]/65536.f;
-	}
-	break;
-      case BYTE:
-	TIFFReadScanline(tif, buf.bp, row);
-	for( int i=0; i<image_width; i++ )
-	{
-	  (*X)(i,row) = buf.bp[i*nSamples]/255.0f;
-	  (*Y)(i,row) = buf.bp[i*nSamples+1]/255.0f;
-	  (*Z)(i,row) = buf.bp[i*nSamples+2]/255.0f;
-// 	  (*X)(i,row) = pow( buf.bp[i*nSamples]/255.0, 2.2 );
-// 	  (*Y)(i,row) = pow( buf.bp[i*nSamples+1]/255.0, 2.2 );
-// 	  (*Z)(i,row) = pow( buf.bp[i*nSamples+2]/255.0, 2.2 );
-//				(*X)(i,row) = buf.bp[i*3];
-//				(*Y)(i,row) = buf.bp[i*3+1];
-//				(*Z)(i,row) = buf.bp[i*3+2];
-	}
-	break;
-      case GRAYSCALE16:
-	TIFFReadScanline(tif, buf.wp, row);
-
-        if( !exponential_mode )
+      const float *fp = (const float*)samples;
+      for( int i=0; i < count; i++ )
+      {
+	x[i] = fp[i*s];
+	y[i] = fp[i*s+1];
+	z[i] = fp[i*s+2];
+      }
+      break;
+    }
+    case WORD:
+    {
+      const uint16 *wp = (const uint16*)samples;
+      for( int i=0; i<count; i++ )
+      {
+	x[i] = wp[i*s]/65536.f;
+	y[i] = wp[i*s+1]/65536.f;
+	z[i] = wp[i*s+2]/65536.f;
+      }
+      break;
+    }
+    case BYTE:
+    {
+      const uint8 *bp = (const uint8*)samples;
+      for( int i=0; i<count; i++ )
+      {
+	x[i] = bp[i*s]/255.0f;
+	y[i] = bp[i*s+1]/255.0f;
+	z[i] = bp[i*s+2]/255.0f;
+      }
+      break;
+    }
+    case GRAYSCALE16:
+    {
+      const uint16 *wp = (const uint16*)samples;
+      if( !exponential_mode )
+      {
+        for( int i=0; i<count ; i++ )
         {
-          for( int i=0; i<image_width ; i++ )
-          {
-            float lum = buf.wp[i];
-            // D65 observer XYZ = (95.047,100,108.883);
-            (*X)(i,row) = 0.95047f * lum;
-            (*Y)(i,row) = lum;
-            (*Z)(i,row) = 1.08883f * lum;
-          }
+          float lum = wp[i];
+          // D65 observer XYZ = (95.047,100,108.883);
+          x[i] = 0.95047f * lum;
+          y[i] = lum;
+          z[i] = 1.08883f * lum;
         }
-        else
+      }
+      else
+      {
+        //!! this is for exponential tiffs
+        for( int i=0; i<count ; i++ )
         {
-          //!! this is for exponential tiffs
-          for( int i=0; i<image_width ; i++ )
-          {
-            static float pow2[] = {1,2,4,8,16,32,64,128,256,
-                                   512,1024,2048,4096,8192,16384,32768};
-            //--- 16bit value = a:4bit..b:12bit, lum = b*2^a
-            float value = buf.wp[i] & 0x0fff;
-            unsigned char expo = ( buf.wp[i] & 0xf000 ) >> 12;
-            float lum = value*pow2[expo];
-            (*X)(i,imagelength-row-1) = lum;
-            (*Y)(i,imagelength-row-1) = lum;
-            (*Z)(i,imagelength-row-1) = lum;
-          }
+          static const float pow2[] = {1,2,4,8,16,32,64,128,256,
+                                       512,1024,2048,4096,8192,16384,32768};
+          //--- 16bit value = a:4bit..b:12bit, lum = b*2^a
+          float value = wp[i] & 0x0fff;
+          unsigned char expo = ( wp[i] & 0xf000 ) >> 12;
+          float lum = value*pow2[expo];
+          x[i] = lum;
+          y[i] = lum;
+          z[i] = lum;
         }
-	break;
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * Size of a decoded pixel in bytes.
+ */
+int HDRTiffReader::pixelBytes() const
+{
+  switch(TypeOfData)
+  {
+    case FLOAT:
+      return sample_stride*sizeof(float);
+    case WORD:
+      return sample_stride*sizeof(uint16);
+    case BYTE:
+      return sample_stride*sizeof(uint8);
+    default:
+      return sizeof(uint16);
+  }
+}
+
+/**
+ * Opens another handle of the file, set up like the main one. libtiff
+ * handles can not be shared between threads.
+ */
+TIFF* HDRTiffReader::openHandle() const
+{
+  TIFF *t = TIFFOpen(file_name.c_str(), "r");
+  if( !t )
+    return NULL;
+  if( directory > 0 && !TIFFSetDirectory(t, (tdir_t)directory) )
+  {
+    TIFFClose(t);
+    return NULL;
+  }
+  if( phot == PHOTOMETRIC_LOGLUV )
+    TIFFSetField(t, TIFFTAG_SGILOGDATAFMT, SGILOGDATAFMT_FLOAT);
+  return t;
+}
+
+/**
+ * Strip or tile of the image
+ */
+struct TiffBlock
+{
+  uint32 index;                 // strip or tile number
+  uint32 x, y;                  // position of the top-left pixel
+};
+
+void HDRTiffReader::readImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
+{
+  DEBUG_STR << "Image region: " << width << "x" << height << "+"
+            << region_x << "+" << region_y << endl;
+
+  float *out[3] = { getRawData( X ), getRawData( Y ), getRawData( Z ) };
+  if( out[0] == NULL || out[1] == NULL || out[2] == NULL )
+  {
+    // Decode to temporary arrays if the memory is not accessible
+    pfs::Array2DImpl tX( width, height ), tY( width, height ), tZ( width, height );
+    readImage( &tX, &tY, &tZ );
+    pfs::copyArray( &tX, X );
+    pfs::copyArray( &tY, Y );
+    pfs::copyArray( &tZ, Z );
+    return;
+  }
+
+  //--- rows of the file that are decoded; exponential (LarsIII
+  //--- camera) files are stored bottom-up
+  const uint32 first = exponential_mode ? image_height-region_y-height : region_y;
+  const uint32 last = first+height;
+
+  //--- strips or tiles that intersect the region
+  const bool tiled = TIFFIsTiled(tif);
+  uint32 block_width = image_width, block_height;
+  tsize_t block_size;
+  std::vector<TiffBlock> blocks;
+  if( tiled )
+  {
+    TIFFGetField(tif, TIFFTAG_TILEWIDTH, &block_width);
+    TIFFGetField(tif, TIFFTAG_TILELENGTH, &block_height);
+    block_size = TIFFTileSize(tif);
+    for( uint32 ty = first - first%block_height; ty < last; ty += block_height )
+      for( uint32 tx = region_x - region_x%block_width; tx < region_x+width; tx += block_width )
+      {
+        TiffBlock b = { TIFFComputeTile(tif, tx, ty, 0, 0), tx, ty };
+        blocks.push_back( b );
+      }
+  }
+  else
+  {
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &block_height);
+    if( block_height > image_height )
+      block_height = image_height;
+    block_size = TIFFStripSize(tif);
+    for( uint32 sy = first - first%block_height; sy < last; sy += block_height )
+    {
+      TiffBlock b = { sy/block_height, 0, sy };
+      blocks.push_back( b );
     }
   }
+  const int pixel_bytes = pixelBytes();
+  const int block_count = blocks.size();
+  bool failed = false;
 
-  //--- free buffers and close files
-  _TIFFfree(buf.vp);
+  //--- independent strips or tiles are decoded concurrently, each
+  //--- thread through its own handle of the file
+  #pragma omp parallel if( block_count > 1 )
+  {
+    TIFF *t = tif;
+#ifdef _OPENMP
+    if( omp_get_thread_num() > 0 )
+      t = openHandle();
+#endif
+    uint8 *buf = (uint8*)_TIFFmalloc(block_size);
+
+    #pragma omp for schedule(dynamic)
+    for( int k = 0; k < block_count; k++ )
+    {
+      //--- the flag is shared by the threads, the remaining blocks
+      //--- are skipped once any of them fails
+      bool any_failed;
+      #pragma omp atomic read
+      any_failed = failed;
+      if( t == NULL || buf == NULL || any_failed )
+      {
+        #pragma omp atomic write
+        failed = true;
+        continue;
+      }
+      const TiffBlock &b = blocks[k];
+      tsize_t n = tiled ? TIFFReadEncodedTile(t, b.index, buf, block_size)
+        : TIFFReadEncodedStrip(t, b.index, buf, block_size);
+      if( n < 0 )
+      {
+        #pragma omp atomic write
+        failed = true;
+        continue;
+      }
+      const uint32 x0 = b.x > region_x ? b.x : region_x;
+      const uint32 x1 = (b.x+block_width < region_x+width) ? b.x+block_width : region_x+width;
+      const uint32 y0 = b.y > first ? b.y : first;
+      const uint32 y1 = (b.y+block_height < last) ? b.y+block_height : last;
+      for( uint32 row = y0; row < y1; row++ )
+      {
+        const int out_row = exponential_mode ?
+          (int)(last-1-row) : (int)(row-first);
+        const size_t offset = (size_t)out_row*width + (x0-region_x);
+        convertPixels( buf + ((size_t)(row-b.y)*block_width + (x0-b.x))*pixel_bytes,
+          x1-x0, out[0]+offset, out[1]+offset, out[2]+offset );
+      }
+    }
+
+    if( buf != NULL )
+      _TIFFfree(buf);
+    if( t != NULL && t != tif )
+      TIFFClose(t);
+  }
+
+  //--- close files
   TIFFClose(tif);
+
+  if( failed )
+    throw pfs::Exception("TIFF: error reading image data");
 }
 
 HDRTiffReader::~HDRTiffReader()
 {
 }
 
+#ifdef HAVE_ZLIB
+/**
+ * Applies the TIFF floating point predictor (PREDICTOR_FLOATINGPOINT)
+ * to a row of count float samples with stride samples per pixel: the
+ * bytes are rearranged into planes from the most to the least
+ * significant byte, and each byte is replaced by its difference to
+ * the byte of the previous pixel.
+ */
+static void floatPredictor( const float *row, int count, int stride,
+  unsigned char *out )
+{
+  static const union { uint32 i; unsigned char c[4]; } endian = { 1 };
+  const unsigned char *in = (const unsigned char*)row;
+  for( int i = 0; i < count; i++ )
+    for( int b = 0; b < 4; b++ )
+      out[(endian.c[0] ? 3-b : b)*count + i] = in[i*4+b];
+  for( int i = count*4-1; i >= stride; i-- )
+    out[i] -= out[i-stride];
+}
+
+void HDRTiffWriter::writeFloatTiles( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
+{
+  const int width = X->getCols();
+  const int height = X->getRows();
+  const int ts = tile_size;
+  const int tiles_x = (width+ts-1)/ts, tiles_y = (height+ts-1)/ts;
+  const size_t row_bytes = (size_t)ts*3*sizeof(float);
+  const size_t tile_bytes = row_bytes*ts;
+
+  // libtiff writes through the descriptor; the FILE is closed by the caller
+  fflush(file);
+  TIFF *tif = TIFFFdOpen(fileno(file), "pfsouttiff", "w");
+  if( !tif )
+    throw pfs::Exception("TIFF: could not open file for writing");
+
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32)width);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32)height);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 32);
+  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+  TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+  TIFFSetField(tif, TIFFTAG_TILEWIDTH, (uint32)ts);
+  TIFFSetField(tif, TIFFTAG_TILELENGTH, (uint32)ts);
+  TIFFSetField(tif, TIFFTAG_SOFTWARE, "PFSTOOLS tiff io operations");
+
+  //--- the tiles of a row are predicted and compressed concurrently,
+  //--- then written in order as raw (already encoded) tiles
+  std::vector< std::vector<unsigned char> > packed( tiles_x );
+  bool failed = false;
+  for( int ty = 0; ty < tiles_y && !failed; ty++ )
+  {
+    #pragma omp parallel
+    {
+      std::vector<float> row( ts*3 );
+      std::vector<unsigned char> tile( tile_bytes );
+
+      #pragma omp for schedule(dynamic) reduction(||:failed)
+      for( int tx = 0; tx < tiles_x; tx++ )
+      {
+        for( int r = 0; r < ts; r++ )
+        {
+          const int y = ty*ts + r;
+          for( int i = 0; i < ts; i++ )
+          {
+            const int x = tx*ts + i;
+            const bool inside = x < width && y < height;
+            row[i*3] = inside ? (*X)(x,y) : 0.f;
+            row[i*3+1] = inside ? (*Y)(x,y) : 0.f;
+            row[i*3+2] = inside ? (*Z)(x,y) : 0.f;
+          }
+          floatPredictor( &row[0], ts*3, 3, &tile[r*row_bytes] );
+        }
+        uLongf size = compressBound( tile_bytes );
+        packed[tx].resize( size );
+        if( compress2( &packed[tx][0], &size, &tile[0], tile_bytes,
+            Z_DEFAULT_COMPRESSION ) != Z_OK )
+          failed = true;
+        packed[tx].resize( size );
+      }
+    }
+
+    for( int tx = 0; tx < tiles_x && !failed; tx++ )
+      if( TIFFWriteRawTile(tif, ty*tiles_x + tx, &packed[tx][0], packed[tx].size()) < 0 )
+        failed = true;
+  }
+
+  if( !failed && !TIFFWriteDirectory(tif) )
+    failed = true;
+  TIFFCleanup(tif);
+
+  if( failed )
+    throw pfs::Exception("TIFF: error writing image data");
+}
+#endif
+
 void HDRTiffWriter::writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
 {
+  if( tile_size > 0 )
+  {
+#ifdef HAVE_ZLIB
+    writeFloatTiles( X, Y, Z );
+    return;
+#else
+    throw pfs::Exception("TIFF: float tiles are not supported without zlib");
+#endif
+  }
+
   // image size
   int width = X->getCols();
   int height = X->getRows();
@@ -308,19 +592,17 @@ void HDRTiffWriter::writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *
 
   //--------------------------------------------------------------------
   //--- writing image data
-  int strip_len = rows_per_strip*width*3;
-  int bytes_count = 0;		//bytes to write
-  int strip_no = 0;	// no of strip
-  unsigned char* strip = new unsigned char[strip_len];
+  //--- the strips are stored one after another, so the whole image is
+  //--- converted in parallel and written at once
+  unsigned char* data = new unsigned char[(size_t)width*height*3];
 
+  #pragma omp parallel for
   for( int y=0 ; y<height ; y++ )
   {
+    unsigned char *line = data + (size_t)y*width*3;
     for( int x=0 ; x<width ; x++ )
     {
       //!! gamma correction performed in transformColorSpace in pfsouttiff.cpp
-//       float r = pow( (*X)(x,y),1.0f/2.2f ) * 255.0f;
-//       float g = pow( (*Y)(x,y),1.0f/2.2f ) * 255.0f;
-//       float b = pow( (*Z)(x,y),1.0f/2.2f ) * 255.0f;
       float r = (*X)(x,y) * 255.0f;
       float g = (*Y)(x,y) * 255.0f;
       float b = (*Z)(x,y) * 255.0f;
@@ -329,38 +611,24 @@ void HDRTiffWriter::writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *
       g = (g>0) ? ( (g<255.0f)?g:255.0f) : 0;
       b = (b>0) ? ( (b<255.0f)?b:255.0f) : 0;
 
-      strip[bytes_count++] = (unsigned char) r;
-      strip[bytes_count++] = (unsigned char) g;
-      strip[bytes_count++] = (unsigned char) b;
-    }
-
-    if( y%rows_per_strip == rows_per_strip-1 )
-    {
-      // write strip
-      strip_offsets[strip_no] = tiff_offset;
-      strip_byte_counts[strip_no] = bytes_count;
-      fwrite(strip, sizeof(unsigned char), bytes_count, file);
-
-      tiff_offset+=bytes_count;
-      strip_no++;
-      bytes_count=0;
+      line[x*3] = (unsigned char) r;
+      line[x*3+1] = (unsigned char) g;
+      line[x*3+2] = (unsigned char) b;
     }
   }
 
-  // write remaining strip
-  if( bytes_count>0 )
+  for( int strip_no=0 ; strip_no<no_of_strips ; strip_no++ )
   {
-    // write strip
+    int rows = height - strip_no*rows_per_strip;
+    if( rows > rows_per_strip )
+      rows = rows_per_strip;
     strip_offsets[strip_no] = tiff_offset;
-    strip_byte_counts[strip_no] = bytes_count;
-    fwrite(strip, sizeof(unsigned char), bytes_count, file);
-
-    tiff_offset+=bytes_count;
-    strip_no++;
-    bytes_count=0;
+    strip_byte_counts[strip_no] = rows*width*3;
+    tiff_offset += strip_byte_counts[strip_no];
   }
+  fwrite(data, sizeof(unsigned char), (size_t)width*height*3, file);
 
-  delete[] strip;
+  delete[] data;
   //--------------------------------------------------------------------
 
   //--- Tiff data
@@ -28,6 +28,8 @@
 #ifndef _HDRTIFFIO_H_
 #define _HDRTIFFIO_H_
 
+#include <string>
+
 #include <tiffio.h>
 #include <array2d.h>
 
@@ -35,13 +37,18 @@
 class HDRTiffReader
 {
   TIFF* tif;
-  uint32 width, height;
+  std::string file_name;        /// for opening a handle per thread
+  int directory;                /// image file directory (level) that is read
+  uint32 width, height;         /// size of the region that is read
+  uint32 image_width, image_height; /// size of the image (level)
+  uint32 region_x, region_y;    /// top-left corner of the region
 
   uint16 comp;                  /// compression type
   uint16 phot;                  /// type of photometric data
   enum {FLOAT, WORD, BYTE, GRAYSCALE16} TypeOfData;
   uint16 bps;                   /// bits per sample
   uint16 nSamples;              /// number of channels in tiff file (only 1-3 are used)
+  int sample_stride;            /// number of samples per pixel in decoded data
   double stonits;               /// scale factor to get nit values
 
   bool exponential_mode;        /// if true, grayscale data come from LarsIII camera
@@ -49,10 +56,26 @@ class HDRTiffReader
   bool xyz_colorspace;          /// if true, values are in XYZ colorspace
 
   char format_string[255];       /// for verbose output 
+
+  void convertPixels( const void *samples, int count,
+    float *x, float *y, float *z ) const;
+  int pixelBytes() const;
+  TIFF* openHandle() const;
 public:
-  HDRTiffReader(  const char* filename );
+  /**
+   * @param level index of the image file directory to read; pyramid
+   * TIFF files store the reduced resolution levels in the directories
+   * following the full resolution image
+   */
+  HDRTiffReader(  const char* filename, int level = 0 );
   ~HDRTiffReader();
 
+  /**
+   * Restricts reading to a region of the image. getWidth() and
+   * getHeight() return the size of the region afterwards.
+   */
+  void setRegion( int x, int y, int w, int h );
+
   int getWidth() const
 	{
 		return width;
@@ -82,11 +105,23 @@ public:
 class HDRTiffWriter
 {
   FILE *file;
+  int tile_size;                /// 0 for 8-bit strips, otherwise float tiles
+
+  void writeFloatTiles( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z );
 public:
-  HDRTiffWriter( FILE *fh ) : file(fh)
+  HDRTiffWriter( FILE *fh ) : file(fh), tile_size(0)
 	{
 	}
 
+  /**
+   * Write 32-bit float RGB in square tiles of the given size (a
+   * multiple of 16), compressed with deflate and the floating point
+   * predictor, instead of uncompressed 8-bit strips. The file must be
+   * seekable, and pfstools must be compiled with zlib (HAVE_ZLIB).
+   */
+  void setFloatTiles( int size )
+    { tile_size = size; }
+
   void writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z );
 };
 
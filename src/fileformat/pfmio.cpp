@@ -0,0 +1,242 @@
+/**
+ * @brief IO operations on PFM file format
+ * 
+ * This file is a part of PFSTOOLS package.
+ * ---------------------------------------------------------------------- 
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ---------------------------------------------------------------------- 
+ * 
+ * @author Rafal Mantiuk, <mantiuk@mpi-sb.mpg.de>
+ *
+ * The format description was based on:
+ * http://netpbm.sourceforge.net/doc/pfm.html
+ */
+
+#include "pfmio.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#define PFM_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <pfs.h>
+
+#define PFMEOL "\x0a"
+
+/// Approximate number of floats read at a time if the file is not mapped
+#define PFM_BAND_FLOATS (1<<20)
+
+
+static inline uint32_t pfs_bswap_32(uint32_t x)
+{
+  x= ((x<<8)&0xFF00FF00) | ((x>>8)&0x00FF00FF);
+  x= (x>>16) | (x<<16);
+  return x;
+}
+
+
+static bool isBigEndian()
+{
+  int x = 1;
+  char *y = (char*)&x;
+  return y[0] == 0;
+}
+
+
+PFMHeader readPFMHeader( FILE *fh )
+{
+  PFMHeader header;
+  char headerID[2];
+  int read;
+    
+  read = fscanf( fh, "%c%c\n%d %d\n%f", &headerID[0], &headerID[1],
+    &header.width, &header.height,
+    &header.scale );
+
+  if( read != 5 )
+    throw pfs::Exception( "Wrong file header" );
+
+  if( !memcmp( "PF", headerID, 2 ) )
+    header.grayscale = false;
+  else if( !memcmp( "Pf", headerID, 2 ) )
+    header.grayscale = true;
+  else
+    throw pfs::Exception( "Wrong PFM image type" );
+
+  if( header.width <= 0 || header.height <= 0 )
+    throw pfs::Exception( "Wrong image size" );
+
+  read = fread( headerID, 1, 1, fh );  // Read a single EOL character
+
+  if( read != 1 || headerID[0] != 0x0a ) 
+    throw pfs::Exception( "Wrong file header" );
+
+  // Check if swapping bytes because of endianness is required
+  header.need_swap = (isBigEndian() ^ (header.scale > 0));
+  
+  return header;
+}
+
+/**
+ * Converts rows of PFM data (interleaved RGB or grayscale floats in
+ * the byte order of the file, not necessarily aligned) to the
+ * channels: the samples are deinterleaved, byte-swapped if needed and
+ * scaled. The inner loops are branch-free so that the compiler turns
+ * them into vector shuffles. data may be the grayscale channel itself.
+ */
+static void convertRows( const unsigned char *data, int rows, int first_row,
+  const PFMHeader &header, float *R, float *G, float *B )
+{
+  const int width = header.width;
+  const int channels = header.grayscale ? 1 : 3;
+  const float scaleFactor = fabs( header.scale );
+  const bool rescale = scaleFactor != 1;
+  float *out[3] = { R, G, B };
+
+  #pragma omp parallel for
+  for( int l = 0; l < rows; l++ ) {
+    const unsigned char *in = data + (size_t)l*width*channels*sizeof(float);
+    const size_t lineOffset = (size_t)(first_row+l)*width;
+    for( int c = 0; c < channels; c++ ) {
+      float *o = out[c] + lineOffset;
+      if( header.need_swap ) {
+        for( int x = 0; x < width; x++ ) {
+          uint32_t v;
+          memcpy( &v, in + (x*channels+c)*sizeof(float), sizeof(v) );
+          v = pfs_bswap_32( v );
+          memcpy( o+x, &v, sizeof(v) );
+        }
+      } else if( channels == 1 ) {
+        if( in != (const unsigned char*)o )
+          memcpy( o, in, width*sizeof(float) );
+      } else {
+        for( int x = 0; x < width; x++ )
+          memcpy( o+x, in + (x*channels+c)*sizeof(float), sizeof(float) );
+      }
+      if( rescale )
+        for( int x = 0; x < width; x++ )
+          o[x] *= scaleFactor;
+    }
+  }
+}
+
+/**
+ * Reads the pixels that follow the header. Regular files are mapped
+ * to memory and converted in place; other streams are read with one
+ * fread per band of rows (or straight into the channel for grayscale
+ * images).
+ */
+void readPFMData( FILE *fh, PFMHeader &header, float *R, float *G, float *B )
+{
+  const int channels = header.grayscale ? 1 : 3;
+  const size_t lineSize = (size_t)header.width*channels;
+
+#ifdef PFM_MMAP
+  struct stat st;
+  const long offset = ftell( fh );
+  if( offset >= 0 && fstat( fileno( fh ), &st ) == 0 && S_ISREG( st.st_mode ) ) {
+    const size_t length = offset + lineSize*header.height*sizeof(float);
+    if( (size_t)st.st_size < length )
+      throw pfs::Exception( "Unexpected EOF" );
+    void *map = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fileno( fh ), 0 );
+    if( map != MAP_FAILED ) {
+      posix_madvise( map, length, POSIX_MADV_SEQUENTIAL );
+      convertRows( (const unsigned char*)map + offset, header.height, 0,
+        header, R, G, B );
+      munmap( map, length );
+      fseek( fh, length, SEEK_SET ); // Leave the stream after the image
+      return;
+    }
+  }
+#endif
+
+  if( header.grayscale ) {
+    const size_t count = lineSize*header.height;
+    if( fread( R, sizeof( float ), count, fh ) != count )
+      throw pfs::Exception( "Unexpected EOF" );
+    convertRows( (const unsigned char*)R, header.height, 0, header, R, G, B );
+    return;
+  }
+  
+  const int bandRows = lineSize >= PFM_BAND_FLOATS ? 1 : PFM_BAND_FLOATS / lineSize;
+  std::vector<float> band( lineSize * (bandRows < header.height ? bandRows : header.height) );
+  for( int l = 0; l < header.height; l += bandRows ) {
+    const int rows = (header.height-l < bandRows) ? header.height-l : bandRows;
+    const size_t count = lineSize*rows;
+    if( fread( &band[0], sizeof( float ), count, fh ) != count )
+      throw pfs::Exception( "Unexpected EOF" );
+    convertRows( (const unsigned char*)&band[0], rows, l, header, R, G, B );
+  }
+}
+
+void writePFMFileColor( FILE *fh, int width, int height,
+  float *R, float *G, float *B )
+{
+  // Write header
+  int scale = -1;
+  if( isBigEndian() ) // Is this a big endian ?
+    scale = 1;  
+  fprintf( fh, "PF" PFMEOL "%d %d" PFMEOL "%d" PFMEOL, width, height, scale );
+  
+  // Rows are interleaved in parallel, a band at a time, and the band
+  // is written with a single fwrite
+  const size_t lineSize = (size_t)width*3;
+  const int bandRows = lineSize >= PFM_BAND_FLOATS ? 1 : PFM_BAND_FLOATS / lineSize;
+  float *band = new float[lineSize * std::min( bandRows, height )];
+  
+  for( int l = 0; l < height; l += bandRows ) {
+    const int rows = std::min( height-l, bandRows );
+    #pragma omp parallel for
+    for( int r = 0; r < rows; r++ ) {
+      const size_t lineOffset = (size_t)(l+r)*width;
+      float *line = band + r*lineSize;
+      for( int x = 0; x < width; x++ ) {
+        line[x*3+0] = R[lineOffset+x];
+        line[x*3+1] = G[lineOffset+x];
+        line[x*3+2] = B[lineOffset+x];
+      }
+    }
+    const size_t count = lineSize*rows;
+    if( fwrite( band, sizeof( float ), count, fh ) != count ) {
+      delete[] band;
+      throw pfs::Exception( "Unable to write data" );
+    }
+  }
+  delete[] band;  
+}
+
+void writePFMFileGrayscale( FILE *fh, int width, int height, float *Y )
+{
+  // Write header
+  int scale = -1;
+  if( isBigEndian() ) // Is this a big endian ?
+    scale = 1;  
+  fprintf( fh, "Pf" PFMEOL "%d %d" PFMEOL "%d" PFMEOL, width, height, scale );
+  
+  // The channel has the layout of the file
+  const size_t count = (size_t)width*height;
+  if( fwrite( Y, sizeof( float ), count, fh ) != count )
+    throw pfs::Exception( "Unable to write data" );
+}
@@ -0,0 +1,55 @@
+/**
+ * @brief IO operations on PFM file format
+ * 
+ * This file is a part of PFSTOOLS package.
+ * ---------------------------------------------------------------------- 
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ---------------------------------------------------------------------- 
+ * 
+ * @author Rafal Mantiuk, <mantiuk@mpi-sb.mpg.de>
+ *
+ * The format description was based on:
+ * http://netpbm.sourceforge.net/doc/pfm.html
+ */
+
+#ifndef PFMIO_H
+#define PFMIO_H
+
+#include <stdio.h>
+
+struct PFMHeader
+{
+  int width, height;
+  bool grayscale;
+  float scale;
+  bool need_swap;
+};
+
+PFMHeader readPFMHeader( FILE *fh );
+
+/**
+ * Reads the pixels that follow the header into the R, G and B arrays
+ * (only R for grayscale images).
+ */
+void readPFMData( FILE *fh, PFMHeader &header, float *R, float *G, float *B );
+
+void writePFMFileColor( FILE *fh, int width, int height,
+  float *R, float *G, float *B );
+
+void writePFMFileGrayscale( FILE *fh, int width, int height, float *Y );
+
+#endif
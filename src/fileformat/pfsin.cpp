@@ -0,0 +1,598 @@
+/**
+ * @brief Read images in any of the recognized formats and write a pfs
+ * stream to the standard output
+ *
+ * This file is a part of PFSTOOLS package.
+ * ----------------------------------------------------------------------
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <config.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#ifdef HAVE_OpenMP
+#include <omp.h>
+#endif
+
+#include <pfs.h>
+
+#include "fileargs.h"
+#include "framepool.h"
+#include "rgbeio.h"
+#include "pfmio.h"
+#ifdef HAVE_TIFF
+#include "hdrtiffio.h"
+#endif
+#ifdef HAVE_NETPBM
+#include "ppmio.h"
+#endif
+
+#define PROG_NAME "pfsin"
+
+class QuietException
+{
+};
+
+void printHelp()
+{
+  fprintf( stderr, PROG_NAME " [--linear] [--absolute <max_lum>] [--radiance] [--quiet] [--threads <n>] [--verbose] [--help] <file> [<file>...]\n"
+    "\nRecognized file formats and extensions:\n"
+    " Radiance RGBE - .pic, .hdr\n"
+    " TIFF (incl. LogLuv) - .tiff, .tif\n"
+    " PNM, PPM - .ppm, .pnm\n"
+    " JPEG - .jpeg, .jpg\n"
+    " PNG - .png\n"
+    " PFS - .pfs\n"
+    " OpenEXR - .exr\n"
+    " PFM - .pfm\n"
+    " DPX - .dpx\n"
+    " GIF - .gif\n"
+    " BMP - .bmp\n"
+    " EPS - .eps\n"
+    " hdrgen - .hdrgen (multi-exposure sequence, see pfscalibration)\n"
+    " Canon 350D RAW - .cr2\n"
+    " (and other camera RAW formats recognized by dcraw)\n"
+    "\nSee the man page for more information.\n" );
+}
+
+enum FileFormat { FMT_UNKNOWN, FMT_PFS, FMT_RGBE, FMT_PFM, FMT_PPM, FMT_TIFF, FMT_EXR };
+
+static const char *formatName( FileFormat format )
+{
+  switch( format ) {
+  case FMT_PFS: return "PFS";
+  case FMT_RGBE: return "Radiance RGBE";
+  case FMT_PFM: return "PFM";
+  case FMT_PPM: return "PNM";
+  case FMT_TIFF: return "TIFF";
+  case FMT_EXR: return "OpenEXR";
+  default: return "unknown";
+  }
+}
+
+/**
+ * Recognize the format from the first bytes of the file.
+ */
+static FileFormat formatFromMagic( const unsigned char *magic, size_t length )
+{
+  if( length >= 4 && !memcmp( magic, "PFS1", 4 ) )
+    return FMT_PFS;
+  if( length >= 2 && !memcmp( magic, "#?", 2 ) )
+    return FMT_RGBE;
+  if( length >= 3 && magic[0] == 'P' && (magic[1] == 'F' || magic[1] == 'f')
+    && isspace( magic[2] ) )
+    return FMT_PFM;
+  if( length >= 3 && magic[0] == 'P' && magic[1] >= '1' && magic[1] <= '6'
+    && isspace( magic[2] ) )
+    return FMT_PPM;
+  if( length >= 4 && (!memcmp( magic, "II*\0", 4 ) || !memcmp( magic, "MM\0*", 4 ) ||
+      !memcmp( magic, "II+\0", 4 ) || !memcmp( magic, "MM\0+", 4 )) )
+    return FMT_TIFF;
+  if( length >= 4 && !memcmp( magic, "\x76\x2f\x31\x01", 4 ) )
+    return FMT_EXR;
+  return FMT_UNKNOWN;
+}
+
+/**
+ * @return true if the format is decoded by this program rather than
+ * by one of the pfsin* programs
+ */
+static bool isFormatNative( FileFormat format )
+{
+  switch( format ) {
+  case FMT_PFS:
+  case FMT_RGBE:
+  case FMT_PFM:
+    return true;
+#ifdef HAVE_TIFF
+  case FMT_TIFF:
+    return true;
+#endif
+#ifdef HAVE_NETPBM
+  case FMT_PPM:
+    return true;
+#endif
+  default:
+    // OpenEXR files are left to pfsinexr, which also copies the
+    // additional channels and the header attributes
+    return false;
+  }
+}
+
+struct InputOptions
+{
+  bool linear;
+  float absoluteMaxLum;
+  bool radiance_compatibility;
+  bool quiet;
+  std::string ldr_arguments;    // Passed to the programs reading LDR images
+};
+
+/**
+ * The command reading a file that is not decoded natively, chosen by
+ * the extension as the pfsin script used to do. extra are the options
+ * given for the file on the command line.
+ */
+static std::string externalCommand( const char *fileName, const InputOptions &opt,
+  const std::string &extra )
+{
+  const char *dot = strrchr( fileName, '.' );
+  const char *ext = dot == NULL ? "" : dot+1;
+  const std::string file = shellQuote( fileName );
+  const std::string args = opt.ldr_arguments + extra;
+
+  if( !strcasecmp( ext, "hdr" ) || !strcasecmp( ext, "pic" ) )
+    return "pfsinrgbe --quiet " + file + (opt.radiance_compatibility ? " --radiance" : "") + extra;
+  if( !strcasecmp( ext, "ppm" ) || !strcasecmp( ext, "pnm" ) || !strcasecmp( ext, "pgm" ) )
+    return "pfsinppm " + file + args;
+  if( !strcasecmp( ext, "tif" ) || !strcasecmp( ext, "tiff" ) )
+#ifdef HAVE_TIFF
+    return "pfsintiff " + file + args;
+#else
+    return "pfsinimgmagick " + file + args;
+#endif
+  if( !strcasecmp( ext, "exr" ) )
+    return "pfsinexr " + file + extra;
+  if( !strcasecmp( ext, "pfm" ) )
+    return "pfsinpfm " + file + extra;
+  if( !strcasecmp( ext, "jpg" ) || !strcasecmp( ext, "jpeg" ) )
+    return "if command -v pfsinimgmagick >/dev/null; then pfsinimgmagick " + file + args +
+      "; else jpegtopnm " + file + " | pfsinppm -" + args + "; fi";
+  if( !strcasecmp( ext, "png" ) )
+    return "if command -v pfsinimgmagick >/dev/null; then pfsinimgmagick " + file + args +
+      "; else pngtopnm " + file + " | pfsinppm -" + args + "; fi";
+  if( !strcasecmp( ext, "dpx" ) || !strcasecmp( ext, "gif" ) ||
+    !strcasecmp( ext, "bmp" ) || !strcasecmp( ext, "eps" ) )
+    return "pfsinimgmagick " + file + args;
+  if( !strcasecmp( ext, "hdrgen" ) )
+    return "pfsinhdrgen " + file + args;
+  const std::string unknown = std::string( PROG_NAME ": Unknown extension: " ) + ext;
+  return "if dcraw -i " + file + " >/dev/null 2>&1; then pfsindcraw " + file + args +
+    "; else echo >&2 " + shellQuote( unknown.c_str() ) + "; exit 1; fi";
+}
+
+/**
+ * A file decoded by a worker thread. Frames are created by the native
+ * readers or, for the other formats, read from the pfs stream of the
+ * pfsin* program that understands the file.
+ */
+class InputJob : public FrameJob
+{
+public:
+  InputJob( FILE *fh, const char *fileName, FileFormat format,
+    const InputOptions &opt, const std::string &extra, int omp_threads ) :
+    fh( fh ), fileName( fileName ), format( format ), opt( opt ),
+    omp_threads( omp_threads )
+  {
+    // The options given for the file are understood only by the pfsin*
+    // programs, which then read the natively decoded formats as well
+    if( !isFormatNative( format ) || (!extra.empty() && format != FMT_PFS) ) {
+      if( fh == stdin )
+        throw pfs::Exception( !isFormatNative( format ) ?
+          "this file format cannot be read from the standard input" :
+          "options cannot be passed for the standard input" );
+      command = externalCommand( fileName, opt, extra );
+      closeFile();    // The command opens the file by itself
+    }
+  }
+
+  ~InputJob()
+  {
+    closeFile();
+    for( size_t i = 0; i < frames.size(); i++ )
+      delete frames[i];
+  }
+
+  void run( pfs::DOMIO &pfsio )
+  {
+#ifdef HAVE_OpenMP
+    omp_set_num_threads( omp_threads );
+#endif
+    if( !command.empty() ) {
+      readExternal( pfsio );
+      return;
+    }
+
+    switch( format ) {
+    case FMT_PFS:
+      readPFS( pfsio );
+      break;
+    case FMT_RGBE:
+      readRGBE( pfsio );
+      break;
+    case FMT_PFM:
+      readPFM( pfsio );
+      break;
+#ifdef HAVE_NETPBM
+    case FMT_PPM:
+      readPPM( pfsio );
+      break;
+#endif
+#ifdef HAVE_TIFF
+    case FMT_TIFF:
+      readTIFF( pfsio );
+      break;
+#endif
+    default:
+      throw pfs::Exception( "unsupported file format" );
+    }
+
+    const char *fileNameTag = fileName == "-" ? "stdin" : fileName.c_str();
+    for( size_t i = 0; i < frames.size(); i++ )
+      frames[i]->getTags()->setString( "FILE_NAME", fileNameTag );
+    closeFile();
+  }
+
+  FILE *fh;
+  std::string fileName;
+  FileFormat format;
+  std::string command;
+  std::vector<pfs::Frame*> frames;
+
+private:
+  const InputOptions &opt;
+  const int omp_threads;
+
+  void closeFile()
+  {
+    if( fh != NULL && fh != stdin )
+      fclose( fh );
+    fh = NULL;
+  }
+
+  void readPFS( pfs::DOMIO &pfsio )
+  {
+    pfs::Frame *frame;
+    while( (frame = pfsio.readFrame( fh )) != NULL )
+      frames.push_back( frame );
+  }
+
+  void readRGBE( pfs::DOMIO &pfsio )
+  {
+    RGBEReader reader( fh, opt.radiance_compatibility );
+    pfs::Frame *frame = pfsio.createFrame( reader.getWidth(), reader.getHeight() );
+    frames.push_back( frame );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+
+    //Store RGB data temporarily in XYZ channels
+    reader.readImage( X, Y, Z );
+    pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    frame->getTags()->setString("LUMINANCE", "RELATIVE");
+  }
+
+  void readPFM( pfs::DOMIO &pfsio )
+  {
+    PFMHeader header = readPFMHeader( fh );
+    pfs::Frame *frame = pfsio.createFrame( header.width, header.height );
+    frames.push_back( frame );
+
+    if( header.grayscale ) {
+      pfs::Channel *Y;
+      Y = frame->createChannel( "Y" );
+      readPFMData( fh, header, Y->getRawData(), NULL, NULL );
+    } else {
+      pfs::Channel *X, *Y, *Z;
+      frame->createXYZChannels( X, Y, Z );
+      readPFMData( fh, header, X->getRawData(), Y->getRawData(),
+        Z->getRawData() );
+      pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    }
+    frame->getTags()->setString("LUMINANCE", "RELATIVE");
+  }
+
+#ifdef HAVE_NETPBM
+  void readPPM( pfs::DOMIO &pfsio )
+  {
+    PPMReader reader( PROG_NAME, fh );
+    reader.setLinearize( opt.linear || opt.absoluteMaxLum != 0 );
+
+    pfs::Frame *frame = pfsio.createFrame( reader.getWidth(), reader.getHeight() );
+    frames.push_back( frame );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+
+    reader.readImage( X, Y, Z );
+    pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    if( opt.absoluteMaxLum != 0 ) {
+      const int pixCount = X->getWidth()*X->getHeight();
+      for( int i = 0; i < pixCount; i++ ) {
+        (*X)(i) *= opt.absoluteMaxLum;
+        (*Y)(i) *= opt.absoluteMaxLum;
+        (*Z)(i) *= opt.absoluteMaxLum;
+      }
+      frame->getTags()->setString("LUMINANCE", "ABSOLUTE");
+    } else if( opt.linear )
+      frame->getTags()->setString("LUMINANCE", "RELATIVE");
+    else
+      frame->getTags()->setString("LUMINANCE", "DISPLAY");
+
+    frame->getTags()->setString("WHITE_Y", "1");
+    char strbuf[3];
+    snprintf( strbuf, 3, "%d", reader.getBitDepth() );
+    frame->getTags()->setString("BITDEPTH", strbuf );
+  }
+#endif
+
+#ifdef HAVE_TIFF
+  void readTIFF( pfs::DOMIO &pfsio )
+  {
+    if( fh == stdin )
+      throw pfs::Exception( "TIFF images cannot be read from the standard input" );
+    closeFile();
+    HDRTiffReader reader( fileName.c_str() );
+
+    pfs::Frame *frame = pfsio.createFrame( reader.getWidth(), reader.getHeight() );
+    frames.push_back( frame );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+
+    //Store RGB data temporarily in XYZ channels
+    reader.readImage( X, Y, Z );
+    if( opt.linear && !reader.isRelative() )
+    {
+      pfs::transformColorSpace( pfs::CS_SRGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+      frame->getTags()->setString("LUMINANCE", "RELATIVE");
+    }
+    else
+    {
+      if( !reader.isColorspaceXYZ() )
+        pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+      frame->getTags()->setString("LUMINANCE", reader.isRelative() ? "RELATIVE" : "DISPLAY");
+    }
+  }
+#endif
+
+  void readExternal( pfs::DOMIO &pfsio )
+  {
+    FILE *pipe = popen( command.c_str(), "r" );
+    if( pipe == NULL )
+      throw pfs::Exception( "cannot execute a program reading the file" );
+    try {
+      pfs::Frame *frame;
+      while( (frame = pfsio.readFrame( pipe )) != NULL )
+        frames.push_back( frame );
+    }
+    catch( ... ) {
+      pclose( pipe );
+      throw;
+    }
+    if( pclose( pipe ) != 0 ) {
+      std::string msg = "cannot read file '" + fileName + "'";
+      throw pfs::Exception( msg.c_str() );
+    }
+  }
+};
+
+/**
+ * Recognize the format of an open file by its first bytes and leave
+ * the file position unchanged.
+ */
+static FileFormat detectFormat( FILE *fh )
+{
+  unsigned char magic[8];
+  const size_t length = fread( magic, 1, sizeof( magic ), fh );
+  if( length > 0 && fseek( fh, -(long)length, SEEK_CUR ) != 0 )
+    throw pfs::Exception( "the format of a non-seekable stream cannot be recognized" );
+  return formatFromMagic( magic, length );
+}
+
+
+void readFrames( int argc, char* argv[] )
+{
+  pfs::DOMIO pfsio;
+
+  bool verbose = false;
+  InputOptions opt;
+  opt.linear = false;
+  opt.absoluteMaxLum = 0;
+  opt.radiance_compatibility = false;
+  opt.quiet = false;
+  const int cpus = std::max( 1, (int)sysconf( _SC_NPROCESSORS_ONLN ) );
+  int threads = cpus;
+
+  // Parse command line parameters
+  static struct option cmdLineOptions[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "linear", no_argument, NULL, 'l' },
+    { "absolute", required_argument, NULL, 'a' },
+    { "radiance", no_argument, NULL, 'r' },
+    { "quiet", no_argument, NULL, 'q' },
+    { "threads", required_argument, NULL, 't' },
+    { NULL, 0, NULL, 0 }
+  };
+  static const char optstring[] = "hvla:rqt:";
+
+  if( argc < 2 ) {
+    printHelp();
+    throw QuietException();
+  }
+
+  // Options not listed above are passed to the pfsin* programs
+  FileArguments it( argc, argv, "rb", stdin, optstring, cmdLineOptions );
+
+  int optionIndex = 0;
+  while( 1 ) {
+    int c = getopt_long (argc, argv, optstring, cmdLineOptions, &optionIndex);
+    if( c == -1 ) break;
+    switch( c ) {
+    case 'h':
+      printHelp();
+      throw QuietException();
+    case 'v':
+      verbose = true;
+      break;
+    case 'l':
+      opt.linear = true;
+      break;
+    case 'a':
+      opt.absoluteMaxLum = (float)strtod( optarg, NULL );
+      break;
+    case 'r':
+      opt.radiance_compatibility = true;
+      break;
+    case 'q':
+      opt.quiet = true;
+      break;
+    case 't':
+      threads = strtol( optarg, NULL, 10 );
+      if( threads < 1 )
+        throw pfs::Exception( "number of threads must be at least 1" );
+      break;
+    case '?':
+      throw QuietException();
+    case ':':
+      throw QuietException();
+    }
+  }
+
+  if( opt.absoluteMaxLum != 0 && opt.linear )
+    throw pfs::Exception( "'absolute' and 'linear' are conflicting options" );
+  if( opt.absoluteMaxLum < 0 )
+    throw pfs::Exception( "maximum absolute luminance must be > 0" );
+
+  if( opt.linear )
+    opt.ldr_arguments += " --linear";
+  if( opt.absoluteMaxLum != 0 ) {
+    std::ostringstream arg;
+    arg << " --absolute " << opt.absoluteMaxLum;
+    opt.ldr_arguments += arg.str();
+  }
+
+  FramePool pool( threads );
+  VERBOSE_STR << "decoding threads: " << pool.getThreadCount() << std::endl;
+
+  bool rgbe_warning = !opt.quiet && !opt.radiance_compatibility;
+
+  // Keep a few files per thread in flight to hide the I/O latency,
+  // but do not open the whole sequence at once
+  const size_t max_jobs = 2*pool.getThreadCount();
+  bool more_files = true;
+  int stdin_jobs = 0;
+  while( more_files || pool.getJobCount() > 0 )
+  {
+    // Images from a stream must be decoded one after another
+    while( more_files && pool.getJobCount() < max_jobs && stdin_jobs == 0 ) {
+      std::string extra;
+      pfs::FrameFile ff = it.getNextFrameFile( extra );
+      if( ff.fh == NULL ) {
+        more_files = false; // No more frames
+        break;
+      }
+      if( ff.fh == stdin ) {
+        const int c = getc( stdin );
+        if( c == EOF ) {
+          more_files = false; // End of the stream
+          break;
+        }
+        ungetc( c, stdin );
+      }
+
+      const FileFormat format = detectFormat( ff.fh );
+      if( format == FMT_RGBE && rgbe_warning ) {
+        std::cerr << PROG_NAME << " warning: starting from pfstools 1.9.0, .hdr files are read without correcting for WHITE_EFFICIENCY,"
+          " which makes the absolute values incompatible with Radiance and previos versions of pfstools but compatible with most software."
+          " Use --radiance option to retain compatibility with Radiance and earlier versions of pfstools.  Use --quiet to suppress this message."
+          " Check the manual pages for pfsinrgbe for details." << std::endl;
+        rgbe_warning = false;
+      }
+
+      // Images decoded at the same time share the processors
+      const int omp_threads = std::max( 1, cpus / (int)(pool.getJobCount()+1) );
+      if( format == FMT_PFS && !extra.empty() )
+        std::cerr << PROG_NAME << " warning: options ignored for the PFS file '"
+                  << ff.fileName << "':" << extra << std::endl;
+      InputJob *job = new InputJob( ff.fh, ff.fileName, format, opt, extra, omp_threads );
+      if( job->command.empty() ) {
+        VERBOSE_STR << "reading file (" << formatName( format ) << ") '"
+                    << ff.fileName << "'" << std::endl;
+      } else
+        VERBOSE_STR << "reading file '" << ff.fileName << "' with: "
+                    << job->command << std::endl;
+      pool.add( job );
+      if( ff.fh == stdin )
+        stdin_jobs++;
+    }
+    if( pool.getJobCount() == 0 )
+      break;
+
+    InputJob *job = (InputJob*)pool.next();
+    if( job->fileName == "-" )
+      stdin_jobs--;
+    if( !job->error.empty() ) {
+      const std::string error = job->fileName + ": " + job->error;
+      delete job;
+      throw pfs::Exception( error.c_str() );
+    }
+
+    for( size_t i = 0; i < job->frames.size(); i++ )
+      pfsio.writeFrame( job->frames[i], stdout );
+    delete job;
+  }
+}
+
+
+int main( int argc, char* argv[] )
+{
+  try {
+    readFrames( argc, argv );
+  }
+  catch( pfs::Exception ex ) {
+    fprintf( stderr, PROG_NAME " error: %s\n", ex.getMessage() );
+    return EXIT_FAILURE;
+  }
+  catch( QuietException  ex ) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
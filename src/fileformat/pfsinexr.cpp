@@ -29,18 +29,24 @@
 
 #include <cstdlib>
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
+#include <memory>
 
 #include <stdio.h>
+#include <string.h>
 #include <pfs.h>
 #include <getopt.h>
 
 #include <ImfHeader.h>
 #include <ImfChannelList.h>
 #include <ImfInputFile.h>
+#include <ImfTiledInputFile.h>
 #include <ImfRgbaFile.h>
 #include <ImfStringAttribute.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 
 #define PROG_NAME "pfsinexr"
 
@@ -54,7 +60,7 @@ class QuietException
 
 void printHelp()
 {
-  fprintf( stderr, PROG_NAME " [--keep-rgb] [--verbose] [--help]\n"
+  fprintf( stderr, PROG_NAME " [--keep-rgb] [--region <x>,<y>,<w>,<h>] [--level <n>] [--threads <n>] [--verbose] [--help]\n"
     "See man page for more information.\n" );
 }
 
@@ -71,6 +77,112 @@ static string escapeString( const string &src )
   return ret;
 }
 
+/// Number of scan lines decoded at a time when reading a region
+#define REGION_BAND_LINES 64
+
+struct ReadChannel
+{
+  const char *name;             // OpenEXR channel name
+  float *data;                  // destination of the region
+};
+
+/**
+ * Reads the part of region rb that lies inside data window dw of a
+ * scan line file. Only the scan lines of the region are decoded, in
+ * bands of full width lines that are cropped into the channels. If
+ * the region spans whole lines, the lines are decoded directly into
+ * the channels.
+ */
+static void readScanlineRegion( InputFile &file, const Box2i &dw,
+  const Box2i &rb, const std::vector<ReadChannel> &channels )
+{
+  const int rw = rb.max.x - rb.min.x + 1;
+  const int x0 = max( rb.min.x, dw.min.x ), x1 = min( rb.max.x, dw.max.x );
+  const int y0 = max( rb.min.y, dw.min.y ), y1 = min( rb.max.y, dw.max.y );
+  if( x0 > x1 || y0 > y1 )
+    return;
+  const int fullWidth = dw.max.x - dw.min.x + 1;
+  const bool direct = (x0 == rb.min.x && x1 == rb.max.x && rw == fullWidth);
+  const int bandLines = direct ? y1-y0+1 : REGION_BAND_LINES;
+  const size_t ch_count = channels.size();
+  std::vector< std::vector<float> > band( direct ? 0 : ch_count );
+  for( size_t c = 0; c < band.size(); c++ )
+    band[c].resize( (size_t)fullWidth*bandLines, 0.f );
+  
+  for( int firstLine = y0; firstLine <= y1; firstLine += bandLines ) {
+    const int lines = (y1-firstLine+1 < bandLines) ? y1-firstLine+1 : bandLines;
+
+    FrameBuffer frameBuffer;
+    for( size_t c = 0; c < ch_count; c++ ) {
+      char *data = direct ?
+        (char*)(channels[c].data + (size_t)(firstLine-rb.min.y)*rw) :
+        (char*)&band[c][0];
+      frameBuffer.insert( channels[c].name,
+        Slice( FLOAT,
+          data - ((ptrdiff_t)dw.min.x + (ptrdiff_t)firstLine*fullWidth) * sizeof(float),
+          sizeof(float),
+          sizeof(float) * fullWidth,
+          1, 1,
+          0.0 ) );
+    }
+    file.setFrameBuffer( frameBuffer );
+    file.readPixels( firstLine, firstLine+lines-1 );
+
+    if( !direct )
+      for( size_t c = 0; c < ch_count; c++ )
+        for( int l = 0; l < lines; l++ )
+          memcpy( channels[c].data + (size_t)(firstLine+l-rb.min.y)*rw + (x0-rb.min.x),
+            &band[c][(size_t)l*fullWidth + (x0-dw.min.x)], (x1-x0+1)*sizeof(float) );
+  }
+}
+
+/**
+ * Reads the part of region rb that lies inside the data window of a
+ * level of a tiled file. Only the tiles that intersect the region are
+ * decoded, one row of tiles at a time.
+ */
+static void readTiledRegion( TiledInputFile &file, int level,
+  const Box2i &rb, const std::vector<ReadChannel> &channels )
+{
+  const Box2i lw = file.dataWindowForLevel( level, level );
+  const int rw = rb.max.x - rb.min.x + 1;
+  const int x0 = max( rb.min.x, lw.min.x ), x1 = min( rb.max.x, lw.max.x );
+  const int y0 = max( rb.min.y, lw.min.y ), y1 = min( rb.max.y, lw.max.y );
+  if( x0 > x1 || y0 > y1 )
+    return;
+  const int tileWidth = file.tileXSize(), tileHeight = file.tileYSize();
+  const int tx0 = (x0-lw.min.x) / tileWidth, tx1 = (x1-lw.min.x) / tileWidth;
+  const int ty0 = (y0-lw.min.y) / tileHeight, ty1 = (y1-lw.min.y) / tileHeight;
+  const int bandWidth = (tx1-tx0+1) * tileWidth;
+  const size_t ch_count = channels.size();
+  std::vector< std::vector<float> > band( ch_count );
+  for( size_t c = 0; c < ch_count; c++ )
+    band[c].resize( (size_t)bandWidth*tileHeight, 0.f );
+
+  for( int ty = ty0; ty <= ty1; ty++ ) {
+    const int bandX = lw.min.x + tx0*tileWidth, bandY = lw.min.y + ty*tileHeight;
+
+    FrameBuffer frameBuffer;
+    for( size_t c = 0; c < ch_count; c++ )
+      frameBuffer.insert( channels[c].name,
+        Slice( FLOAT,
+          (char*)&band[c][0] - ((ptrdiff_t)bandX + (ptrdiff_t)bandY*bandWidth) * sizeof(float),
+          sizeof(float),
+          sizeof(float) * bandWidth,
+          1, 1,
+          0.0 ) );
+    file.setFrameBuffer( frameBuffer );
+    file.readTiles( tx0, tx1, ty, ty, level, level );
+
+    const int by0 = max( y0, bandY ), by1 = min( y1, bandY+tileHeight-1 );
+    for( size_t c = 0; c < ch_count; c++ )
+      for( int y = by0; y <= by1; y++ )
+        memcpy( channels[c].data + (size_t)(y-rb.min.y)*rw + (x0-rb.min.x),
+          &band[c][(size_t)(y-bandY)*bandWidth + (x0-bandX)],
+          (x1-x0+1)*sizeof(float) );
+  }
+}
+
 
 void readFrames( int argc, char* argv[] )
 {
@@ -78,6 +190,10 @@ void readFrames( int argc, char* argv[] )
 
   bool verbose = false;
   bool keepRGB = false;
+  int threads = 0;
+  int level = 0;
+  bool region = false;
+  int regionX = 0, regionY = 0, regionWidth = 0, regionHeight = 0;
 
   // Parse command line parameters
   static struct option cmdLineOptions[] = {
@@ -85,9 +201,12 @@ void readFrames( int argc, char* argv[] )
     { "verbose", no_argument, NULL, 'v' },
     { "keep-rgb", no_argument, NULL, 'k' },
     { "linear", no_argument, NULL, 'l' },
+    { "threads", required_argument, NULL, 't' },
+    { "region", required_argument, NULL, 'r' },
+    { "level", required_argument, NULL, 'L' },
     { NULL, 0, NULL, 0 }
   };
-  static const char optstring[] = "lkhv";
+  static const char optstring[] = "lkhvt:r:L:";
     
   pfs::FrameFileIterator it( argc, argv, "rb", NULL, NULL,
     optstring, cmdLineOptions );
@@ -106,6 +225,22 @@ void readFrames( int argc, char* argv[] )
     case 'k':
       keepRGB = true;
       break;
+    case 't':
+      threads = atoi( optarg );
+      if( threads < 0 )
+        throw pfs::Exception( "number of threads must be non-negative" );
+      break;
+    case 'r':
+      if( sscanf( optarg, "%d,%d,%d,%d", &regionX, &regionY, &regionWidth, &regionHeight ) != 4 ||
+        regionX < 0 || regionY < 0 || regionWidth <= 0 || regionHeight <= 0 )
+        throw pfs::Exception( "region must be given as <x>,<y>,<w>,<h> with non-negative position and positive size" );
+      region = true;
+      break;
+    case 'L':
+      level = atoi( optarg );
+      if( level < 0 )
+        throw pfs::Exception( "level must be non-negative" );
+      break;
     case 'l':
       std::cerr << PROG_NAME << " warning: linearize option ignored for an HDR input!"
                 << std::endl;
@@ -118,6 +253,16 @@ void readFrames( int argc, char* argv[] )
   }
 
   VERBOSE_STR << "keep RGB channels untouch: " << (keepRGB ? "yes" : "no") << std::endl;
+  VERBOSE_STR << "decompression threads: " << threads << std::endl;
+  if( region )
+    VERBOSE_STR << "region: " << regionWidth << "x" << regionHeight << " at ("
+                << regionX << "," << regionY << ")" << std::endl;
+  if( level > 0 )
+    VERBOSE_STR << "level: " << level << std::endl;
+
+  // Lines are decompressed by the OpenEXR thread pool straight into
+  // the channel memory
+  setGlobalThreadCount( threads );
   
   while( true )
   {
@@ -127,21 +272,40 @@ void readFrames( int argc, char* argv[] )
 
     InputFile file( ff.fileName );
 
-    FrameBuffer frameBuffer;
-    
     Box2i dw = file.header().displayWindow();
     Box2i dtw = file.header().dataWindow();
-    int width  = dw.max.x - dw.min.x + 1;
-    int height = dw.max.y - dw.min.y + 1;
 
     if( dtw.min.x < dw.min.x || dtw.max.x > dw.max.x ||
 	dtw.min.y < dw.min.y || dtw.max.y > dw.max.y )
       throw pfs::Exception( "No support for OpenEXR files DataWidow greater than DisplayWindow" );
-    
 
-    pfs::Frame *frame = pfsio.createFrame( width, height );
+    // Regions and levels of tiled files are read tile by tile. The
+    // image is the display window, or the data window of a level
+    // above 0, and the region is measured from its top-left corner
+    // for both kinds of files.
+    std::auto_ptr<TiledInputFile> tiledFile;
+    if( file.header().hasTileDescription() && (region || level > 0) ) {
+      tiledFile.reset( new TiledInputFile( ff.fileName ) );
+      if( !tiledFile->isValidLevel( level, level ) )
+        throw pfs::Exception( "Level does not exist in the OpenEXR file" );
+      if( level > 0 )
+        dw = dtw = tiledFile->dataWindowForLevel( level, level );
+    } else if( level > 0 )
+      throw pfs::Exception( "Levels can be read only from tiled OpenEXR files" );
+
+    const int width  = dw.max.x - dw.min.x + 1;
+    const int height = dw.max.y - dw.min.y + 1;
+
+    if( !region ) {
+      regionWidth = width;
+      regionHeight = height;
+    } else if( regionX + regionWidth > width || regionY + regionHeight > height )
+      throw pfs::Exception( "Region exceeds the image" );
+
+    pfs::Frame *frame = pfsio.createFrame( regionWidth, regionHeight );
 
     const ChannelList &channels = file.header().channels();
+    std::vector<ReadChannel> readChannels;
 
     bool processColorChannels = false;
     pfs::Channel *X, *Y, *Z;
@@ -152,30 +316,10 @@ void readFrames( int argc, char* argv[] )
       if( rChannel!=NULL && gChannel!=NULL && bChannel!=NULL ) {
         frame->createXYZChannels( X, Y, Z );
 
-        frameBuffer.insert( "R",				  // name
-          Slice( FLOAT,			  // type
-//            (char*)(X->getRawData()),
-            (char*)(X->getRawData()),
-            sizeof(float),	  // xStride
-            sizeof(float) * width,// yStride
-            1, 1,			  // x/y sampling
-            0.0));			  // fillValue
-
-        frameBuffer.insert( "G",				  // name
-          Slice( FLOAT,			  // type
-            (char*)(Y->getRawData()),
-            sizeof(float),	  // xStride
-            sizeof(float) * width,// yStride
-            1, 1,			  // x/y sampling
-            0.0));			  // fillValue
-
-        frameBuffer.insert( "B",				  // name
-          Slice( FLOAT,			  // type
-            (char*)(Z->getRawData()),
-            sizeof(float),	  // xStride
-            sizeof(float) * width,// yStride
-            1, 1,			  // x/y sampling
-            0.0)); // fillValue
+        ReadChannel rgb[3] = { { "R", X->getRawData() },
+                               { "G", Y->getRawData() },
+                               { "B", Z->getRawData() } };
+        readChannels.insert( readChannels.end(), rgb, rgb+3 );
 
         processColorChannels = true;
       }
@@ -184,8 +328,6 @@ void readFrames( int argc, char* argv[] )
     for( ChannelList::ConstIterator i = channels.begin();
          i != channels.end(); ++i )
     {
-      const Channel &channel = i.channel();
-        
       if( processColorChannels ) { // Skip color channels
         if( !strcmp( i.name(), "R" ) || !strcmp( i.name(), "G" ) ||
           !strcmp( i.name(), "B" ) ) continue;
@@ -197,13 +339,8 @@ void readFrames( int argc, char* argv[] )
       }
         
       pfs::Channel *pfsCh = frame->createChannel( channelName );
-      frameBuffer.insert( i.name(),				  // name
-        Slice( FLOAT,			  // type
-          (char *)pfsCh->getRawData(),
-          sizeof(float),	  // xStride
-          sizeof(float) * width,// yStride
-          1, 1,			  // x/y sampling
-          0.0));			  // fillValue
+      ReadChannel rc = { i.name(), pfsCh->getRawData() };
+      readChannels.push_back( rc );
     }     
 
     // Copy attributes to tags
@@ -234,8 +371,23 @@ void readFrames( int argc, char* argv[] )
       }
     }
     
-    file.setFrameBuffer( frameBuffer );
-    file.readPixels( dw.min.y, dw.max.y );
+    Box2i rb;
+    rb.min.x = dw.min.x + regionX;
+    rb.min.y = dw.min.y + regionY;
+    rb.max.x = rb.min.x + regionWidth - 1;
+    rb.max.y = rb.min.y + regionHeight - 1;
+
+    // Pixels outside the data window are black
+    if( rb.min.x < dtw.min.x || rb.max.x > dtw.max.x ||
+      rb.min.y < dtw.min.y || rb.max.y > dtw.max.y )
+      for( size_t c = 0; c < readChannels.size(); c++ )
+        std::fill( readChannels[c].data,
+          readChannels[c].data + (size_t)regionWidth*regionHeight, 0.f );
+
+    if( tiledFile.get() != NULL )
+      readTiledRegion( *tiledFile, level, rb, readChannels );
+    else
+      readScanlineRegion( file, dtw, rb, readChannels );
 
     VERBOSE_STR << "reading file (linear) '" << ff.fileName << "'" << std::endl;
     
@@ -244,10 +396,12 @@ void readFrames( int argc, char* argv[] )
       if( hasWhiteLuminance( file.header() ) ) {
         float scaleFactor = whiteLuminance( file.header() );
         int pixelCount = frame->getHeight()*frame->getWidth();
+        float *x = X->getRawData(), *y = Y->getRawData(), *z = Z->getRawData();
+        #pragma omp parallel for
         for( int i = 0; i < pixelCount; i++ ) {
-          (*X)(i) *= scaleFactor;
-          (*Y)(i) *= scaleFactor;
-          (*Z)(i) *= scaleFactor;
+          x[i] *= scaleFactor;
+          y[i] *= scaleFactor;
+          z[i] *= scaleFactor;
         }
 //        const StringAttribute *relativeLum =
 //          file.header().findTypedAttribute<StringAttribute>("RELATIVE_LUMINANCE");
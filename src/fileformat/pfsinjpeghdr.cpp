@@ -28,13 +28,19 @@
 #include <config.h>
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <stdio.h>
 #include <pfs.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <math.h>
 
+#include "framepool.h"
+
 #define PROG_NAME "pfsinhdrjpeg"
 
 
@@ -53,31 +59,107 @@ class QuietException
 
 void printHelp()
 {
-  fprintf( stderr, PROG_NAME " [--verbose] [--help]\n"
+  fprintf( stderr, PROG_NAME " [--threads <n>] [--verbose] [--help]\n"
     "See man page for more information.\n" );
 }
 
+// The same matrix as used by pfs::transformColorSpace (colorspace.cpp)
+static const float rgb2xyzD65Mat[3][3] =
+{ { 0.412424f, 0.357579f, 0.180464f },
+  { 0.212656f, 0.715158f, 0.072186f },
+  { 0.019332f, 0.119193f, 0.950444f } };
 
-void readFrames( int argc, char* argv[] )
+/**
+ * Decode a JPEG-HDR image one scanline at a time, converting from
+ * RGB to XYZ while storing the pixels in the channels of the frame.
+ */
+static pfs::Frame *decodeJPEGHDR( FILE *fh, pfs::DOMIO &pfsio )
 {
-  pfs::DOMIO pfsio;
-  
-  JHSAMPLE   *hdrscan;
-  JSAMPLE    *ldrscan;
-  
   jpeghdr_decompress_struct jhinf;
   struct jpeg_error_mgr     jerr;
 
+  jhinf.cinfo.err = jpeg_std_error(&jerr);
+  // Reassign error handling functions as desired
+  jpeghdr_create_decompress(&jhinf);
+  jpeg_stdio_src(&jhinf.cinfo, fh);
+
+  if( jpeghdr_read_header(&jhinf) != JPEG_HEADER_HDR ) {
+    jpeghdr_destroy_decompress(&jhinf);
+    throw pfs::Exception( "Can handle only JPEG-HDR images" );
+  }
+
+  jpeghdr_start_decompress(&jhinf);
+  const int width = jhinf.cinfo.output_width;
+  const int height = jhinf.cinfo.output_height;
+  pfs::Frame *frame = pfsio.createFrame( width, height );
+  pfs::Channel *X, *Y, *Z;
+  frame->createXYZChannels( X, Y, Z );
+
+  std::vector<JHSAMPLE> hdrscan( width*3 );
+  // Important: test jhinf.output_scanline, not jhinf.cinfo
+  while (jhinf.output_scanline < jhinf.cinfo.output_height) {
+    const size_t offset = (size_t)width * jhinf.output_scanline;
+    jpeghdr_read_scanline(&jhinf, &hdrscan[0] );
+    float *x = X->getRawData() + offset, *y = Y->getRawData() + offset,
+      *z = Z->getRawData() + offset;
+    const JHSAMPLE *rgb = &hdrscan[0];
+    for( int i = 0; i < width; i++, rgb += 3 ) {
+      const float r = rgb[0], g = rgb[1], b = rgb[2];
+      x[i] = rgb2xyzD65Mat[0][0]*r + rgb2xyzD65Mat[0][1]*g + rgb2xyzD65Mat[0][2]*b;
+      y[i] = rgb2xyzD65Mat[1][0]*r + rgb2xyzD65Mat[1][1]*g + rgb2xyzD65Mat[1][2]*b;
+      z[i] = rgb2xyzD65Mat[2][0]*r + rgb2xyzD65Mat[2][1]*g + rgb2xyzD65Mat[2][2]*b;
+    }
+  }
+  jpeghdr_destroy_decompress(&jhinf);
+
+  return frame;
+}
+
+/**
+ * A file decoded by a worker thread.
+ */
+class JPEGHDRJob : public FrameJob
+{
+public:
+  JPEGHDRJob( FILE *fh, const char *fileName ) : fh( fh ),
+    fileName( fileName ), frame( NULL )
+  {
+  }
+
+  ~JPEGHDRJob()
+  {
+    if( fh != stdin )
+      fclose( fh );
+    delete frame;
+  }
+
+  void run( pfs::DOMIO &pfsio )
+  {
+    frame = decodeJPEGHDR( fh, pfsio );
+  }
+
+  FILE *fh;
+  std::string fileName;
+  pfs::Frame *frame;
+};
+
+
+void readFrames( int argc, char* argv[] )
+{
+  pfs::DOMIO pfsio;
+  
   bool verbose = false;
+  int threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
 
   // Parse command line parameters
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "verbose", no_argument, NULL, 'v' },
     { "linear", no_argument, NULL, 'l' },
+    { "threads", required_argument, NULL, 't' },
     { NULL, 0, NULL, 0 }
   };
-  static const char optstring[] = "";
+  static const char optstring[] = "t:";
     
   pfs::FrameFileIterator it( argc, argv, "rb", NULL, stdin,
     optstring, cmdLineOptions );
@@ -97,6 +179,11 @@ void readFrames( int argc, char* argv[] )
       std::cerr << PROG_NAME << " warning: linearize option ignored for an HDR input!"
                 << std::endl;
       break;
+    case 't':
+      threads = strtol( optarg, NULL, 10 );
+      if( threads < 1 )
+        throw pfs::Exception( "number of threads must be at least 1" );
+      break;
     case '?':
       throw QuietException();
     case ':':
@@ -104,66 +191,51 @@ void readFrames( int argc, char* argv[] )
     }
   }
 
- 
-  while( true )
-  {
-    pfs::FrameFile ff = it.getNextFrameFile();
-    if( ff.fh == NULL ) break; // No more frames
+  if( threads < 1 )
+    threads = 1;
 
-    jhinf.cinfo.err = jpeg_std_error(&jerr);
-    // Reassign error handling functions as desired
-    jpeghdr_create_decompress(&jhinf);
-    jpeg_stdio_src(&jhinf.cinfo, ff.fh);
+  FramePool pool( threads );
+  VERBOSE_STR << "decoding threads: " << pool.getThreadCount() << std::endl;
 
-    VERBOSE_STR << "reading file '" << ff.fileName << "'" << std::endl;
-    
-    pfs::Frame *frame;
-     
-    switch (jpeghdr_read_header(&jhinf)) {
-    case JPEG_HEADER_HDR:  // HDR image          
-      jpeghdr_start_decompress(&jhinf);
-      frame = pfsio.createFrame( jhinf.cinfo.output_width, jhinf.cinfo.output_height );
-      hdrscan = (JHSAMPLE *)malloc(jhinf.cinfo.output_width * jhinf.cinfo.output_height *
-        sizeof(JHSAMPLE)*3);
-      // Important: test jhinf.output_scanline, not jhinf.cinfo
-      int index ;
-      index = 0;
-      while (jhinf.output_scanline < jhinf.cinfo.output_height) {
-        jpeghdr_read_scanline(&jhinf, (JHSAMPLE *)hdrscan + index );
-        index += jhinf.cinfo.output_width * 3; 
+  // Keep a few files per thread in flight to hide the I/O latency,
+  // but do not open the whole sequence at once
+  const size_t max_jobs = 2*pool.getThreadCount();
+  bool more_files = true;
+  int stdin_jobs = 0;
+  while( more_files || pool.getJobCount() > 0 )
+  {
+    // Images from a stream must be decoded one after another
+    while( more_files && pool.getJobCount() < max_jobs && stdin_jobs == 0 ) {
+      pfs::FrameFile ff = it.getNextFrameFile();
+      if( ff.fh == NULL ) {
+        more_files = false; // No more frames
+        break;
       }
-       
-      pfs::Channel *X, *Y, *Z;
-      frame->createXYZChannels( X, Y, Z );
-      //printf("bbb");
-      //exit(0);
-      for(int i=0;i<jhinf.cinfo.output_width * jhinf.cinfo.output_height;i++)
-      {
-        (X->getRawData())[i] = hdrscan[3*i];
-        (Y->getRawData())[i] = hdrscan[3*i + 1];
-        (Z->getRawData())[i] = hdrscan[3*i + 2];
-      }       
-      pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );	  
-      free((void *)hdrscan);
-      break;
-    case JPEG_HEADER_OK:  // LDR image
-    case JPEG_SUSPENDED:
-    case JPEG_HEADER_TABLES_ONLY:
-    default:
-      throw pfs::Exception( "Can handle only JPEG-HDR images" );
+      VERBOSE_STR << "reading file '" << ff.fileName << "'" << std::endl;
+      pool.add( new JPEGHDRJob( ff.fh, ff.fileName ) );
+      if( ff.fh == stdin )
+        stdin_jobs++;
+    }
+    if( pool.getJobCount() == 0 )
       break;
+
+    JPEGHDRJob *job = (JPEGHDRJob*)pool.next();
+    if( job->fh == stdin )
+      stdin_jobs--;
+    if( job->frame == NULL ) {
+      const std::string error = job->error;
+      delete job;
+      throw pfs::Exception( error.c_str() );
     }
-    it.closeFrameFile( ff );
     
+    pfs::Frame *frame = job->frame;
     frame->getTags()->setString("LUMINANCE", "RELATIVE");
 
-    const char *fileNameTag = strcmp( "-", ff.fileName )==0 ? "stdin" : ff.fileName;
+    const char *fileNameTag = strcmp( "-", job->fileName.c_str() )==0 ? "stdin" : job->fileName.c_str();
     frame->getTags()->setString( "FILE_NAME", fileNameTag );
 
-    jpeghdr_destroy_decompress(&jhinf);
-    
     pfsio.writeFrame( frame, stdout );
-    pfsio.freeFrame( frame );
+    delete job;
   }
 }
 
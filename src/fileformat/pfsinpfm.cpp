@@ -33,136 +33,15 @@
 #include <iostream>
 
 #include <stdio.h>
-#include <stdint.h>
+#include <string.h>
 #include <getopt.h>
 #include <stdlib.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#define PROG_NAME "pfsinpfm"
-
-struct PFMHeader
-{
-  int width, height;
-  bool grayscale;
-  float scale;
-  bool need_swap;
-};
-
-
-static inline uint32_t pfs_bswap_32(uint32_t x)
-{
-  x= ((x<<8)&0xFF00FF00) | ((x>>8)&0x00FF00FF);
-  x= (x>>16) | (x<<16);
-  return x;
-}
-
-static float swap_if_needed(float x, bool swap_needed )
-{
-  if( swap_needed ) {
-    uint32_t *xi = (uint32_t*)&x;
-    uint32_t yi = pfs_bswap_32( *xi );
-    float *y = (float*)&yi;    
-    return *y;
-  } else
-    return x;
-}
-
-
-static bool isBigEndian()
-{
-  int x = 1;
-  char *y = (char*)&x;
-  return y[0] == 0;
-}
-
-
-PFMHeader readPFMHeader( FILE *fh )
-{
-  PFMHeader header;
-  char headerID[2];
-  int read;
-    
-  read = fscanf( fh, "%c%c\n%d %d\n%f", &headerID[0], &headerID[1],
-    &header.width, &header.height,
-    &header.scale );
-
-  if( read != 5 )
-    throw pfs::Exception( "Wrong file header" );
-
-  if( !memcmp( "PF", headerID, 2 ) )
-    header.grayscale = false;
-  else if( !memcmp( "Pf", headerID, 2 ) )
-    header.grayscale = true;
-  else
-    throw pfs::Exception( "Wrong PFM image type" );
-
-  read = fread( headerID, 1, 1, fh );  // Read a single EOL character
+#include "pfmio.h"
 
-  if( read != 1 || headerID[0] != 0x0a ) 
-    throw pfs::Exception( "Wrong file header" );
-
-  // Check if swapping bytes because of endianness is required
-  header.need_swap = (isBigEndian() ^ (header.scale > 0));
-  
-  return header;
-}
-
-void readPFMFileColor( FILE *fh, PFMHeader &header, float *R, float *G, float *B )
-{
-  const int lineSize = header.width*3;
-  float *line = new float[lineSize];
-  
-  for( int l = 0; l < header.height; l++ ) {
-    int read = fread( line, sizeof( float ), lineSize, fh );
-    if( read != lineSize )
-      throw pfs::Exception( "Unexpected EOF" );
-    for( int x = 0; x < header.width; x++ ) {
-      const int lineOffset = l*header.width;
-      R[lineOffset+x] = swap_if_needed( line[x*3+0], header.need_swap );
-      G[lineOffset+x] = swap_if_needed( line[x*3+1], header.need_swap );
-      B[lineOffset+x] = swap_if_needed( line[x*3+2], header.need_swap );      
-    }
-  }
-  delete[] line;
-
-  if( fabs(header.scale) != 1 ) {
-    const float scaleFactor = fabs( header.scale );
-    for( int i = 0; i < header.width*header.height; i++ ) {
-      R[i] *= scaleFactor;
-      G[i] *= scaleFactor;
-      B[i] *= scaleFactor;
-    }    
-  }
-  
-}
-
-void readPFMFileGrayscale( FILE *fh, PFMHeader &header, float *Y )
-{
-  for( int l = 0; l < header.height; l++ ) {
-    int read = fread( Y + header.width*l,
-      sizeof( float ), header.width, fh );
-
-    if( header.need_swap ) {
-      const int lineOffset = l*header.width;
-      for( int x = 0; x < header.width; x++ ) {
-        Y[lineOffset+x] = swap_if_needed( Y[lineOffset+x], 1 );
-      }
-    }
-    
-    if( read != header.width )
-      throw pfs::Exception( "Unexpected EOF" );
-  }
-  if( fabs(header.scale) != 1 ) {
-    const float scaleFactor = fabs( header.scale );
-    for( int i = 0; i < header.width*header.height; i++ ) {
-      Y[i] *= scaleFactor;
-    }    
-  }
-}
-
-// ======== Main
+#define PROG_NAME "pfsinpfm"
 
 class QuietException 
 {
@@ -231,11 +110,11 @@ void readFrames( int argc, char* argv[] )
     if( header.grayscale ) {
       pfs::Channel *Y;
       Y = frame->createChannel( "Y" );
-      readPFMFileGrayscale( ff.fh, header, Y->getRawData() );      
+      readPFMData( ff.fh, header, Y->getRawData(), NULL, NULL );      
     } else {
       pfs::Channel *X, *Y, *Z;
       frame->createXYZChannels( X, Y, Z );
-      readPFMFileColor( ff.fh, header, X->getRawData(), Y->getRawData(),
+      readPFMData( ff.fh, header, X->getRawData(), Y->getRawData(),
         Z->getRawData() );
       pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
     }
@@ -113,6 +113,8 @@ void readFrames( int argc, char* argv[] )
     if( ff.fh == NULL ) break; // No more frames
 
     PPMReader reader( PROG_NAME, ff.fh );
+    // sRGB linearization is done with a look-up table while reading
+    reader.setLinearize( opt_linear || absoluteMaxLum != 0 );
 
     VERBOSE_STR << "reading file '" << ff.fileName << "'" << std::endl;
 
@@ -121,11 +123,11 @@ void readFrames( int argc, char* argv[] )
     pfs::Channel *X, *Y, *Z;
     frame->createXYZChannels( X, Y, Z );
 
-    //Store sRGB data temporarily in XYZ channels        
+    //Store RGB data temporarily in XYZ channels        
     eofP = reader.readImage( X, Y, Z );
     if( opt_linear || absoluteMaxLum != 0 )
     {
-      pfs::transformColorSpace( pfs::CS_SRGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+      pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
       if( absoluteMaxLum != 0 ) {
         // Rescale to absolute luminance level
         const int pixCount = X->getWidth()*X->getHeight();
@@ -44,7 +44,7 @@ class QuietException
 
 void printHelp()
 {
-  std::cerr << PROG_NAME " [--linear] [--expmode] [--verbose] [--help]" << std::endl
+  std::cerr << PROG_NAME " [--linear] [--expmode] [--region <x>,<y>,<w>,<h>] [--level <n>] [--verbose] [--help]" << std::endl
             << "See man page for more information." << std::endl;
 }
 
@@ -57,6 +57,9 @@ void readFrames( int argc, char* argv[] )
   bool verbose = false;
   bool opt_linear=false;
   bool opt_exponential_mode = false;
+  int opt_level = 0;
+  bool opt_region = false;
+  int region_x = 0, region_y = 0, region_w = 0, region_h = 0;
   
   // Parse command line parameters
   static struct option cmdLineOptions[] = {
@@ -64,9 +67,11 @@ void readFrames( int argc, char* argv[] )
     { "verbose", no_argument, NULL, 'v' },
     { "linear", no_argument, NULL, 'l' },
     { "expmode", no_argument, NULL, 'e' },
+    { "region", required_argument, NULL, 'r' },
+    { "level", required_argument, NULL, 'L' },
     { NULL, 0, NULL, 0 }
   };
-  static const char optstring[] = "elhv";
+  static const char optstring[] = "elhvr:L:";
     
   pfs::FrameFileIterator it( argc, argv, "rb", NULL, stdin,
     optstring, cmdLineOptions );
@@ -88,6 +93,17 @@ void readFrames( int argc, char* argv[] )
     case 'e':
       opt_exponential_mode = true;
       break;
+    case 'r':
+      if( sscanf( optarg, "%d,%d,%d,%d", &region_x, &region_y, &region_w, &region_h ) != 4 ||
+        region_x < 0 || region_y < 0 || region_w <= 0 || region_h <= 0 )
+        throw pfs::Exception( "region must be given as <x>,<y>,<w>,<h> with non-negative position and positive size" );
+      opt_region = true;
+      break;
+    case 'L':
+      opt_level = atoi( optarg );
+      if( opt_level < 0 )
+        throw pfs::Exception( "level must be non-negative" );
+      break;
     case '?':
       throw QuietException();
     case ':':
@@ -98,16 +114,23 @@ void readFrames( int argc, char* argv[] )
   VERBOSE_STR << "linearize input image: " << (opt_linear ? "yes" : "no") << std::endl;
   VERBOSE_STR << "exponential mode (Lars3 HDR camera): "
               << (opt_exponential_mode ? "yes" : "no") << std::endl;  
+  if( opt_region )
+    VERBOSE_STR << "region: " << region_w << "x" << region_h << " at ("
+                << region_x << "," << region_y << ")" << std::endl;
+  if( opt_level > 0 )
+    VERBOSE_STR << "level: " << opt_level << std::endl;
   
   while( true ) {
     pfs::FrameFile ff = it.getNextFrameFile();
     if( ff.fh == NULL ) break; // No more frames
 
     it.closeFrameFile( ff );
-    HDRTiffReader reader( ff.fileName );
+    HDRTiffReader reader( ff.fileName, opt_level );
 
     if( opt_exponential_mode )
       reader.setExponentialMode();
+    if( opt_region )
+      reader.setRegion( region_x, region_y, region_w, region_h );
 
     VERBOSE_STR << "reading file (" << reader.getFormatString() << ") '"
                 << ff.fileName << "'" << std::endl;
@@ -0,0 +1,605 @@
+/**
+ * @brief Read pfs frames from the standard input and write them in the
+ * format determined by the extension of the file name
+ *
+ * This file is a part of PFSTOOLS package.
+ * ----------------------------------------------------------------------
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <config.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <set>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#ifdef HAVE_OpenMP
+#include <omp.h>
+#endif
+
+#include <pfs.h>
+
+#include "fileargs.h"
+#include "framepool.h"
+#include "rgbeio.h"
+#include "pfmio.h"
+#ifdef HAVE_TIFF
+#include "hdrtiffio.h"
+#endif
+#ifdef HAVE_NETPBM
+#include "ppmio.h"
+#endif
+
+#define PROG_NAME "pfsout"
+
+class QuietException
+{
+};
+
+void printHelp()
+{
+  fprintf( stderr, PROG_NAME " [--srgb] [--bit-depth <bits>] [--radiance] [--quiet] [--threads <n>] [--verbose] [--help] <file> [<file>...]\n"
+    "\nRecognized file formats and extensions:\n"
+    " Radiance RGBE - .pic, .hdr\n"
+    " TIFF (incl. LogLuv) - .tiff, .tif\n"
+    " PNM, PPM - .ppm, .pnm\n"
+    " JPEG - .jpeg, .jpg\n"
+    " PNG - .png\n"
+    " PFS - .pfs\n"
+    " OpenEXR - .exr\n"
+    " PFM - .pfm\n"
+    " DPX - .dpx\n"
+    " GIF - .gif\n"
+    " BMP - .bmp\n"
+    " EPS - .eps\n"
+    "\nSee the man page for more information.\n" );
+}
+
+enum FileFormat { FMT_UNKNOWN, FMT_PFS, FMT_RGBE, FMT_PFM, FMT_PPM, FMT_TIFF,
+                  FMT_EXR, FMT_JPEG, FMT_PNG, FMT_IMGMAGICK };
+
+static FileFormat formatFromExtension( const char *fileName )
+{
+  const char *dot = strrchr( fileName, '.' );
+  if( dot == NULL )
+    return FMT_UNKNOWN;
+  const char *ext = dot+1;
+  if( !strcasecmp( ext, "pfs" ) )
+    return FMT_PFS;
+  if( !strcasecmp( ext, "hdr" ) || !strcasecmp( ext, "pic" ) )
+    return FMT_RGBE;
+  if( !strcasecmp( ext, "pfm" ) )
+    return FMT_PFM;
+  if( !strcasecmp( ext, "ppm" ) || !strcasecmp( ext, "pnm" ) )
+    return FMT_PPM;
+  if( !strcasecmp( ext, "tif" ) || !strcasecmp( ext, "tiff" ) )
+    return FMT_TIFF;
+  if( !strcasecmp( ext, "exr" ) )
+    return FMT_EXR;
+  if( !strcasecmp( ext, "jpg" ) || !strcasecmp( ext, "jpeg" ) )
+    return FMT_JPEG;
+  if( !strcasecmp( ext, "png" ) )
+    return FMT_PNG;
+  if( !strcasecmp( ext, "dpx" ) || !strcasecmp( ext, "gif" ) ||
+    !strcasecmp( ext, "bmp" ) || !strcasecmp( ext, "eps" ) )
+    return FMT_IMGMAGICK;
+  return FMT_UNKNOWN;
+}
+
+#ifdef HAVE_TIFF
+/**
+ * @return true if pfsoutimgmagick can be found in the PATH
+ */
+static bool isImageMagickInstalled()
+{
+  static const bool installed =
+    system( "command -v pfsoutimgmagick >/dev/null 2>&1" ) == 0;
+  return installed;
+}
+#endif
+
+/**
+ * @return true if the format is encoded by this program rather than
+ * by one of the pfsout* programs
+ */
+static bool isFormatNative( FileFormat format )
+{
+  switch( format ) {
+  case FMT_PFS:
+  case FMT_RGBE:
+  case FMT_PFM:
+    return true;
+#ifdef HAVE_TIFF
+  case FMT_TIFF:
+    // As the pfsout script did, pfsoutimgmagick is preferred for TIFF
+    // files when it is installed
+    return !isImageMagickInstalled();
+#endif
+#ifdef HAVE_NETPBM
+  case FMT_PPM:
+    return true;
+#endif
+  default:
+    // OpenEXR files are left to pfsoutexr, which also writes the
+    // additional channels and the tags as header attributes
+    return false;
+  }
+}
+
+static bool isFormatHDR( FileFormat format )
+{
+  return format == FMT_RGBE || format == FMT_PFM || format == FMT_EXR;
+}
+
+struct OutputOptions
+{
+  bool srgb;
+  int bit_depth;
+  bool radiance_compatibility;
+  std::string ldr_arguments;    // Passed to the programs writing LDR images
+};
+
+/**
+ * The command writing a file that is not encoded natively, chosen by
+ * the extension as the pfsout script used to do. extra are the options
+ * given for the file on the command line.
+ */
+static std::string externalCommand( const char *fileName, FileFormat format,
+  const OutputOptions &opt, const std::string &extra )
+{
+  const std::string file = shellQuote( fileName );
+  const std::string args = opt.ldr_arguments + extra;
+
+  switch( format ) {
+  case FMT_RGBE:
+    return "pfsoutrgbe --quiet " + file + (opt.radiance_compatibility ? " --radiance" : "") + extra;
+  case FMT_PFM:
+    return "pfsoutpfm " + file + extra;
+  case FMT_PPM:
+    return "pfsoutppm " + file + args;
+  case FMT_TIFF:
+    return "if command -v pfsoutimgmagick >/dev/null; then pfsoutimgmagick " + file + args +
+      "; else pfsouttiff " + file + args + "; fi";
+  case FMT_EXR:
+    return "pfsoutexr " + file + extra;
+  case FMT_JPEG:
+    return "if command -v pfsoutimgmagick >/dev/null; then pfsoutimgmagick " + file + args +
+      "; else pfsoutppm -" + args + " | pnmtojpeg >" + file + "; fi";
+  case FMT_PNG:
+    return "if command -v pfsoutimgmagick >/dev/null; then pfsoutimgmagick " + file + args +
+      "; else pfsoutppm -" + args + " | pnmtopng >" + file + "; fi";
+  default:
+    return "pfsoutimgmagick " + file + args;
+  }
+}
+
+/**
+ * A frame encoded by a worker thread, either with the native writers
+ * or by piping it to the pfsout* program for the format.
+ */
+class OutputJob : public FrameJob
+{
+public:
+  OutputJob( pfs::Frame *frame, FILE *fh, const char *fileName,
+    FileFormat format, const OutputOptions &opt, const std::string &extra,
+    int omp_threads ) :
+    frame( frame ), fh( fh ), fileName( fileName ), format( format ),
+    opt( opt ), omp_threads( omp_threads )
+  {
+    // The options given for the file are understood only by the pfsout*
+    // programs, which then write the natively encoded formats as well
+    if( !isFormatNative( format ) || (!extra.empty() && format != FMT_PFS) ) {
+      if( fh == stdout )
+        throw pfs::Exception( !isFormatNative( format ) ?
+          "this file format cannot be written to the standard output" :
+          "options cannot be passed for the standard output" );
+      command = externalCommand( fileName, format, opt, extra );
+      closeFile();    // The command writes the file by itself
+    }
+  }
+
+  ~OutputJob()
+  {
+    closeFile();
+    delete frame;
+  }
+
+  void run( pfs::DOMIO &pfsio )
+  {
+#ifdef HAVE_OpenMP
+    omp_set_num_threads( omp_threads );
+#endif
+    if( !command.empty() ) {
+      writeExternal( pfsio );
+      return;
+    }
+
+    if( format == FMT_PFS ) {
+      pfsio.writeFrame( frame, fh );
+    } else if( format == FMT_PFM ) {
+      writePFM();
+    } else {
+      pfs::Channel *X, *Y, *Z;
+      frame->getXYZChannels( X, Y, Z );
+      switch( format ) {
+      case FMT_RGBE:
+        writeRGBE( X, Y, Z );
+        break;
+#ifdef HAVE_NETPBM
+      case FMT_PPM:
+        writePPM( X, Y, Z );
+        break;
+#endif
+#ifdef HAVE_TIFF
+      case FMT_TIFF:
+        writeTIFF( X, Y, Z );
+        break;
+#endif
+      default:
+        throw pfs::Exception( "unsupported file format" );
+      }
+    }
+
+    if( fh != stdout && fclose( fh ) != 0 ) {
+      fh = NULL;
+      throw pfs::Exception( "cannot write the file" );
+    }
+    fh = NULL;
+  }
+
+  pfs::Frame *frame;
+  FILE *fh;
+  std::string fileName;
+  FileFormat format;
+  std::string command;
+
+private:
+  const OutputOptions &opt;
+  const int omp_threads;
+
+  void closeFile()
+  {
+    if( fh != NULL && fh != stdout )
+      fclose( fh );
+    fh = NULL;
+  }
+
+  void writeRGBE( pfs::Channel *X, pfs::Channel *Y, pfs::Channel *Z )
+  {
+    if( X == NULL )         // No color
+      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
+    RGBEWriter writer( fh, opt.radiance_compatibility );
+    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+    writer.writeImage( X, Y, Z );
+  }
+
+  void writePFM()
+  {
+    pfs::Channel *X, *Y, *Z;
+    frame->getXYZChannels( X, Y, Z );
+    if( X != NULL ) {       // Has color
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+      writePFMFileColor( fh, frame->getWidth(), frame->getHeight(),
+        X->getRawData(), Y->getRawData(), Z->getRawData() );
+    } else {
+      Y = frame->getChannel( "Y" );
+      if( Y == NULL )
+        throw pfs::Exception( "Can not find color or grayscale channels in the pfs stream" );
+      writePFMFileGrayscale( fh, frame->getWidth(), frame->getHeight(),
+        Y->getRawData() );
+    }
+  }
+
+#ifdef HAVE_NETPBM
+  void writePPM( pfs::Channel *X, pfs::Channel *Y, pfs::Channel *Z )
+  {
+    int bitdepth = 8;
+    if( opt.bit_depth != -1 )
+      bitdepth = opt.bit_depth;
+    else {
+      const char* bitDepthTag = frame->getTags()->getString("BITDEPTH");
+      if( bitDepthTag!=NULL ) {
+        bitdepth=strtol( bitDepthTag, NULL, 10 );
+        if( bitdepth < 8 )
+          bitdepth = 8;
+        else if( bitdepth > 16 )
+          bitdepth = 16;
+      }
+    }
+
+    PPMWriter writer( PROG_NAME, fh, bitdepth );
+    if( X == NULL )         // No color
+    {
+      Y = frame->getChannel( "Y" );
+      if( Y == NULL )       // No luminance
+        throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
+      // Grey levels
+      X = frame->createChannel( "X" );
+      Z = frame->createChannel( "Z" );
+      pfs::transformColorSpace( pfs::CS_RGB, Y, Y, Y, pfs::CS_XYZ, X, Y, Z );
+    }
+
+    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+    // The sRGB non-linearity is applied by the writer
+    writer.setSRGB( opt.srgb );
+    writer.writeImage( X, Y, Z );
+  }
+#endif
+
+#ifdef HAVE_TIFF
+  void writeTIFF( pfs::Channel *X, pfs::Channel *Y, pfs::Channel *Z )
+  {
+    if( X == NULL )         // No color
+      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
+    HDRTiffWriter writer( fh );
+    if( opt.srgb )
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_SRGB, X, Y, Z );
+    else
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+    writer.writeImage( X, Y, Z );
+  }
+#endif
+
+  void writeExternal( pfs::DOMIO &pfsio )
+  {
+    FILE *pipe = popen( command.c_str(), "w" );
+    if( pipe == NULL )
+      throw pfs::Exception( "cannot execute a program writing the file" );
+    try {
+      pfsio.writeFrame( frame, pipe );
+    }
+    catch( ... ) {
+      pclose( pipe );
+      throw;
+    }
+    if( pclose( pipe ) != 0 ) {
+      std::string msg = "cannot write file '" + fileName + "'";
+      throw pfs::Exception( msg.c_str() );
+    }
+  }
+};
+
+
+void writeFrames( int argc, char* argv[] )
+{
+  pfs::DOMIO pfsio;
+
+  bool verbose = false;
+  OutputOptions opt;
+  opt.srgb = false;
+  opt.bit_depth = -1;
+  opt.radiance_compatibility = false;
+  bool quiet = false;
+  const int cpus = std::max( 1, (int)sysconf( _SC_NPROCESSORS_ONLN ) );
+  int threads = cpus;
+
+  // Parse command line parameters
+  static struct option cmdLineOptions[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "srgb", no_argument, NULL, 's' },
+    { "bit-depth", required_argument, NULL, 'b' },
+    { "radiance", no_argument, NULL, 'r' },
+    { "quiet", no_argument, NULL, 'q' },
+    { "threads", required_argument, NULL, 't' },
+    { NULL, 0, NULL, 0 }
+  };
+  static const char optstring[] = "hvsb:rqt:";
+
+  if( argc < 2 ) {
+    printHelp();
+    throw QuietException();
+  }
+
+  // File names given literally rather than as a %d pattern
+  std::set<std::string> literal_names;
+  for( int i = 1; i < argc; i++ )
+    if( strchr( argv[i], '%' ) == NULL )
+      literal_names.insert( argv[i] );
+
+  // Options not listed above are passed to the pfsout* programs
+  FileArguments it( argc, argv, "wb", stdout, optstring, cmdLineOptions );
+
+  int optionIndex = 0;
+  while( 1 ) {
+    int c = getopt_long (argc, argv, optstring, cmdLineOptions, &optionIndex);
+    if( c == -1 ) break;
+    switch( c ) {
+    case 'h':
+      printHelp();
+      throw QuietException();
+    case 'v':
+      verbose = true;
+      break;
+    case 's':
+      opt.srgb = true;
+      break;
+    case 'b':
+      opt.bit_depth = strtol( optarg, NULL, 10 );
+      break;
+    case 'r':
+      opt.radiance_compatibility = true;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 't':
+      threads = strtol( optarg, NULL, 10 );
+      if( threads < 1 )
+        throw pfs::Exception( "number of threads must be at least 1" );
+      break;
+    case '?':
+      throw QuietException();
+    case ':':
+      throw QuietException();
+    }
+  }
+
+  if( opt.bit_depth!=-1 && (opt.bit_depth < 8 || opt.bit_depth > 32) )
+      throw pfs::Exception( "'bit-depth' argument must be within 8-32 range" );
+
+  if( opt.srgb )
+    opt.ldr_arguments += " --srgb";
+  if( opt.bit_depth != -1 ) {
+    std::ostringstream arg;
+    arg << " --bit-depth " << opt.bit_depth;
+    opt.ldr_arguments += arg.str();
+  }
+
+  // A failing pfsout* program is reported by pclose
+  signal( SIGPIPE, SIG_IGN );
+
+  FramePool pool( threads );
+  VERBOSE_STR << "encoding threads: " << pool.getThreadCount() << std::endl;
+
+  bool display_warning = true;
+  bool rgbe_warning = !quiet && !opt.radiance_compatibility;
+  std::string pfs_file;   // Last PFS file given by its name
+
+  // Frames are encoded while the next ones are read; keep a few per
+  // thread in memory at most
+  const size_t max_jobs = 2*pool.getThreadCount();
+  bool more_frames = true;
+  while( more_frames || pool.getJobCount() > 0 )
+  {
+    while( more_frames && pool.getJobCount() < max_jobs ) {
+      pfs::Frame *frame = pfsio.readFrame( stdin );
+      if( frame == NULL ) {
+        more_frames = false; // No more frames
+        break;
+      }
+
+      std::string extra;
+      pfs::FrameFile ff = it.getNextFrameFile( extra );
+      if( ff.fh == NULL && !pfs_file.empty() ) {
+        // As the pfsout script did, all remaining frames go to a PFS
+        // file given by its name
+        while( pool.getJobCount() > 0 ) {
+          OutputJob *job = (OutputJob*)pool.next();
+          if( !job->error.empty() ) {
+            const std::string error = job->fileName + ": " + job->error;
+            delete job;
+            throw pfs::Exception( error.c_str() );
+          }
+          delete job;
+        }
+        FILE *fh = fopen( pfs_file.c_str(), "ab" );
+        if( fh == NULL ) {
+          pfsio.freeFrame( frame );
+          std::string msg = "cannot open file '" + pfs_file + "'";
+          throw pfs::Exception( msg.c_str() );
+        }
+        do {
+          pfsio.writeFrame( frame, fh );
+          pfsio.freeFrame( frame );
+        } while( (frame = pfsio.readFrame( stdin )) != NULL );
+        fclose( fh );
+        more_frames = false;
+        break;
+      }
+      if( ff.fh == NULL ) {
+        pfsio.freeFrame( frame );
+        more_frames = false; // No more frames
+        break;
+      }
+
+      const FileFormat format = formatFromExtension( ff.fileName );
+      if( format == FMT_UNKNOWN ) {
+        pfsio.freeFrame( frame );
+        it.closeFrameFile( ff );
+        const char *dot = strrchr( ff.fileName, '.' );
+        std::string msg = std::string( "Unknown extension: " ) + (dot == NULL ? ff.fileName : dot+1);
+        throw pfs::Exception( msg.c_str() );
+      }
+
+      if( format == FMT_PFS && ff.fh != stdout && literal_names.count( ff.fileName ) > 0 )
+        pfs_file = ff.fileName;
+      else
+        pfs_file.clear();
+
+      if( format == FMT_RGBE && rgbe_warning ) {
+        std::cerr << PROG_NAME << " warning: starting from pfstools 1.9.0, .hdr files are written without correcting for WHITE_EFFICIENCY,"
+          " which makes the absolute values incompatible with Radiance and previos versions of pfstools but compatible with most software."
+          " Use --radiance option to retain compatibility with Radiance and earlier versions of pfstools.  Use --quiet to suppress this message."
+          " Check the manual pages for pfsoutrgbe for details." << std::endl;
+        rgbe_warning = false;
+      }
+
+      const char* luminanceTag = frame->getTags()->getString("LUMINANCE");
+      if( isFormatHDR( format ) && display_warning &&
+        luminanceTag!=NULL && 0==strcmp(luminanceTag,"DISPLAY") ) {
+        std::cerr << PROG_NAME << " warning: "
+                  << "display profiled content written to an HDR output" << std::endl;
+        display_warning = false;
+      }
+      if( !isFormatHDR( format ) && format != FMT_PFS && luminanceTag!=NULL &&
+        strcmp(luminanceTag,"ABSOLUTE")==0 )
+        std::cerr << PROG_NAME << " warning: This file format cannot store absolute luminance values\n";
+
+      // Frames encoded at the same time share the processors
+      const int omp_threads = std::max( 1, cpus / (int)(pool.getJobCount()+1) );
+      if( format == FMT_PFS && !extra.empty() )
+        std::cerr << PROG_NAME << " warning: options ignored for the PFS file '"
+                  << ff.fileName << "':" << extra << std::endl;
+      OutputJob *job = new OutputJob( frame, ff.fh, ff.fileName, format, opt, extra, omp_threads );
+      if( job->command.empty() ) {
+        VERBOSE_STR << "writing file '" << ff.fileName << "'" << std::endl;
+      } else
+        VERBOSE_STR << "writing file '" << ff.fileName << "' with: "
+                    << job->command << std::endl;
+      pool.add( job );
+    }
+    if( pool.getJobCount() == 0 )
+      break;
+
+    OutputJob *job = (OutputJob*)pool.next();
+    if( !job->error.empty() ) {
+      const std::string error = job->fileName + ": " + job->error;
+      delete job;
+      throw pfs::Exception( error.c_str() );
+    }
+    delete job;
+  }
+}
+
+
+int main( int argc, char* argv[] )
+{
+  try {
+    writeFrames( argc, argv );
+  }
+  catch( pfs::Exception ex ) {
+    fprintf( stderr, PROG_NAME " error: %s\n", ex.getMessage() );
+    return EXIT_FAILURE;
+  }
+  catch( QuietException  ex ) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
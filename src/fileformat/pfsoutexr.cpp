@@ -32,6 +32,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <math.h>
 
 #include <stdio.h>
 #include <pfs.h>
@@ -40,9 +42,11 @@
 #include <ImfHeader.h>
 #include <ImfChannelList.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
 #include <ImfRgbaFile.h>
 #include <ImfStringAttribute.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 
 using namespace Imf;
 using namespace Imath;
@@ -57,7 +61,7 @@ class QuietException
 
 void printHelp()
 {
-  fprintf( stderr, PROG_NAME " [--compression <method>] [--float32] [--clamp-halfmax] [--linear] [--verbose] [--help]\n"
+  fprintf( stderr, PROG_NAME " [--compression <method>] [--float32] [--clamp-halfmax] [--tile-size <w>[x<h>]] [--mipmap] [--mipmap-filter box|mitchell] [--threads <n>] [--linear] [--verbose] [--help]\n"
     "See man page for more information.\n" );
 }
 
@@ -78,6 +82,159 @@ const char *exrChannelName( const char *pfsChannelName )
   return pfsChannelName;
 }
 
+enum MipmapFilter { MIPMAP_BOX, MIPMAP_MITCHELL };
+
+struct FilterTap
+{
+  int index;
+  float weight;
+};
+
+/**
+ * Mitchell-Netravali cubic with B = C = 1/3.
+ */
+static float mitchell( float t )
+{
+  t = fabs( t );
+  if( t < 1.f )
+    return (7.f*t*t*t - 12.f*t*t + 16.f/3.f) / 6.f;
+  if( t < 2.f )
+    return (-7.f/3.f*t*t*t + 12.f*t*t - 20.f*t + 32.f/3.f) / 6.f;
+  return 0.f;
+}
+
+/**
+ * Computes normalized filter taps for reducing src_size samples to
+ * dst_size samples. The box filter averages the source interval
+ * covered by each destination sample; the Mitchell filter spans two
+ * destination samples on each side and is clamped at the borders.
+ */
+static void reductionTaps( int src_size, int dst_size, MipmapFilter filter,
+  std::vector< std::vector<FilterTap> > &taps )
+{
+  const float scale = (float)src_size / (float)dst_size;
+  taps.assign( dst_size, std::vector<FilterTap>() );
+  
+  for( int x = 0; x < dst_size; x++ ) {
+    std::vector<FilterTap> &t = taps[x];
+    if( filter == MIPMAP_BOX ) {
+      const float lo = x*scale, hi = (x+1)*scale;
+      for( int i = (int)floorf( lo ); i < (int)ceilf( hi ) && i < src_size; i++ ) {
+        FilterTap tap = { i, min( hi, (float)(i+1) ) - (lo > i ? lo : (float)i) };
+        if( tap.weight > 0 )
+          t.push_back( tap );
+      }
+    } else {
+      const float center = (x+0.5f)*scale, radius = 2.f*scale;
+      for( int i = (int)floorf( center-radius ); i <= (int)ceilf( center+radius ); i++ ) {
+        FilterTap tap = { i < 0 ? 0 : (i >= src_size ? src_size-1 : i),
+                          mitchell( (i+0.5f-center)/scale ) };
+        if( tap.weight != 0 )
+          t.push_back( tap );
+      }
+    }
+    float sum = 0;
+    for( size_t k = 0; k < t.size(); k++ )
+      sum += t[k].weight;
+    for( size_t k = 0; k < t.size(); k++ )
+      t[k].weight /= sum;
+  }
+}
+
+/**
+ * Reduces a channel to the next mipmap level with separable
+ * horizontal and vertical passes. The Mitchell filter results are
+ * clamped to the range of the source samples, so that the negative
+ * lobes do not produce ringing below zero or above HALF_MAX.
+ */
+static void reduceChannel( const float *src, int src_width, int src_height,
+  float *dst, int dst_width, int dst_height, MipmapFilter filter )
+{
+  std::vector< std::vector<FilterTap> > taps_x, taps_y;
+  reductionTaps( src_width, dst_width, filter, taps_x );
+  reductionTaps( src_height, dst_height, filter, taps_y );
+  const bool clamp = filter != MIPMAP_BOX;
+  
+  std::vector<float> tmp( (size_t)dst_width*src_height );
+  
+  #pragma omp parallel for
+  for( int y = 0; y < src_height; y++ ) {
+    const float *in = src + (size_t)y*src_width;
+    float *out = &tmp[(size_t)y*dst_width];
+    for( int x = 0; x < dst_width; x++ ) {
+      const std::vector<FilterTap> &t = taps_x[x];
+      float v = 0, lo = in[t[0].index], hi = lo;
+      for( size_t k = 0; k < t.size(); k++ ) {
+        const float s = in[t[k].index];
+        v += t[k].weight*s;
+        if( s < lo ) lo = s;
+        if( s > hi ) hi = s;
+      }
+      out[x] = clamp ? (v < lo ? lo : (v > hi ? hi : v)) : v;
+    }
+  }
+
+  #pragma omp parallel for
+  for( int y = 0; y < dst_height; y++ ) {
+    const std::vector<FilterTap> &t = taps_y[y];
+    float *out = dst + (size_t)y*dst_width;
+    for( int x = 0; x < dst_width; x++ ) {
+      float v = 0, lo = tmp[(size_t)t[0].index*dst_width+x], hi = lo;
+      for( size_t k = 0; k < t.size(); k++ ) {
+        const float s = tmp[(size_t)t[k].index*dst_width+x];
+        v += t[k].weight*s;
+        if( s < lo ) lo = s;
+        if( s > hi ) hi = s;
+      }
+      out[x] = clamp ? (v < lo ? lo : (v > hi ? hi : v)) : v;
+    }
+  }
+}
+
+struct LevelChannel
+{
+  const char *name;
+  const float *data;
+};
+
+/**
+ * Writes all levels of a tiled file. Level 0 is written from
+ * frameBuffer, each further level is reduced from the previous one.
+ */
+static void writeTiledLevels( TiledOutputFile &file, const FrameBuffer &frameBuffer,
+  const std::vector<LevelChannel> &channels, MipmapFilter filter )
+{
+  file.setFrameBuffer( frameBuffer );
+  file.writeTiles( 0, file.numXTiles(0)-1, 0, file.numYTiles(0)-1, 0 );
+
+  const size_t ch_count = channels.size();
+  std::vector< std::vector<float> > prev( ch_count ), next( ch_count );
+  std::vector<const float*> prev_data( ch_count );
+  for( size_t c = 0; c < ch_count; c++ )
+    prev_data[c] = channels[c].data;
+  int prev_width = file.levelWidth( 0 ), prev_height = file.levelHeight( 0 );
+  
+  for( int l = 1; l < file.numLevels(); l++ ) {
+    const int width = file.levelWidth( l ), height = file.levelHeight( l );
+    FrameBuffer levelBuffer;
+    for( size_t c = 0; c < ch_count; c++ ) {
+      next[c].resize( (size_t)width*height );
+      reduceChannel( prev_data[c], prev_width, prev_height,
+        &next[c][0], width, height, filter );
+      levelBuffer.insert( channels[c].name,
+        Slice( FLOAT, (char*)&next[c][0], sizeof(float), sizeof(float) * width ) );
+    }
+    file.setFrameBuffer( levelBuffer );
+    file.writeTiles( 0, file.numXTiles(l)-1, 0, file.numYTiles(l)-1, l );
+
+    prev.swap( next );
+    for( size_t c = 0; c < ch_count; c++ )
+      prev_data[c] = &prev[c][0];
+    prev_width = width;
+    prev_height = height;
+  }
+}
+
 
 void writeFrames( int argc, char* argv[] )
 {
@@ -87,6 +244,10 @@ void writeFrames( int argc, char* argv[] )
   bool fixHalfMax = false;
   bool float32 = false;
   bool clampHalfMax = false;
+  int threads = 0;
+  int tileWidth = 0, tileHeight = 0;
+  bool mipmap = false;
+  MipmapFilter mipmapFilter = MIPMAP_BOX;
 
   // Parse command line parameters
   static struct option cmdLineOptions[] = {
@@ -98,9 +259,13 @@ void writeFrames( int argc, char* argv[] )
     { "clamp-halfmax", no_argument, NULL, 'p' },
     { "float32", no_argument, NULL, '3' },
     { "linear", no_argument, NULL, 'l' },
+    { "threads", required_argument, NULL, 't' },
+    { "tile-size", required_argument, NULL, 'T' },
+    { "mipmap", no_argument, NULL, 'm' },
+    { "mipmap-filter", required_argument, NULL, 'F' },
     { NULL, 0, NULL, 0 }
   };
-  static const char optstring[] = "hvc:kf3pl";
+  static const char optstring[] = "hvc:kf3plt:T:mF:";
 
   pfs::FrameFileIterator it( argc, argv, "wb", NULL, NULL,
     optstring, cmdLineOptions );
@@ -128,6 +293,31 @@ void writeFrames( int argc, char* argv[] )
     case 'p':
       clampHalfMax = true;
       break;
+    case 't':
+      threads = atoi( optarg );
+      if( threads < 0 )
+        throw pfs::Exception( "number of threads must be non-negative" );
+      break;
+    case 'T': {
+      int n = sscanf( optarg, "%dx%d", &tileWidth, &tileHeight );
+      if( n == 1 )
+        tileHeight = tileWidth;
+      if( n < 1 || tileWidth <= 0 || tileHeight <= 0 )
+        throw pfs::Exception( "tile size must be given as <w> or <w>x<h>, both positive" );
+      break;
+    }
+    case 'm':
+      mipmap = true;
+      break;
+    case 'F':
+      if( !strcasecmp( optarg, "box" ) ) {
+        mipmapFilter = MIPMAP_BOX;
+      } else if( !strcasecmp( optarg, "mitchell" ) ) {
+        mipmapFilter = MIPMAP_MITCHELL;
+      } else {
+        throw pfs::Exception( "Unknown mipmap filter. Possible values: box, mitchell" );
+      }
+      break;
     case 'c':
       if( !strcasecmp( optarg, "NO" ) ) {
         exrCompression = NO_COMPRESSION;
@@ -166,17 +356,25 @@ void writeFrames( int argc, char* argv[] )
     //fprintf( stderr, PROG_NAME ": keeping XYZ channels untouched\n" );
 	
 	fprintf( stderr, PROG_NAME ": Color channel precision: %s\n", float32 ? "32-bit float" : "16-bit float" );
+	fprintf( stderr, PROG_NAME ": Compression threads: %d\n", threads );
+	if( tileWidth > 0 || mipmap )
+	  fprintf( stderr, PROG_NAME ": Tiled output: %dx%d tiles, %s\n",
+	    tileWidth > 0 ? tileWidth : 64, tileWidth > 0 ? tileHeight : 64,
+	    mipmap ? (mipmapFilter == MIPMAP_BOX ? "box filtered mipmap" : "Mitchell filtered mipmap") : "one level" );
 	
    }
+
+  // Blocks of lines are compressed by the OpenEXR thread pool
+  setGlobalThreadCount( threads );
+
+  // Mipmaps are stored in tiled files only
+  if( mipmap && tileWidth == 0 )
+    tileWidth = tileHeight = 64;
   
   pfs::DOMIO pfsio;
  
   bool firstFrame = true;
 
-  half *halfRGB[3] = { NULL, NULL, NULL }; //*halfG = NULL, *halfB = NULL;
-//  float *floatRGB[3] = { NULL, NULL, NULL }; //*floatG = NULL, *floatB = NULL;
-  size_t pix_count_prev = 0;
-  
   while( true ) {
     pfs::Frame *frame = pfsio.readFrame( stdin );
     if( frame == NULL ) {
@@ -288,6 +486,7 @@ void writeFrames( int argc, char* argv[] )
       }
 
       FrameBuffer frameBuffer;      
+      std::vector<LevelChannel> levelChannels;
 
       // Create channels in FrameBuffer
       {
@@ -301,6 +500,8 @@ void writeFrames( int argc, char* argv[] )
               (char*)ch->getRawData(), // base	 
               sizeof(float) * 1,	// xStride
               sizeof(float) * frame->getWidth()) ); // yStride        
+          LevelChannel lc = { exrChannelName( ch->getName() ), ch->getRawData() };
+          levelChannels.push_back( lc );
         }
         
         if( storeRGBChannels ) {
@@ -327,31 +528,29 @@ void writeFrames( int argc, char* argv[] )
 					sizeof(float) * frame->getWidth()) ); // yStride        
 					
 			} else { // Half-float
-				const size_t pix_count = frame->getWidth()*frame->getHeight();			
-				if( pix_count_prev != pix_count ) { // Reallocate memory if needed			
-					for( int cc=0; cc<3; cc++ ) {								
-						delete [] halfRGB[cc];
-						halfRGB[cc] = new half[pix_count];
-					}
-					pix_count_prev = pix_count;
-				}
+				// The float data are converted to half by the library
+				// while compressing, so the slices point directly to the
+				// channels, which are rescaled or clamped in place
+				const int pix_count = frame->getWidth()*frame->getHeight();
+				float *rgb[3] = { R->getRawData(), G->getRawData(), B->getRawData() };
 
 				for( int cc=0; cc<3; cc++ ) {
 					frameBuffer.insert( rgb_strings[cc],		// name
-						Slice( HALF,			// type	 
-						(char*)halfRGB[cc],		// base	 
-						sizeof(half) * 1,	// xStride
-						sizeof(half) * frame->getWidth()) ); // yStride
+						Slice( FLOAT,			// type	 
+						(char*)rgb[cc],		// base	 
+						sizeof(float) * 1,	// xStride
+						sizeof(float) * frame->getWidth()) ); // yStride
 				}			
 
 	//          Check if pixel values do not exceed maximum HALF value            
 				bool maxHalfExceeded = false;
 				float maxValue = -1;
 				if( !clampHalfMax ) {
+					#pragma omp parallel for reduction(max:maxValue)
 					for( int i = 0; i < pix_count; i++ ) {
-						if( (*R)(i) > maxValue ) maxValue = (*R)(i);
-						if( (*G)(i) > maxValue ) maxValue = (*G)(i);
-						if( (*B)(i) > maxValue ) maxValue = (*B)(i);
+						if( rgb[0][i] > maxValue ) maxValue = rgb[0][i];
+						if( rgb[1][i] > maxValue ) maxValue = rgb[1][i];
+						if( rgb[2][i] > maxValue ) maxValue = rgb[2][i];
 					}
 					maxHalfExceeded = maxValue > HALF_MAX;
 				}
@@ -360,26 +559,33 @@ void writeFrames( int argc, char* argv[] )
 					fprintf( stderr, PROG_NAME " warning: Some pixels exceed maximum value that can be stored in an OpenEXR file (maximum value of HALF-16 float). The values are scaled and the \"WhiteLuminance\" tag is added to preserve those values.\n" );
           
 				if( maxHalfExceeded ) {
-		//          Rescale and copy pixels to half-type buffers
+		//          Rescale pixels to the half range
 					float scaleFactor = HALF_MAX/maxValue;
-					for( size_t i = 0; i < pix_count; i++ ) {
-						halfRGB[0][i] = (half)((*R)(i)*scaleFactor);
-						halfRGB[1][i] = (half)((*G)(i)*scaleFactor);
-						halfRGB[2][i] = (half)((*B)(i)*scaleFactor);          
+					#pragma omp parallel for
+					for( int i = 0; i < pix_count; i++ ) {
+						rgb[0][i] *= scaleFactor;
+						rgb[1][i] *= scaleFactor;
+						rgb[2][i] *= scaleFactor;
 					}
 					// Store scale factor as WhileLuminance standard sttribute
 					// in order to restore absolute values later
 					addWhiteLuminance( header, 1/scaleFactor );
 					whiteLuminanceUsed = true;
 				} else {
-		//          Copy pixels to half-type buffers
-					for( size_t i = 0; i < pix_count; i++ ) {
-						halfRGB[0][i] = min( (*R)(i), HALF_MAX );
-						halfRGB[1][i] = min( (*G)(i), HALF_MAX );
-						halfRGB[2][i] = min( (*B)(i), HALF_MAX );          
+		//          Clamp pixels to the half range
+					#pragma omp parallel for
+					for( int i = 0; i < pix_count; i++ ) {
+						rgb[0][i] = min( rgb[0][i], HALF_MAX );
+						rgb[1][i] = min( rgb[1][i], HALF_MAX );
+						rgb[2][i] = min( rgb[2][i], HALF_MAX );
 					}
 				}
 			}
+			LevelChannel lc[3] = { { rgb_strings[0], R->getRawData() },
+			                       { rgb_strings[1], G->getRawData() },
+			                       { rgb_strings[2], B->getRawData() } };
+			levelChannels.insert( levelChannels.end(), lc, lc+3 );
+
 			if( luminanceTag != NULL && !strcmp( luminanceTag, "ABSOLUTE" ) && !whiteLuminanceUsed )			
 			{
 				// Use WhiteLuminance tag to signalize absolute values
@@ -389,20 +595,23 @@ void writeFrames( int argc, char* argv[] )
         }
       }
 
-      OutputFile file(ff.fileName, header);
+      if( tileWidth > 0 ) {
+        header.setTileDescription( TileDescription( tileWidth, tileHeight,
+            mipmap ? MIPMAP_LEVELS : ONE_LEVEL, ROUND_DOWN ) );
+        
+        TiledOutputFile file( ff.fileName, header );
+        writeTiledLevels( file, frameBuffer, levelChannels, mipmapFilter );
+      } else {
+        OutputFile file(ff.fileName, header);
       
-      file.setFrameBuffer (frameBuffer);
+        file.setFrameBuffer (frameBuffer);
 
-      file.writePixels( frame->getHeight() );
+        file.writePixels( frame->getHeight() );
+      }
       
     }
     pfsio.freeFrame( frame );
   }
-  
-  for( int cc=0; cc<3; cc++ ) {								
-	delete [] halfRGB[cc];
-  }
-  
 }
 
 
@@ -40,78 +40,20 @@
 #include <pfs.h>
 #include <getopt.h>
 
-#define PROG_NAME "pfsoutpfm"
+#include "pfmio.h"
 
-#define PFMEOL "\x0a"
+#define PROG_NAME "pfsoutpfm"
 
 class QuietException 
 {
 };
 
-#define min(x,y) ( (x)<(y) ? (x) : (y) )
-
-static bool isBigEndian()
-{
-  int x = 1;
-  char *y = (char*)&x;
-  return y[0] == 0;
-}
-
 void printHelp()
 {
   fprintf( stderr, PROG_NAME " [--verbose] [--help]\n"
     "See man page for more information.\n" );
 }
 
-void writePFMFileColor( FILE *fh, int width, int height,
-  float *R, float *G, float *B )
-{
-  // Write header
-  int scale = -1;
-  if( isBigEndian() ) // Is this a big endian ?
-    scale = 1;  
-  fprintf( fh, "PF" PFMEOL "%d %d" PFMEOL "%d" PFMEOL, width, height, scale );
-  
-  const int lineSize = width*3;
-  float *line = new float[lineSize];
-  
-  for( int l = 0; l < height; l++ ) {
-    for( int x = 0; x < width; x++ ) {
-      const int lineOffset = l*width;
-      line[x*3+0] = R[lineOffset+x];
-      line[x*3+1] = G[lineOffset+x];
-      line[x*3+2] = B[lineOffset+x];
-    }
-    int written = fwrite( line, sizeof( float ), lineSize, fh );
-    if( written != lineSize )
-      throw new pfs::Exception( "Unable to write data" );
-  }
-  delete[] line;  
-}
-
-void writePFMFileGrayscale( FILE *fh, int width, int height, float *Y )
-{
-  // Write header
-  int scale = -1;
-  if( isBigEndian() ) // Is this a big endian ?
-    scale = 1;  
-  fprintf( fh, "Pf" PFMEOL "%d %d" PFMEOL "%d" PFMEOL, width, height, scale );
-  
-  const int lineSize = width;
-  float *line = new float[lineSize];
-  
-  for( int l = 0; l < height; l++ ) {
-    for( int x = 0; x < width; x++ ) {
-      const int lineOffset = l*width;
-      line[x] = Y[lineOffset+x];
-    }
-    int written = fwrite( line, sizeof( float ), lineSize, fh );
-    if( written != lineSize )
-      throw new pfs::Exception( "Unable to write data" );
-  }
-  delete[] line;  
-}
-
 void writeFrames( int argc, char* argv[] )
 {
   bool verbose = false;
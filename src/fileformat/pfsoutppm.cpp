@@ -150,7 +150,9 @@ void writeFrames( int argc, char* argv[] )
     {
       if( luminanceTag!=NULL && strcmp(luminanceTag,"DISPLAY")==0 )
         std::cerr << PROG_NAME << " warning: This image seems to be display referred thus there is no need for applying the sRGB non-linearity\n";
-      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_SRGB, X, Y, Z );        
+      // The sRGB non-linearity is applied by the writer
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );        
+      writer.setSRGB( true );
       VERBOSE_STR << "writing file (sRGB corrected) '" << ff.fileName << "'" << std::endl;
     }
     else
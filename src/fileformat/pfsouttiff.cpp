@@ -32,6 +32,7 @@
 #include <iostream>
 
 #include <getopt.h>
+#include <unistd.h>
 #include <pfs.h>
 
 #include "hdrtiffio.h"
@@ -46,7 +47,7 @@ class QuietException
 
 void printHelp()
 {
-  std::cerr << PROG_NAME " [--linear] [--verbose] [--help]" << std::endl
+  std::cerr << PROG_NAME " [--srgb] [--float] [--tile-size <n>] [--verbose] [--help]" << std::endl
             << "See man page for more information." << std::endl;
 }
 
@@ -57,15 +58,20 @@ void writeFrames( int argc, char* argv[] )
 
   bool verbose = false;
   bool opt_srgb=false;
+  bool opt_float=false;
+  int tile_size=256;
+  bool tile_size_given=false;
   
   // Parse command line parameters
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "verbose", no_argument, NULL, 'v' },
     { "srgb", no_argument, NULL, 's' },
+    { "float", no_argument, NULL, 'f' },
+    { "tile-size", required_argument, NULL, 'T' },
     { NULL, 0, NULL, 0 }
   };
-  static const char optstring[] = "shv";
+  static const char optstring[] = "shvfT:";
     
   pfs::FrameFileIterator it( argc, argv, "wb", NULL, stdout,
     optstring, cmdLineOptions );
@@ -84,12 +90,27 @@ void writeFrames( int argc, char* argv[] )
     case 's':
       opt_srgb = true;
       break;
+    case 'f':
+#ifndef HAVE_ZLIB
+      throw pfs::Exception( "'--float' is not available, pfstools were compiled without zlib" );
+#endif
+      opt_float = true;
+      break;
+    case 'T':
+      tile_size = atoi( optarg );
+      if( tile_size <= 0 || tile_size % 16 != 0 )
+        throw pfs::Exception( "tile size must be a positive multiple of 16" );
+      tile_size_given = true;
+      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
     }
   }
+
+  if( tile_size_given && !opt_float )
+    throw pfs::Exception( "'tile-size' can be used only with '--float'" );
    
   while( true ) {
     pfs::Frame *frame = pfsio.readFrame( stdin );
@@ -103,7 +124,20 @@ void writeFrames( int argc, char* argv[] )
       break; // No more frames
     }    
 
+    // libtiff seeks back to the header when the directory of the float
+    // tiles is written
+    if( opt_float && lseek( fileno( ff.fh ), 0, SEEK_CUR ) == (off_t)-1 ) {
+      pfsio.freeFrame( frame );
+      throw pfs::Exception( "'--float' cannot be used with a pipe; give a file name" );
+    }
+
     HDRTiffWriter writer( ff.fh );
+    if( opt_float )
+    {
+      writer.setFloatTiles( tile_size );
+      VERBOSE_STR << "32-bit float, " << tile_size << "x" << tile_size
+                  << " deflate compressed tiles" << std::endl;
+    }
 
 
     pfs::Channel *X, *Y, *Z;
@@ -0,0 +1,588 @@
+/**
+ * @brief Write pfs frames as an uncompressed YUV4MPEG2 (y4m) video
+ *
+ * The frames are converted to Y'CbCr planes, optionally with the PQ or
+ * HLG transfer functions for HDR video, and written as one y4m stream
+ * that can be piped to a video encoder. Colour conversion of a frame
+ * runs in parallel with the writing of the previous one.
+ *
+ * This file is a part of PFSTOOLS package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <config.h>
+
+#include <cstdlib>
+
+#include <iostream>
+#include <vector>
+#include <deque>
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <pfs.h>
+
+#define PROG_NAME "pfsoutvideo"
+
+/// Number of frame buffers shared by the conversion and the writer
+#define QUEUE_FRAMES 3
+
+class QuietException
+{
+};
+
+void printHelp()
+{
+  fprintf( stderr, PROG_NAME " [--fps <n>[/<d>]] [--bit-depth 8|10|12] [--chroma 420|444] [--transfer sdr|srgb|pq|hlg] [--peak <val>] [--verbose] [--help] <file>\n"
+    "See man page for more information.\n" );
+}
+
+enum Transfer { TRANSFER_SDR, TRANSFER_SRGB, TRANSFER_PQ, TRANSFER_HLG };
+
+struct VideoFormat
+{
+  int width, height;
+  int bit_depth;
+  bool chroma420;
+  Transfer transfer;
+
+  int chromaWidth() const
+    {
+      return chroma420 ? (width+1)/2 : width;
+    }
+  int chromaHeight() const
+    {
+      return chroma420 ? (height+1)/2 : height;
+    }
+  int sampleBytes() const
+    {
+      return bit_depth > 8 ? 2 : 1;
+    }
+  size_t frameBytes() const
+    {
+      return ((size_t)width*height + 2*(size_t)chromaWidth()*chromaHeight()) * sampleBytes();
+    }
+};
+
+// ======== Colour conversion
+
+static inline float clamp01( float v )
+{
+  return v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+}
+
+/**
+ * SMPTE ST 2084 (PQ) inverse EOTF, L in cd/m^2
+ */
+static float pqEncode( float L )
+{
+  const float m1 = 2610.f/16384.f, m2 = 2523.f/4096.f*128.f;
+  const float c1 = 3424.f/4096.f, c2 = 2413.f/4096.f*32.f, c3 = 2392.f/4096.f*32.f;
+  const float Lm = powf( clamp01( L/10000.f ), m1 );
+  return powf( (c1 + c2*Lm) / (1.f + c3*Lm), m2 );
+}
+
+/**
+ * ITU-R BT.2100 hybrid log-gamma OETF, E relative scene light in [0,1]
+ */
+static float hlgEncode( float E )
+{
+  const float a = 0.17883277f, b = 0.28466892f, c = 0.55991073f;
+  E = clamp01( E );
+  return E <= 1.f/12.f ? sqrtf( 3.f*E ) : a*logf( 12.f*E - b ) + c;
+}
+
+/**
+ * Converts a row of pixels to non-linear Y'CbCr. For SDR the input
+ * is display encoded R'G'B' in [0,1], for PQ and HLG it is linear
+ * XYZ, converted to BT.2020 primaries before the transfer function.
+ */
+static void rowToYCbCr( const float *c1, const float *c2, const float *c3,
+  int n, Transfer transfer, float *Yp, float *Cb, float *Cr )
+{
+  const bool hdr = transfer == TRANSFER_PQ || transfer == TRANSFER_HLG;
+  // BT.709 or BT.2020 luma coefficients
+  const float kr = hdr ? 0.2627f : 0.2126f;
+  const float kb = hdr ? 0.0593f : 0.0722f;
+  const float kg = 1.f - kr - kb;
+
+  for( int i = 0; i < n; i++ ) {
+    float r, g, b;
+    if( hdr ) {
+      // XYZ to linear BT.2020 RGB (D65)
+      r =  1.7166512f*c1[i] - 0.3556708f*c2[i] - 0.2533663f*c3[i];
+      g = -0.6666844f*c1[i] + 1.6164812f*c2[i] + 0.0157685f*c3[i];
+      b =  0.0176399f*c1[i] - 0.0427706f*c2[i] + 0.9421031f*c3[i];
+      if( transfer == TRANSFER_PQ ) {
+        r = pqEncode( r );
+        g = pqEncode( g );
+        b = pqEncode( b );
+      } else {
+        r = hlgEncode( r );
+        g = hlgEncode( g );
+        b = hlgEncode( b );
+      }
+    } else {
+      r = clamp01( c1[i] );
+      g = clamp01( c2[i] );
+      b = clamp01( c3[i] );
+    }
+    Yp[i] = kr*r + kg*g + kb*b;
+    Cb[i] = (b - Yp[i]) / (2.f*(1.f-kb));
+    Cr[i] = (r - Yp[i]) / (2.f*(1.f-kr));
+  }
+}
+
+/**
+ * Quantizes a row to limited (video) range codes: scale*v + offset,
+ * rounded and clamped, stored as bytes or little-endian 16-bit words.
+ */
+static void quantizeRow( const float *v, int n, float scale, float offset,
+  int bit_depth, unsigned char *out )
+{
+  const int max_code = (1<<bit_depth) - 1;
+  if( bit_depth == 8 ) {
+    for( int i = 0; i < n; i++ ) {
+      int code = (int)(v[i]*scale + offset + 0.5f);
+      out[i] = code < 0 ? 0 : (code > max_code ? max_code : code);
+    }
+  } else {
+    for( int i = 0; i < n; i++ ) {
+      int code = (int)(v[i]*scale + offset + 0.5f);
+      code = code < 0 ? 0 : (code > max_code ? max_code : code);
+      out[2*i] = code & 0xff;
+      out[2*i+1] = code >> 8;
+    }
+  }
+}
+
+/**
+ * Divides the XYZ channels by the peak for HLG, which encodes relative
+ * scene light with 1 as the nominal peak.
+ * @return maximum of the scaled luminance
+ */
+static float normalizeToPeak( pfs::Channel *X, pfs::Channel *Y, pfs::Channel *Z,
+  float peak )
+{
+  float *x = X->getRawData(), *y = Y->getRawData(), *z = Z->getRawData();
+  const int size = Y->getCols()*Y->getRows();
+  const float scale = 1.f/peak;
+  float max_Y = 0.f;
+  #pragma omp parallel for schedule(static) reduction(max:max_Y)
+  for( int i = 0; i < size; i++ ) {
+    x[i] *= scale;
+    y[i] *= scale;
+    z[i] *= scale;
+    if( y[i] > max_Y )
+      max_Y = y[i];
+  }
+  return max_Y;
+}
+
+/**
+ * Converts a frame to the Y, Cb and Cr planes of a y4m frame. Rows
+ * (pairs of rows for 4:2:0) are converted in parallel; 4:2:0 chroma
+ * is the average of 2x2 pixels (centre sited).
+ */
+static void convertFrame( const float *c1, const float *c2, const float *c3,
+  const VideoFormat &fmt, unsigned char *planes )
+{
+  const int width = fmt.width, height = fmt.height;
+  const int cw = fmt.chromaWidth(), ch = fmt.chromaHeight();
+  const int sb = fmt.sampleBytes();
+  const float bd_scale = (float)(1<<(fmt.bit_depth-8));
+  const float y_scale = 219.f*bd_scale, y_offset = 16.f*bd_scale;
+  const float c_scale = 224.f*bd_scale, c_offset = 128.f*bd_scale;
+  unsigned char *y_plane = planes;
+  unsigned char *cb_plane = y_plane + (size_t)width*height*sb;
+  unsigned char *cr_plane = cb_plane + (size_t)cw*ch*sb;
+  const int rows_per_chroma = fmt.chroma420 ? 2 : 1;
+
+  #pragma omp parallel
+  {
+    std::vector<float> Yp( 2*width ), Cb( 2*width ), Cr( 2*width );
+    std::vector<float> Cbs( cw ), Crs( cw );
+
+    #pragma omp for schedule(dynamic)
+    for( int cy = 0; cy < ch; cy++ ) {
+      const int y0 = cy*rows_per_chroma;
+      const int rows = (y0+rows_per_chroma <= height) ? rows_per_chroma : height-y0;
+      for( int r = 0; r < rows; r++ ) {
+        const size_t offset = (size_t)(y0+r)*width;
+        rowToYCbCr( c1+offset, c2+offset, c3+offset, width, fmt.transfer,
+          &Yp[r*width], &Cb[r*width], &Cr[r*width] );
+        quantizeRow( &Yp[r*width], width, y_scale, y_offset, fmt.bit_depth,
+          y_plane + offset*sb );
+      }
+
+      const float *cb_row = &Cb[0], *cr_row = &Cr[0];
+      if( fmt.chroma420 ) {
+        for( int x = 0; x < cw; x++ ) {
+          const int x1 = (2*x+1 < width) ? 2*x+1 : 2*x;
+          const int r1 = (rows > 1) ? width : 0;
+          Cbs[x] = 0.25f*(Cb[2*x] + Cb[x1] + Cb[r1+2*x] + Cb[r1+x1]);
+          Crs[x] = 0.25f*(Cr[2*x] + Cr[x1] + Cr[r1+2*x] + Cr[r1+x1]);
+        }
+        cb_row = &Cbs[0];
+        cr_row = &Crs[0];
+      }
+      quantizeRow( cb_row, cw, c_scale, c_offset, fmt.bit_depth,
+        cb_plane + (size_t)cy*cw*sb );
+      quantizeRow( cr_row, cw, c_scale, c_offset, fmt.bit_depth,
+        cr_plane + (size_t)cy*cw*sb );
+    }
+  }
+}
+
+// ======== Writer thread
+
+/**
+ * Writes converted frames on a separate thread. Frame buffers are
+ * taken from a small pool, so that the conversion of the next frame
+ * overlaps with the writing of the previous one.
+ */
+class FrameWriter
+{
+  FILE *fh;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  std::vector< std::vector<unsigned char>* > free_buffers;
+  std::deque< std::vector<unsigned char>* > queue;
+  bool finished;
+  bool failed;
+
+  static void *threadMain( void *arg )
+  {
+    ((FrameWriter*)arg)->run();
+    return NULL;
+  }
+
+  void run()
+  {
+    while( true ) {
+      pthread_mutex_lock( &mutex );
+      while( queue.empty() && !finished )
+        pthread_cond_wait( &changed, &mutex );
+      if( queue.empty() ) {
+        pthread_mutex_unlock( &mutex );
+        return;
+      }
+      std::vector<unsigned char> *buffer = queue.front();
+      queue.pop_front();
+      pthread_mutex_unlock( &mutex );
+
+      const bool ok = fwrite( &(*buffer)[0], 1, buffer->size(), fh ) == buffer->size();
+
+      pthread_mutex_lock( &mutex );
+      if( !ok )
+        failed = true;
+      free_buffers.push_back( buffer );
+      pthread_cond_broadcast( &changed );
+      pthread_mutex_unlock( &mutex );
+    }
+  }
+
+public:
+  FrameWriter( FILE *fh ) : fh( fh ), finished( false ), failed( false )
+  {
+    for( int i = 0; i < QUEUE_FRAMES; i++ )
+      free_buffers.push_back( new std::vector<unsigned char>() );
+    pthread_mutex_init( &mutex, NULL );
+    pthread_cond_init( &changed, NULL );
+    if( pthread_create( &thread, NULL, threadMain, this ) != 0 )
+      throw pfs::Exception( "cannot create writer thread" );
+  }
+
+  ~FrameWriter()
+  {
+    finish();
+    for( size_t i = 0; i < free_buffers.size(); i++ )
+      delete free_buffers[i];
+    pthread_cond_destroy( &changed );
+    pthread_mutex_destroy( &mutex );
+  }
+
+  /**
+   * Waits for a buffer that is not being written.
+   */
+  std::vector<unsigned char> *getBuffer()
+  {
+    pthread_mutex_lock( &mutex );
+    while( free_buffers.empty() )
+      pthread_cond_wait( &changed, &mutex );
+    std::vector<unsigned char> *buffer = free_buffers.back();
+    free_buffers.pop_back();
+    const bool write_failed = failed;
+    pthread_mutex_unlock( &mutex );
+    if( write_failed ) {
+      putBack( buffer );
+      throw pfs::Exception( "cannot write video data" );
+    }
+    return buffer;
+  }
+
+  void write( std::vector<unsigned char> *buffer )
+  {
+    pthread_mutex_lock( &mutex );
+    queue.push_back( buffer );
+    pthread_cond_broadcast( &changed );
+    pthread_mutex_unlock( &mutex );
+  }
+
+  void putBack( std::vector<unsigned char> *buffer )
+  {
+    pthread_mutex_lock( &mutex );
+    free_buffers.push_back( buffer );
+    pthread_mutex_unlock( &mutex );
+  }
+
+  /**
+   * Writes the remaining frames and stops the thread.
+   * @return false if any frame could not be written
+   */
+  bool finish()
+  {
+    pthread_mutex_lock( &mutex );
+    const bool running = !finished;
+    finished = true;
+    pthread_cond_broadcast( &changed );
+    pthread_mutex_unlock( &mutex );
+    if( running )
+      pthread_join( thread, NULL );
+    return !failed;
+  }
+};
+
+// ======== Main
+
+static const char *y4mChroma( const VideoFormat &fmt )
+{
+  if( fmt.chroma420 )
+    return fmt.bit_depth == 8 ? "420jpeg" : (fmt.bit_depth == 10 ? "420p10" : "420p12");
+  return fmt.bit_depth == 8 ? "444" : (fmt.bit_depth == 10 ? "444p10" : "444p12");
+}
+
+void writeFrames( int argc, char* argv[] )
+{
+  bool verbose = false;
+  int fps_num = 25, fps_den = 1;
+  float peak = -1.f;    // WHITE_Y of the first frame or 1 if not given
+  VideoFormat fmt;
+  fmt.width = fmt.height = 0;
+  fmt.bit_depth = 8;
+  fmt.chroma420 = true;
+  fmt.transfer = TRANSFER_SDR;
+
+  // Parse command line parameters
+  static struct option cmdLineOptions[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "fps", required_argument, NULL, 'f' },
+    { "bit-depth", required_argument, NULL, 'b' },
+    { "chroma", required_argument, NULL, 'c' },
+    { "transfer", required_argument, NULL, 't' },
+    { "peak", required_argument, NULL, 'p' },
+    { NULL, 0, NULL, 0 }
+  };
+  static const char optstring[] = "hvf:b:c:t:p:";
+
+  int optionIndex = 0;
+  while( 1 ) {
+    int c = getopt_long (argc, argv, optstring, cmdLineOptions, &optionIndex);
+    if( c == -1 ) break;
+    switch( c ) {
+    case 'h':
+      printHelp();
+      throw QuietException();
+    case 'v':
+      verbose = true;
+      break;
+    case 'f': {
+      int n = sscanf( optarg, "%d/%d", &fps_num, &fps_den );
+      if( n == 1 )
+        fps_den = 1;
+      if( n < 1 || fps_num <= 0 || fps_den <= 0 )
+        throw pfs::Exception( "frame rate must be given as <n> or <n>/<d>" );
+      break;
+    }
+    case 'b':
+      fmt.bit_depth = atoi( optarg );
+      if( fmt.bit_depth != 8 && fmt.bit_depth != 10 && fmt.bit_depth != 12 )
+        throw pfs::Exception( "bit depth must be 8, 10 or 12" );
+      break;
+    case 'c':
+      if( !strcmp( optarg, "420" ) )
+        fmt.chroma420 = true;
+      else if( !strcmp( optarg, "444" ) )
+        fmt.chroma420 = false;
+      else
+        throw pfs::Exception( "chroma format must be 420 or 444" );
+      break;
+    case 't':
+      if( !strcasecmp( optarg, "sdr" ) )
+        fmt.transfer = TRANSFER_SDR;
+      else if( !strcasecmp( optarg, "srgb" ) )
+        fmt.transfer = TRANSFER_SRGB;
+      else if( !strcasecmp( optarg, "pq" ) )
+        fmt.transfer = TRANSFER_PQ;
+      else if( !strcasecmp( optarg, "hlg" ) )
+        fmt.transfer = TRANSFER_HLG;
+      else
+        throw pfs::Exception( "Unknown transfer function. Possible values: sdr, srgb, pq, hlg" );
+      break;
+    case 'p':
+      peak = (float)strtod( optarg, NULL );
+      if( peak <= 0.f )
+        throw pfs::Exception( "peak must be a positive value" );
+      break;
+    case '?':
+      throw QuietException();
+    case ':':
+      throw QuietException();
+    }
+  }
+
+  if( optind != argc-1 ) {
+    printHelp();
+    throw QuietException();
+  }
+  const char *fileName = argv[optind];
+
+  if( (fmt.transfer == TRANSFER_PQ || fmt.transfer == TRANSFER_HLG) && fmt.bit_depth == 8 )
+    throw pfs::Exception( "pq and hlg transfer functions require 10 or 12 bits (--bit-depth)" );
+
+  static const char *transfer_names[] = { "SDR (BT.709)", "sRGB (BT.709)", "PQ (BT.2020)", "HLG (BT.2020)" };
+  VERBOSE_STR << "writing " << fmt.bit_depth << "-bit " << (fmt.chroma420 ? "4:2:0" : "4:4:4")
+              << " " << transfer_names[fmt.transfer] << " video at "
+              << fps_num << "/" << fps_den << " fps to '" << fileName << "'" << std::endl;
+
+  FILE *fh = strcmp( fileName, "-" ) ? fopen( fileName, "wb" ) : stdout;
+  if( fh == NULL )
+    throw pfs::Exception( "cannot open output file" );
+
+  pfs::DOMIO pfsio;
+  int frame_count = 0;
+  {
+    FrameWriter writer( fh );
+
+    while( true ) {
+      pfs::Frame *frame = pfsio.readFrame( stdin );
+      if( frame == NULL )
+        break; // No more frames
+
+      pfs::Channel *X, *Y, *Z;
+      frame->getXYZChannels( X, Y, Z );
+      if( X == NULL ) {
+        pfsio.freeFrame( frame );
+        throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
+      }
+
+      if( frame_count == 0 ) {
+        fmt.width = frame->getWidth();
+        fmt.height = frame->getHeight();
+        // Header of the stream is the first buffer
+        std::vector<unsigned char> *header = writer.getBuffer();
+        char line[256];
+        int len = snprintf( line, sizeof(line), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C%s XCOLORRANGE=LIMITED\n",
+          fmt.width, fmt.height, fps_num, fps_den, y4mChroma( fmt ) );
+        header->assign( line, line+len );
+        writer.write( header );
+      } else if( frame->getWidth() != fmt.width || frame->getHeight() != fmt.height ) {
+        pfsio.freeFrame( frame );
+        throw pfs::Exception( "all frames of a video must have the same size" );
+      }
+
+      const char* luminanceTag = frame->getTags()->getString("LUMINANCE");
+      if( fmt.transfer == TRANSFER_PQ && (luminanceTag == NULL || strcmp( luminanceTag, "ABSOLUTE" )) ) {
+        static bool show_once = false;
+        if( !show_once ) {
+          std::cerr << PROG_NAME << " warning: PQ expects absolute luminance values in cd/m^2" << std::endl;
+          show_once = true;
+        }
+      }
+
+      if( fmt.transfer == TRANSFER_HLG ) {
+        // The peak is fixed for the whole video, otherwise the
+        // brightness would change from frame to frame
+        if( peak <= 0.f ) {
+          const char *white_y_str = frame->getTags()->getString( "WHITE_Y" );
+          peak = white_y_str == NULL ? 0.f : (float)strtod( white_y_str, NULL );
+          if( peak <= 0.f )
+            peak = 1.f;
+          VERBOSE_STR << "HLG peak: " << peak << std::endl;
+        }
+        const float max_Y = normalizeToPeak( X, Y, Z, peak );
+        static bool show_once = false;
+        if( max_Y > 1.f && !show_once ) {
+          std::cerr << PROG_NAME << " warning: HLG clips luminance above the peak of "
+                    << peak << " (maximum " << max_Y*peak
+                    << "); use --peak to set the value mapped to the nominal peak" << std::endl;
+          show_once = true;
+        }
+      }
+
+      if( fmt.transfer == TRANSFER_SDR )
+        pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+      else if( fmt.transfer == TRANSFER_SRGB )
+        pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_SRGB, X, Y, Z );
+
+      std::vector<unsigned char> *buffer = writer.getBuffer();
+      static const char frame_tag[] = "FRAME\n";
+      const size_t tag_len = sizeof(frame_tag)-1;
+      buffer->resize( tag_len + fmt.frameBytes() );
+      memcpy( &(*buffer)[0], frame_tag, tag_len );
+      convertFrame( X->getRawData(), Y->getRawData(), Z->getRawData(), fmt,
+        &(*buffer)[tag_len] );
+      pfsio.freeFrame( frame );
+
+      writer.write( buffer );
+      frame_count++;
+    }
+
+    if( !writer.finish() )
+      throw pfs::Exception( "cannot write video data" );
+  }
+
+  if( fh != stdout )
+    fclose( fh );
+  else
+    fflush( fh );
+
+  VERBOSE_STR << frame_count << " frames written" << std::endl;
+}
+
+
+int main( int argc, char* argv[] )
+{
+  try {
+    writeFrames( argc, argv );
+  }
+  catch( pfs::Exception ex ) {
+    fprintf( stderr, PROG_NAME " error: %s\n", ex.getMessage() );
+    return EXIT_FAILURE;
+  }
+  catch( QuietException  ex ) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
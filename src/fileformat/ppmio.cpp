@@ -25,6 +25,7 @@
  * $Id: ppmio.cpp,v 1.5 2009/05/25 19:24:49 rafm Exp $
  */
 
+
 #include "ppmio.h"
 
 extern "C" {
@@ -33,6 +34,13 @@ extern "C" {
 
 #include <math.h>
 #include <assert.h>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+#include <pfs.h>
+
+#include "rawdata.h"
 
 struct PPMData
 {
@@ -47,40 +55,175 @@ static inline float clamp( const float v, const float minV, const float maxV )
     return v;
 }
 
-PPMReader::PPMReader( const char *program_name, FILE *fh ) : fh(fh)
+static inline float srgbEncode( float v )
+{
+    v = clamp( v, 0.f, 1.f );
+    return (v <= 0.0031308f ? v * 12.92f : 1.055f * powf( v, 1./2.4 ) - 0.055f);
+}
+
+/**
+ * Read a decimal number from the header of a PPM file, skipping white
+ * spaces and comments.
+ */
+static int readHeaderValue( FILE *fh )
+{
+  int c = getc( fh );
+  while( c != EOF && (isspace( c ) || c == '#') ) {
+    if( c == '#' )
+      while( c != EOF && c != '\n' && c != '\r' )
+        c = getc( fh );
+    c = getc( fh );
+  }
+  if( c == EOF || !isdigit( c ) )
+    throw pfs::Exception( "corrupted PPM header" );
+  int value = 0;
+  while( c != EOF && isdigit( c ) ) {
+    if( value > 0x7fffffff/10 - 1 )
+      throw pfs::Exception( "corrupted PPM header" );
+    value = value*10 + (c - '0');
+    c = getc( fh );
+  }
+  // Exactly one white space character separates the header and the
+  // raster
+  if( c != EOF && !isspace( c ) )
+    throw pfs::Exception( "corrupted PPM header" );
+  return value;
+}
+
+PPMReader::PPMReader( const char *program_name, FILE *fh ) : fh(fh),
+  linearize( false )
 {
   pm_init(program_name, 0);
   
   data = new PPMData;
 
-  ppm_readppminit(  fh, &width, &height, &data->maxPV, &data->formatP );
+  data->formatP = pm_readmagicnumber( fh );
+  if( data->formatP == RPPM_FORMAT ) {
+    width = readHeaderValue( fh );
+    height = readHeaderValue( fh );
+    const int maxval = readHeaderValue( fh );
+    if( width <= 0 || height <= 0 || maxval <= 0 || maxval > 65535 )
+      throw pfs::Exception( "unsupported PPM image size or maximum value" );
+    data->maxPV = (pixval)maxval;
+    return;
+  }
+
+  switch( PPM_FORMAT_TYPE( data->formatP ) ) {
+  case PPM_TYPE:
+    ppm_readppminitrest( fh, &width, &height, &data->maxPV );
+    break;
+  case PGM_TYPE: {
+    gray maxval;
+    pgm_readpgminitrest( fh, &width, &height, &maxval );
+    data->maxPV = (pixval)maxval;
+    break;
+  }
+  case PBM_TYPE:
+    pbm_readpbminitrest( fh, &width, &height );
+    data->maxPV = 1;
+    break;
+  default:
+    throw pfs::Exception( "not a PPM, PGM or PBM file" );
+  }
 }
 
 bool PPMReader::readImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
+{
+    // Values above maxPV are clamped rather than rejected
+    const int lutSize = data->maxPV > 255 ? 65536 : 256;
+    std::vector<float> lut( lutSize );
+    const float normalization_factor = 1.f / (float)data->maxPV;
+    for( int i = 0; i < lutSize; i++ ) {
+      float v = (float)(i < (int)data->maxPV ? i : data->maxPV) *
+        normalization_factor;
+      if( linearize )
+        v = (v <= 0.04045 ? v / 12.92f : powf( (v + 0.055f) / 1.055f, 2.4f ));
+      lut[i] = v;
+    }
+
+    if( data->formatP == RPPM_FORMAT )
+      readRawImage( X, Y, Z, lut );
+    else
+      readNetpbmImage( X, Y, Z, lut );
+
+    int eofP;
+    ppm_nextimage( fh, &eofP);
+
+    return eofP!=0;
+}
+
+void PPMReader::readRawImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z,
+  const std::vector<float> &lut )
+{
+    const int bytesPerSample = data->maxPV > 255 ? 2 : 1;
+    const size_t rowBytes = (size_t)width*3*bytesPerSample;
+    std::vector<unsigned char> raster( rowBytes*height );
+    if( fread( &raster[0], 1, raster.size(), fh ) != raster.size() )
+      throw pfs::Exception( "unexpected end of PPM file" );
+
+    float *x_data = getRawData( X ), *y_data = getRawData( Y ),
+      *z_data = getRawData( Z );
+    const bool direct = x_data != NULL && y_data != NULL && z_data != NULL;
+    const float *l = &lut[0];
+
+    #pragma omp parallel for schedule(static)
+    for( int y = 0; y < height; y++ ) {
+      const unsigned char *in = &raster[0] + rowBytes*y;
+      if( direct ) {
+        float *o_x = x_data + (size_t)width*y, *o_y = y_data + (size_t)width*y,
+          *o_z = z_data + (size_t)width*y;
+        if( bytesPerSample == 1 ) {
+          for( int x = 0; x < width; x++, in += 3 ) {
+            o_x[x] = l[in[0]];
+            o_y[x] = l[in[1]];
+            o_z[x] = l[in[2]];
+          }
+        } else {
+          for( int x = 0; x < width; x++, in += 6 ) {
+            o_x[x] = l[(in[0]<<8) | in[1]];
+            o_y[x] = l[(in[2]<<8) | in[3]];
+            o_z[x] = l[(in[4]<<8) | in[5]];
+          }
+        }
+      } else {
+        for( int x = 0; x < width; x++ ) {
+          if( bytesPerSample == 1 ) {
+            (*X)(x,y) = l[in[0]];
+            (*Y)(x,y) = l[in[1]];
+            (*Z)(x,y) = l[in[2]];
+            in += 3;
+          } else {
+            (*X)(x,y) = l[(in[0]<<8) | in[1]];
+            (*Y)(x,y) = l[(in[2]<<8) | in[3]];
+            (*Z)(x,y) = l[(in[4]<<8) | in[5]];
+            in += 6;
+          }
+        }
+      }
+    }
+}
+
+void PPMReader::readNetpbmImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z,
+  const std::vector<float> &lut )
 {
     pixel *ppmRow;
     ppmRow = ppm_allocrow( width );
     assert( ppmRow != NULL );
 
-    float normalization_factor = 1.f / (float)data->maxPV;
+    const int maxIndex = (int)lut.size() - 1;
     
     for( int y = 0; y < height; y++ ) { // For each row of the image
 
       ppm_readppmrow( fh, ppmRow, width, data->maxPV, data->formatP );
 
       for( int x = 0; x < width; x++ ) {
-        (*X)(x,y) = (float)PPM_GETR(ppmRow[x]) * normalization_factor;
-        (*Y)(x,y) = (float)PPM_GETG(ppmRow[x]) * normalization_factor;
-        (*Z)(x,y) = (float)PPM_GETB(ppmRow[x]) * normalization_factor;
+        (*X)(x,y) = lut[std::min( (int)PPM_GETR(ppmRow[x]), maxIndex )];
+        (*Y)(x,y) = lut[std::min( (int)PPM_GETG(ppmRow[x]), maxIndex )];
+        (*Z)(x,y) = lut[std::min( (int)PPM_GETB(ppmRow[x]), maxIndex )];
       }
       
     }
     ppm_freerow( ppmRow );
-
-    int eofP;
-    ppm_nextimage( fh, &eofP);
-
-    return eofP!=0;
 }
 
 int PPMReader::getBitDepth()
@@ -97,13 +240,66 @@ PPMReader::~PPMReader()
 
 
 PPMWriter::PPMWriter( const char *program_name, FILE *fh, int bit_depth ) :
-   fh(fh), bit_depth( bit_depth ) 
+   fh(fh), bit_depth( bit_depth ), srgb( false )
 {
    pm_init(program_name, 0);
 }
 
 
 void PPMWriter::writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
+{
+    const int width = X->getCols();
+    const int height =  X->getRows();
+
+    if( bit_depth > 16 ) {
+      // Beyond the range of the binary format, leave it to libnetpbm
+      writeNetpbmImage( X, Y, Z );
+      return;
+    }
+
+    const int max_val = (1<<bit_depth)-1;
+    const float max_valf = max_val;
+    const int bytesPerSample = max_val > 255 ? 2 : 1;
+    const size_t rowBytes = (size_t)width*3*bytesPerSample;
+    std::vector<unsigned char> raster( rowBytes*height );
+
+    float *x_data = getRawData( X ), *y_data = getRawData( Y ),
+      *z_data = getRawData( Z );
+    const bool direct = x_data != NULL && y_data != NULL && z_data != NULL;
+
+    #pragma omp parallel for schedule(static)
+    for( int y = 0; y < height; y++ ) {
+      unsigned char *out = &raster[0] + rowBytes*y;
+      for( int x = 0; x < width; x++ ) {
+        float rgb[3];
+        if( direct ) {
+          const size_t i = (size_t)width*y + x;
+          rgb[0] = x_data[i];
+          rgb[1] = y_data[i];
+          rgb[2] = z_data[i];
+        } else {
+          rgb[0] = (*X)(x,y);
+          rgb[1] = (*Y)(x,y);
+          rgb[2] = (*Z)(x,y);
+        }
+        for( int c = 0; c < 3; c++ ) {
+          if( srgb )
+            rgb[c] = srgbEncode( rgb[c] );
+          const unsigned int v =
+            (unsigned int)clamp( rgb[c]*max_valf, 0.f, max_valf );
+          if( bytesPerSample == 2 )
+            *out++ = (unsigned char)(v >> 8);
+          *out++ = (unsigned char)v;
+        }
+      }
+    }
+
+    fprintf( fh, "P6\n%d %d\n%d\n", width, height, max_val );
+    if( fwrite( &raster[0], 1, raster.size(), fh ) != raster.size() )
+      throw pfs::Exception( "cannot write PPM file" );
+}
+
+void PPMWriter::writeNetpbmImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
 {
     pixel *ppmRow;
     int width = X->getCols();
@@ -118,10 +314,16 @@ void PPMWriter::writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
     for( int y = 0; y < height; y++ ) { // For each row of the image
 
         for( int x = 0; x < width; x++ ) {
+            float r = (*X)( x, y ), g = (*Y)( x, y ), b = (*Z)( x, y );
+            if( srgb ) {
+              r = srgbEncode( r );
+              g = srgbEncode( g );
+              b = srgbEncode( b );
+            }
             PPM_ASSIGN( ppmRow[x],
-                (pixval)( clamp( (*X)( x, y )*max_valf, 0.f, max_valf) ),
-                (pixval)( clamp( (*Y)( x, y )*max_valf, 0.f, max_valf) ),
-                (pixval)( clamp( (*Z)( x, y )*max_valf, 0.f, max_valf) ) );
+                (pixval)( clamp( r*max_valf, 0.f, max_valf) ),
+                (pixval)( clamp( g*max_valf, 0.f, max_valf) ),
+                (pixval)( clamp( b*max_valf, 0.f, max_valf) ) );
         }
         ppm_writeppmrow( fh, ppmRow, width, max_val, false );
 
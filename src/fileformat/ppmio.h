@@ -29,15 +29,28 @@
 #define PPMIO_H
 
 #include <stdio.h>
+#include <vector>
 #include <array2d.h>
 
 struct PPMData;
 
+/**
+ * Reads PPM, PGM and PBM images. Binary PPM (P6) images are read
+ * directly, with one fread per image; other formats are read row by
+ * row with libnetpbm. The reader does not share state with other
+ * instances, so different streams can be decoded concurrently.
+ */
 class PPMReader 
 {
     FILE *fh;
     int width, height;
     PPMData *data;
+    bool linearize;
+
+    void readRawImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z,
+      const std::vector<float> &lut );
+    void readNetpbmImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z,
+      const std::vector<float> &lut );
 public:
     PPMReader( const char *program_name, FILE *fh );    
     ~PPMReader();
@@ -53,6 +66,16 @@ public:
 
      int getBitDepth();
 
+     /**
+      * Convert the sRGB encoded samples to linear RGB while reading,
+      * which gives the same result as transforming from CS_SRGB to
+      * CS_RGB afterwards.
+      */
+     void setLinearize( bool linearize )
+       {
+         this->linearize = linearize;
+       }
+
      bool readImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z );
 
  };
@@ -61,9 +84,22 @@ public:
  {
      FILE *fh;
      const int bit_depth;
+     bool srgb;
+
+     void writeNetpbmImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z );
      
  public:
      PPMWriter( const char *program_name, FILE *fh, int bit_depth = 8 );
+
+     /**
+      * Apply the sRGB non-linearity to linear RGB data while writing,
+      * which gives the same result as transforming from CS_RGB to
+      * CS_SRGB beforehand.
+      */
+     void setSRGB( bool srgb )
+       {
+         this->srgb = srgb;
+       }
     
      void writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z );
     
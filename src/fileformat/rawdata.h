@@ -0,0 +1,45 @@
+/**
+ * @brief Direct access to the pixels of pfs arrays for the image readers
+ * and writers
+ *
+ * This file is a part of PFSTOOLS package.
+ * ----------------------------------------------------------------------
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef RAWDATA_H
+#define RAWDATA_H
+
+#include <pfs.h>
+
+/**
+ * Returns a pointer to the row-major float data of an array, or NULL
+ * if the array does not expose its memory.
+ */
+inline float *getRawData( pfs::Array2D *array )
+{
+  pfs::Channel *ch = dynamic_cast<pfs::Channel*>( array );
+  if( ch != NULL )
+    return ch->getRawData();
+  pfs::Array2DImpl *impl = dynamic_cast<pfs::Array2DImpl*>( array );
+  if( impl != NULL )
+    return impl->getRawData();
+  return NULL;
+}
+
+#endif
@@ -29,12 +29,17 @@
 
 #include <iostream>
 
+#include <vector>
+
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include <pfs.h>
 
 #include "rgbeio.h"
+#include "rawdata.h"
 
 using namespace std;
 
@@ -80,42 +85,37 @@ void RGBEWriter::writeImage( pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
 // RGBE IO format support functions
 
 typedef unsigned char Trgbe;
-struct Trgbe_pixel
-{
-  /// @name RGB values and their exponent
-  //@{
-  Trgbe r;
-  Trgbe g;
-  Trgbe b;
-  Trgbe e;
-  //@}
-
-};
 
-void rgbe2rgb(const Trgbe_pixel& rgbe, float exposure, float &r, float &g, float &b)
+/**
+ * Conversion of RGBE pixels to floats: value = mantissa * scale[e],
+ * where scale[e] = 2^(e-136) / exposure and scale[0] = 0 (a zero
+ * pixel). The table lookup replaces ldexp() of every pixel. The scale
+ * is kept in double precision so that the values are rounded once, as
+ * before.
+ */
+class RGBEDecodeTable
 {
-  if( rgbe.e!=0 )		// a non-zero pixel
-  {
-    int e = rgbe.e - int(128+8);
-//    double f = ldexp( 1.0, e ) * WHITE_EFFICACY / exposure;
-	double f = ldexp(1.0, e) / exposure;
+public:
+  double scale[256];
 
-    r = (float)(rgbe.r * f);
-    g = (float)(rgbe.g * f);
-    b = (float)(rgbe.b * f);
+  RGBEDecodeTable( float exposure )
+  {
+    scale[0] = 0.;
+    for( int e=1 ; e<256 ; e++ )
+      scale[e] = ldexp( 1.0, e - int(128+8) ) / exposure;
   }
-  else
-    r = g = b = 0.f;
-}
-
+};
 
-void rgb2rgbe( float r, float g, float b, Trgbe_pixel& rgbe)
+/**
+ * Convert a float pixel to RGBE. The exponent is taken directly from
+ * the bits of the largest component (the same as frexp() for normal
+ * floats, and values below 1e-32 are stored as zero), and the
+ * mantissas are scaled by the exact power of two 2^(8-e).
+ */
+static inline void rgb2rgbe( float r, float g, float b,
+  Trgbe &out_r, Trgbe &out_g, Trgbe &out_b, Trgbe &out_e )
 {
-//  r /= WHITE_EFFICACY;
-//  g /= WHITE_EFFICACY;
-//  b /= WHITE_EFFICACY;
-  
-  double v = r;	// max rgb value
+  float v = r;	// max rgb value
   if( v < g)
     v = g;
   if( v < b )
@@ -123,17 +123,20 @@ void rgb2rgbe( float r, float g, float b, Trgbe_pixel& rgbe)
 
   if( v < 1e-32 )
   {
-    rgbe.r = rgbe.g = rgbe.b = rgbe.e = 0;
+    out_r = out_g = out_b = out_e = 0;
   }
   else
   {
-    int e;	// exponent
-
-    v = frexp(v,&e) * 256.0/v;
-    rgbe.r = Trgbe( v*r );
-    rgbe.g = Trgbe( v*g );
-    rgbe.b = Trgbe( v*b );
-    rgbe.e = Trgbe( e+128 );
+    uint32_t bits;
+    memcpy( &bits, &v, sizeof(bits) );
+    const int e = (int)((bits >> 23) & 0xff) - 126;	// exponent
+    const uint32_t scale_bits = (uint32_t)(8 - e + 127) << 23;
+    float scale;
+    memcpy( &scale, &scale_bits, sizeof(scale) );
+    out_r = Trgbe( r*scale );
+    out_g = Trgbe( g*scale );
+    out_b = Trgbe( b*scale );
+    out_e = Trgbe( e+128 );
   }
 }
 
@@ -217,115 +220,209 @@ void readRadianceHeader( FILE *file, int &width, int &height, float &exposure )
 
 
 
-void RLERead( FILE* file, Trgbe* scanline, int size )
+/**
+ * Read the rest of the file into memory.
+ */
+static void readAll( FILE *file, std::vector<Trgbe> &data )
 {
-  int peek=0;
+  size_t size = 0;
+  data.resize( 1 << 20 );
+  while( true )
+  {
+    size += fread( &data[size], 1, data.size()-size, file );
+    if( size < data.size() )
+      break;
+    data.resize( data.size()*2 );
+  }
+  data.resize( size );
+}
+
+static inline bool isRLEScanline( const Trgbe *p, int width )
+{
+  return p[0] == 2 && p[1] == 2 && (p[2]<<8) + p[3] == width;
+}
+
+/**
+ * Find the offset of the RLE data of one channel that follows the data
+ * at pos, validating the run lengths.
+ */
+static size_t skipRLE( const std::vector<Trgbe> &data, size_t pos, int size )
+{
+  int peek = 0;
   while( peek<size )
   {
-    Trgbe p[2];
-    fread(p, sizeof(p), 1, file);
-    if( p[0]>128 )
+    if( pos+2 > data.size() )
+      throw pfs::Exception( "RGBE: not enough data to read the RLE scanline" );
+    const int code = data[pos];
+    if( code>128 )
     {
       // a run
-      int run_len = p[0]-128;
-
-      while( run_len>0 )
-      {
-	scanline[peek++] = p[1];
-	run_len--;
-      }
+      peek += code-128;
+      pos += 2;
     }
     else
     {
       // a non-run
-      scanline[peek++] = p[1];
-
-      int nonrun_len = p[0]-1;
-      if( nonrun_len>0 )
-      {
-	fread(scanline+peek, sizeof(*scanline), nonrun_len, file);
-	peek += nonrun_len;
-      }
+      const int nonrun_len = code > 0 ? code : 1;
+      peek += nonrun_len;
+      pos += 1+nonrun_len;
     }
   }
-  if( peek!=size )
+  if( peek!=size || pos > data.size() )
   {
     throw pfs::Exception( "RGBE: difference in size while reading RLE scanline");
   }
+  return pos;
+}
 
+/**
+ * Decode one channel of an RLE scanline that has been validated by
+ * skipRLE().
+ */
+static const Trgbe *RLERead( const Trgbe *p, Trgbe* scanline, int size )
+{
+  int peek=0;
+  while( peek<size )
+  {
+    if( p[0]>128 )
+    {
+      // a run
+      const int run_len = p[0]-128;
+      memset( scanline+peek, p[1], run_len );
+      peek += run_len;
+      p += 2;
+    }
+    else
+    {
+      // a non-run
+      const int nonrun_len = p[0] > 0 ? p[0] : 1;
+      memcpy( scanline+peek, p+1, nonrun_len );
+      peek += nonrun_len;
+      p += 1+nonrun_len;
+    }
+  }
+  return p;
 }
 
 
+/**
+ * The pixel data is read at once. A serial pass over the run lengths
+ * finds where every scanline starts, then the scanlines are decoded
+ * and converted in parallel.
+ */
 void readRadiance( FILE *file, int width, int height, float exposure,
 		   pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z )
 {
-  // read image
-  // depending on format read either rle or normal (note: only rle supported)
-  Trgbe* scanline = new Trgbe[width*4];
+  std::vector<Trgbe> data;
+  readAll( file, data );
 
+  // scanline index
+  std::vector<size_t> offset( height );
+  size_t pos = 0;
   for( int y=0 ; y<height ; y++ )
   {
-    // read rle header
-    Trgbe header[4];
-    fread(header, sizeof(header), 1, file);
-    if( header[0] != 2 || header[1] != 2 || (header[2]<<8) + header[3] != width )
+    offset[y] = pos;
+    if( pos+4 <= data.size() && isRLEScanline( &data[pos], width ) )
+    {
+      //--- rle scanline, each channel is encoded separately
+      pos += 4;
+      for( int ch=0 ; ch<4 ; ch++ )
+        pos = skipRLE( data, pos, width );
+    }
+    else
     {
       //--- simple scanline (not rle)
-      size_t rez = fread(scanline+4, sizeof(Trgbe), 4*width-4, file);
-      if( rez!=4*width-4 )
+      pos += 4*(size_t)width;
+      if( pos > data.size() )
       {
-	DEBUG_STR << "RGBE: scanline " << y
-		  << "(" << (int)rez << "/" << width << ")" <<endl;
+	DEBUG_STR << "RGBE: scanline " << y << endl;
         throw pfs::Exception( "RGBE: not enough data to read "
 			      "in the simple format." );
       }
-      //--- yes, we've read one pixel as a header
-      scanline[0]=header[0];
-      scanline[1]=header[1];
-      scanline[2]=header[2];
-      scanline[3]=header[3];
-
-      //--- write scanline to the image
-      for( int x=0 ; x<width ; x++ )
-      {
-	Trgbe_pixel rgbe;
-	rgbe.r = scanline[4*x+0];
-	rgbe.g = scanline[4*x+1];
-	rgbe.b = scanline[4*x+2];
-	rgbe.e = scanline[4*x+3];
-
-	rgbe2rgb(rgbe, exposure, (*X)(x,y), (*Y)(x,y), (*Z)(x,y));
-      }
     }
-    else
+  }
+
+  float *R_raw = getRawData( X );
+  float *G_raw = getRawData( Y );
+  float *B_raw = getRawData( Z );
+  std::vector<float> tmp;
+  const bool direct = R_raw != NULL && G_raw != NULL && B_raw != NULL;
+  if( !direct )
+  {
+    tmp.resize( 3*(size_t)width*height );
+    R_raw = &tmp[0];
+    G_raw = R_raw + (size_t)width*height;
+    B_raw = G_raw + (size_t)width*height;
+  }
+
+  const RGBEDecodeTable table( exposure );
+
+  #pragma omp parallel
+  {
+    std::vector<Trgbe> scanline_buf( width*4 );
+    Trgbe *scanline = &scanline_buf[0];
+
+    #pragma omp for schedule(static)
+    for( int y=0 ; y<height ; y++ )
     {
-      //--- rle scanline
-      //--- each channel is encoded separately
-      for( int ch=0 ; ch<4 ; ch++ )
-	RLERead(file, scanline+width*ch, width);
+      const Trgbe *src = &data[offset[y]];
+      float *R = R_raw + (size_t)y*width;
+      float *G = G_raw + (size_t)y*width;
+      float *B = B_raw + (size_t)y*width;
 
-      //--- write scanline to the image
-      for( int x=0 ; x<width ; x++ )
+      if( isRLEScanline( src, width ) )
       {
-	Trgbe_pixel rgbe;
-	rgbe.r = scanline[x+width*0];
-	rgbe.g = scanline[x+width*1];
-	rgbe.b = scanline[x+width*2];
-	rgbe.e = scanline[x+width*3];
-
-	rgbe2rgb(rgbe, exposure, (*X)(x,y), (*Y)(x,y), (*Z)(x,y));
+        src += 4;
+        for( int ch=0 ; ch<4 ; ch++ )
+          src = RLERead( src, scanline+width*ch, width );
+
+        const Trgbe *r = scanline, *g = scanline+width,
+          *b = scanline+2*width, *e = scanline+3*width;
+        for( int x=0 ; x<width ; x++ )
+        {
+          const double f = table.scale[e[x]];
+          R[x] = (float)(r[x] * f);
+          G[x] = (float)(g[x] * f);
+          B[x] = (float)(b[x] * f);
+        }
+      }
+      else
+      {
+        for( int x=0 ; x<width ; x++ )
+        {
+          const double f = table.scale[src[4*x+3]];
+          R[x] = (float)(src[4*x+0] * f);
+          G[x] = (float)(src[4*x+1] * f);
+          B[x] = (float)(src[4*x+2] * f);
+        }
       }
     }
   }
-  delete[] scanline;
-}
 
+  if( !direct )
+  {
+    const int size = width*height;
+    for( int i=0 ; i<size ; i++ )
+    {
+      (*X)(i) = R_raw[i];
+      (*Y)(i) = G_raw[i];
+      (*Z)(i) = B_raw[i];
+    }
+  }
+}
 
 
 
-int RLEWrite( FILE* file, Trgbe* scanline, int size )
+/**
+ * Run length encode one channel of a scanline into out, which must
+ * have room for size + size/128 + 1 bytes.
+ *
+ * @return number of bytes written
+ */
+static int RLEWrite( const Trgbe* scanline, int size, Trgbe *out )
 {
-  Trgbe* scanend = scanline + size;
+  Trgbe *out_start = out;
+  const Trgbe* scanend = scanline + size;
   while( scanline<scanend )
   {
     int run_start=0;
@@ -350,44 +447,34 @@ int RLEWrite( FILE* file, Trgbe* scanline, int size )
       // write a non run: scanline[0] to scanline[run_start]
       if( run_start>0 )
       {
-	Trgbe* buf = new Trgbe[run_start+1];
-	buf[0] = run_start;
-	for( int i=0 ; i<run_start ; i++ )
-	  buf[i+1] = scanline[i];
-	fwrite(buf, sizeof(Trgbe), run_start+1, file);
-	delete[] buf;
+	*out++ = run_start;
+	memcpy( out, scanline, run_start );
+	out += run_start;
       }
 
       // write a run: scanline[run_start], run_len
-      Trgbe buf[2];
-      buf[0] = 128+run_len;
-      buf[1] = scanline[run_start];
-      fwrite(buf, sizeof(*buf), 2, file);
+      *out++ = 128+run_len;
+      *out++ = scanline[run_start];
     }
     else
     {
       // write a non run: scanline[0] to scanline[peek]
-      Trgbe* buf = new Trgbe[peek+1];
-      buf[0] = peek;
-      for( int i=0 ; i<peek ; i++ )
-	buf[i+1] = scanline[i];
-      fwrite(buf, sizeof(Trgbe), peek+1, file);
-      delete[] buf;
+      *out++ = peek;
+      memcpy( out, scanline, peek );
+      out += peek;
     }
     scanline += peek;
   }
 
-  if( scanline!=scanend )
-  {
-    throw pfs::Exception( "RGBE: difference in size while writing RLE scanline");
-    return -1;
-  }
-
-  return 0;
+  return out - out_start;
 }
 
 
 
+/**
+ * The scanlines are converted and encoded in parallel, each into its
+ * own slot of a buffer. The slots are then packed and written at once.
+ */
 void writeRadiance(FILE *file, pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z, bool radiance_compatibility )
 {
   int width = X->getCols();
@@ -418,42 +505,80 @@ void writeRadiance(FILE *file, pfs::Array2D *X, pfs::Array2D *Y, pfs::Array2D *Z
   // image size
   fprintf(file, "-Y %d +X %d\n", height, width);
 
-  // image run length encoded
-  Trgbe* scanlineR = new Trgbe[width];
-  Trgbe* scanlineG = new Trgbe[width];
-  Trgbe* scanlineB = new Trgbe[width];
-  Trgbe* scanlineE = new Trgbe[width];
+  const float *R_raw = getRawData( X );
+  const float *G_raw = getRawData( Y );
+  const float *B_raw = getRawData( Z );
+  std::vector<float> tmp;
+  if( R_raw == NULL || G_raw == NULL || B_raw == NULL )
+  {
+    const int size = width*height;
+    tmp.resize( 3*(size_t)size );
+    for( int i=0 ; i<size ; i++ )
+    {
+      tmp[i] = (*X)(i);
+      tmp[i+size] = (*Y)(i);
+      tmp[i+2*size] = (*Z)(i);
+    }
+    R_raw = &tmp[0];
+    G_raw = R_raw + size;
+    B_raw = G_raw + size;
+  }
 
-  for( int y=0 ; y<height ; y++ )
+  const float scale = radiance_compatibility ? (float)(1.0/WHITE_EFFICACY) : 1.f;
+
+  // worst case size of an encoded scanline
+  const size_t slot_size = 4 + 4*(size_t)(width + width/128 + 1);
+  std::vector<Trgbe> buffer( slot_size*height );
+  std::vector<size_t> length( height );
+
+  // image run length encoded
+  #pragma omp parallel
   {
-    // write rle header
-    unsigned char header[4];
-    header[0] = 2;
-    header[1] = 2;
-    header[2] = width >> 8;;
-    header[3] = width & 0xFF;
-    fwrite(header, sizeof(header), 1, file);
-
-    // each channel is encoded separately
-    for( int x=0 ; x<width ; x++ )
+    std::vector<Trgbe> scanline_buf( width*4 );
+    Trgbe *scanlineR = &scanline_buf[0];
+    Trgbe *scanlineG = scanlineR + width;
+    Trgbe *scanlineB = scanlineG + width;
+    Trgbe *scanlineE = scanlineB + width;
+
+    #pragma omp for schedule(static)
+    for( int y=0 ; y<height ; y++ )
     {
-      Trgbe_pixel p;
-	  if ( radiance_compatibility )
-		  rgb2rgbe((*X)(x, y) / WHITE_EFFICACY, (*Y)(x, y) / WHITE_EFFICACY, (*Z)(x, y) / WHITE_EFFICACY, p);
-	  else
-		rgb2rgbe((*X)(x, y), (*Y)(x, y), (*Z)(x, y), p);
-	  scanlineR[x] = p.r;
-      scanlineG[x] = p.g;
-      scanlineB[x] = p.b;
-      scanlineE[x] = p.e;
+      const float *R = R_raw + (size_t)y*width;
+      const float *G = G_raw + (size_t)y*width;
+      const float *B = B_raw + (size_t)y*width;
+
+      // each channel is encoded separately
+      if( radiance_compatibility )
+        for( int x=0 ; x<width ; x++ )
+          rgb2rgbe( R[x]*scale, G[x]*scale, B[x]*scale,
+            scanlineR[x], scanlineG[x], scanlineB[x], scanlineE[x] );
+      else
+        for( int x=0 ; x<width ; x++ )
+          rgb2rgbe( R[x], G[x], B[x],
+            scanlineR[x], scanlineG[x], scanlineB[x], scanlineE[x] );
+
+      // rle header
+      Trgbe *out = &buffer[slot_size*y];
+      out[0] = 2;
+      out[1] = 2;
+      out[2] = width >> 8;
+      out[3] = width & 0xFF;
+      size_t len = 4;
+      len += RLEWrite( scanlineR, width, out+len );
+      len += RLEWrite( scanlineG, width, out+len );
+      len += RLEWrite( scanlineB, width, out+len );
+      len += RLEWrite( scanlineE, width, out+len );
+      length[y] = len;
     }
-    RLEWrite(file, scanlineR, width);
-    RLEWrite(file, scanlineG, width);
-    RLEWrite(file, scanlineB, width);
-    RLEWrite(file, scanlineE, width);
   }
-  delete[] scanlineR;
-  delete[] scanlineG;
-  delete[] scanlineB;
-  delete[] scanlineE;
+
+  // pack the scanlines
+  size_t size = length.empty() ? 0 : length[0];
+  for( int y=1 ; y<height ; y++ )
+  {
+    memmove( &buffer[size], &buffer[slot_size*y], length[y] );
+    size += length[y];
+  }
+  if( fwrite( &buffer[0], 1, size, file ) != size )
+    throw pfs::Exception( "RGBE: cannot write the image data" );
 }
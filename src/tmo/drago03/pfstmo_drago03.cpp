@@ -35,11 +35,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#include "tmo_drago03.h"
+#include "tmo_context.h"
 
 #define PROG_NAME "pfstmo_drago03"
 
@@ -61,8 +60,8 @@ void tmo_drago03( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-  float biasValue = 0.85f;
+  //--- tone mapping parameters, checked by the drago03 context
+  pfstmo::Options tmo_options;
 
   //--- process command line args
   bool verbose = false;
@@ -85,60 +84,48 @@ void tmo_drago03( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 'b':
-      biasValue = (float)strtod( optarg, NULL );
-      if( biasValue<0.0f || biasValue>1.0f )
-        throw pfs::Exception("incorrect bias value, accepted range is (0..1)");
-      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  VERBOSE_STR << ": bias: " << biasValue << endl;
-   
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "drago03", 1, 1, tmo_options );
+
+  pfstmo::Context *tmo = NULL;
   while( true ) {
     pfs::Frame *frame = pfsio.readFrame( stdin );
     if( frame == NULL ) break; // No more frames
 
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y == NULL )
       throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
 
+    // buffers are reused for all frames of the same size
     int w = Y->getCols();
     int h = Y->getRows();
-        
-    float maxLum,avLum;
-    calculateLuminance( w, h, Y->getRawData(), avLum, maxLum );
-    VERBOSE_STR << ": maximum luminance: " << maxLum << endl;
-    VERBOSE_STR << ": average luminance: " << avLum << endl;
-
-    pfs::Array2DImpl* L = new pfs::Array2DImpl(w,h);
-    tmo_drago03(w, h, Y->getRawData(), L->getRawData(), maxLum, avLum, biasValue);
-		
-    for( int y=0 ; y<h ; y++ )
-    {
-      for( int x=0 ; x<w ; x++ )
-      {
-        float scale = (*L)(x,y) / (*Y)(x,y);
-        (*Y)(x,y) *= scale;
-        (*X)(x,y) *= scale;
-        (*Z)(x,y) *= scale;
-      }
+    if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "drago03", w, h, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
     }
 
-    delete L;
-    
+    tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
+
     //---
     pfsio.writeFrame( frame, stdout );
     pfsio.freeFrame( frame );        
   }
+  delete tmo;
 }
 
 
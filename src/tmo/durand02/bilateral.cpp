@@ -73,6 +73,11 @@ public:
       scaleFactor = (float)(N-1) / maxVal;
     }
 
+  ~GaussLookup()
+    {
+      delete[] gauss;
+    }
+
   float getValue( float x )
     {
       x = fabs( x );
@@ -99,7 +104,8 @@ void bilateralFilter( const pfstmo::Array2D *I,
 
   for( int y = 0; y < I->getRows(); y++ )
   {
-    progress_cb( y * 100 / I->getRows() );
+    if( progress_cb != NULL )
+      progress_cb( y * 100 / I->getRows() );
     
     for( int x = 0; x < I->getCols(); x++ )
     {
@@ -35,6 +35,8 @@
 #include <math.h>
 
 #include "pfstmo.h"
+#include "fftw_lock.h"
+#include "fastbilateral.h"
 
 
 using namespace std;
@@ -72,11 +74,17 @@ public:
     freq = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * osize);
 //    if( source == NULL || freq == NULL )
     //TODO: throw exception
+    pfstmo::FFTWPlannerLock lock;
     fplan_fw = fftwf_plan_dft_r2c_2d(nx, ny, source, freq, FFTW_ESTIMATE);
     fplan_in = fftwf_plan_dft_c2r_2d(nx, ny, freq, source, FFTW_ESTIMATE);    
   }
 
 
+  void setSigma( float sigma )
+  {
+    this->sigma = sigma;
+  }
+
   void blur( const pfstmo::Array2D *I, pfstmo::Array2D *J )
   {
     int i,x,y;
@@ -121,6 +129,7 @@ public:
   {
     fftwf_free(source); 
     fftwf_free(freq);
+    pfstmo::FFTWPlannerLock lock;
     fftwf_destroy_plan(fplan_fw);
     fftwf_destroy_plan(fplan_in);
   }
@@ -234,7 +243,41 @@ PiecewiseBilateral (Image I, spatial kernel fs , intensity influence gr )
     J=J+Jj .*  InterpolationWeight(I, ij )
 */
 
-void fastBilateralFilter( const pfstmo::Array2D *I,
+FastBilateralFilter::FastBilateralFilter() :
+  gaussian_blur( NULL ), jJ( NULL ), jG( NULL ), jK( NULL ), jH( NULL )
+{
+}
+
+FastBilateralFilter::~FastBilateralFilter()
+{
+  release();
+}
+
+void FastBilateralFilter::release()
+{
+  delete gaussian_blur;
+  delete jJ;
+  delete jG;
+  delete jK;
+  delete jH;
+  gaussian_blur = NULL;
+  jJ = jG = jK = jH = NULL;
+}
+
+void FastBilateralFilter::allocate( int w, int h )
+{
+  if( jJ != NULL && (int)jJ->getCols() == w && (int)jJ->getRows() == h )
+    return;
+  release();
+
+  jJ = new pfstmo::Array2D(w,h);
+  jG = new pfstmo::Array2D(w,h);
+  jK = new pfstmo::Array2D(w,h);
+  jH = new pfstmo::Array2D(w,h);
+  gaussian_blur = new GaussianBlur( w, h, 0 );
+}
+
+void FastBilateralFilter::filter( const pfstmo::Array2D *I,
   pfstmo::Array2D *J, float sigma_s, float sigma_r, int downsample,
   pfstmo_progress_callback progress_cb )
 {
@@ -267,20 +310,17 @@ void fastBilateralFilter( const pfstmo::Array2D *I,
   const pfstmo::Array2D* Iz = I;
 //  sigma_s /= downsample;
   
-  pfstmo::Array2D* jJ = new pfstmo::Array2D(w,h);
-  pfstmo::Array2D* jG = new pfstmo::Array2D(w,h);
-  pfstmo::Array2D* jK = new pfstmo::Array2D(w,h);
-  pfstmo::Array2D* jH = new pfstmo::Array2D(w,h);
+  allocate( w, h );
+  gaussian_blur->setSigma( sigma_s );
 
   const int NB_SEGMENTS = (int)ceil((maxI-minI)/sigma_r);
   float stepI = (maxI-minI)/NB_SEGMENTS;
 
-  GaussianBlur gaussian_blur( w, h, sigma_s );
-
   // piecewise bilateral
   for( int j=0 ; j<NB_SEGMENTS ; j++ )
   {
-    progress_cb( j * 100 / NB_SEGMENTS );
+    if( progress_cb != NULL )
+      progress_cb( j * 100 / NB_SEGMENTS );
     float jI = minI + j*stepI;        // current intensity value
     
     for( i=0 ; i<sizeZ ; i++ )
@@ -290,8 +330,8 @@ void fastBilateralFilter( const pfstmo::Array2D *I,
       (*jH)(i) = (*jG)(i) * (*I)(i);
     }
 
-    gaussian_blur.blur( jG, jK );
-    gaussian_blur.blur( jH, jH );
+    gaussian_blur->blur( jG, jK );
+    gaussian_blur->blur( jH, jH );
     
 //    convolveArray(jG, sigma_s, jK);
 //    convolveArray(jH, sigma_s, jH);
@@ -344,8 +384,12 @@ void fastBilateralFilter( const pfstmo::Array2D *I,
 //  delete Iz;
 //  if( downsample != 1 )
 //    delete JJ;
-  delete jJ;
-  delete jG;
-  delete jK;
-  delete jH;
+}
+
+void fastBilateralFilter( const pfstmo::Array2D *I,
+  pfstmo::Array2D *J, float sigma_s, float sigma_r, int downsample,
+  pfstmo_progress_callback progress_cb )
+{
+  FastBilateralFilter filter;
+  filter.filter( I, J, sigma_s, sigma_r, downsample, progress_cb );
 }
@@ -33,6 +33,38 @@
 
 #include <pfstmo.h>
 
+class GaussianBlur;
+
+/**
+ * @brief Fast bilateral filter that keeps its buffers and FFT plans
+ * between calls
+ *
+ * The buffers are reallocated only when the size of the image changes.
+ */
+class FastBilateralFilter
+{
+public:
+  FastBilateralFilter();
+  ~FastBilateralFilter();
+
+  /**
+   * @brief Filter an image, see fastBilateralFilter()
+   */
+  void filter( const pfstmo::Array2D *I,
+    pfstmo::Array2D *J, float sigma_s, float sigma_r, int downsample,
+    pfstmo_progress_callback progress_cb );
+
+private:
+  GaussianBlur *gaussian_blur;
+  pfstmo::Array2D *jJ, *jG, *jK, *jH;
+
+  void allocate( int w, int h );
+  void release();
+
+  FastBilateralFilter( const FastBilateralFilter& );
+  FastBilateralFilter& operator=( const FastBilateralFilter& );
+};
+
 /**
  * @brief Fast bilateral filtering
  *
@@ -36,12 +36,12 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#include "tmo_durand02.h"
+#include "tmo_context.h"
 
 using namespace std;
 
@@ -82,16 +82,8 @@ void pfstmo_durand02( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-#ifdef HAVE_FFTW3F
-  float sigma_s = 40.0f;
-#else
-  float sigma_s = 8.0f;
-#endif
-  float sigma_r = 0.4f;
-  float baseContrast = 5.0f;
-  int downsample=1;
-  bool original_algorithm = false;
+  //--- tone mapping parameters, checked by the durand02 context
+  pfstmo::Options tmo_options;
 
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
@@ -100,7 +92,6 @@ void pfstmo_durand02( int argc, char* argv[] )
     { "sigma-s", required_argument, NULL, 's' },
     { "sigma-r", required_argument, NULL, 'r' },
     { "base-contrast", required_argument, NULL, 'c' },
-//    { "downsampling", required_argument, NULL, 'z' },
     { "quiet", no_argument, NULL, 'q' },    
     { NULL, 0, NULL, 0 }
   };
@@ -119,46 +110,19 @@ void pfstmo_durand02( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 'g':
-      original_algorithm = true;
-      break;
-    case 's':
-      sigma_s = (float)strtod( optarg, NULL );
-      if( sigma_s<=0.0f )
-        throw pfs::Exception("sigma_s value out of range, should be >0");
-      break;
-    case 'r':
-      sigma_r = (float)strtod( optarg, NULL );
-      if( sigma_r<=0.0f )
-        throw pfs::Exception("sigma_r value out of range, should be >0");
-      break;
-    case 'c':
-      baseContrast = (float)strtod( optarg, NULL );
-      if( baseContrast<=0.0f )
-        throw pfs::Exception("base contrast value out of range, should be >0");
-      break;
-//     case 'z':
-//       downsample = atoi( optarg );
-//       if( downsample<1 || downsample>20 )
-//         throw pfs::Exception("down sampling factor should be in 1:20 range");
-//       break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  VERBOSE_STR << "sigma_s: " << sigma_s << endl;
-  VERBOSE_STR << "sigma_r: " << sigma_r << endl;
-  VERBOSE_STR << "base contrast: " << baseContrast << endl;
-//  VERBOSE_STR << "down sampling factor: " << downsample << endl;
-#ifdef HAVE_FFTW3F
-  VERBOSE_STR << "fast bilateral filtering (fftw3)" << endl;
-#else
-  VERBOSE_STR << "conventional bilateral filtering" << endl;
-#endif
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "durand02", 1, 1, tmo_options );
 
+  pfstmo::Context *tmo = NULL;
   int frame_no = 1;
   while( true )    
   {
@@ -167,7 +131,6 @@ void pfstmo_durand02( int argc, char* argv[] )
 
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y==NULL || X==NULL || Z==NULL)
@@ -187,11 +150,17 @@ void pfstmo_durand02( int argc, char* argv[] )
       strcpy( frame_name, "..." );
       strncpy( frame_name+3, file_name + strlen( file_name ) - len, len+1 );
     }
-    
 
-    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
-    tmo_durand02( w, h, X->getRawData(), Y->getRawData(), Z->getRawData(), sigma_s, sigma_r, baseContrast, downsample, !original_algorithm, progress_report );
-    pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    // buffers are reused for all frames of the same size
+    if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "durand02", w, h, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
+    }
+
+    tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData(), progress_report );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
 
     //---
     pfsio.writeFrame( frame, stdout );
@@ -199,6 +168,7 @@ void pfstmo_durand02( int argc, char* argv[] )
 
     frame_no++;
   }
+  delete tmo;
 }
 
 int main( int argc, char* argv[] )
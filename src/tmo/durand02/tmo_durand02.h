@@ -35,8 +35,47 @@
 #ifndef _tmo_durand02_h_
 #define _tmo_durand02_h_
 
+#include <vector>
+
 #include <pfstmo.h>
 
+class FastBilateralFilter;
+
+/**
+ * @brief Durand02 operator with its working buffers kept between frames
+ *
+ * The intensity and base layers and, if compiled with FFTW, the
+ * buffers and FFT plans of the bilateral filter are reused as long as
+ * consecutive frames have the same size.
+ */
+class Durand02Context
+{
+public:
+  Durand02Context();
+  ~Durand02Context();
+
+  /**
+   * @brief Tone map one frame, see tmo_durand02()
+   */
+  void tonemap( unsigned int width, unsigned int height,
+    float *R, float *G, float *B,
+    float sigma_s, float sigma_r, float baseContrast, int downsample,
+    const bool color_correction = true,
+    pfstmo_progress_callback progress_cb = NULL );
+
+private:
+  pfstmo::Array2D *I;           // intensities
+  pfstmo::Array2D *BASE;        // base layer
+  FastBilateralFilter *fast_bilateral;
+  std::vector<float> sorted;    // for the percentiles of the base layer
+
+  void findMaxMinPercentile( float minPrct, float& minLum,
+    float maxPrct, float& maxLum );
+
+  Durand02Context( const Durand02Context& );
+  Durand02Context& operator=( const Durand02Context& );
+};
+
 /*
  * @brief Fast bilateral filtering
  *
@@ -72,8 +72,8 @@ using namespace std;
 // precision
 #define EPS 1.0e-12
 
-void linbcg(unsigned long n, float b[], float x[], int itol, float tol,
-  int itmax, int *iter, float *err);
+void linbcg(int rows, int cols, float b[], float x[], int itol, float tol,
+  int itmax, int *iter, float *err, float *work);
 
 inline float max( float a, float b )
 {
@@ -314,27 +314,24 @@ void exact_sollution( pfstmo::Array2D *F, pfstmo::Array2D *U )
 //   }
 }
 
-static int rows, cols;
-
-inline int idx( int r, int c )
+inline int idx( int r, int c, int cols )
 {
   return r*cols+c+1;
 }
 
 // smooth u using f at level
-void smooth( pfstmo::Array2D *U, pfstmo::Array2D *F )
+// work is the scratch of linbcg, 6*(n+1) floats
+void smooth( pfstmo::Array2D *U, pfstmo::Array2D *F, float *work )
 {
 //   DEBUG_STR << "smooth" << endl;
   
-  rows = U->getRows();
-  cols = U->getCols();
+  const int rows = U->getRows();
+  const int cols = U->getCols();
   
-  const int n = rows*cols;
-
   int iter;
   float err;
         
-  linbcg( n, F->getRawData()-1, U->getRawData()-1, 1, BCG_TOL, BCG_STEPS, &iter, &err);
+  linbcg( rows, cols, F->getRawData()-1, U->getRawData()-1, 1, BCG_TOL, BCG_STEPS, &iter, &err, work);
 
 //   fprintf( stderr, "." );
 
@@ -409,20 +406,43 @@ void add_correction( pfstmo::Array2D *U, pfstmo::Array2D *C )
 }
 
 
-void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
+PDEMultigridSolver::PDEMultigridSolver() :
+  xmax(0), ymax(0), levels(0)
 {
-  int xmax = F->getCols();
-  int ymax = F->getRows();
-  
-  int i;	// index for simple loops
-  int k;	// index for iterating through levels
-  int k2;	// index for iterating through levels in V-cycles
-  int x,y;
+}
+
+PDEMultigridSolver::~PDEMultigridSolver()
+{
+  release();
+}
 
-  // 1. restrict f to coarse-grid (by the way count the number of levels)
+void PDEMultigridSolver::release()
+{
+  for( size_t k=0 ; k<IU.size() ; k++ ) {
+    if( k>0 )
+      delete RHS[k];
+    delete IU[k];
+    delete VF[k];
+    delete T[k];
+  }
+  RHS.clear();
+  IU.clear();
+  VF.clear();
+  T.clear();
+}
+
+void PDEMultigridSolver::allocate( int w, int h )
+{
+  if( !IU.empty() && w==xmax && h==ymax )
+    return;
+  release();
+  xmax = w;
+  ymax = h;
+
+  // 1. count the number of levels
   //	  k=0: fine-grid = f
   //	  k=levels: coarsest-grid
-  int levels = 0;
+  levels = 0;
   int mins = (xmax<ymax) ? xmax : ymax;
   while( mins>=MINS )
   {
@@ -431,35 +451,51 @@ void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
   }
 
   // given function f restricted on levels
-  pfstmo::Array2D** RHS = new pfstmo::Array2D*[levels+1];
-
+  RHS.resize(levels+1);
   // approximate initial sollutions on levels
-  pfstmo::Array2D** IU = new pfstmo::Array2D*[levels+1];
+  IU.resize(levels+1);
   // target functions in cycles (approximate sollution error (uh - ~uh) )
-  pfstmo::Array2D** VF = new pfstmo::Array2D*[levels+1];
-
-  VF[0] = new pfstmo::Array2D(xmax,ymax);
-  RHS[0] = F;
-  IU[0] = new pfstmo::Array2D(xmax,ymax);
-  pfstmo::copyArray( U, IU[0] );
+  VF.resize(levels+1);
+  // defect and correction at levels
+  T.resize(levels+1);
 
   int sx=xmax;
   int sy=ymax;
-  DEBUG_STR << "FMG: #0 size " << sx << "x" << sy << endl;
-  for( k=0 ; k<levels ; k++ )
+  for( int k=0 ; k<=levels ; k++ )
   {
+    RHS[k] = k==0 ? NULL : new pfstmo::Array2D(sx,sy);  // RHS[0] is F
+    IU[k] = new pfstmo::Array2D(sx,sy);
+    VF[k] = new pfstmo::Array2D(sx,sy);
+    T[k] = new pfstmo::Array2D(sx,sy);
+
     // calculate size of next level
     sx=sx/2+MODYF;
     sy=sy/2+MODYF;
-    
-    RHS[k+1] = new pfstmo::Array2D(sx,sy);
-    IU[k+1] = new pfstmo::Array2D(sx,sy);
-    VF[k+1] = new pfstmo::Array2D(sx,sy);
+  }
+
+  // scratch of the smoother, sized for the finest level
+  work.resize( 6*(xmax*ymax+1) );
+}
+
+void PDEMultigridSolver::solve( pfstmo::Array2D *F, pfstmo::Array2D *U )
+{
+  allocate( F->getCols(), F->getRows() );
+
+  int i;	// index for simple loops
+  int k;	// index for iterating through levels
+  int k2;	// index for iterating through levels in V-cycles
 
+  // 1. restrict f to coarse-grid
+  RHS[0] = F;
+  pfstmo::copyArray( U, IU[0] );
+
+  DEBUG_STR << "FMG: #0 size " << xmax << "x" << ymax << endl;
+  for( k=0 ; k<levels ; k++ )
+  {
     // restrict from level k to level k+1 (coarser-grid)
     restrict( RHS[k], RHS[k+1] );
 
-    DEBUG_STR << "FMG: #" << k+1 << " size " << sx << "x" << sy << endl;
+    DEBUG_STR << "FMG: #" << k+1 << " size " << RHS[k+1]->getCols() << "x" << RHS[k+1]->getRows() << endl;
   }
 
   // 2. find exact sollution at the coarsest-grid (k=levels)
@@ -491,17 +527,16 @@ void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
 //        fprintf( stderr, "Level: %d --------\n", k2 );
         
 	for( i=0 ; i<SMOOTH_IT ; i++ )
-          smooth( IU[k2], VF[k2] );
+          smooth( IU[k2], VF[k2], &work[0] );
 
         // 8. calculate defect at level
         //    d[k2] = Lh * ~u[k2] - f[k2]
-        pfstmo::Array2D* D = new pfstmo::Array2D(IU[k2]->getCols(), IU[k2]->getRows());
+        pfstmo::Array2D* D = T[k2];
 	calculate_defect( D, IU[k2], VF[k2] );
 
         // 9. restrict deffect as target function for next coarser-grid
         //    def -> f[k2+1]
 	restrict( D, VF[k2+1] );
-	delete D;
       }
 
       // 10. solve on coarsest-grid (target function is the deffect)
@@ -514,18 +549,17 @@ void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
       {
         // 12. interpolate correction from last coarser-grid to finer-grid
         //     iu[k2+1] -> cor
-        pfstmo::Array2D* C = new pfstmo::Array2D(IU[k2]->getCols(), IU[k2]->getRows());
+        pfstmo::Array2D* C = T[k2];
 	prolongate( IU[k2+1], C );
 
         // 13. add interpolated correction to initial sollution at level k2
 	add_correction( IU[k2], C );
-	delete C;
 
 //        fprintf( stderr, "Level: %d --------\n", k2 );
         
         // 14. post-smoothing of current sollution using target function
 	for( i=0 ; i<SMOOTH_IT ; i++ )
-          smooth( IU[k2], VF[k2] );
+          smooth( IU[k2], VF[k2], &work[0] );
       }
 
     } //--- end of V-cycle
@@ -535,16 +569,6 @@ void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
   // 15. final sollution
   //     IU[0] contains the final sollution
 
-//   for( k=0 ; k<levels ; k++ ) {
-//     char name[200];
-//     sprintf( name, "u_%d.pfs", k );
-//     dumpPFS( name, IU[k], "Y" );
-//     sprintf( name, "rh_%d.pfs", k );
-//     dumpPFS( name, RHS[k], "Y" );
-//     sprintf( name, "v_%d.pfs", k );
-//     dumpPFS( name, VF[k], "Y" );
-//   }  
-
   pfstmo::copyArray( IU[0], U );
 
   // further improvement of the solution
@@ -554,29 +578,23 @@ void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
     float err;
     DEBUG_STR << "FMG: cg post improving ..., maxiter=" << BCG_POST_STEPS;
     DEBUG_STR << ", tol=" << BCG_POST_TOL << std::endl;
-    linbcg( xmax*ymax, F->getRawData()-1, U->getRawData()-1, 1,
-               BCG_POST_TOL, BCG_POST_STEPS, &iter, &err);
+    linbcg( ymax, xmax, F->getRawData()-1, U->getRawData()-1, 1,
+               BCG_POST_TOL, BCG_POST_STEPS, &iter, &err, &work[0]);
     DEBUG_STR << "FMG: cg post improvement: iter=" << iter << ", err=" << err;
     DEBUG_STR << std::endl;
   }
 
-
-  delete VF[0];
-  delete IU[0];
-
-  for( k=1 ; k<=levels ; k++ ) {
-    delete RHS[k];
-    delete IU[k];
-    delete VF[k];
-  }
-
-  delete[] RHS;
-  delete[] IU;
-  delete[] VF;
+  RHS[0] = NULL;
 
   DEBUG_STR << "FMG: solved\n";
 }
 
+void solve_pde_multigrid( pfstmo::Array2D *F, pfstmo::Array2D *U )
+{
+  PDEMultigridSolver solver;
+  solver.solve( F, U );
+}
+
 
 
 
@@ -648,40 +666,40 @@ void solve_pde_sor( pfstmo::Array2D *F, pfstmo::Array2D *U, int maxits)
 
 //#define EPS 1.0e-14
 
-void asolve(unsigned long n, float b[], float x[], int itrnsp)
+void asolve(int rows, int cols, float b[], float x[], int itrnsp)
 {
     for( int r = 0; r < rows; r++ )
       for( int c = 0; c < cols; c++ ) {
-        x[idx(r,c)] = -4 * b[idx(r,c)];
+        x[idx(r,c,cols)] = -4 * b[idx(r,c,cols)];
       }
 }
 
-void atimes(unsigned long n, float x[], float res[], int itrnsp)
+void atimes(int rows, int cols, float x[], float res[], int itrnsp)
 {
   for( int r = 1; r < rows-1; r++ )
     for( int c = 1; c < cols-1; c++ ) {
-      res[idx(r,c)] = x[idx(r-1,c)] + x[idx(r+1,c)] +
-        x[idx(r,c-1)] + x[idx(r,c+1)] - 4*x[idx(r,c)];
+      res[idx(r,c,cols)] = x[idx(r-1,c,cols)] + x[idx(r+1,c,cols)] +
+        x[idx(r,c-1,cols)] + x[idx(r,c+1,cols)] - 4*x[idx(r,c,cols)];
     }        
 
   for( int r = 1; r < rows-1; r++ ) {
-    res[idx(r,0)] = x[idx(r-1,0)] + x[idx(r+1,0)] +
-        x[idx(r,1)] - 3*x[idx(r,0)];
-    res[idx(r,cols-1)] = x[idx(r-1,cols-1)] + x[idx(r+1,cols-1)] +
-        x[idx(r,cols-2)] - 3*x[idx(r,cols-1)];
+    res[idx(r,0,cols)] = x[idx(r-1,0,cols)] + x[idx(r+1,0,cols)] +
+        x[idx(r,1,cols)] - 3*x[idx(r,0,cols)];
+    res[idx(r,cols-1,cols)] = x[idx(r-1,cols-1,cols)] + x[idx(r+1,cols-1,cols)] +
+        x[idx(r,cols-2,cols)] - 3*x[idx(r,cols-1,cols)];
   }
   
   for( int c = 1; c < cols-1; c++ ) {
-    res[idx(0,c)] = x[idx(1,c)] +
-        x[idx(0,c-1)] + x[idx(0,c+1)] - 3*x[idx(0,c)];
-    res[idx(rows-1,c)] = x[idx(rows-2,c)] +
-        x[idx(rows-1,c-1)] + x[idx(rows-1,c+1)] - 3*x[idx(rows-1,c)];
+    res[idx(0,c,cols)] = x[idx(1,c,cols)] +
+        x[idx(0,c-1,cols)] + x[idx(0,c+1,cols)] - 3*x[idx(0,c,cols)];
+    res[idx(rows-1,c,cols)] = x[idx(rows-2,c,cols)] +
+        x[idx(rows-1,c-1,cols)] + x[idx(rows-1,c+1,cols)] - 3*x[idx(rows-1,c,cols)];
   }
-  res[idx(0,0)] = x[idx(1,0)] + x[idx(0,1)] - 2*x[idx(0,0)];
-  res[idx(rows-1,0)] = x[idx(rows-2,0)] + x[idx(rows-1,1)] - 2*x[idx(rows-1,0)];
-  res[idx(0,cols-1)] = x[idx(1,cols-1)] + x[idx(0,cols-2)] - 2*x[idx(0,cols-1)];
-  res[idx(rows-1,cols-1)] = x[idx(rows-2,cols-1)] + x[idx(rows-1,cols-2)]
-    - 2*x[idx(rows-1,cols-1)];  
+  res[idx(0,0,cols)] = x[idx(1,0,cols)] + x[idx(0,1,cols)] - 2*x[idx(0,0,cols)];
+  res[idx(rows-1,0,cols)] = x[idx(rows-2,0,cols)] + x[idx(rows-1,1,cols)] - 2*x[idx(rows-1,0,cols)];
+  res[idx(0,cols-1,cols)] = x[idx(1,cols-1,cols)] + x[idx(0,cols-2,cols)] - 2*x[idx(0,cols-1,cols)];
+  res[idx(rows-1,cols-1,cols)] = x[idx(rows-2,cols-1,cols)] + x[idx(rows-1,cols-2,cols)]
+    - 2*x[idx(rows-1,cols-1,cols)];  
 }
 
 float snrm(unsigned long n, float sx[], int itol)
@@ -705,45 +723,48 @@ float snrm(unsigned long n, float sx[], int itol)
 /**
  * Biconjugate Gradient Method
  * from Numerical Recipes in C
+ *
+ * work is the scratch of the method, 6*(rows*cols+1) floats
  */
-void linbcg(unsigned long n, float b[], float x[], int itol, float tol,	int itmax, int *iter, float *err)
+void linbcg(int rows, int cols, float b[], float x[], int itol, float tol,	int itmax, int *iter, float *err, float *work)
 {	
+	const unsigned long n=rows*cols;
 	unsigned long j;
 	float ak,akden,bk,bkden,bknum,bnrm,dxnrm,xnrm,zm1nrm,znrm;
 	float *p,*pp,*r,*rr,*z,*zz;
 
-	p=new float[n+1];
-	pp=new float[n+1];
-	r=new float[n+1];
-	rr=new float[n+1];
-	z=new float[n+1];
-	zz=new float[n+1];
+	p=work;
+	pp=p+n+1;
+	r=pp+n+1;
+	rr=r+n+1;
+	z=rr+n+1;
+	zz=z+n+1;
 
 	*iter=0;
-	atimes(n,x,r,0);
+	atimes(rows,cols,x,r,0);
 	for (j=1;j<=n;j++) {
 		r[j]=b[j]-r[j];
 		rr[j]=r[j];
 	}
-	atimes(n,r,rr,0);       // minimum residual
+	atimes(rows,cols,r,rr,0);       // minimum residual
         znrm=1.0;
 	if (itol == 1) bnrm=snrm(n,b,itol);
 	else if (itol == 2) {
-		asolve(n,b,z,0);
+		asolve(rows,cols,b,z,0);
 		bnrm=snrm(n,z,itol);
 	}
 	else if (itol == 3 || itol == 4) {
-		asolve(n,b,z,0);
+		asolve(rows,cols,b,z,0);
 		bnrm=snrm(n,z,itol);
-		asolve(n,r,z,0);
+		asolve(rows,cols,r,z,0);
 		znrm=snrm(n,z,itol);
 	} else printf("illegal itol in linbcg");
-	asolve(n,r,z,0);        
+	asolve(rows,cols,r,z,0);        
 
 	while (*iter <= itmax) {
 		++(*iter);
 		zm1nrm=znrm;
-		asolve(n,rr,zz,1);
+		asolve(rows,cols,rr,zz,1);
 		for (bknum=0.0,j=1;j<=n;j++) bknum += z[j]*rr[j];
 		if (*iter == 1) {
 			for (j=1;j<=n;j++) {
@@ -759,16 +780,16 @@ void linbcg(unsigned long n, float b[], float x[], int itol, float tol,	int itma
 			}
 		}                
 		bkden=bknum;
-		atimes(n,p,z,0);
+		atimes(rows,cols,p,z,0);
 		for (akden=0.0,j=1;j<=n;j++) akden += z[j]*pp[j];
 		ak=bknum/akden;
-		atimes(n,pp,zz,1);
+		atimes(rows,cols,pp,zz,1);
 		for (j=1;j<=n;j++) {
 			x[j] += ak*p[j];
 			r[j] -= ak*z[j];
 			rr[j] -= ak*zz[j];
 		}
-		asolve(n,r,z,0);
+		asolve(rows,cols,r,z,0);
 		if (itol == 1 || itol == 2) {
 			znrm=1.0;
 			*err=snrm(n,r,itol)/bnrm;
@@ -791,13 +812,6 @@ void linbcg(unsigned long n, float b[], float x[], int itol, float tol,	int itma
 //		fprintf( stderr, "iter=%4d err=%12.6f\n",*iter,*err);
 	if (*err <= tol) break;
 	}
-
-	delete [] p;
-	delete [] pp;
-	delete [] r;
-	delete [] rr;
-	delete [] z;
-	delete [] zz;
 }
 //#undef EPS
 
@@ -32,8 +32,12 @@
 #ifndef _fmg_pde_h_
 #define _fmg_pde_h_
 
+#include <vector>
+
 #include "pfstmo.h"
 
+struct fftw_plan_s;
+
 /// limit of iterations for successive overrelaxation
 #define SOR_MAXITS 5001
 
@@ -45,6 +49,38 @@
  */
 void solve_pde_multigrid(pfstmo::Array2D *F, pfstmo::Array2D *U);
 
+/**
+ * @brief Full multigrid solver keeping its levels between the calls
+ *
+ * The levels and the scratch of the smoother are reallocated only when
+ * the size of F changes.
+ */
+class PDEMultigridSolver
+{
+public:
+  PDEMultigridSolver();
+  ~PDEMultigridSolver();
+
+  /**
+   * @brief solve pde using full multrigrid algorithm
+   *
+   * @param F array with divergence
+   * @param U [in] initial guess, [out] solution
+   */
+  void solve(pfstmo::Array2D *F, pfstmo::Array2D *U);
+
+private:
+  int xmax, ymax, levels;
+  std::vector<pfstmo::Array2D*> RHS, IU, VF, T;
+  std::vector<float> work;
+
+  void allocate(int xmax, int ymax);
+  void release();
+
+  PDEMultigridSolver(const PDEMultigridSolver&);
+  PDEMultigridSolver& operator=(const PDEMultigridSolver&);
+};
+
 /**
  * @brief solve pde using successive overrelaxation
  *
@@ -64,6 +100,40 @@ void solve_pde_sor(pfstmo::Array2D *F, pfstmo::Array2D *U, int maxits=SOR_MAXITS
  */
 void solve_pde_fft(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound=false);
 
+/**
+ * @brief Discrete cosine transform solver keeping its buffers and plans
+ *
+ * The buffers and the fftw plans are recreated only when the size of F
+ * changes.
+ */
+class PDEFFTSolver
+{
+public:
+  PDEFFTSolver();
+  ~PDEFFTSolver();
+
+  /**
+   * @brief solve poisson pde (Laplace U = F) using discrete cosine transform
+   *
+   * @param F array of the right hand side (contains div G in this example)
+   * @param U [out] solution
+   * @param adjust_bound, adjust boundary values of F to make pde solvable 
+   */
+  void solve(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound=false);
+
+private:
+  int width, height;
+  pfstmo::Array2Dd *Fd, *F_tr, *U_tr, *Ud;
+  std::vector<double> l1, l2;
+  fftw_plan_s *normal2ev, *ev2normal;
+
+  void allocate(int width, int height);
+  void release();
+
+  PDEFFTSolver(const PDEFFTSolver&);
+  PDEFFTSolver& operator=(const PDEFFTSolver&);
+};
+
 /**
  * @brief returns the residual error of the solution U, ie norm(Laplace U - F) 
  *
@@ -47,6 +47,7 @@
 #include <config.h>
 
 #include "pde.h"
+#include "fftw_lock.h"
 
 using namespace std;
 
@@ -56,9 +57,34 @@ using namespace std;
 #endif
 
 
-// returns T = EVy A EVx^tr
+// creates the plan of the 2d discrete cosine transform used by both
+// transforms below; planning is serialized as the fftw planner is not
+// thread-safe, fftw_plan_with_nthreads() included
+static fftw_plan plan_dct(pfstmo::Array2Dd *A, pfstmo::Array2Dd *T)
+{
+  static bool threads_initialized = false;
+  pfstmo::FFTWPlannerLock lock;
+  if( !threads_initialized )
+  {
+    fftw_init_threads();
+    threads_initialized = true;
+  }
+  // activate parallel execution of fft routines
+  fftw_plan_with_nthreads(omp_get_max_threads());
+  return fftw_plan_r2r_2d(A->getRows(), A->getCols(), A->getRawData(), T->getRawData(),
+                          FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
+}
+
+static void destroy_plan(fftw_plan p)
+{
+  pfstmo::FFTWPlannerLock lock;
+  fftw_destroy_plan(p);
+}
+
+
+// returns T = EVy A EVx^tr, p is the plan_dct() of A and T
 // note, modifies input data
-void transform_ev2normal(pfstmo::Array2Dd *A, pfstmo::Array2Dd *T)
+void transform_ev2normal(pfstmo::Array2Dd *A, pfstmo::Array2Dd *T, fftw_plan p)
 {
   int width = A->getCols();
   int height = A->getRows();
@@ -91,27 +117,19 @@ void transform_ev2normal(pfstmo::Array2Dd *A, pfstmo::Array2Dd *T)
   // fftw_free(in);
 
   // executes 2d discrete cosine transform
-  fftw_plan p;
-  p=fftw_plan_r2r_2d(height, width, A->getRawData(), T->getRawData(),
-                        FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
   fftw_execute(p); 
-  fftw_destroy_plan(p);
 }
 
 
-// returns T = EVy^-1 * A * (EVx^-1)^tr
-void transform_normal2ev(pfstmo::Array2Dd *A, pfstmo::Array2Dd *T)
+// returns T = EVy^-1 * A * (EVx^-1)^tr, p is the plan_dct() of A and T
+void transform_normal2ev(pfstmo::Array2Dd *A, pfstmo::Array2Dd *T, fftw_plan p)
 {
   int width = A->getCols();
   int height = A->getRows();
   assert((int)T->getCols()==width && (int)T->getRows()==height);
 
   // executes 2d discrete cosine transform
-  fftw_plan p;
-  p=fftw_plan_r2r_2d(height, width, A->getRawData(), T->getRawData(),
-                        FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
   fftw_execute(p); 
-  fftw_destroy_plan(p);
 
   // need to scale the output matrix to get the right transform
   for(int y=0 ; y<height ; y++ )
@@ -184,19 +202,21 @@ void make_compatible_boundary(pfstmo::Array2Dd *F)
 // the equation has a solution, if adjust_bound is set to false then F is
 // not modified and the equation might not have a solution but an
 // approximate solution with a minimum error is then calculated
-// double precision version
+// F_tr and U_tr are buffers of the size of F, normal2ev and ev2normal
+// the plan_dct() of (F,F_tr) and (U_tr,U), l1 and l2 the eigenvalues
+// from get_lambda()
 // note, input data F might be modified
-void solve_pde_fft(pfstmo::Array2Dd *F, pfstmo::Array2Dd *U, bool adjust_bound)
+static void solve_pde_fft(pfstmo::Array2Dd *F, pfstmo::Array2Dd *U,
+                          pfstmo::Array2Dd *F_tr, pfstmo::Array2Dd *U_tr,
+                          fftw_plan normal2ev, fftw_plan ev2normal,
+                          const std::vector<double>& l1, const std::vector<double>& l2,
+                          bool adjust_bound)
 {
   DEBUG_STR << "solve_pde_fft: solving Laplace U = F ..." << std::endl;
   int width = F->getCols();
   int height = F->getRows();
   assert((int)U->getCols()==width && (int)U->getRows()==height);
 
-  // activate parallel execution of fft routines
-  fftw_init_threads();
-  fftw_plan_with_nthreads(omp_get_max_threads());
-
   // in general there might not be a solution to the Poisson pde
   // with Neumann boundary conditions unless the boundary satisfies
   // an integral condition, this function modifies the boundary so that
@@ -209,17 +229,12 @@ void solve_pde_fft(pfstmo::Array2Dd *F, pfstmo::Array2Dd *U, bool adjust_bound)
 
   // transforms F into eigenvector space: Ftr = 
   DEBUG_STR << "solve_pde_fft: transform F to ev space (fft)" << std::endl;
-  pfstmo::Array2Dd* F_tr = new pfstmo::Array2Dd(width,height);
-  transform_normal2ev(F, F_tr);
-  F->allocate(1,1);       // no longer needed so release memory (better not?)
+  transform_normal2ev(F, F_tr, normal2ev);
   DEBUG_STR << "solve_pde_fft: F_tr(0,0) = " << (*F_tr)(0,0);
   DEBUG_STR << " (must be 0 for solution to exist)" << std::endl;
 
   // in the eigenvector space the solution is very simple
   DEBUG_STR << "solve_pde_fft: solve in eigenvector space" << std::endl;
-  pfstmo::Array2Dd* U_tr = new pfstmo::Array2Dd(width,height);
-  std::vector<double> l1=get_lambda(height);
-  std::vector<double> l2=get_lambda(width);
   for(int y=0 ; y<height ; y++ )
     for(int x=0 ; x<width ; x++ )
     {
@@ -228,13 +243,10 @@ void solve_pde_fft(pfstmo::Array2Dd *F, pfstmo::Array2Dd *U, bool adjust_bound)
       else
         (*U_tr)(x,y)=(*F_tr)(x,y)/(l1[y]+l2[x]);
     }
-  delete F_tr;    // no longer needed so release memory
-
 
   // transforms U_tr back to the normal space
   DEBUG_STR << "solve_pde_fft: transform U_tr to normal space (fft)" << std::endl;
-  transform_ev2normal(U_tr, U);
-  delete U_tr;    // no longer needed so release memory
+  transform_ev2normal(U_tr, U, ev2normal);
 
   // the solution U as calculated will satisfy something like int U = 0
   // since for any constant c, U-c is also a solution and we are mainly
@@ -258,28 +270,102 @@ void solve_pde_fft(pfstmo::Array2Dd *F, pfstmo::Array2Dd *U, bool adjust_bound)
   DEBUG_STR << "solve_pde_fft: done" << std::endl;
 }
 
-// solves Laplace U = F
-// single precision version (right now simply calls the double prec version)
-void solve_pde_fft(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound)
+// double precision version, plans the transforms for this call only
+// note, input data F might be modified
+void solve_pde_fft(pfstmo::Array2Dd *F, pfstmo::Array2Dd *U, bool adjust_bound)
 {
   int width = F->getCols();
   int height = F->getRows();
-  assert((int)U->getCols()==width && (int)U->getRows()==height);
 
-  pfstmo::Array2Dd* Fd = new pfstmo::Array2Dd(width,height);
-  pfstmo::Array2Dd* Ud = new pfstmo::Array2Dd(width,height);
+  pfstmo::Array2Dd F_tr(width,height);
+  pfstmo::Array2Dd U_tr(width,height);
+  fftw_plan normal2ev=plan_dct(F, &F_tr);
+  fftw_plan ev2normal=plan_dct(&U_tr, U);
+
+  solve_pde_fft(F, U, &F_tr, &U_tr, normal2ev, ev2normal,
+                get_lambda(height), get_lambda(width), adjust_bound);
+
+  destroy_plan(normal2ev);
+  destroy_plan(ev2normal);
+}
+
+
+PDEFFTSolver::PDEFFTSolver() :
+  width(0), height(0), Fd(NULL), F_tr(NULL), U_tr(NULL), Ud(NULL),
+  normal2ev(NULL), ev2normal(NULL)
+{
+}
+
+PDEFFTSolver::~PDEFFTSolver()
+{
+  release();
+}
+
+void PDEFFTSolver::allocate(int w, int h)
+{
+  if( Fd!=NULL && w==width && h==height )
+    return;
+  release();
+  width = w;
+  height = h;
+
+  Fd = new pfstmo::Array2Dd(width,height);
+  F_tr = new pfstmo::Array2Dd(width,height);
+  U_tr = new pfstmo::Array2Dd(width,height);
+  Ud = new pfstmo::Array2Dd(width,height);
+  l1 = get_lambda(height);
+  l2 = get_lambda(width);
+
+  // the plans stay bound to the buffers above until the size changes
+  normal2ev = plan_dct(Fd, F_tr);
+  ev2normal = plan_dct(U_tr, Ud);
+}
+
+void PDEFFTSolver::release()
+{
+  if( normal2ev!=NULL )
+    destroy_plan(normal2ev);
+  if( ev2normal!=NULL )
+    destroy_plan(ev2normal);
+  normal2ev = ev2normal = NULL;
+
+  delete Fd;
+  delete F_tr;
+  delete U_tr;
+  delete Ud;
+  Fd = F_tr = U_tr = Ud = NULL;
+}
+
+// solves Laplace U = F
+// single precision version (internally uses double precision)
+void PDEFFTSolver::solve(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound)
+{
+  int w = F->getCols();
+  int h = F->getRows();
+  assert((int)U->getCols()==w && (int)U->getRows()==h);
+
+  allocate(w, h);
 
   // convert float array to double array
-  for(int i=0; i<width*height; i++)
+  for(int i=0; i<w*h; i++)
     (*Fd)(i)=(*F)(i);
 
-  solve_pde_fft(Fd,Ud,adjust_bound);
+  solve_pde_fft(Fd, Ud, F_tr, U_tr, normal2ev, ev2normal, l1, l2, adjust_bound);
 
-  // convert float array to double array
-  for(int i=0; i<width*height; i++)
+  // convert double array to float array
+  for(int i=0; i<w*h; i++)
     (*U)(i)=(*Ud)(i);
 }
 
+// solves Laplace U = F
+// single precision version, the buffers and plans are released on return
+void solve_pde_fft(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound)
+{
+  PDEFFTSolver solver;
+  solver.solve(F, U, adjust_bound);
+}
+
+
 // ---------------------------------------------------------------------
 // the functions below are only for test purposes to check the accuracy
 // of the pde solvers
@@ -37,11 +37,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#include "tmo_fattal02.h"
+#include "tmo_context.h"
 
 using namespace std;
 
@@ -72,23 +71,9 @@ void pfstmo_fattal02( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-  float opt_alpha = 1.0f;
-  float opt_beta = 0.9f;
-  float opt_gamma = -1.0f;    // not set (0.8 for fft solver, 1.0 otherwise)
-  float opt_saturation=0.8f;
-  float opt_noise = -1.0f;    // not set 
-  int   opt_detail_level=-1;  // not set (2 for fft solver, 0 otherwise)
-  float opt_black_point=0.1f;
-  float opt_white_point=0.5f;
+  //--- tone mapping parameters, checked by the fattal02 context
+  pfstmo::Options tmo_options;
 
-  // Use multigrid if FFTW lib not available
-#if !defined(HAVE_FFTW3) || !defined(HAVE_OpenMP)
-  bool  opt_fftsolver=false;
-#else  
-  bool  opt_fftsolver=true;
-#endif
-  
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "verbose", no_argument, NULL, 'v' },
@@ -100,7 +85,7 @@ void pfstmo_fattal02( int argc, char* argv[] )
     { "noise", required_argument, NULL, 'n' },
     { "detail-level", required_argument, NULL, 'd' },
     { "white-point", required_argument, NULL, 'w' },
-    { "black-point", required_argument, NULL, 'l' },
+    { "black-point", required_argument, NULL, 'k' },
     { NULL, 0, NULL, 0 }
   };
 
@@ -115,87 +100,19 @@ void pfstmo_fattal02( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 'm':
-      opt_fftsolver = false;
-      break;
-    case 'a':
-      opt_alpha = (float)strtod( optarg, NULL );
-      if( opt_alpha<=0.0f )
-        throw pfs::Exception("alpha value out of range, should be >0");
-      break;
-    case 'b':
-      opt_beta = (float)strtod( optarg, NULL );
-      if( opt_beta<=0.0f )
-        throw pfs::Exception("beta value out of range, should be >0");
-      break;
-    case 'g':
-      opt_gamma = (float)strtod( optarg, NULL );
-      if( opt_gamma<=0.0f || opt_gamma>=10.0 )
-        throw pfs::Exception("gamma value out of range, should be >0");
-      break;
-    case 's':
-      opt_saturation = (float)strtod( optarg, NULL );
-      if( opt_saturation<=0.0f || opt_saturation>1.0f )
-        throw pfs::Exception("saturation value out of range, should be 0..1");
-      break;
-    case 'n':
-      opt_noise = (float)strtod( optarg, NULL );
-      if( opt_noise<0.0f )
-        throw pfs::Exception("noise level value out of range, should be >=0");
-      break;
-    case 'd':
-      opt_detail_level = (int) strtod( optarg, NULL );
-      if( opt_detail_level<0 || opt_detail_level>9 )
-        throw pfs::Exception("detail-level value out of range, should be 0..9");
-      break;
-    case 'w':
-      opt_white_point = (float)strtod( optarg, NULL );
-      if( opt_white_point<0.0f || opt_white_point>=50.0f )
-        throw pfs::Exception("white-point value out of range, should be 0..50");
-      break;
-    case 'k':
-      opt_black_point = (float)strtod( optarg, NULL );
-      if( opt_black_point<0.0f || opt_black_point>=50.0f )
-        throw pfs::Exception("black-point value out of range, should be 0..50");
-      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  if( opt_fftsolver ) {
-    // Default params for the fftsolver
-    if(opt_detail_level==-1)
-      opt_detail_level=3;     // 2 for low res, 3 is better for high res
-    if(opt_gamma==-1.0f)
-      opt_gamma=0.8f;
-    if(opt_noise==-1.0f)
-      opt_noise=0.002f;
-  }
-
-  
-  // adjust noise floor if not set by user
-  if( opt_noise<0.0f )
-    opt_noise = opt_alpha*0.01;
-  // set gamma and detail level to default values which produce the
-  // same output as older programme versions using the multi-level pde solver
-  if(opt_detail_level==-1)
-    opt_detail_level=0;
-  if(opt_gamma==-1.0f)
-    opt_gamma=1.0f;
-
-  VERBOSE_STR << "threshold gradient (alpha): " << opt_alpha << endl;
-  VERBOSE_STR << "strengh of modification (beta): " << opt_beta << endl;
-  VERBOSE_STR << "gamma: " << opt_gamma << endl;
-  VERBOSE_STR << "noise floor: " << opt_noise << endl;  
-  VERBOSE_STR << "saturation: " << opt_saturation << endl;
-  VERBOSE_STR << "detail level: " << opt_detail_level << endl;
-  VERBOSE_STR << "white point: " << opt_white_point << "%" << endl;
-  VERBOSE_STR << "black point: " << opt_black_point << "%" << endl;
-  VERBOSE_STR << "use fft pde solver: " << opt_fftsolver << endl;
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "fattal02", 1, 1, tmo_options );
 
+  pfstmo::Context *tmo = NULL;
   while( true ) 
   {
     pfs::Frame *frame = pfsio.readFrame( stdin );
@@ -203,47 +120,29 @@ void pfstmo_fattal02( int argc, char* argv[] )
 
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y==NULL || X==NULL || Z==NULL)
       throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
         
-    // tone mapping
+    // buffers are reused for all frames of the same size
     int w = Y->getCols();
     int h = Y->getRows();
-
-    pfs::Array2DImpl* L = new pfs::Array2DImpl(w,h);
-    tmo_fattal02(w, h, Y->getRawData(), L->getRawData(), opt_alpha, opt_beta,
-            opt_gamma, opt_noise, opt_detail_level,
-            opt_black_point, opt_white_point, opt_fftsolver);
-
-    // in-place color space transform
-    pfs::Array2DImpl *G = new pfs::Array2DImpl( w, h ); // copy for G to preserve Y
-    pfs::Array2D *R = X, *B = Z;
-    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, R, G, B );
-    
-    // Color correction 
-    for( int i=0; i < w*h; i++ )
-    {
-      const float epsilon = 1e-4f;
-      float y = max( (*Y)(i), epsilon );
-      float l = max( (*L)(i), epsilon );
-      (*R)(i) = powf( max((*R)(i)/y,0.f), opt_saturation ) * l;      
-      (*G)(i) = powf( max((*G)(i)/y,0.f), opt_saturation ) * l;
-      (*B)(i) = powf( max((*B)(i)/y,0.f), opt_saturation ) * l;
+    if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "fattal02", w, h, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
     }
-    
-    
-    pfs::transformColorSpace( pfs::CS_RGB, R, G, B, pfs::CS_XYZ, X, Y, Z );
 
-    delete G;    
-    delete L;
-    
+    tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
+
     //---
     pfsio.writeFrame( frame, stdout );
     pfsio.freeFrame( frame );        
   }
+  delete tmo;
 }
 
 int main( int argc, char* argv[] )
@@ -43,18 +43,32 @@
 
 #include "pfstmo.h"
 #include "pde.h"
+#include "tmo_fattal02.h"
 
 using namespace std;
 
 
 #if !defined(HAVE_FFTW3) || !defined(HAVE_OpenMP)
 
-// Dummy function, compiled when FFTW3 not available
+// Dummy functions, compiled when FFTW3 not available
 void solve_pde_fft(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound)
 {
   throw pfs::Exception("FFT solver not available. Compile with libfftw3.");
 }
 
+PDEFFTSolver::PDEFFTSolver()
+{
+}
+
+PDEFFTSolver::~PDEFFTSolver()
+{
+}
+
+void PDEFFTSolver::solve(pfstmo::Array2D *F, pfstmo::Array2D *U, bool adjust_bound)
+{
+  solve_pde_fft(F, U, adjust_bound);
+}
+
 #endif
 
 //for debugging purposes
@@ -101,14 +115,15 @@ void downSample(pfstmo::Array2D* A, pfstmo::Array2D* B)
     }	
 }
 	
-void gaussianBlur( pfstmo::Array2D* I, pfstmo::Array2D* L )
+// buffer is the scratch of the blur, at least the size of I
+void gaussianBlur( pfstmo::Array2D* I, pfstmo::Array2D* L, float* buffer )
 {
   int width = I->getCols();
   int height = I->getRows();
-  int size = width*height;
   int x,y;
 
-  pfstmo::Array2D* T = new pfstmo::Array2D(width,height);
+  pfstmo::Array2D tmp(width,height,buffer);
+  pfstmo::Array2D* T = &tmp;
 
   //--- X blur
   for( y=0 ; y<height ; y++ )
@@ -137,36 +152,32 @@ void gaussianBlur( pfstmo::Array2D* I, pfstmo::Array2D* L )
     (*L)(x,0) = ( 3*(*T)(x,0)+(*T)(x,1) ) / 4.0f;
     (*L)(x,height-1) = ( 3*(*T)(x,height-1)+(*T)(x,height-2) ) / 4.0f;
   }
-
-  delete T;
 }
 
-void createGaussianPyramids( pfstmo::Array2D* H, pfstmo::Array2D** pyramids, int nlevels )
+// pyramids hold the allocated levels, buffer and lowpass are scratch
+// buffers of the size of H
+void createGaussianPyramids( pfstmo::Array2D* H, pfstmo::Array2D** pyramids, int nlevels,
+  float* buffer, float* lowpass )
 {
   int width = H->getCols();
   int height = H->getRows();
   int size = width*height;
 
-  pyramids[0] = new pfstmo::Array2D(width,height);
   for( int i=0 ; i<size ; i++ )
     (*pyramids[0])(i) = (*H)(i);
 
-  pfstmo::Array2D* L = new pfstmo::Array2D(width,height);
-  gaussianBlur( pyramids[0], L );
+  pfstmo::Array2D L(width,height,lowpass);
+  gaussianBlur( pyramids[0], &L, buffer );
 	
   for( int k=1 ; k<nlevels ; k++ )
   {
     width /= 2;
     height /= 2;		
-    pyramids[k] = new pfstmo::Array2D(width,height);
-    downSample(L, pyramids[k]);
+    downSample(&L, pyramids[k]);
     
-    delete L;
-    L = new pfstmo::Array2D(width,height);
-    gaussianBlur( pyramids[k], L );
+    L = pfstmo::Array2D(width,height,lowpass);
+    gaussianBlur( pyramids[k], &L, buffer );
   }
-
-  delete L;
 }
 
 //--------------------------------------------------------------------
@@ -242,16 +253,15 @@ void upSample(pfstmo::Array2D* A, pfstmo::Array2D* B)
 //     }	
 }
 
-void calculateFiMatrix(pfstmo::Array2D* FI, pfstmo::Array2D* gradients[], 
+// fi hold the allocated levels of the attenuation, fi[0] is the result
+void calculateFiMatrix(pfstmo::Array2D* fi[], pfstmo::Array2D* gradients[], 
   float avgGrad[], int nlevels, int detail_level,
-  float alfa, float beta, float noise)
+  float alfa, float beta, float noise, float* buffer)
 {
   int width = gradients[nlevels-1]->getCols();
   int height = gradients[nlevels-1]->getRows();
   int k;
-  pfstmo::Array2D** fi = new pfstmo::Array2D*[nlevels];
 
-  fi[nlevels-1] = new pfstmo::Array2D(width,height);
   for( k=0 ; k<width*height ; k++ )
     (*fi[nlevels-1])(k) = 1.0f;
   
@@ -279,35 +289,22 @@ void calculateFiMatrix(pfstmo::Array2D* FI, pfstmo::Array2D* gradients[],
     }
 		
     // create next level
-    if( k>1 )
-    {
-      width = gradients[k-1]->getCols();
-      height = gradients[k-1]->getRows();
-      fi[k-1] = new pfstmo::Array2D(width,height);
-    }
-    else
-      fi[0] = FI;               // highest level -> result
-
     if( k>0 )
     {
       upSample(fi[k], fi[k-1]);		// upsample to next level
-      gaussianBlur(fi[k-1],fi[k-1]);
+      gaussianBlur(fi[k-1],fi[k-1],buffer);
     }
   }
-
-  for( k=1 ; k<nlevels ; k++ )
-    delete fi[k];
-  delete[] fi;
 }
 
 //--------------------------------------------------------------------
 
 
 static void findMaxMinPercentile(pfstmo::Array2D* I, float minPrct, float& minLum, 
-  float maxPrct, float& maxLum)
+  float maxPrct, float& maxLum, std::vector<float>& vI)
 {
   int size = I->getRows() * I->getCols();
-  std::vector<float> vI;
+  vI.clear();
 
   for( int i=0 ; i<size ; i++ )
     if( (*I)(i)!=0.0f )          //TODO: remove this, no point ignoring 0's
@@ -321,14 +318,78 @@ static void findMaxMinPercentile(pfstmo::Array2D* I, float minPrct, float& minLu
 
 //--------------------------------------------------------------------
 
-void tmo_fattal02(unsigned int width, unsigned int height,
+Fattal02Context::Fattal02Context() :
+  width(0), height(0), nlevels(0), H(NULL), Gx(NULL), Gy(NULL), DivG(NULL), U(NULL),
+  fft_solver(NULL), multigrid_solver(NULL)
+{
+}
+
+Fattal02Context::~Fattal02Context()
+{
+  release();
+  delete fft_solver;
+  delete multigrid_solver;
+}
+
+void Fattal02Context::release()
+{
+  delete H;
+  delete Gx;
+  delete Gy;
+  delete DivG;
+  delete U;
+  H = Gx = Gy = DivG = U = NULL;
+  for( size_t k=0 ; k<pyramids.size() ; k++ )
+  {
+    delete pyramids[k];
+    delete gradients[k];
+    delete fi[k];
+  }
+  pyramids.clear();
+  gradients.clear();
+  fi.clear();
+}
+
+void Fattal02Context::allocate( unsigned int w, unsigned int h, int levels )
+{
+  if( H!=NULL && w==width && h==height && levels==nlevels )
+    return;
+  release();
+  width = w;
+  height = h;
+  nlevels = levels;
+
+  H = new pfstmo::Array2D(width, height);
+  Gx = new pfstmo::Array2D(width, height);
+  Gy = new pfstmo::Array2D(width, height);
+  DivG = new pfstmo::Array2D(width, height);
+  U = new pfstmo::Array2D(width, height);
+
+  // fi[0] is the attenuation matrix FI
+  int cols = width, rows = height;
+  for( int k=0 ; k<nlevels ; k++ )
+  {
+    pyramids.push_back( new pfstmo::Array2D(cols,rows) );
+    gradients.push_back( new pfstmo::Array2D(cols,rows) );
+    fi.push_back( new pfstmo::Array2D(cols,rows) );
+    cols /= 2;
+    rows /= 2;
+  }
+  avgGrad.resize(nlevels);
+  buffer.resize(width*height);
+  lowpass.resize(width*height);
+}
+
+void Fattal02Context::tonemap(unsigned int width, unsigned int height,
                   const float* nY, float* nL, float alfa, float beta,
                   float gamma, float noise, int detail_level,
                   float black_point, float white_point, bool fftsolver)
 {
 
-  const pfstmo::Array2D* Y = new pfstmo::Array2D(width, height, const_cast<float*>(nY));
-  pfstmo::Array2D* L = new pfstmo::Array2D(width, height, nL);
+  const pfstmo::Array2D Yarr(width, height, const_cast<float*>(nY));
+  pfstmo::Array2D Larr(width, height, nL);
+  const pfstmo::Array2D* Y = &Yarr;
+  pfstmo::Array2D* L = &Larr;
 
   int MSIZE=32;       // minimum size of gaussian pyramid (32 as in paper)
   // I believe a smaller value than 32 results in slightly better overall
@@ -349,41 +410,37 @@ void tmo_fattal02(unsigned int width, unsigned int height,
     minLum = ( (*Y)(i)<minLum ) ? (*Y)(i) : minLum;
     maxLum = ( (*Y)(i)>maxLum ) ? (*Y)(i) : maxLum;
   }
-  pfstmo::Array2D* H = new pfstmo::Array2D(width, height);
+  // count the levels of the gaussian pyramids
+  int mins = (width<height) ? width : height;	// smaller dimension
+  int levels = 0;
+  while( mins>=MSIZE )
+  {
+    levels++;
+    mins /= 2;
+  }
+  if( levels==0 )
+    levels = 1;     // images smaller than MSIZE are attenuated at full size
+  allocate(width, height, levels);
+
   for( i=0 ; i<size ; i++ )
     (*H)(i) = log( 100.0f*((*Y)(i)-minLum)/(maxLum-minLum) + 1e-4 );
 
   DEBUG_STR << "tmo_fattal02: calculating attenuation matrix" << endl;
   
   // create gaussian pyramids
-  int mins = (width<height) ? width : height;	// smaller dimension
-  int nlevels = 0;
-  while( mins>=MSIZE )
-  {
-    nlevels++;
-    mins /= 2;
-  }
-  pfstmo::Array2D** pyramids = new pfstmo::Array2D*[nlevels];
-  createGaussianPyramids(H, pyramids, nlevels);
+  createGaussianPyramids(H, &pyramids[0], nlevels, &buffer[0], &lowpass[0]);
 
   // calculate gradients and its average values on pyramid levels
-  pfstmo::Array2D** gradients = new pfstmo::Array2D*[nlevels];
-  float* avgGrad = new float[nlevels];
   for( k=0 ; k<nlevels ; k++ )
-  {
-    gradients[k] = new pfstmo::Array2D(pyramids[k]->getCols(), pyramids[k]->getRows());
     avgGrad[k] = calculateGradients(pyramids[k],gradients[k], k);
-  }
 
   // calculate fi matrix
-  pfstmo::Array2D* FI = new pfstmo::Array2D(width, height);
-  calculateFiMatrix(FI, gradients, avgGrad, nlevels, detail_level, alfa, beta, noise);
+  calculateFiMatrix(&fi[0], &gradients[0], &avgGrad[0], nlevels, detail_level, alfa, beta, noise, &buffer[0]);
+  pfstmo::Array2D* FI = fi[0];
 
 //  dumpPFS( "FI.pfs", FI, "Y" );
 
   // attenuate gradients
-  pfstmo::Array2D* Gx = new pfstmo::Array2D(width, height);
-  pfstmo::Array2D* Gy = new pfstmo::Array2D(width, height);
 
   // the fft solver solves the Poisson pde but with slightly different
   // boundary conditions, so we need to adjust the assembly of the right hand
@@ -419,7 +476,6 @@ void tmo_fattal02(unsigned int width, unsigned int height,
   DEBUG_STR << "tmo_fattal02: compressing gradients" << endl;
   
   // calculate divergence
-  pfstmo::Array2D* DivG = new pfstmo::Array2D(width, height);
   for( y=0 ; y<height ; y++ )
     for( x=0 ; x<width ; x++ )
     {
@@ -440,12 +496,15 @@ void tmo_fattal02(unsigned int width, unsigned int height,
   DEBUG_STR << "tmo_fattal02: recovering image" << endl;
   
   // solve pde and exponentiate (ie recover compressed image)
-  pfstmo::Array2D* U = new pfstmo::Array2D(width, height);
   if(fftsolver) {
-    solve_pde_fft( DivG, U );
+    if( fft_solver==NULL )
+      fft_solver = new PDEFFTSolver();
+    fft_solver->solve( DivG, U );
   } else {
     // solve_pde_sor( DivG, U );
-    solve_pde_multigrid( DivG, U );
+    if( multigrid_solver==NULL )
+      multigrid_solver = new PDEMultigridSolver();
+    multigrid_solver->solve( DivG, U );
   }
   DEBUG_STR << "pde residual error: " << residual_pde(U, DivG) << std::endl;
 
@@ -457,7 +516,7 @@ void tmo_fattal02(unsigned int width, unsigned int height,
   float cut_min=0.01f*black_point;
   float cut_max=1.0f-0.01f*white_point;
   assert(cut_min>=0.0f && (cut_max<=1.0f) && (cut_min<cut_max));
-  findMaxMinPercentile(L, cut_min, minLum, cut_max, maxLum);
+  findMaxMinPercentile(L, cut_min, minLum, cut_max, maxLum, sorted);
   for( y=0 ; y<height ; y++ )
     for( x=0 ; x<width ; x++ )
     {
@@ -467,23 +526,14 @@ void tmo_fattal02(unsigned int width, unsigned int height,
       // note, we intentionally do not cut off values > 1.0
     }
 
-  // clean up
-  DEBUG_STR << "tmo_fattal02: clean up" << endl;
-  delete H;
-  for( i=0 ; i<nlevels ; i++ )
-  {
-    delete pyramids[i];
-    delete gradients[i];
-  }
-  delete[] pyramids;
-  delete[] gradients;
-  delete[] avgGrad;
-  delete FI;
-  delete Gx;
-  delete Gy;
-  delete DivG;
-  delete U;
+}
 
-  delete L;
-  delete Y;
+void tmo_fattal02(unsigned int width, unsigned int height,
+                  const float* nY, float* nL, float alfa, float beta,
+                  float gamma, float noise, int detail_level,
+                  float black_point, float white_point, bool fftsolver)
+{
+  Fattal02Context tmo;
+  tmo.tonemap(width, height, nY, nL, alfa, beta, gamma, noise, detail_level,
+              black_point, white_point, fftsolver);
 }
@@ -33,6 +33,56 @@
 #ifndef _tmo_fattal02_h_
 #define _tmo_fattal02_h_
 
+#include <vector>
+
+#include <pfstmo.h>
+
+class PDEFFTSolver;
+class PDEMultigridSolver;
+
+/**
+ * @brief Fattal02 operator with its working buffers kept between frames
+ *
+ * The log-luminance, the gaussian pyramid, the gradients, the
+ * attenuation levels and the state of the pde solver (levels of the
+ * multigrid or buffers and FFT plans of the fft solver) are reused as
+ * long as consecutive frames have the same size.
+ */
+class Fattal02Context
+{
+public:
+  Fattal02Context();
+  ~Fattal02Context();
+
+  /**
+   * @brief Tone map one frame, see tmo_fattal02()
+   */
+  void tonemap(unsigned int width, unsigned int height,
+               const float* nY, float* nL, float alfa, float beta,
+               float gamma, float noise, int detail_level,
+               float black_point, float white_point, bool fftsolver);
+
+private:
+  unsigned int width, height;
+  int nlevels;
+  pfstmo::Array2D *H;                       // log-luminance
+  pfstmo::Array2D *Gx, *Gy, *DivG, *U;      // attenuated gradients, pde
+  std::vector<pfstmo::Array2D*> pyramids;   // gaussian pyramid of H
+  std::vector<pfstmo::Array2D*> gradients;  // gradients on the levels
+  std::vector<pfstmo::Array2D*> fi;         // attenuation on the levels
+  std::vector<float> avgGrad;
+  std::vector<float> buffer, lowpass;       // scratch of the gaussian blur
+  std::vector<float> sorted;                // for the percentiles
+  PDEFFTSolver *fft_solver;
+  PDEMultigridSolver *multigrid_solver;
+
+  void allocate(unsigned int width, unsigned int height, int nlevels);
+  void release();
+
+  Fattal02Context(const Fattal02Context&);
+  Fattal02Context& operator=(const Fattal02Context&);
+};
+
 /**
  * @brief Gradient Domain High Dynamic Range Compression
  *
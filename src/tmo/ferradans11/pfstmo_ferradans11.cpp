@@ -30,13 +30,15 @@
  *
  */
 
+#include <config.h>
+
 #include <stdlib.h>
  
 #include <getopt.h>
 #include <pfs.h>
 #include "pfstmo.h"
 
-#include "Imagen.h"
+#include "tmo_context.h"
 
 #define PROG_NAME "pfstmo_ferradans11"
 
@@ -59,9 +61,8 @@ void pfstmo_ferradans11( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-  float rho = -2;
-  float inv_alpha = 5;
+  //--- tone mapping parameters, checked by the ferradans11 context
+  pfstmo::Options tmo_options;
     
     
   static struct option cmdLineOptions[] = {
@@ -88,14 +89,6 @@ void pfstmo_ferradans11( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 'r':
-      rho = (float)strtod( optarg, NULL );
-      break;
-    case 'a':
-      inv_alpha = (float)strtod( optarg, NULL );
-      if( inv_alpha<=0.0f )
-        throw pfs::Exception("inv_alpha value out of range, should be >0");
-      break;
    case '?':
       printHelp();
       throw QuietException();
@@ -104,9 +97,16 @@ void pfstmo_ferradans11( int argc, char* argv[] )
       printHelp();
       throw QuietException();
       
+   default:
+      tmo_options.set( cmdLineOptions, c, optarg );
    }
   }
   
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "ferradans11", 1, 1, tmo_options );
+
+  pfstmo::Context *tmo = NULL;
+
   while( true ) 
   {
     pfs::Frame *frame = pfsio.readFrame( stdin );
@@ -114,31 +114,21 @@ void pfstmo_ferradans11( int argc, char* argv[] )
       
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y==NULL || X==NULL || Z==NULL)
       throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
         
-    // tone mapping
+    // buffers are reused for all frames of the same size
       int w = Z->getCols();
       int h = Z->getRows();
+      if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+        delete tmo;
+        tmo = pfstmo::createContext( "ferradans11", w, h, tmo_options );
+      }
 
-    // in-place color space transform
-      pfs::Array2DImpl* R = new pfs::Array2DImpl(w,h);
-      pfs::Array2DImpl* G = new pfs::Array2DImpl(w,h);
-      pfs::Array2DImpl* B = new pfs::Array2DImpl(w,h);
-      
-      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, R, G, B );
-     
-      tmo_ferradans11(w, h, R->getRawData(), G->getRawData(), B->getRawData(),
-                      rho, inv_alpha);
-   
-      pfs::transformColorSpace( pfs::CS_SRGB, R, G, B, pfs::CS_XYZ, X, Y, Z );
-      
-      delete R;
-      delete G;
-      delete B;
+      tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+      frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
       
       //---
      
@@ -146,6 +136,7 @@ void pfstmo_ferradans11( int argc, char* argv[] )
       pfsio.freeFrame( frame );
       
   }
+  delete tmo;
 }
 
 int main( int argc, char* argv[] )
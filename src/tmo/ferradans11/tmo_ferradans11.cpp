@@ -32,73 +32,66 @@
 
 #include <config.h>
 
-#include <vector>
 #include <algorithm>
 
+#include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <time.h>
+
 #include <fftw3.h>
-#include <assert.h>
-#include <pfs.h>
 
-#include "Imagen.h"
-#include "pfstmo.h"
-#include <pfs.h>
+#include "tmo_ferradans11.h"
+#include "fftw_lock.h"
 
-#include <cstring>
-#include <iostream>
+using namespace std;
 
-#include <stdlib.h>
 
-using namespace std;
+//--------------------------------------------------------------------
 
+/*
+ * Coefficients of the polynomial of degree 7 that approximates the
+ * arctan with slope 10, so that the neighborhood averaging can be
+ * computed as a sum of convolutions:
+ *
+ *   R(u)(x) = sum_k c_k (G * (u(x) - u)^k)(x)
+ *
+ * Expanding the binomial gives
+ *
+ *   R(u) = sum_j (G * u^j) Q_j(u),  Q_j(u) = sum_{k>=j} (-1)^j C(k,j) c_k u^(k-j)
+ *
+ * so each power u^j is convolved only once and its contribution is
+ * accumulated immediately, instead of keeping all seven convolutions.
+ */
+#define DEGREE 7
 
+static const double arctg_slope10[DEGREE+1] = {
+  1.2391e-15, 3.7891e+00, 4.4531e-16, -1.1013e+01,
+  -1.8371e-15, 1.5836e+01, 3.1255e-16, -7.7456e+00 };
 
-//for debugging purposes
-#if 0
-#define PFSEOL "\x0a"
-static void dumpPFS( const char *fileName, const pfstmo::Array2D *data, const char *channelName )
+// q[j][m] are the coefficients of Q_j, m = 0..DEGREE-j
+static void expandPolynomial( float q[DEGREE+1][DEGREE+1] )
 {
-   FILE *fh = fopen( fileName, "wb" );
-   assert( fh != NULL );
-
-   int width = data->getCols();
-   int height = data->getRows();
-
-   fprintf( fh, "PFS1" PFSEOL "%d %d" PFSEOL "1" PFSEOL "0" PFSEOL
-     "%s" PFSEOL "0" PFSEOL "ENDH", width, height, channelName );
-
-   for( int y = 0; y < height; y++ )
-     for( int x = 0; x < width; x++ ) {
-       float d = (*data)(x,y);       
-       fwrite( &d, sizeof( float ), 1, fh );
-     }
-  
-   fclose( fh );
+  for( int j=0; j<=DEGREE; j++ )
+  {
+    double binom = 1;           // C(j+m,j)
+    for( int m=0; m<=DEGREE-j; m++ )
+    {
+      q[j][m] = (float)((j%2 ? -1 : 1) * binom * arctg_slope10[j+m]);
+      binom = binom*(j+m+1)/(m+1);
+    }
+  }
 }
-#endif
 
-
-//--------------------------------------------------------------------
-
-
-/*Implementation, hardcoded of the R function */
-float apply_arctg_slope10(float Ip,float I,float I2,float I3,float I4,float I5,float I6,float I7)
+static inline float polyval( const float *q, int degree, float x )
 {
-    //Arctan, slope 10
-    float  gr1,gr2,gr3,gr4,gr5,gr6,gr7;
-    gr1=Ip-I;
-    gr2=Ip*Ip-2*Ip*I+I2;
-    gr3=Ip*Ip*Ip-3*Ip*Ip*I+3*Ip*I2-I3;
-    gr4=Ip*Ip*Ip*Ip+4*Ip*Ip*I2+I4-4*Ip*I3+2*Ip*Ip*(I2-2*Ip*I);
-    gr5=Ip*gr4-Ip*Ip*Ip*Ip*I-4*Ip*Ip*I3-I5+4*Ip*I4-2*Ip*Ip*(I3-2*Ip*I2);
-    gr6=Ip*Ip*gr4-Ip*Ip*Ip*Ip*Ip*I-4*Ip*Ip*Ip*I3-Ip*I5+4*Ip*Ip*I4-2*Ip*Ip*Ip*(I3-2*Ip*I2)-(I*Ip*gr4-Ip*Ip*Ip*Ip*I2-4*Ip*Ip*I4-I6+4*Ip*I5-2*Ip*Ip*(I4-2*Ip*I3)    );
-    gr7=Ip*Ip*(Ip*(  Ip*Ip*Ip*Ip+4*Ip*Ip*I2+I4-4*Ip*I3+2*Ip*Ip*(I2-2*Ip*I)     )-Ip*Ip*Ip*Ip*I-4*Ip*Ip*I3-I5+4*Ip*I4-2*Ip*Ip*(I3-2*Ip*I2))-2*Ip*(Ip*(Ip*Ip*Ip*Ip*I+4*Ip*Ip*I3+I5-4*Ip*I4+2*Ip*Ip*(I3-2*Ip*I2)) -Ip*Ip*Ip*Ip*I2-4*Ip*Ip*I4-I6+4*Ip*I5-2*Ip*Ip*(I4-2*Ip*I3))+Ip*(Ip*Ip*Ip*Ip*I2+4*Ip*Ip*I4+I6-4*Ip*I5+2*Ip*Ip*(I4-2*Ip*I3)) -Ip*Ip*Ip*Ip*I3-4*Ip*Ip*I5-I7+4*Ip*I6-2*Ip*Ip*(I5-2*Ip*I4);
-    
-    // Hardcoded coefficients of the polynomial of degree 9 that allows to approximate the neighborhood averaging as a sum of convolutions
-    return(( -7.7456e+00)*gr7+ (3.1255e-16)*gr6+(1.5836e+01)*gr5+(-1.8371e-15)*gr4+(-1.1013e+01)*gr3+(4.4531e-16)*gr2+(3.7891e+00)*gr1+ 1.2391e-15 ) ;
+  float r = q[degree];
+  for( int m=degree-1; m>=0; m-- )
+    r = r*x + q[m];
+  return r;
 }
 
 
-
 /*
  *  This Quickselect routine is based on the algorithm described in
  *  "Numerical recipes in C", Second Edition,
@@ -107,10 +100,9 @@ float apply_arctg_slope10(float Ip,float I,float I2,float I3,float I4,float I5,f
  */
 
 
-#define ELEM_SWAP(a,b) { register float t=(a);(a)=(b);(b)=t; }
-//#define ELEM_SWAP(a,b) { register float t=a;a=b;b=t; }
+#define ELEM_SWAP(a,b) { float t=(a);(a)=(b);(b)=t; }
 
-double quick_select(float arr[], int n)
+static double quick_select(float arr[], int n)
 {
     int low, high ;
     int median;
@@ -162,307 +154,343 @@ double quick_select(float arr[], int n)
 
 #undef ELEM_SWAP
 
-void tmo_ferradans11(int col,int fil,float* imR, float* imG, float* imB,float rho, float invalpha){
-    
-    int length=fil*col;
-    int colors=3;
-    float lambda;
-    float dt=0.2;//1e-1;//
-    float threshold_diff=dt/20.0;//1e-5;//
-    
-    
-    Imagen RGBorig[3],*pIm;
-    
-    pIm = new Imagen(fil,col);
-    for (int c =0;c<3;c++){
-        RGBorig[c] = *pIm;
-        
+
+//--------------------------------------------------------------------
+
+Ferradans11Context::Ferradans11Context() :
+  fil( 0 ), col( 0 ), kernel_invalpha( -1 ),
+  power( NULL ), conv( NULL ), contrast( NULL ),
+  spectrum( NULL ), kernel( NULL ), forward( NULL ), inverse( NULL )
+{
+  for( int k=0; k<3; k++ )
+    orig[k] = NULL;
+}
+
+Ferradans11Context::~Ferradans11Context()
+{
+  release();
+}
+
+void Ferradans11Context::release()
+{
+  {
+    pfstmo::FFTWPlannerLock lock;
+    if( forward != NULL )
+      fftwf_destroy_plan( forward );
+    if( inverse != NULL )
+      fftwf_destroy_plan( inverse );
+  }
+  forward = inverse = NULL;
+
+  for( int k=0; k<3; k++ )
+  {
+    fftwf_free( orig[k] );
+    orig[k] = NULL;
+  }
+  fftwf_free( power );
+  fftwf_free( conv );
+  fftwf_free( contrast );
+  fftwf_free( spectrum );
+  fftwf_free( kernel );
+  power = conv = contrast = NULL;
+  spectrum = kernel = NULL;
+
+  fil = col = 0;
+  kernel_invalpha = -1;
+}
+
+void Ferradans11Context::allocate( int fil, int col )
+{
+  if( this->fil == fil && this->col == col )
+    return;
+  release();
+
+  this->fil = fil;
+  this->col = col;
+  const int length = fil*col;
+  const int slength = fil*(col/2+1);      // r2c stores half of the spectrum
+
+  for( int k=0; k<3; k++ )
+    orig[k] = (float*)fftwf_malloc( sizeof(float)*length );
+  power = (float*)fftwf_malloc( sizeof(float)*length );
+  conv = (float*)fftwf_malloc( sizeof(float)*length );
+  contrast = (float*)fftwf_malloc( sizeof(float)*length );
+  spectrum = (fftwf_complex*)fftwf_malloc( sizeof(fftwf_complex)*slength );
+  kernel = (fftwf_complex*)fftwf_malloc( sizeof(fftwf_complex)*slength );
+
+  pfstmo::FFTWPlannerLock lock;
+  forward = fftwf_plan_dft_r2c_2d( fil, col, power, spectrum, FFTW_ESTIMATE );
+  inverse = fftwf_plan_dft_c2r_2d( fil, col, spectrum, conv, FFTW_ESTIMATE );
+}
+
+void Ferradans11Context::setKernel( float invalpha )
+{
+  if( kernel_invalpha == invalpha )
+    return;
+  kernel_invalpha = invalpha;
+
+  const int length = fil*col;
+  const int slength = fil*(col/2+1);
+  const float sigma = min(fil,col)/invalpha;
+  const int mitfil = fil/2;
+  const int mitcol = col/2;
+
+  // Gaussian centred in the image, shifted so that its minimum is 0
+  float gmin = FLT_MAX;
+  #pragma omp parallel for schedule(static) reduction(min:gmin)
+  for( int i=0; i<fil; i++ )
+    for( int j=0; j<col; j++ )
+    {
+      const float g = exp( -((i-mitfil)*(i-mitfil)+(j-mitcol)*(j-mitcol))/(2*sigma*sigma) );
+      power[i*col+j] = g;
+      gmin = min( gmin, g );
     }
-    
-    for(int i=0;i<length;i++){
-        RGBorig[0].datos[i] = (double)max(imR[i],0);
-        RGBorig[1].datos[i] = (double)max(imG[i],0);
-        RGBorig[2].datos[i] = (double)max(imB[i],0);
+
+  double sum = 0;
+  #pragma omp parallel for simd schedule(static) reduction(+:sum)
+  for( int i=0; i<length; i++ )
+  {
+    power[i] -= gmin;
+    sum += power[i];
+  }
+
+  // fftshift, move the centre to (0,0)
+  #pragma omp parallel for schedule(static)
+  for( int i=0; i<fil/2; i++ )
+    for( int j=0; j<col/2; j++ )
+    {
+      swap( power[i*col+j], power[(i+mitfil)*col+j+mitcol] );
+      swap( power[(i+mitfil)*col+j], power[i*col+j+mitcol] );
     }
-    
-    delete(pIm);
-    
-    ///////////////////////////////////////////
-    
-    char* aux_char = new char[1000];
-    
-    Imagen RGB[3];
-    
-    int iteration=0;
-    char indice[3];
-    float difference0=2000.0;
-    float difference=1000.0;
-    
-    float med[3];
-    float valmax[3];
-    float valmin[3];
-    
-    Imagen aux;
-    float median,mu[3];
-    
-    int cInit=clock();  //start counting time for first step 
-    
-    fprintf(stderr,"inv_alpha=%f, rho=%f\n",invalpha,rho);
-    
-    for(int k=0;k<3;k++)
+
+  fftwf_execute( forward );
+
+  // unit integral; fold in the 1/length scaling of the inverse FFT
+  const float norm = (float)(1.0/(sum*length));
+  #pragma omp parallel for simd schedule(static)
+  for( int i=0; i<slength; i++ )
+  {
+    kernel[i][0] = spectrum[i][0]*norm;
+    kernel[i][1] = spectrum[i][1]*norm;
+  }
+}
+
+/*
+ * Computes the contrast term R(u), clamped to [-1,1], into 'contrast'
+ * and returns its maximum absolute value.
+ */
+float Ferradans11Context::contrastTerm( const float *u )
+{
+  const int length = fil*col;
+  const int slength = fil*(col/2+1);
+
+  float q[DEGREE+1][DEGREE+1];
+  expandPolynomial( q );
+
+  // j = 0: the convolution of a constant with the unit kernel
+  #pragma omp parallel for simd schedule(static)
+  for( int i=0; i<length; i++ )
+  {
+    contrast[i] = polyval( q[0], DEGREE, u[i] );
+    power[i] = u[i];
+  }
+
+  float maxabs = 0;
+  for( int j=1; j<=DEGREE; j++ )
+  {
+    fftwf_execute( forward );
+
+    #pragma omp parallel for simd schedule(static)
+    for( int i=0; i<slength; i++ )
     {
-        RGBorig[k]+=1e-6;
-        aux=RGBorig[k];
-        median=quick_select(aux.datos,length);
-        mu[k]=pow(aux.medval(),0.5)*pow(median,0.5);
-        
-        RGB[k]=RGBorig[k] ;
+      const float re = spectrum[i][0]*kernel[i][0] - spectrum[i][1]*kernel[i][1];
+      const float im = spectrum[i][0]*kernel[i][1] + spectrum[i][1]*kernel[i][0];
+      spectrum[i][0] = re;
+      spectrum[i][1] = im;
     }
-    
-    // SEMISATURATION CONSTANT SIGMA DEPENDS ON THE ILUMINATION
-    // OF THE BACKGROUND. DATA IN TABLA1 FROM VALETON+VAN NORREN.
-    // TAKE AS REFERENCE THE CHANNEL WITH MAXIMUM ILUMINATION.
-    float muMax=max(max(mu[0],mu[1]),mu[2]);
-    for(int k=0;k<3;k++)
+
+    fftwf_execute( inverse );
+
+    if( j < DEGREE )
     {
-        //MOVE log(mu) EQUALLY FOR THE 3 COLOR CHANNELS: rho DOES NOT CHANGE
-        //PARAMETER OF OUR ALGORITHM
-        float x=log10(muMax)-log10(mu[k]);
-        
-        float z= - 0.37*(log10(mu[k])+4-rho) + 1.9;
-        mu[k]*=pow(10,z);
+      #pragma omp parallel for simd schedule(static)
+      for( int i=0; i<length; i++ )
+      {
+        contrast[i] += polyval( q[j], DEGREE-j, u[i] )*conv[i];
+        power[i] *= u[i];
+      }
     }
-    
-    
-    // VALETON + VAN NORREN:
-    // range = 4 orders; r is half the range
-    // n=0.74 : EXPONENT in NAKA-RUSHTON formula 
-    float r=2;
-    float n=0.74;
-    for(int k=0;k<3;k++)
+    else
     {
-        //find ctes. for WEBER-FECHNER from NAKA-RUSHTON
-        float logs=log10(mu[k]);
-        float I0=mu[k]/pow(10,1.2);
-        float sigma_n=pow(mu[k],n);
-        
-        // WYSZECKI-STILES, PÁG. 530: FECHNER FRACTION
-        float K_=100.0/1.85;
-        if(k==2)
-            K_= 100.0/8.7;
-        float Ir=pow(10,logs+r);
-        float mKlogc=pow(Ir,n)/(pow(Ir,n)+pow(mu[k],n))-K_*log10(Ir+I0);
-    
-        //mix W-F and N-R
-        for(int d=0;d<length;d++)
-      	{
-            float x=log10(RGBorig[k].datos[d]);
-            float In= pow(RGBorig[k].datos[d],n);
-            float srn=pow(pow(10,logs+r),n);
-            // before logs+r apply W-F, after N-R
-            if(x<=logs+r)
-                RGB[k].datos[d]=K_*log10( RGBorig[k].datos[d] + I0)+mKlogc;
-            else
-                RGB[k].datos[d]= In/(In+sigma_n);
-            
-      	}
-        
-        float minmez=RGB[k].minval();
-        RGB[k]+= -minmez;
-        float escalamez=1.0/(RGB[k].maxval()+1e-12);
-        RGB[k]*=escalamez;
-        
+      //project onto the interval [-1,1]
+      #pragma omp parallel for simd schedule(static) reduction(max:maxabs)
+      for( int i=0; i<length; i++ )
+      {
+        const float r = max( min( contrast[i] + q[j][0]*conv[i], 1.f ), -1.f );
+        contrast[i] = r;
+        maxabs = max( maxabs, fabsf( r ) );
+      }
     }
-    
-    int cFin=clock();
-    fprintf(stderr,"Step 1 done in: %f", (float)(cFin - cInit)/(float)CLOCKS_PER_SEC);
-    
-    for(int color=0;color<colors;color++)
+  }
+
+  return maxabs;
+}
+
+
+void Ferradans11Context::tonemap( int col, int fil, float *imR, float *imG,
+  float *imB, float rho, float invalpha )
+{
+  allocate( fil, col );
+  setKernel( invalpha );
+
+  const int length = fil*col;
+  const int colors = 3;
+  float *RGB[3] = { imR, imG, imB };
+  const float dt = 0.2;//1e-1;//
+  const float threshold_diff = dt/20.0;//1e-5;//
+
+  int cInit = clock();  //start counting time for first step
+
+  fprintf(stderr,"inv_alpha=%f, rho=%f\n",invalpha,rho);
+
+  float mu[3];
+  for( int k=0; k<3; k++ )
+  {
+    float *o = orig[k];
+    const float *in = RGB[k];
+    double sum = 0;
+    #pragma omp parallel for simd schedule(static) reduction(+:sum)
+    for( int i=0; i<length; i++ )
     {
-        RGBorig[color]=RGB[color];
-        med[color]=RGB[color].medval();
+      o[i] = max( in[i], 0.f ) + 1e-6f;
+      power[i] = o[i];
+      sum += o[i];
     }
-    
-    lambda=1;
-    
-    int c1,c0=clock();
-    
-    Imagen RGB0=RGB[0];
-    Imagen u=RGB[0];
-    Imagen u0=RGB[0];
-    Imagen u2=RGB[0];
-    Imagen u3=RGB[0];
-    Imagen u4=RGB[0];
-    Imagen u5=RGB[0];
-    Imagen u6=RGB[0];
-    Imagen u7=RGB[0];
-    Imagen I0= RGB0;
-    Imagen ut= RGB0;
-    
-    
-    fftwf_complex* U = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU = fftwf_plan_dft_r2c_2d(fil, col, u0.datos, U,FFTW_ESTIMATE);
-    fftwf_complex* U2 = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU2 = fftwf_plan_dft_r2c_2d(fil, col, u2.datos, U2,FFTW_ESTIMATE);
-    fftwf_complex* U3 = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU3 = fftwf_plan_dft_r2c_2d(fil, col, u3.datos, U3,FFTW_ESTIMATE);
-    fftwf_complex* U4 = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU4 = fftwf_plan_dft_r2c_2d(fil, col, u4.datos, U4,FFTW_ESTIMATE);
-    
-    fftwf_complex* U5 = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU5 = fftwf_plan_dft_r2c_2d(fil, col, u5.datos, U5,FFTW_ESTIMATE);
-    fftwf_complex* U6 = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU6 = fftwf_plan_dft_r2c_2d(fil, col, u6.datos, U6,FFTW_ESTIMATE);
-    fftwf_complex* U7 = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pU7 = fftwf_plan_dft_r2c_2d(fil, col, u7.datos, U7,FFTW_ESTIMATE);
-    
-    fftwf_complex* UG = new fftwf_complex[fil*col];
-    fftwf_complex* U2G= new fftwf_complex[fil*col];
-    fftwf_complex* U3G= new fftwf_complex[fil*col];
-    fftwf_complex* U4G= new fftwf_complex[fil*col];
-    fftwf_complex* U5G= new fftwf_complex[fil*col];
-    fftwf_complex* U6G= new fftwf_complex[fil*col];
-    fftwf_complex* U7G= new fftwf_complex[fil*col];
-    
-    Imagen iu(fil,col,0);
-    fftwf_plan pinvU = fftwf_plan_dft_c2r_2d(fil, col, UG,iu.datos, FFTW_ESTIMATE);
-    Imagen  iu2(fil,col,0);
-    fftwf_plan pinvU2 = fftwf_plan_dft_c2r_2d(fil, col, U2G,iu2.datos, FFTW_ESTIMATE);
-    Imagen  iu3(fil,col,0);
-    fftwf_plan pinvU3 = fftwf_plan_dft_c2r_2d(fil, col, U3G,iu3.datos, FFTW_ESTIMATE);
-    Imagen  iu4(fil,col,0);
-    fftwf_plan pinvU4 = fftwf_plan_dft_c2r_2d(fil, col, U4G,iu4.datos, FFTW_ESTIMATE);
-    Imagen iu5(fil,col,0);
-    fftwf_plan pinvU5 = fftwf_plan_dft_c2r_2d(fil, col, U5G,iu5.datos, FFTW_ESTIMATE);
-    Imagen iu6(fil,col,0);
-    fftwf_plan pinvU6 = fftwf_plan_dft_c2r_2d(fil, col, U6G,iu6.datos, FFTW_ESTIMATE);
-    Imagen iu7(fil,col,0);
-    fftwf_plan pinvU7 = fftwf_plan_dft_c2r_2d(fil, col, U7G,iu7.datos, FFTW_ESTIMATE);
-    
-    float alpha=min(fil,col)/invalpha;
-    Imagen g;
-    g=nucleo_gaussiano(fil,col,alpha);
-    g.escala(1.0,0.0);
-    
-    g.fftshift();
-    
-    float suma=0, norm=1.0/(fil*col);
-    for(int i=0;i<length;i++)
-        suma+=g.datos[i];
-    
-    g*=(1.0/suma); //now integral of the weight sums 1
-    
-    fftwf_complex* G = (fftwf_complex*) fftw_malloc(sizeof(fftwf_complex) * length);
-    fftwf_plan pG = fftwf_plan_dft_r2c_2d(fil, col, g.datos, G,FFTW_ESTIMATE);
-    fftwf_execute(pG);
-    
-    while(difference>threshold_diff)
+    const float median = quick_select( power, length );
+    mu[k] = sqrt( (float)(sum/length) )*sqrt( median );
+  }
+
+  // SEMISATURATION CONSTANT SIGMA DEPENDS ON THE ILUMINATION
+  // OF THE BACKGROUND. DATA IN TABLA1 FROM VALETON+VAN NORREN.
+  for( int k=0; k<3; k++ )
+  {
+    //MOVE log(mu) EQUALLY FOR THE 3 COLOR CHANNELS: rho DOES NOT CHANGE
+    //PARAMETER OF OUR ALGORITHM
+    float z = - 0.37*(log10(mu[k])+4-rho) + 1.9;
+    mu[k] *= pow(10,z);
+  }
+
+  // VALETON + VAN NORREN:
+  // range = 4 orders; r is half the range
+  // n=0.74 : EXPONENT in NAKA-RUSHTON formula
+  const float r = 2;
+  const float n = 0.74;
+  double med[3];
+  for( int k=0; k<3; k++ )
+  {
+    //find ctes. for WEBER-FECHNER from NAKA-RUSHTON
+    const float logs = log10(mu[k]);
+    const float I0 = mu[k]/pow(10,1.2);
+    const float sigma_n = pow(mu[k],n);
+
+    // WYSZECKI-STILES, PÁG. 530: FECHNER FRACTION
+    float K_ = 100.0/1.85;
+    if( k==2 )
+      K_ = 100.0/8.7;
+    const float Ir = pow(10,logs+r);
+    const float mKlogc = pow(Ir,n)/(pow(Ir,n)+pow(mu[k],n))-K_*log10(Ir+I0);
+
+    //mix W-F and N-R: before logs+r apply W-F, after N-R
+    float *o = orig[k];
+    float *v = RGB[k];
+    float vmin = FLT_MAX, vmax = -FLT_MAX;
+    #pragma omp parallel for schedule(static) reduction(min:vmin) reduction(max:vmax)
+    for( int d=0; d<length; d++ )
     {
-        iteration++;
-        difference0=difference;
-        difference=0.0;
-        for(int color=0;color<colors;color++)
-        {
-            u0=RGB[color];
-            RGB0=RGB[color];
-            
-            u=u0;
-            u2=u; u2*=u;
-            u3=u2;u3*=u;
-            u4=u3;u4*=u;
-            u5=u4;u5*=u;
-            u6=u5;u6*=u;
-            u7=u6;u7*=u;
-            
-            fftwf_execute(pU);
-            fftwf_execute(pU2);
-            fftwf_execute(pU3);
-            fftwf_execute(pU4);
-            fftwf_execute(pU5);
-            fftwf_execute(pU6);
-            fftwf_execute(pU7);
-            
-            producto(U,G,UG,fil,col);
-            producto(U2,G,U2G,fil,col);
-            producto(U3,G,U3G,fil,col);
-            producto(U4,G,U4G,fil,col);
-            producto(U5,G,U5G,fil,col);
-            producto(U6,G,U6G,fil,col);
-            producto(U7,G,U7G,fil,col);
-            
-            fftwf_execute(pinvU);
-            iu *= norm;
-            
-            fftwf_execute(pinvU2);
-            iu2 *= norm;
-            fftwf_execute(pinvU3);
-            iu3 *= norm;
-            fftwf_execute(pinvU4);
-            iu4 *= norm;
-            fftwf_execute(pinvU5);
-            iu5 *= norm;
-            fftwf_execute(pinvU6);
-            iu6 *= norm;
-            fftwf_execute(pinvU7);
-            iu7 *= norm;
-            
-            for(int i=0;i<length;i++)
-            {
-                // compute contrast component
-                 u0.datos[i]=apply_arctg_slope10(u0.datos[i],iu.datos[i],iu2.datos[i],iu3.datos[i],iu4.datos[i],iu5.datos[i],iu6.datos[i],iu7.datos[i]);
-                
-                //project onto the interval [-1,1]
-                 u0.datos[i] = max( min( u0.datos[i],1) , -1 );
-            }
-            
-            // normalizing R term to estandarize results
-            u0 *= (1.0/u0.maxabsval());
-            
-            double norm = (1.0 + dt*(1.0+255.0/253.0));// assuming alpha=255/253,beta=1 
-            for(int i=0;i<length;i++)
-            {
-                RGB[color].datos[i] = (RGB[color].datos[i] + dt*(RGBorig[color].datos[i] + 0.5*u0.datos[i]+255.0/253.0 *med[color])) / norm;
-                //project onto the interval [0,1]
-                RGB[color].datos[i] = max( min( RGB[color].datos[i],1) , 0 );
-            }
-            
-            difference+=RGB0.MSE(RGB[color],1.0);
-            
-            //for debugging purposes only:
-            //fprintf(stderr,"diff=%f, it=%d, range:(%f,%f)\n",difference,iteration, RGB[color].minval(),RGB[color].maxval());
-        }
-        c1=clock();
+      float a;
+      if( log10(o[d]) <= logs+r )
+        a = K_*log10( o[d] + I0 ) + mKlogc;
+      else
+      {
+        const float In = pow( o[d], n );
+        a = In/(In+sigma_n);
+      }
+      v[d] = a;
+      vmin = min( vmin, a );
+      vmax = max( vmax, a );
     }
-    delete[] U;
-    delete[] U2;
-    delete[] U3;
-    delete[] U4;
-    delete[] U5;
-    delete[] U6;
-    delete[] U7;
-    
-    delete[] UG;
-    delete[] U2G;
-    delete[] U3G;
-    delete[] U4G;
-    delete[] U5G;
-    delete[] U6G;
-    delete[] U7G;
-    
-    fprintf(stderr,"\nComplete execution done in: %f secs\n", (float)(c1 - cInit)/(float)CLOCKS_PER_SEC);
-    
-    for(int c=0;c<3;c++)
-        RGB[c].escala(1,0);
-    
-    //range between (0,1)
-    for (int i =0;i<length;i++){
-        imR[i] = (float)RGB[0].datos[i];
-        imG[i] = (float)RGB[1].datos[i];
-        imB[i] = (float)RGB[2].datos[i];
+
+    const float escalamez = 1.0/(vmax-vmin+1e-12);
+    double sum = 0;
+    #pragma omp parallel for simd schedule(static) reduction(+:sum)
+    for( int d=0; d<length; d++ )
+    {
+      const float a = (v[d]-vmin)*escalamez;
+      v[d] = a;
+      o[d] = a;
+      sum += a;
     }
- 
-    delete[] G;
-}
+    med[k] = sum/length;
+  }
 
+  int cFin = clock();
+  fprintf(stderr,"Step 1 done in: %f", (float)(cFin - cInit)/(float)CLOCKS_PER_SEC);
 
+  // assuming alpha=255/253,beta=1
+  const float norm = 1.0/(1.0 + dt*(1.0+255.0/253.0));
+  double difference = 1000.0;
+  while( difference > threshold_diff )
+  {
+    difference = 0.0;
+    for( int color=0; color<colors; color++ )
+    {
+      float *u = RGB[color];
+      const float *o = orig[color];
+
+      // normalizing R term to estandarize results
+      const float maxabs = contrastTerm( u );
+      const float scale = maxabs > 0 ? 0.5f/maxabs : 0.f;
+      const float bias = 255.0/253.0*med[color];
+
+      double diff = 0;
+      #pragma omp parallel for simd schedule(static) reduction(+:diff)
+      for( int i=0; i<length; i++ )
+      {
+        float a = (u[i] + dt*(o[i] + scale*contrast[i] + bias))*norm;
+        //project onto the interval [0,1]
+        a = max( min( a, 1.f ), 0.f );
+        diff += fabsf( a - u[i] );
+        u[i] = a;
+      }
+      difference += diff/length;
+    }
+  }
 
+  int c1 = clock();
+  fprintf(stderr,"\nComplete execution done in: %f secs\n", (float)(c1 - cInit)/(float)CLOCKS_PER_SEC);
+
+  //range between (0,1)
+  for( int c=0; c<3; c++ )
+  {
+    float *v = RGB[c];
+    float vmin = FLT_MAX, vmax = -FLT_MAX;
+    #pragma omp parallel for simd schedule(static) reduction(min:vmin) reduction(max:vmax)
+    for( int i=0; i<length; i++ )
+    {
+      vmin = min( vmin, v[i] );
+      vmax = max( vmax, v[i] );
+    }
+    const float s = vmax > vmin ? 1.f/(vmax-vmin) : 0.f;
+    #pragma omp parallel for simd schedule(static)
+    for( int i=0; i<length; i++ )
+      v[i] = (v[i]-vmin)*s;
+  }
+}
+
+
+void tmo_ferradans11( int col, int fil, float *imR, float *imG, float *imB,
+  float rho, float invalpha )
+{
+  Ferradans11Context context;
+  context.tonemap( col, fil, imR, imG, imB, rho, invalpha );
+}
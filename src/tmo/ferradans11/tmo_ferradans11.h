@@ -0,0 +1,92 @@
+/**
+ * @file tmo_ferradans11.h
+ * Implementation of the algorithm presented in :
+ *
+ * An Analysis of Visual Adaptation and Contrast Perception for Tone Mapping
+ * S. Ferradans, M. Bertalmio, E. Provenzi, V. Caselles
+ * In IEEE Trans. Pattern Analysis and Machine Intelligence
+ *
+ * @author Sira Ferradans Copyright (C) 2013
+ *
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ *
+ */
+
+#ifndef TMO_FERRADANS11_H
+#define TMO_FERRADANS11_H
+
+#include <fftw3.h>
+
+/**
+ * @brief Workspace of the Ferradans11 operator
+ *
+ * The working buffers and the FFT plans are allocated once and reused
+ * as long as consecutive frames have the same size. The spectrum of
+ * the Gaussian kernel is cached for the last (size, inv_alpha) pair.
+ *
+ * The plans are created and destroyed under the FFTW planner lock
+ * (fftw_lock.h), so several contexts can be used concurrently.
+ */
+class Ferradans11Context
+{
+public:
+  Ferradans11Context();
+  ~Ferradans11Context();
+
+  /**
+   * @brief Tone map one frame
+   *
+   * @param col image width
+   * @param fil image height
+   * @param imR,imG,imB [in] linear RGB, [out] tone mapped RGB in (0,1)
+   * @param rho overall intensity of the result
+   * @param invalpha contrast resolution
+   */
+  void tonemap( int col, int fil, float *imR, float *imG, float *imB,
+    float rho, float invalpha );
+
+private:
+  int fil, col;
+  float kernel_invalpha;
+
+  float *orig[3];           // adapted image, the attachment term
+  float *power;             // u^j, input of the forward FFT
+  float *conv;              // G * u^j, output of the inverse FFT
+  float *contrast;          // contrast enhancement term R(u)
+  fftwf_complex *spectrum;
+  fftwf_complex *kernel;    // spectrum of the Gaussian, scaled by 1/(fil*col)
+  fftwf_plan forward, inverse;
+
+  void allocate( int fil, int col );
+  void release();
+  void setKernel( float invalpha );
+  float contrastTerm( const float *u );
+
+  Ferradans11Context( const Ferradans11Context& );
+  Ferradans11Context& operator=( const Ferradans11Context& );
+};
+
+/**
+ * Tone map a single frame using a temporary context.
+ */
+void tmo_ferradans11( int col, int fil, float *imR, float *imG, float *imB,
+  float rho, float invalpha );
+
+#endif
@@ -1,14 +1,34 @@
 #ifndef COMPRESSION_TMO
 #define COMPRESSION_TMO
 
+#include <vector>
+
 #include <pfstmo.h>
 
 class CompressionTMO
 {
  public:
+  CompressionTMO();
+
   void tonemap(const float *R_in, const float *G_in, float *B_in, int width, int height,
         float *R_out, float *G_out, float *B_out, const float *L_in,
         pfstmo_progress_callback progress_cb = NULL );
+
+ private:
+  /// Histogram of log10 luminance, a statistics functor for reduce_tiles()
+  struct HistogramStats
+  {
+    const float *L;
+    std::vector<int> bins;
+
+    void add( int begin, int end );
+    void merge( const HistogramStats& other );
+  };
+
+  // Workspace, kept between frames
+  std::vector<int> bins;      // histogram of log10 luminance
+  std::vector<HistogramStats> tile_hist; // histograms of the tiles of a frame
+  std::vector<float> curve;   // tone curve sampled at the bin edges
 };
 
 
@@ -33,11 +33,9 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <iostream>
-#include <memory>
 
 #include <sys/time.h>
 
@@ -46,7 +44,7 @@
 
 #include <config.h>
 
-#include "compression_tmo.h"
+#include "tmo_context.h"
 
 #define PROG_NAME "pfstmo_mai11"
 
@@ -105,11 +103,8 @@ int progress_report( int progress )
 void tmo_mai11(int argc, char * argv[])
 {
 
-  //--- default tone mapping parameters;
-
   //--- process command line args
 
-  
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "verbose", no_argument, NULL, 'v' },
@@ -119,7 +114,7 @@ void tmo_mai11(int argc, char * argv[])
 
   int optionIndex = 0;
   while( 1 ) {
-    int c = getopt_long (argc, argv, "vhe:c:y:t:o:qm:f:a:", cmdLineOptions, &optionIndex);
+    int c = getopt_long (argc, argv, "vhq", cmdLineOptions, &optionIndex);
     if( c == -1 ) break;
     switch( c ) {
     case 'h':
@@ -131,6 +126,10 @@ void tmo_mai11(int argc, char * argv[])
     case 'q':
       quiet = true;
       break;
+    case '?':
+      throw QuietException();
+    case ':':
+      throw QuietException();
     }
   }
 
@@ -139,7 +138,7 @@ void tmo_mai11(int argc, char * argv[])
 
   pfs::DOMIO pfsio;
 
-  CompressionTMO tmo;
+  pfstmo::Context *tmo = NULL;
 
   size_t frame_no = 0;
   while( true ) {
@@ -150,6 +149,8 @@ void tmo_mai11(int argc, char * argv[])
     pfs::Channel *inX, *inY, *inZ;
 	
     frame->getXYZChannels(inX, inY, inZ);
+    if( inY==NULL || inX==NULL || inZ==NULL )
+      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
     int cols = frame->getWidth();
     int rows = frame->getHeight();
 
@@ -165,32 +166,24 @@ void tmo_mai11(int argc, char * argv[])
     }
     
 
-    {
-      pfs::Array2DImpl R( cols, rows );
-  
-      pfs::transformColorSpace( pfs::CS_XYZ, inX, inY, inZ, pfs::CS_RGB, inX, &R, inZ );        
-
-
-      tmo.tonemap( inX->getRawData(), R.getRawData(), inZ->getRawData(), cols, rows,
-        inX->getRawData(), R.getRawData(), inZ->getRawData(), inY->getRawData(),
-		progress_report );
-        
-        progress_report( 100 );        
-
-        pfs::transformColorSpace( pfs::CS_RGB, inX, &R, inZ, pfs::CS_XYZ, inX, inY, inZ );
-        frame->getTags()->setString("LUMINANCE", "DISPLAY");
-  
-        pfsio.writeFrame( frame, stdout );
-     
-        
-      pfsio.freeFrame(frame);
+    // buffers are reused for all frames of the same size
+    if( tmo == NULL || tmo->getWidth() != cols || tmo->getHeight() != rows ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "mai11", cols, rows, pfstmo::Options() );
     }
-    
+
+    tmo->process( inX->getRawData(), inY->getRawData(), inZ->getRawData(), progress_report );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
+
+    pfsio.writeFrame( frame, stdout );
+    pfsio.freeFrame(frame);
 
     frame_no++;
 
   }
 
+  delete tmo;
+
   tm_entire.report( "Entire operation" );
 }
 
@@ -55,10 +55,38 @@ typedef struct pyramid_s {
   int cols;
   float* Gx;
   float* Gy;
+  float* temp;  // scratch matrix of the size of the finest level (finest level only)
   struct pyramid_s* next;
   struct pyramid_s* prev;
 } pyramid_t;
 
+// uniform lookup tables for the transducer functions (G <-> R)
+#define TRANSDUCER_LUT_SIZE 4096
+typedef struct transducer_s {
+  float G_scale;  // LUT index = G * G_scale
+  float R_scale;  // LUT index = R * R_scale
+  float G_to_R[TRANSDUCER_LUT_SIZE];
+  float R_to_G[TRANSDUCER_LUT_SIZE];
+} transducer_t;
+
+#define SOLVER_VECTORS 7
+
+// All buffers needed to tone map a frame of a given size. They are
+// reused for all frames of that size by Mantiuk06Context, so that
+// tone mapping a sequence does not allocate memory for every frame.
+struct mantiuk06_workspace {
+  int cols;
+  int rows;
+  transducer_t transducer;
+  pyramid_t* pp;              // gradient pyramid
+  pyramid_t* pC;              // scale factors (Cx,Cy)
+  float* b;                   // right hand side of the linear system
+  float* scratch;             // matrix of the size of the frame
+  float* vec[SOLVER_VECTORS]; // vectors of the linear solvers (allocated on first use)
+  struct mg_level_s* mg;      // multigrid hierarchy for linpcg (allocated on first use)
+  struct hist_data* hist;     // histogram for contrast_equalization (allocated on first use)
+};
+
 
 extern float xyz2rgbD65Mat[3][3];
 extern float rgb2xyzD65Mat[3][3];
@@ -66,9 +94,9 @@ extern float rgb2xyzD65Mat[3][3];
 #define PYRAMID_MIN_PIXELS 3
 #define LOOKUP_W_TO_R 107
 
-static void contrast_equalization( pyramid_t *pp, const float contrastFactor );
+static void contrast_equalization( mantiuk06_workspace* ws, const float contrastFactor );
 
-static void transform_to_luminance(pyramid_t* pyramid, float* const x, pfstmo_progress_callback progress_cb, const bool bcg);
+static void transform_to_luminance(mantiuk06_workspace* ws, float* const x, pfstmo_progress_callback progress_cb, const mantiuk06_solver solver, const int itmax, const float tol);
 static void matrix_add(const int n, const float* const a, float* const b);
 static void matrix_subtract(const int n, const float* const a, float* const b);
 static void matrix_copy(const int n, const float* const a, float* const b);
@@ -78,27 +106,27 @@ static float* matrix_alloc(const int size);
 static void matrix_free(float* m);
 static float matrix_DotProduct(const int n, const float* const a, const float* const b);
 static void matrix_zero(const int n, float* const m);
-static void calculate_and_add_divergence(const int rows, const int cols, const float* const Gx, const float* const Gy, float* const divG);
-static void pyramid_calculate_divergence(pyramid_t* pyramid);
+static float* workspace_vector(mantiuk06_workspace* ws, const int k);
+static void calculate_divergence(const int cols, const int rows, const float* const Gx, const float* const Gy, const float* const coarse, float* const divG);
 static void pyramid_calculate_divergence_sum(pyramid_t* pyramid, float* divG_sum);
-static void calculate_scale_factor(const int n, const float* const G, float* const C);
-static void pyramid_calculate_scale_factor(pyramid_t* pyramid, pyramid_t* pC);
-static void scale_gradient(const int n, float* const G, const float* const C);
-static void pyramid_scale_gradient(pyramid_t* pyramid, pyramid_t* pC);
+static void calculate_and_apply_scale_factor(const int n, float* const G, float* const C);
+static void pyramid_calculate_and_apply_scale_factor(pyramid_t* pyramid, pyramid_t* pC);
 static void pyramid_free(pyramid_t* pyramid);
 static pyramid_t* pyramid_allocate(const int cols, const int rows);
-static void calculate_gradient(const int cols, const int rows, const float* const lum, float* const Gx, float* const Gy);
-static void pyramid_calculate_gradient(pyramid_t* pyramid, float* lum);
+static void calculate_gradient(const int cols, const int rows, const float* const lum, float* const Gx, float* const Gy, const float* const Cx, const float* const Cy);
+static void pyramid_calculate_gradient(pyramid_t* pyramid, const float* const lum, float* const scratch, pyramid_t* pC);
 static void solveX(const int n, const float* const b, float* const x);
 static void multiplyA(pyramid_t* px, pyramid_t* pyramid, const float* const x, float* const divG_sum);
-static void linbcg(pyramid_t* pyramid, pyramid_t* pC, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb);
-static void lincg(pyramid_t* pyramid, pyramid_t* pC, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb);
+static void linbcg(mantiuk06_workspace* ws, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb);
+static void lincg(mantiuk06_workspace* ws, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb);
+static void linpcg(mantiuk06_workspace* ws, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb);
 static float lookup_table(const int n, const float* const in_tab, const float* const out_tab, const float val);
-static void transform_to_R(const int n, float* const G);
-static void pyramid_transform_to_R(pyramid_t* pyramid);
-static void transform_to_G(const int n, float* const R);
-static void pyramid_transform_to_G(pyramid_t* pyramid);
-static void pyramid_gradient_multiply(pyramid_t* pyramid, const float val);
+static void transducer_init(transducer_t* const t);
+static void transform_to_R(const transducer_t* const t, const int n, float* const G);
+static void pyramid_transform_to_R(const transducer_t* const t, pyramid_t* pyramid);
+static void transform_to_G(const transducer_t* const t, const int n, float* const R);
+static void pyramid_transform_to_G(const transducer_t* const t, pyramid_t* pyramid);
+static void pyramid_contrast_map(const transducer_t* const t, pyramid_t* pyramid, const float contrastFactor);
 
 static void dump_matrix_to_file(const int width, const int height, const float* const m, const char * const file_name);
 static void matrix_show(const char* const text, int rows, int cols, const float* const data);
@@ -170,45 +198,6 @@ static inline int imin(int a, int b)
 }
 
 
-// upsample the matrix
-// upsampled matrix is twice bigger in each direction than data[]
-// res should be a pointer to allocated memory for bigger matrix
-// cols and rows are the dimmensions of the output matrix
-static void matrix_upsample(const int outCols, const int outRows, const float* const in, float* const out)
-{
-  const int inRows = outRows/2;
-  const int inCols = outCols/2;
-
-  // Transpose of experimental downsampling matrix (theoretically the correct thing to do)
-
-  const float dx = (float)inCols / ((float)outCols);
-  const float dy = (float)inRows / ((float)outRows);
-  const float factor = 1.0f / (dx*dy); // This gives a genuine upsampling matrix, not the transpose of the downsampling matrix
-  // const float factor = 1.0f; // Theoretically, this should be the best.
-
-#pragma omp parallel for schedule(static)
-  for (int y = 0; y < outRows; y++)
-    {
-      const float sy = y * dy;
-      const int iy1 =      (  y   * inRows) / outRows;
-      const int iy2 = imin(((y+1) * inRows) / outRows, inRows-1);
-
-      for (int x = 0; x < outCols; x++)
-	{
-	  const float sx = x * dx;
-	  const int ix1 =      (  x   * inCols) / outCols;
-	  const int ix2 = imin(((x+1) * inCols) / outCols, inCols-1);
-
-	  out[x + y*outCols] = (
-	    ((ix1+1) - sx)*((iy1+1 - sy)) * in[ix1 + iy1*inCols] +
-	    ((ix1+1) - sx)*(sy+dy - (iy1+1)) * in[ix1 + iy2*inCols] +
-	    (sx+dx - (ix1+1))*((iy1+1 - sy)) * in[ix2 + iy1*inCols] +
-	    (sx+dx - (ix1+1))*(sy+dx - (iy1+1)) * in[ix2 + iy2*inCols])*factor;
-	}
-    }
-}
-
-
 // downsample the matrix
 static void matrix_downsample(const int inCols, const int inRows, const float* const data, float* const res)
 {
@@ -352,37 +341,75 @@ static inline void matrix_zero(int n, float* m)
   bzero(m, n*sizeof(float));
 }
 
+// solver vector k of the workspace, allocated on first use
+static float* workspace_vector(mantiuk06_workspace* ws, const int k)
+{
+  if (ws->vec[k] == NULL)
+    ws->vec[k] = matrix_alloc(ws->cols * ws->rows);
+  return ws->vec[k];
+}
+
 // calculate divergence of two gradient maps (Gx and Gy)
 // divG(x,y) = Gx(x,y) - Gx(x-1,y) + Gy(x,y) - Gy(x,y-1)  
-static inline void calculate_and_add_divergence(const int cols, const int rows, const float* const Gx, const float* const Gy, float* const divG)
+// If coarse is not NULL, the divergence map of the coarser level (half
+// the size in each direction) is upsampled and added in the same pass
+static void calculate_divergence(const int cols, const int rows, const float* const Gx, const float* const Gy, const float* const coarse, float* const divG)
 {
+  const int inRows = rows/2;
+  const int inCols = cols/2;
+
+  // Transpose of experimental downsampling matrix (theoretically the correct thing to do)
+
+  const float dx = (float)inCols / ((float)cols);
+  const float dy = (float)inRows / ((float)rows);
+  const float factor = 1.0f / (dx*dy); // This gives a genuine upsampling matrix, not the transpose of the downsampling matrix
+  // const float factor = 1.0f; // Theoretically, this should be the best.
+
 #pragma omp parallel for schedule(static)
   for(int ky=0; ky<rows; ky++)
-    for(int kx=0; kx<cols; kx++)
-      {
-	float divGx, divGy;
-	const int idx = kx + ky*cols;
+    {
+      const float sy = ky * dy;
+      const int iy1 =      (  ky   * inRows) / rows;
+      const int iy2 = imin(((ky+1) * inRows) / rows, inRows-1);
+
+      for(int kx=0; kx<cols; kx++)
+	{
+	  float divGx, divGy;
+	  const int idx = kx + ky*cols;
 	
-	if(kx == 0)
-	  divGx = Gx[idx];
-	else	
-	  divGx = Gx[idx] - Gx[idx-1];
+	  if(kx == 0)
+	    divGx = Gx[idx];
+	  else	
+	    divGx = Gx[idx] - Gx[idx-1];
 	
-	if(ky == 0)
-	  divGy = Gy[idx];
-	else	
-	  divGy = Gy[idx] - Gy[idx - cols];			
+	  if(ky == 0)
+	    divGy = Gy[idx];
+	  else	
+	    divGy = Gy[idx] - Gy[idx - cols];			
+
+	  float up = 0.0f;
+	  if(coarse != NULL)
+	    {
+	      const float sx = kx * dx;
+	      const int ix1 =      (  kx   * inCols) / cols;
+	      const int ix2 = imin(((kx+1) * inCols) / cols, inCols-1);
+
+	      up = (((ix1+1) - sx)*((iy1+1 - sy)) * coarse[ix1 + iy1*inCols] +
+		    ((ix1+1) - sx)*(sy+dy - (iy1+1)) * coarse[ix1 + iy2*inCols] +
+		    (sx+dx - (ix1+1))*((iy1+1 - sy)) * coarse[ix2 + iy1*inCols] +
+		    (sx+dx - (ix1+1))*(sy+dx - (iy1+1)) * coarse[ix2 + iy2*inCols])*factor;
+	    }
 		
-	divG[idx] += divGx + divGy;			
+	  divG[idx] = up + divGx + divGy;			
+	}
     }
 }
 
 // calculate the sum of divergences for the all pyramid level
 // the smaller divergence map is upsamled and added to the divergence map for the higher level of pyramid
-// temp is a temporary matrix of size (cols, rows), assumed to already be allocated
 static void pyramid_calculate_divergence_sum(pyramid_t* pyramid, float* divG_sum)
 {
-  float* temp = matrix_alloc(pyramid->rows*pyramid->cols);
+  float* temp = pyramid->temp;
 
   // Find the coarsest pyramid, and the number of pyramid levels
   int levels = 1;
@@ -403,21 +430,14 @@ static void pyramid_calculate_divergence_sum(pyramid_t* pyramid, float* divG_sum
   // Add them all together
   while (pyramid != NULL)
     {
-      // Upsample or zero as needed
-      if (pyramid->next != NULL)
-	matrix_upsample(pyramid->cols, pyramid->rows, divG_sum, temp);
-      else
-	matrix_zero(pyramid->rows * pyramid->cols, temp);
-
-      // Add in the (freshly calculated) divergences
-      calculate_and_add_divergence(pyramid->cols, pyramid->rows, pyramid->Gx, pyramid->Gy, temp);
+      // Upsample the coarser level (if any) and add in the (freshly calculated) divergences
+      calculate_divergence(pyramid->cols, pyramid->rows, pyramid->Gx, pyramid->Gy,
+			   pyramid->next != NULL ? divG_sum : NULL, temp);
 
 //   char name[256];
 //   sprintf( name, "Up_%d.pfs", pyramid->cols );
 //   dump_matrix_to_file( pyramid->cols, pyramid->rows, temp, name );  
 
-      // matrix_copy(pyramid->rows*pyramid->cols, temp, divG_sum);
-
       // Rather than copying, just switch round the pointers: we know we get them the right way round at the end.
       float* const dummy = divG_sum;
       divG_sum = temp;
@@ -425,16 +445,12 @@ static void pyramid_calculate_divergence_sum(pyramid_t* pyramid, float* divG_sum
 
       pyramid = pyramid->prev;
     }
-
-  matrix_free(temp);
 }
 
-// calculate scale factors (Cx,Cy) for gradients (Gx,Gy)
-// C is equal to EDGE_WEIGHT for gradients smaller than GFIXATE or 1.0 otherwise
-static inline void calculate_scale_factor(const int n, const float* const G, float* const C)
+// calculate scale factors (Cx,Cy) for gradients (Gx,Gy) and scale the gradients
+// G = G * C
+static inline void calculate_and_apply_scale_factor(const int n, float* const G, float* const C)
 {
-  float GFIXATE = 0.1f;
-  float EDGE_WEIGHT = 0.01f;
   const float detectT = 0.001f;
   const float a = 0.038737;
   const float b = 0.537756;
@@ -442,48 +458,21 @@ static inline void calculate_scale_factor(const int n, const float* const G, flo
 #pragma omp parallel for schedule(static)
   for(int i=0; i<n; i++)
     {
-#if 1
       const float g = max( detectT, fabsf(G[i]) );    
-      C[i] = 1.0f / (a*powf(g,b));
-#else
-      if(fabsf(G[i]) < GFIXATE)
-	C[i] = 1.0f / EDGE_WEIGHT;
-      else	
-	C[i] = 1.0f;
-#endif
-    }
-}
-
-// calculate scale factor for the whole pyramid
-static void pyramid_calculate_scale_factor(pyramid_t* pyramid, pyramid_t* pC)
-{
-  while (pyramid != NULL)
-    {
-      const int size = pyramid->rows * pyramid->cols;
-      calculate_scale_factor(size, pyramid->Gx, pC->Gx);
-      calculate_scale_factor(size, pyramid->Gy, pC->Gy);
-      pyramid = pyramid->next;
-      pC = pC->next;
+      const float c = 1.0f / (a*powf(g,b));
+      C[i] = c;
+      G[i] *= c;
     }
 }
 
-// Scale gradient (Gx and Gy) by C (Cx and Cy)
-// G = G / C
-static inline void scale_gradient(const int n, float* const G, const float* const C)
-{
-#pragma omp parallel for schedule(static)
-  for(int i=0; i<n; i++)
-    G[i] *= C[i];
-}
-
-// scale gradients for the whole one pyramid with the use of (Cx,Cy) from the other pyramid
-static void pyramid_scale_gradient(pyramid_t* pyramid, pyramid_t* pC)
+// calculate scale factor for the whole pyramid and scale the gradients
+static void pyramid_calculate_and_apply_scale_factor(pyramid_t* pyramid, pyramid_t* pC)
 {
   while (pyramid != NULL)
     {
       const int size = pyramid->rows * pyramid->cols;
-      scale_gradient(size, pyramid->Gx, pC->Gx);	
-      scale_gradient(size, pyramid->Gy, pC->Gy);
+      calculate_and_apply_scale_factor(size, pyramid->Gx, pC->Gx);
+      calculate_and_apply_scale_factor(size, pyramid->Gy, pC->Gy);
       pyramid = pyramid->next;
       pC = pC->next;
     }
@@ -493,58 +482,56 @@ static void pyramid_scale_gradient(pyramid_t* pyramid, pyramid_t* pC)
 // free memory allocated for the pyramid
 static void pyramid_free(pyramid_t* pyramid)
 {
-  while (pyramid)
-    {
-      if(pyramid->Gx != NULL)
-	{
-	  free(pyramid->Gx);
-	  pyramid->Gx = NULL;
-	}
-      if(pyramid->Gy != NULL)
-	{
-	  free(pyramid->Gy);
-	  pyramid->Gy = NULL;
-	}
-      pyramid_t* const next = pyramid->next;
-      pyramid->prev = NULL;
-      pyramid->next = NULL;
-      free(pyramid);
-      pyramid = next;
-    }			
+  // all levels live in a single block owned by the finest level
+  free(pyramid);
 }
 
 
 // allocate memory for the pyramid
+// All levels, their gradient maps and the scratch matrix are allocated
+// as a single block, so that creating a pyramid costs one malloc.
 static pyramid_t * pyramid_allocate(int cols, int rows)
 {
-  pyramid_t* level = NULL;
-  pyramid_t* pyramid = NULL;
-  pyramid_t* prev = NULL;
+  int levels = 0;
+  size_t size = (size_t)cols*rows; // scratch matrix
+  for (int c = cols, r = rows; r >= PYRAMID_MIN_PIXELS && c >= PYRAMID_MIN_PIXELS; c /= 2, r /= 2)
+    {
+      levels++;
+      size += 2*(size_t)c*r;
+    }
 
-  while(rows >= PYRAMID_MIN_PIXELS && cols >= PYRAMID_MIN_PIXELS)
+  const size_t bytes = sizeof(pyramid_t)*levels + sizeof(float)*size;
+  char* const block = (char*)malloc(bytes);
+  if(block == NULL)
     {
-      level = (pyramid_t *) malloc(sizeof(pyramid_t));
-      if(level == NULL)
-	{
-	  fprintf(stderr, "ERROR: malloc in pyramid_alloc() (size:%d)", (int)sizeof(pyramid_t));
-	  exit(155);
-	}
-      memset( level, 0, sizeof(pyramid_t) );
-      
+      fprintf(stderr, "ERROR: malloc in pyramid_alloc() (size:%d)", (int)bytes);
+      exit(155);
+    }
+
+  pyramid_t* const pyramid = (pyramid_t*)block;
+  float* data = (float*)(block + sizeof(pyramid_t)*levels);
+  pyramid->temp = data;
+  data += cols*rows;
+
+  pyramid_t* prev = NULL;
+  for (int l = 0; l < levels; l++)
+    {
+      pyramid_t* const level = pyramid + l;
       level->rows = rows;
       level->cols = cols;
+      if (l > 0)
+	level->temp = NULL;
       const int size = level->rows * level->cols;
-      level->Gx = matrix_alloc(size);
-      level->Gy = matrix_alloc(size);
+      level->Gx = data;
+      level->Gy = data + size;
+      data += 2*size;
       
       level->prev = prev;
+      level->next = NULL;
       if(prev != NULL)
 	prev->next = level;
       prev = level;
       
-      if(pyramid == NULL)
-	pyramid = level;
-      
       rows /= 2;
       cols /= 2;		
   }
@@ -554,7 +541,8 @@ static pyramid_t * pyramid_allocate(int cols, int rows)
 
 
 // calculate gradients
-static inline void calculate_gradient(const int cols, const int rows, const float* const lum, float* const Gx, float* const Gy)
+// If Cx and Cy are not NULL, the gradients are scaled by them: G = G * C
+static inline void calculate_gradient(const int cols, const int rows, const float* const lum, float* const Gx, float* const Gy, const float* const Cx, const float* const Cy)
 {
 #pragma omp parallel for schedule(static)
   for(int ky=0; ky<rows; ky++){
@@ -564,12 +552,16 @@ static inline void calculate_gradient(const int cols, const int rows, const floa
 			
       if(kx == (cols - 1))
         Gx[idx] = 0;
-      else	
+      else if(Cx != NULL)
+        Gx[idx] = (lum[idx+1] - lum[idx]) * Cx[idx];
+      else
         Gx[idx] = lum[idx+1] - lum[idx];
 			
       if(ky == (rows - 1))
         Gy[idx] = 0;
-      else	
+      else if(Cy != NULL)
+        Gy[idx] = (lum[idx + cols] - lum[idx]) * Cy[idx];
+      else
         Gy[idx] = lum[idx + cols] - lum[idx];
     }
   }
@@ -595,38 +587,41 @@ static void dump_matrix_to_file(const int width, const int height, const float*
 }  
 
 // calculate gradients for the pyramid
-// lum_temp gets overwritten!
-static void pyramid_calculate_gradient(pyramid_t* pyramid, float* lum_temp)
+// scratch (of the size of the finest level) gets overwritten!
+// If pC is not NULL, gradients are scaled by (Cx,Cy) from that pyramid
+static void pyramid_calculate_gradient(pyramid_t* pyramid, const float* const lum, float* const scratch, pyramid_t* pC)
 {
-  float* temp = matrix_alloc((pyramid->rows/2)*(pyramid->cols/2));
-  float* const temp_saved = temp;
+  float* temp = pyramid->temp;
+  float* next_temp = scratch;
+  const float* lum_level = lum;
 
-  calculate_gradient(pyramid->cols, pyramid->rows, lum_temp, pyramid->Gx, pyramid->Gy);	
+  calculate_gradient(pyramid->cols, pyramid->rows, lum_level, pyramid->Gx, pyramid->Gy,
+		     pC != NULL ? pC->Gx : NULL, pC != NULL ? pC->Gy : NULL);
 
   pyramid = pyramid->next;
+  if (pC != NULL)
+    pC = pC->next;
 
   //  int l = 1;
   while(pyramid)
     {
-      matrix_downsample(pyramid->prev->cols, pyramid->prev->rows, lum_temp, temp);
+      matrix_downsample(pyramid->prev->cols, pyramid->prev->rows, lum_level, temp);
 		
-//     fprintf( stderr, "%d x %d -> %d x %d\n", pyramid->cols, pyramid->rows,
-//       prev_pp->cols, prev_pp->rows );
-    
 //      char name[40];
 //      sprintf( name, "ds_%d.pfs", l++ );
 //      dump_matrix_to_file( pyramid->cols, pyramid->rows, temp, name );    
 		
-      calculate_gradient(pyramid->cols, pyramid->rows, temp, pyramid->Gx, pyramid->Gy);
+      calculate_gradient(pyramid->cols, pyramid->rows, temp, pyramid->Gx, pyramid->Gy,
+			 pC != NULL ? pC->Gx : NULL, pC != NULL ? pC->Gy : NULL);
 		
-      float* const dummy = lum_temp;
-      lum_temp = temp;	
-      temp = dummy;
+      lum_level = temp;
+      temp = next_temp;
+      next_temp = (float*)lum_level;
 			
       pyramid = pyramid->next;
+      if (pC != NULL)
+	pC = pC->next;
   }
-
-  matrix_free(temp_saved);
 }
 
 
@@ -642,29 +637,29 @@ static inline void solveX(const int n, const float* const b, float* const x)
 // memory for the temporary pyramid px should be allocated
 static inline void multiplyA(pyramid_t* px, pyramid_t* pC, const float* const x, float* const divG_sum)
 {
-  matrix_copy(pC->rows*pC->cols, x, divG_sum); // use divG_sum as a temp variable
-  pyramid_calculate_gradient(px, divG_sum);
-  pyramid_scale_gradient(px, pC); // scale gradients by Cx,Cy from main pyramid
+  pyramid_calculate_gradient(px, x, divG_sum, pC); // use divG_sum as a temp variable, scale gradients by Cx,Cy from main pyramid
   pyramid_calculate_divergence_sum(px, divG_sum); // calculate the sum of divergences
 } 
 
 
 // bi-conjugate linear equation solver
-// overwrites pyramid!
-static void linbcg(pyramid_t* pyramid, pyramid_t* pC, float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
+// overwrites the gradient pyramid of the workspace!
+static void linbcg(mantiuk06_workspace* ws, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
 {
+  pyramid_t* const pyramid = ws->pp;
+  pyramid_t* const pC = ws->pC;
   const int rows = pyramid->rows;
   const int cols = pyramid->cols;
   const int n = rows*cols;
   const float tol2 = tol*tol;
 	
-  float* const z = matrix_alloc(n);
-  float* const zz = matrix_alloc(n);
-  float* const p = matrix_alloc(n);
-  float* const pp = matrix_alloc(n);
-  float* const r = matrix_alloc(n);
-  float* const rr = matrix_alloc(n);	
-  float* const x_save = matrix_alloc(n);	
+  float* const z = workspace_vector(ws, 0);
+  float* const zz = workspace_vector(ws, 1);
+  float* const p = workspace_vector(ws, 2);
+  float* const pp = workspace_vector(ws, 3);
+  float* const r = workspace_vector(ws, 4);
+  float* const rr = workspace_vector(ws, 5);
+  float* const x_save = workspace_vector(ws, 6);
 	
   const float bnrm2 = matrix_DotProduct(n, b, b);
 	
@@ -797,31 +792,24 @@ static void linbcg(pyramid_t* pyramid, pyramid_t* pC, float* const b, float* con
     }
   else if (progress_cb != NULL)
     progress_cb(100);
-    
-  
-  matrix_free(x_save);
-  matrix_free(p);
-  matrix_free(pp);
-  matrix_free(z);
-  matrix_free(zz);
-  matrix_free(r);
-  matrix_free(rr);
 }
 
 
 // conjugate linear equation solver
-// overwrites pyramid!
-static void lincg(pyramid_t* pyramid, pyramid_t* pC, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
+// overwrites the gradient pyramid of the workspace!
+static void lincg(mantiuk06_workspace* ws, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
 {
+  pyramid_t* const pyramid = ws->pp;
+  pyramid_t* const pC = ws->pC;
   const int rows = pyramid->rows;
   const int cols = pyramid->cols;
   const int n = rows*cols;
   const float tol2 = tol*tol;
 	
-  float* const x_save = matrix_alloc(n);
-  float* const r = matrix_alloc(n);
-  float* const p = matrix_alloc(n);
-  float* const Ap = matrix_alloc(n);	
+  float* const x_save = workspace_vector(ws, 0);
+  float* const r = workspace_vector(ws, 1);
+  float* const p = workspace_vector(ws, 2);
+  float* const Ap = workspace_vector(ws, 3);
 	
   // bnrm2 = ||b||
   const float bnrm2 = matrix_DotProduct(n, b, b);
@@ -942,11 +930,427 @@ static void lincg(pyramid_t* pyramid, pyramid_t* pC, const float* const b, float
     }
   else if (progress_cb != NULL)
     progress_cb(100);
-    
-  matrix_free(x_save);
-  matrix_free(p);
-  matrix_free(Ap);
-  matrix_free(r);
+}
+
+
+// Multigrid preconditioner for the conjugate gradient solver.
+//
+// Each level stores a weighted Laplacian K = D' C D, where C are the
+// weights of the horizontal (cx) and vertical (cy) edges between
+// neighbouring pixels. The finest level uses the scale factors of the
+// finest pyramid level. Coarser levels are obtained by aggregating 2x2
+// blocks of pixels (Galerkin coarsening with piecewise constant
+// interpolation), to which the scale factors of the pyramid level of the
+// same resolution are added. This mirrors how multiplyA() sums the
+// divergences of all pyramid levels, so the hierarchy approximates -A,
+// while the operators stay symmetric and the V-cycle can be used as a
+// CG preconditioner.
+typedef struct mg_level_s {
+  int rows;
+  int cols;
+  float* cx;     // weight of the edge (x,y)-(x+1,y)
+  float* cy;     // weight of the edge (x,y)-(x,y+1)
+  float* idiag;  // damped inverse of the diagonal of K
+  float* z;      // solution
+  float* f;      // right hand side
+  float* res;    // residual
+  struct mg_level_s* next;
+} mg_level_t;
+
+#define MG_SMOOTH_OMEGA 0.8f
+#define MG_COARSEST_SWEEPS 8
+
+static mg_level_t* mg_level_allocate(const int cols, const int rows)
+{
+  mg_level_t* level = (mg_level_t *) malloc(sizeof(mg_level_t));
+  if(level == NULL)
+    {
+      fprintf(stderr, "ERROR: malloc in mg_level_allocate() (size:%d)", (int)sizeof(mg_level_t));
+      exit(155);
+    }
+  const int n = cols*rows;
+  level->cols = cols;
+  level->rows = rows;
+  level->cx = matrix_alloc(n);
+  level->cy = matrix_alloc(n);
+  level->idiag = matrix_alloc(n);
+  level->z = matrix_alloc(n);
+  level->f = matrix_alloc(n);
+  level->res = matrix_alloc(n);
+  level->next = NULL;
+  return level;
+}
+
+static void mg_free(mg_level_t* mg)
+{
+  while (mg != NULL)
+    {
+      matrix_free(mg->cx);
+      matrix_free(mg->cy);
+      matrix_free(mg->idiag);
+      matrix_free(mg->z);
+      matrix_free(mg->f);
+      matrix_free(mg->res);
+      mg_level_t* const next = mg->next;
+      free(mg);
+      mg = next;
+    }
+}
+
+// damped inverse of the diagonal, which is the sum of the incident edge weights
+static void mg_calculate_idiag(mg_level_t* level)
+{
+  const int cols = level->cols;
+  const int rows = level->rows;
+  const float* const cx = level->cx;
+  const float* const cy = level->cy;
+
+#pragma omp parallel for schedule(static)
+  for (int ky = 0; ky < rows; ky++)
+    for (int kx = 0; kx < cols; kx++)
+      {
+	const int idx = kx + ky*cols;
+	float d = cx[idx] + cy[idx];
+	if (kx > 0) d += cx[idx-1];
+	if (ky > 0) d += cy[idx-cols];
+	level->idiag[idx] = d > 0.0f ? MG_SMOOTH_OMEGA / d : 0.0f;
+      }
+}
+
+// allocate the hierarchy of levels for a frame of the given size
+static mg_level_t* mg_allocate(const int cols, const int rows)
+{
+  mg_level_t* const mg = mg_level_allocate(cols, rows);
+  mg_level_t* fine = mg;
+  while (fine->cols >= 2*PYRAMID_MIN_PIXELS && fine->rows >= 2*PYRAMID_MIN_PIXELS)
+    {
+      fine->next = mg_level_allocate((fine->cols+1)/2, (fine->rows+1)/2);
+      fine = fine->next;
+    }
+  return mg;
+}
+
+// build the hierarchy of operators from the scale factors of the finest level
+static void mg_setup(mg_level_t* const mg, const pyramid_t* const pC)
+{
+  // Gradients at the last column/row are always zero, so are their edges
+  const int cols = pC->cols;
+  const int rows = pC->rows;
+#pragma omp parallel for schedule(static)
+  for (int ky = 0; ky < rows; ky++)
+    for (int kx = 0; kx < cols; kx++)
+      {
+	const int idx = kx + ky*cols;
+	mg->cx[idx] = kx < cols-1 ? pC->Gx[idx] : 0.0f;
+	mg->cy[idx] = ky < rows-1 ? pC->Gy[idx] : 0.0f;
+      }
+  mg_calculate_idiag(mg);
+
+  const pyramid_t* pyr = pC->next;
+  float pyr_weight = 4.0f;
+  for (mg_level_t* fine = mg; fine->next != NULL; fine = fine->next)
+    {
+      const int fcols = fine->cols;
+      const int frows = fine->rows;
+      mg_level_t* const coarse = fine->next;
+      const int ccols = coarse->cols;
+      const int crows = coarse->rows;
+
+      // a coarse edge is the sum of the fine edges crossing between two blocks
+#pragma omp parallel for schedule(static)
+      for (int ky = 0; ky < crows; ky++)
+	for (int kx = 0; kx < ccols; kx++)
+	  {
+	    const int fx = 2*kx;
+	    const int fy = 2*ky;
+	    float cx = 0.0f, cy = 0.0f;
+	    if (fx+1 < fcols)
+	      {
+		cx += fine->cx[fx+1 + fy*fcols];
+		if (fy+1 < frows)
+		  cx += fine->cx[fx+1 + (fy+1)*fcols];
+	      }
+	    if (fy+1 < frows)
+	      {
+		cy += fine->cy[fx + (fy+1)*fcols];
+		if (fx+1 < fcols)
+		  cy += fine->cy[fx+1 + (fy+1)*fcols];
+	      }
+	    // the pyramid level of the same resolution
+	    if (pyr != NULL)
+	      {
+		const int px = imin(kx, pyr->cols-1);
+		const int py = imin(ky, pyr->rows-1);
+		if (px < pyr->cols-1)
+		  cx += pyr_weight * pyr->Gx[px + py*pyr->cols];
+		if (py < pyr->rows-1)
+		  cy += pyr_weight * pyr->Gy[px + py*pyr->cols];
+	      }
+
+	    coarse->cx[kx + ky*ccols] = kx < ccols-1 ? cx : 0.0f;
+	    coarse->cy[kx + ky*ccols] = ky < crows-1 ? cy : 0.0f;
+	  }
+      mg_calculate_idiag(coarse);
+
+      if (pyr != NULL)
+	pyr = pyr->next;
+      pyr_weight *= 4.0f;
+    }
+}
+
+// res = f - K z
+static void mg_residual(mg_level_t* level)
+{
+  const int cols = level->cols;
+  const int rows = level->rows;
+  const float* const cx = level->cx;
+  const float* const cy = level->cy;
+  const float* const z = level->z;
+
+#pragma omp parallel for schedule(static)
+  for (int ky = 0; ky < rows; ky++)
+    for (int kx = 0; kx < cols; kx++)
+      {
+	const int idx = kx + ky*cols;
+	const float zi = z[idx];
+	float Kz = 0.0f;
+	if (kx < cols-1) Kz += cx[idx] * (zi - z[idx+1]);
+	if (kx > 0)      Kz += cx[idx-1] * (zi - z[idx-1]);
+	if (ky < rows-1) Kz += cy[idx] * (zi - z[idx+cols]);
+	if (ky > 0)      Kz += cy[idx-cols] * (zi - z[idx-cols]);
+	level->res[idx] = level->f[idx] - Kz;
+      }
+}
+
+// one sweep of damped Jacobi: z = z + omega D^-1 (f - K z)
+static void mg_smooth(mg_level_t* level)
+{
+  const int n = level->cols * level->rows;
+  mg_residual(level);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n; i++)
+    level->z[i] += level->idiag[i] * level->res[i];
+}
+
+// symmetric V-cycle approximating z = K^-1 f with z starting from zero
+static void mg_vcycle(mg_level_t* level)
+{
+  const int n = level->cols * level->rows;
+
+  // first Jacobi sweep from z = 0 needs no residual
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n; i++)
+    level->z[i] = level->idiag[i] * level->f[i];
+
+  mg_level_t* const coarse = level->next;
+  if (coarse == NULL)
+    {
+      for (int s = 1; s < MG_COARSEST_SWEEPS; s++)
+	mg_smooth(level);
+      return;
+    }
+
+  // restrict the residual (sum over 2x2 blocks)
+  mg_residual(level);
+  const int fcols = level->cols;
+  const int frows = level->rows;
+  const int ccols = coarse->cols;
+#pragma omp parallel for schedule(static)
+  for (int ky = 0; ky < coarse->rows; ky++)
+    for (int kx = 0; kx < ccols; kx++)
+      {
+	const int fx = 2*kx;
+	const int fy = 2*ky;
+	float sum = level->res[fx + fy*fcols];
+	if (fx+1 < fcols) sum += level->res[fx+1 + fy*fcols];
+	if (fy+1 < frows)
+	  {
+	    sum += level->res[fx + (fy+1)*fcols];
+	    if (fx+1 < fcols) sum += level->res[fx+1 + (fy+1)*fcols];
+	  }
+	coarse->f[kx + ky*ccols] = sum;
+      }
+
+  mg_vcycle(coarse);
+
+  // prolongate the correction (piecewise constant)
+#pragma omp parallel for schedule(static)
+  for (int ky = 0; ky < frows; ky++)
+    for (int kx = 0; kx < fcols; kx++)
+      level->z[kx + ky*fcols] += coarse->z[(kx/2) + (ky/2)*ccols];
+
+  mg_smooth(level);
+}
+
+
+// r = b - A x, z = M^-1 r, p = z
+// returns r.r and stores r.z in rdotz
+static float pcg_restart(pyramid_t* pyramid, pyramid_t* pC, mg_level_t* mg, const float* const b, const float* const x, float* const p, float* const rdotz)
+{
+  const int n = mg->cols * mg->rows;
+  float* const r = mg->f;
+  const float* const z = mg->z;
+
+  multiplyA(pyramid, pC, x, r);
+  float rdotr = 0.0f;
+#pragma omp parallel for reduction(+:rdotr) schedule(static)
+  for (int i = 0; i < n; i++)
+    {
+      const float ri = b[i] - r[i];
+      r[i] = ri;
+      rdotr += ri*ri;
+    }
+
+  // M ~ -K, hence the sign change
+  mg_vcycle(mg);
+  float rz = 0.0f;
+#pragma omp parallel for reduction(+:rz) schedule(static)
+  for (int i = 0; i < n; i++)
+    {
+      p[i] = -z[i];
+      rz -= r[i]*z[i];
+    }
+
+  *rdotz = rz;
+  return rdotr;
+}
+
+// multigrid preconditioned conjugate gradient solver
+// The vector updates and dot products are fused with each other
+// so that an iteration makes as few passes over the data as possible.
+// overwrites the gradient pyramid of the workspace!
+static void linpcg(mantiuk06_workspace* ws, const float* const b, float* const x, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
+{
+  pyramid_t* const pyramid = ws->pp;
+  pyramid_t* const pC = ws->pC;
+  const int rows = pyramid->rows;
+  const int cols = pyramid->cols;
+  const int n = rows*cols;
+  const float tol2 = tol*tol;
+
+  if (ws->mg == NULL)
+    ws->mg = mg_allocate(cols, rows);
+  mg_level_t* const mg = ws->mg;
+  mg_setup(mg, pC);
+  float* const r = mg->f;  // the preconditioner reads the residual in place
+  float* const z = mg->z;  // and leaves its result here
+  float* const x_save = workspace_vector(ws, 0);
+  float* const p = workspace_vector(ws, 1);
+  float* const Ap = workspace_vector(ws, 2);
+
+  // bnrm2 = ||b||
+  const float bnrm2 = matrix_DotProduct(n, b, b);
+
+  float rdotz;
+  float rdotr = pcg_restart(pyramid, pC, mg, b, x, p, &rdotz);
+
+  // Setup initial vector
+  float saved_rdotr = rdotr;
+  matrix_copy(n, x, x_save);
+
+  const float irdotr = rdotr;
+  const float percent_sf = 100.0f/logf(tol2*bnrm2/irdotr);
+  int iter = 0;
+  int num_backwards = 0;
+  const int num_backwards_ceiling = 3;
+  for (; iter < itmax; iter++)
+    {
+      if( progress_cb != NULL ) {
+	int ret = progress_cb( (int) (logf(rdotr/irdotr)*percent_sf));
+        if( ret == PFSTMO_CB_ABORT && iter > 0 ) // User requested abort
+          break;
+      }
+
+      // Ap = A p
+      multiplyA(pyramid, pC, p, Ap);
+
+      // alpha = r.z / (p . Ap)
+      const float alpha = rdotz / matrix_DotProduct(n, p, Ap);
+
+      // r = r - alpha Ap, rdotr = r.r
+      const float old_rdotr = rdotr;
+      rdotr = 0.0f;
+#pragma omp parallel for reduction(+:rdotr) schedule(static)
+      for (int i = 0; i < n; i++)
+	{
+	  const float ri = r[i] - alpha * Ap[i];
+	  r[i] = ri;
+	  rdotr += ri*ri;
+	}
+
+      // Have we gone unstable?
+      if (rdotr > old_rdotr)
+	{
+	  // Save where we've got to
+	  if (num_backwards == 0 && old_rdotr < saved_rdotr)
+	    {
+	      saved_rdotr = old_rdotr;
+	      matrix_copy(n, x, x_save);
+	    }
+
+	  num_backwards++;
+	}
+      else
+	{
+	  num_backwards = 0;
+	}
+
+      // x = x + alpha p
+#pragma omp parallel for schedule(static)
+      for (int i = 0; i < n; i++)
+	x[i] += alpha * p[i];
+
+      // Exit if we're done
+      // fprintf(stderr, "iter:%d err:%f\n", iter+1, sqrtf(rdotr/bnrm2));
+      if(rdotr/bnrm2 < tol2)
+	break;
+
+      if (num_backwards > num_backwards_ceiling)
+	{
+	  // Reset
+	  num_backwards = 0;
+	  matrix_copy(n, x_save, x);
+	  rdotr = pcg_restart(pyramid, pC, mg, b, x, p, &rdotz);
+	  saved_rdotr = rdotr;
+	}
+      else
+	{
+	  // z = M^-1 r
+	  mg_vcycle(mg);
+
+	  // p = z + beta p
+	  const float old_rdotz = rdotz;
+	  rdotz = 0.0f;
+#pragma omp parallel for reduction(+:rdotz) schedule(static)
+	  for (int i = 0; i < n; i++)
+	    rdotz -= r[i]*z[i];
+
+	  const float beta = rdotz/old_rdotz;
+#pragma omp parallel for schedule(static)
+	  for (int i = 0; i < n; i++)
+	    p[i] = beta*p[i] - z[i];
+	}
+    }
+
+  // Use the best version we found
+  if (rdotr > saved_rdotr)
+    {
+      rdotr = saved_rdotr;
+      matrix_copy(n, x_save, x);
+    }
+
+  if (rdotr/bnrm2 > tol2)
+    {
+      // Not converged
+      if( progress_cb != NULL )
+	progress_cb( (int) (logf(rdotr/irdotr)*percent_sf));
+      if (iter == itmax)
+	fprintf(stderr, "\npfstmo_mantiuk06: Warning: Not converged (hit maximum iterations), error = %g (should be below %g).\n", sqrtf(rdotr/bnrm2), tol);
+      else
+	fprintf(stderr, "\npfstmo_mantiuk06: Warning: Not converged (going unstable), error = %g (should be below %g).\n", sqrtf(rdotr/bnrm2), tol);
+    }
+  else if (progress_cb != NULL)
+    progress_cb(100);
 }
 
 
@@ -967,85 +1371,110 @@ static inline float lookup_table(const int n, const float* const in_tab, const f
 }
 
 
+// fill in the uniform lookup tables of the transducer
+// G_to_R samples G in [0, log10(W_max+1)], R_to_G samples R in [0, 1];
+// both are the (linearly interpolated) W_table/R_table mapping, but
+// sampled densely enough to be indexed directly, without a search
+static void transducer_init(transducer_t* const t)
+{
+  const float G_max = log10f(W_table[LOOKUP_W_TO_R-1] + 1.0f);
+  const float R_max = R_table[LOOKUP_W_TO_R-1];
+
+  t->G_scale = (TRANSDUCER_LUT_SIZE-1) / G_max;
+  t->R_scale = (TRANSDUCER_LUT_SIZE-1) / R_max;
+
+  for (int i = 0; i < TRANSDUCER_LUT_SIZE; i++)
+    {
+      // G to W to RESP
+      const float G = (float)i / t->G_scale;
+      t->G_to_R[i] = lookup_table(LOOKUP_W_TO_R, W_table, R_table, powf(10,G) - 1.0f);
+
+      // RESP to W to G
+      const float R = (float)i / t->R_scale;
+      t->R_to_G[i] = log10f(lookup_table(LOOKUP_W_TO_R, R_table, W_table, R) + 1.0f);
+    }
+}
+
+// linear interpolation in a uniform lookup table, val must be >= 0
+static inline float transducer_lookup(const float* const lut, const float scale, const float val)
+{
+  const float ind_f = val * scale;
+  if (unlikely(!(ind_f < TRANSDUCER_LUT_SIZE-1))) // also catches NaN
+    return lut[TRANSDUCER_LUT_SIZE-1];
+
+  const int ind = (int)ind_f;
+  return lut[ind] + (lut[ind+1] - lut[ind]) * (ind_f - (float)ind);
+}
+
+// transform gradient G to response R
+static inline float G_to_R(const transducer_t* const t, const float G)
+{
+  const float R = transducer_lookup(t->G_to_R, t->G_scale, fabsf(G));
+  return G < 0 ? -R : R;
+}
+
+// transform response R to gradient G
+static inline float R_to_G(const transducer_t* const t, const float R)
+{
+  const float G = transducer_lookup(t->R_to_G, t->R_scale, fabsf(R));
+  return R < 0 ? -G : G;
+}
+
+
 // transform gradient (Gx,Gy) to R
-static inline void transform_to_R(const int n, float* const G)
+static inline void transform_to_R(const transducer_t* const t, const int n, float* const G)
 {
 #pragma omp parallel for schedule(static)
   for(int j=0;j<n;j++)
-    {
-      // G to W
-      const float absG = fabsf(G[j]);
-      int sign;
-      if(G[j] < 0)
-	sign = -1;
-      else
-	sign = 1;	
-      G[j] = (powf(10,absG) - 1.0f) * sign;
-		
-      // W to RESP
-      if(G[j] < 0)
-	sign = -1;
-      else
-	sign = 1;	
-      
-      G[j] = sign * lookup_table(LOOKUP_W_TO_R, W_table, R_table, fabsf(G[j]));
-    }
+    G[j] = G_to_R(t, G[j]);
 }
 
 // transform gradient (Gx,Gy) to R for the whole pyramid
-static inline void pyramid_transform_to_R(pyramid_t* pyramid)
+static inline void pyramid_transform_to_R(const transducer_t* const t, pyramid_t* pyramid)
 {
   while (pyramid != NULL)
     {
       const int size = pyramid->rows * pyramid->cols;
-      transform_to_R(size, pyramid->Gx);	
-      transform_to_R(size, pyramid->Gy);	
+      transform_to_R(t, size, pyramid->Gx);	
+      transform_to_R(t, size, pyramid->Gy);	
       pyramid = pyramid->next;
     }
 }
 
 // transform from R to G
-static inline void transform_to_G(const int n, float* const R){
+static inline void transform_to_G(const transducer_t* const t, const int n, float* const R){
 
 #pragma omp parallel for schedule(static)
-  for(int j=0;j<n;j++){
-	
-    // RESP to W
-    int sign;
-    if(R[j] < 0)
-      sign = -1;
-    else
-      sign = 1;			
-    R[j] = sign * lookup_table(LOOKUP_W_TO_R, R_table, W_table, fabsf(R[j]));
-	
-    // W to G
-    if(R[j] < 0)
-      sign = -1;
-    else
-      sign = 1;	
-    R[j] = log10f(fabsf(R[j]) + 1.0f) * sign;
-		
-  }
+  for(int j=0;j<n;j++)
+    R[j] = R_to_G(t, R[j]);
 }
 
 // transform from R to G for the pyramid
-static inline void pyramid_transform_to_G(pyramid_t* pyramid)
+static inline void pyramid_transform_to_G(const transducer_t* const t, pyramid_t* pyramid)
 {
   while (pyramid != NULL)
     {
-      transform_to_G(pyramid->rows*pyramid->cols, pyramid->Gx);	
-      transform_to_G(pyramid->rows*pyramid->cols, pyramid->Gy);	
+      transform_to_G(t, pyramid->rows*pyramid->cols, pyramid->Gx);	
+      transform_to_G(t, pyramid->rows*pyramid->cols, pyramid->Gy);	
       pyramid = pyramid->next;
     }
 }
 
-// multiply gradient (Gx,Gy) values by float scalar value for the whole pyramid
-static inline void pyramid_gradient_multiply(pyramid_t* pyramid, const float val)
+// contrast mapping for the whole pyramid: G to R, multiply by
+// contrastFactor and back to G, in a single pass over each level
+static void pyramid_contrast_map(const transducer_t* const t, pyramid_t* pyramid, const float contrastFactor)
 {
   while (pyramid != NULL)
     {
-      matrix_multiply_const(pyramid->rows*pyramid->cols, pyramid->Gx, val);	
-      matrix_multiply_const(pyramid->rows*pyramid->cols, pyramid->Gy, val);	
+      const int size = pyramid->rows*pyramid->cols;
+      float* const Gx = pyramid->Gx;
+      float* const Gy = pyramid->Gy;
+#pragma omp parallel for schedule(static)
+      for(int j=0;j<size;j++)
+	{
+	  Gx[j] = R_to_G(t, G_to_R(t, Gx[j]) * contrastFactor);
+	  Gy[j] = R_to_G(t, G_to_R(t, Gy[j]) * contrastFactor);
+	}
       pyramid = pyramid->next;
     }
 }
@@ -1064,23 +1493,25 @@ static int sort_float(const void* const v1, const void* const v2)
 
 
 // transform gradients to luminance
-static void transform_to_luminance(pyramid_t* pp, float* const x, pfstmo_progress_callback progress_cb, const bool bcg, const int itmax, const float tol)
+static void transform_to_luminance(mantiuk06_workspace* ws, float* const x, pfstmo_progress_callback progress_cb, const mantiuk06_solver solver, const int itmax, const float tol)
 {
-  pyramid_t* pC = pyramid_allocate(pp->cols, pp->rows);
-  pyramid_calculate_scale_factor(pp, pC); // calculate (Cx,Cy)
-  pyramid_scale_gradient(pp, pC); // scale small gradients by (Cx,Cy);
+  pyramid_calculate_and_apply_scale_factor(ws->pp, ws->pC); // calculate (Cx,Cy) and scale small gradients by (Cx,Cy)
 
-  float* b = matrix_alloc(pp->cols * pp->rows);
-  pyramid_calculate_divergence_sum(pp, b); // calculate the sum of divergences (equal to b)
+  float* const b = ws->b;
+  pyramid_calculate_divergence_sum(ws->pp, b); // calculate the sum of divergences (equal to b)
   
   // calculate luminances from gradients
-  if (bcg)
-    linbcg(pp, pC, b, x, itmax, tol, progress_cb);
-  else
-    lincg(pp, pC, b, x, itmax, tol, progress_cb);
-  
-  matrix_free(b);
-  pyramid_free(pC);
+  switch (solver)
+    {
+    case MANTIUK06_BCG:
+      linbcg(ws, b, x, itmax, tol, progress_cb);
+      break;
+    case MANTIUK06_PCG:
+      linpcg(ws, b, x, itmax, tol, progress_cb);
+      break;
+    default:
+      lincg(ws, b, x, itmax, tol, progress_cb);
+    }
 }
 
 
@@ -1109,8 +1540,10 @@ static int hist_data_index(const void* const v1, const void* const v2)
 }
 
 
-static void contrast_equalization( pyramid_t *pp, const float contrastFactor )
+static void contrast_equalization( mantiuk06_workspace* ws, const float contrastFactor )
 {
+  pyramid_t* const pp = ws->pp;
+
   // Count sizes
   int total_pixels = 0;
   pyramid_t* l = pp;
@@ -1121,12 +1554,16 @@ static void contrast_equalization( pyramid_t *pp, const float contrastFactor )
     }
   
   // Allocate memory
-  struct hist_data* hist = (struct hist_data*) malloc(sizeof(struct hist_data) * total_pixels);
-  if (hist == NULL)
+  if (ws->hist == NULL)
     {
-      fprintf(stderr, "ERROR: malloc in contrast_equalization() (size:%d)", (int)sizeof(struct hist_data) * total_pixels);
-      exit(155);
+      ws->hist = (struct hist_data*) malloc(sizeof(struct hist_data) * total_pixels);
+      if (ws->hist == NULL)
+	{
+	  fprintf(stderr, "ERROR: malloc in contrast_equalization() (size:%d)", (int)sizeof(struct hist_data) * total_pixels);
+	  exit(155);
+	}
     }
+  struct hist_data* const hist = ws->hist;
     
   // Build histogram info
   l = pp;
@@ -1174,14 +1611,65 @@ static void contrast_equalization( pyramid_t *pp, const float contrastFactor )
     index += pixels;
     l = l->next;
   }
+}
+
+
+static mantiuk06_workspace* workspace_allocate(const int cols, const int rows)
+{
+  mantiuk06_workspace* const ws = (mantiuk06_workspace*)malloc(sizeof(mantiuk06_workspace));
+  if (ws == NULL)
+    {
+      fprintf(stderr, "ERROR: malloc in workspace_allocate() (size:%d)", (int)sizeof(mantiuk06_workspace));
+      exit(155);
+    }
+  ws->cols = cols;
+  ws->rows = rows;
+  transducer_init(&ws->transducer);
+  ws->pp = pyramid_allocate(cols, rows);
+  ws->pC = pyramid_allocate(cols, rows);
+  ws->b = matrix_alloc(cols*rows);
+  ws->scratch = matrix_alloc(cols*rows);
+  for (int k = 0; k < SOLVER_VECTORS; k++)
+    ws->vec[k] = NULL;
+  ws->mg = NULL;
+  ws->hist = NULL;
+  return ws;
+}
+
+static void workspace_free(mantiuk06_workspace* ws)
+{
+  if (ws == NULL)
+    return;
+  pyramid_free(ws->pp);
+  pyramid_free(ws->pC);
+  matrix_free(ws->b);
+  matrix_free(ws->scratch);
+  for (int k = 0; k < SOLVER_VECTORS; k++)
+    matrix_free(ws->vec[k]);
+  mg_free(ws->mg);
+  free(ws->hist);
+  free(ws);
+}
+
 
-  free(hist);
+Mantiuk06Context::Mantiuk06Context() : ws( NULL )
+{
+}
+
+Mantiuk06Context::~Mantiuk06Context()
+{
+  workspace_free(ws);
 }
 
 
 // tone mapping
-int tmo_mantiuk06_contmap(const int c, const int r, float* const R, float* const G, float* const B, float* const Y, const float contrastFactor, const float saturationFactor, const bool bcg, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
+int Mantiuk06Context::tonemap(const int c, const int r, float* const R, float* const G, float* const B, float* const Y, const float contrastFactor, const float saturationFactor, const mantiuk06_solver solver, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
 {
+  if (ws == NULL || ws->cols != c || ws->rows != r)
+    {
+      workspace_free(ws);
+      ws = workspace_allocate(c, r);
+    }
   
   const int n = c*r;
   
@@ -1199,36 +1687,31 @@ int tmo_mantiuk06_contmap(const int c, const int r, float* const R, float* const
       if( unlikely(G[j] < clip_min) ) G[j] = clip_min;
       if( unlikely(B[j] < clip_min) ) B[j] = clip_min;
       if( unlikely(Y[j] < clip_min) ) Y[j] = clip_min;    
-    }
-	
-#pragma omp parallel for schedule(static)
-  for(int j=0;j<n;j++)
-    {
+
       R[j] /= Y[j];
       G[j] /= Y[j];
       B[j] /= Y[j];
       Y[j] = log10f(Y[j]);
     }
 	
-  pyramid_t* pp = pyramid_allocate(c,r); // create pyramid
-  float* tY = matrix_alloc(n);
-  matrix_copy(n, Y, tY); // copy Y to tY
-  pyramid_calculate_gradient(pp,tY); // calculate gradients for pyramid, destroys tY
-  matrix_free(tY);
-  pyramid_transform_to_R(pp); // transform gradients to R
+  const transducer_t* const transducer = &ws->transducer;
+  pyramid_t* const pp = ws->pp;
+  pyramid_calculate_gradient(pp, Y, ws->scratch, NULL); // calculate gradients for pyramid, destroys scratch
 
   /* Contrast map */
   if( contrastFactor > 0.0f )
-    pyramid_gradient_multiply(pp, contrastFactor); // Contrast mapping
+    pyramid_contrast_map(transducer, pp, contrastFactor); // Contrast mapping
   else
-    contrast_equalization(pp, -contrastFactor); // Contrast equalization
+    {
+      pyramid_transform_to_R(transducer, pp); // transform gradients to R
+      contrast_equalization(ws, -contrastFactor); // Contrast equalization
+      pyramid_transform_to_G(transducer, pp); // transform R to gradients
+    }
 	
-  pyramid_transform_to_G(pp); // transform R to gradients
-  transform_to_luminance(pp, Y, progress_cb, bcg, itmax, tol); // transform gradients to luminance Y
-  pyramid_free(pp);
+  transform_to_luminance(ws, Y, progress_cb, solver, itmax, tol); // transform gradients to luminance Y
 
   /* Renormalize luminance */
-  float* temp = matrix_alloc(n);
+  float* const temp = ws->scratch;
 	
   matrix_copy(n, Y, temp); // copy Y to temp
   qsort(temp, n, sizeof(float), sort_float); // sort temp in ascending order
@@ -1244,17 +1727,12 @@ int tmo_mantiuk06_contmap(const int c, const int r, float* const R, float* const
   delta = trim - floorf(trim);
   const float l_max = temp[(int)floorf(trim)] * delta + temp[(int)ceilf(trim)] * (1.0f-delta);	
 	
-  matrix_free(temp);
-	
   const float disp_dyn_range = 2.3f;
-#pragma omp parallel for schedule(static)
-  for(int j=0;j<n;j++)
-    Y[j] = (Y[j] - l_min) / (l_max - l_min) * disp_dyn_range - disp_dyn_range; // x scaled
-                                                                               // 
   /* Transform to linear scale RGB */
 #pragma omp parallel for schedule(static)
   for(int j=0;j<n;j++)
     {
+      Y[j] = (Y[j] - l_min) / (l_max - l_min) * disp_dyn_range - disp_dyn_range; // x scaled
       Y[j] = powf(10,Y[j]);
       R[j] = powf( R[j], saturationFactor) * Y[j];
       G[j] = powf( G[j], saturationFactor) * Y[j];
@@ -1264,3 +1742,10 @@ int tmo_mantiuk06_contmap(const int c, const int r, float* const R, float* const
   return PFSTMO_OK;
 }
 
+
+
+int tmo_mantiuk06_contmap(const int c, const int r, float* const R, float* const G, float* const B, float* const Y, const float contrastFactor, const float saturationFactor, const mantiuk06_solver solver, const int itmax, const float tol, pfstmo_progress_callback progress_cb)
+{
+  Mantiuk06Context tmo;
+  return tmo.tonemap(c, r, R, G, B, Y, contrastFactor, saturationFactor, solver, itmax, tol, progress_cb);
+}
@@ -38,6 +38,45 @@
 
 #include "pfstmo.h"
 
+/**
+ * @brief Linear solvers available for the gradient-domain system
+ */
+enum mantiuk06_solver {
+  MANTIUK06_CG,   /* Conjugate Gradients */
+  MANTIUK06_BCG,  /* BiConjugate Gradients */
+  MANTIUK06_PCG   /* Multigrid-preconditioned Conjugate Gradients */
+};
+
+struct mantiuk06_workspace;
+
+/**
+ * @brief Mantiuk06 operator with its working buffers kept between frames
+ *
+ * The gradient pyramids, the vectors of the linear solver, the
+ * multigrid hierarchy and the transducer tables are allocated for the
+ * first frame and reused as long as consecutive frames have the same
+ * size.
+ */
+class Mantiuk06Context
+{
+public:
+  Mantiuk06Context();
+  ~Mantiuk06Context();
+
+  /**
+   * @brief Tone map one frame, see tmo_mantiuk06_contmap()
+   */
+  int tonemap( int cols, int rows, float* R, float* G, float* B, float* Y,
+    float contrastFactor, float saturationFactor, mantiuk06_solver solver,
+    int itmax = 200, float tol = 1e-3, pfstmo_progress_callback progress_cb = NULL );
+
+private:
+  mantiuk06_workspace *ws;
+
+  Mantiuk06Context( const Mantiuk06Context& );
+  Mantiuk06Context& operator=( const Mantiuk06Context& );
+};
+
 /**
  * @brief: Tone mapping algorithm [Mantiuk2006]
  *
@@ -47,16 +86,19 @@
  * @param Y luminance channel
  * @param contrastFactor contrast scaling factor (in 0-1 range)
  * @param saturationFactor color desaturation (in 0-1 range)
- * @param bcg true if to use BiConjugate Gradients, false if to use Conjugate Gradients
+ * @param solver linear solver used to reconstruct luminance from gradients
  * @param itmax maximum number of iterations for convergence (typically 50)
  * @param tol tolerence to get within for convergence (typically 1e-3)
  * @param progress_cb callback function that reports progress
  * @return PFSTMO_OK if tone-mapping was sucessful, PFSTMO_ABORTED if
  * it was stopped from a callback function and PFSTMO_ERROR if an
  * error was encountered.
+ *
+ * A temporary Mantiuk06Context is used; use a context directly to
+ * tone map a sequence of frames.
  */
 int tmo_mantiuk06_contmap( int cols, int rows, float* R, float* G, float* B, float* Y,
-			    float contrastFactor, float saturationFactor, bool bcg,
+			    float contrastFactor, float saturationFactor, mantiuk06_solver solver,
 			    int itmax = 200, float tol = 1e-3, pfstmo_progress_callback progress_cb  = NULL);
 
 #endif
@@ -39,14 +39,13 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <iostream>
 
 #include <pfs.h>
 
-#include "contrast_domain.h"
+#include "tmo_context.h"
 
 
 #define PROG_NAME "pfstmo_mantiuk06"
@@ -61,7 +60,7 @@ void printHelp()
 {
   fprintf( stderr, PROG_NAME " (" PACKAGE_STRING ") : \n"
     "\t[--factor <val>] [--saturation <val>] [--equalize-contrast <val>]\n"
-    "\t[--help] [--quiet] [--verbose]\n"
+    "\t[--precondition] [--help] [--quiet] [--verbose]\n"
     "See man page for more information.\n" );
 }
 
@@ -85,12 +84,8 @@ int progress_report( int progress )
 void tmo_mantiuk06(int argc, char * argv[])
 {
 
-  //--- default tone mapping parameters;
-  float scaleFactor = 0.1f;
-  float saturationFactor = 0.8f;
-  bool cont_map = false, cont_eq = false, bcg = false;
-  int itmax = 200;
-  float tol = 1e-3;
+  //--- tone mapping parameters, checked by the mantiuk06 context
+  pfstmo::Options tmo_options;
 
   //--- process command line args
 
@@ -98,6 +93,7 @@ void tmo_mantiuk06(int argc, char * argv[])
     { "help", no_argument, NULL, 'h' },
     { "verbose", no_argument, NULL, 'v' },
 //    { "bcg", no_argument, NULL, 'b' },
+    { "precondition", no_argument, NULL, 'p' },
     { "factor", required_argument, NULL, 'f' },
     { "saturation", required_argument, NULL, 's' },
 //    { "itmax", required_argument, NULL, 'm' },
@@ -109,7 +105,7 @@ void tmo_mantiuk06(int argc, char * argv[])
 
   int optionIndex = 0;
   while( 1 ) {
-    int c = getopt_long (argc, argv, "vhf:s:e:q", cmdLineOptions, &optionIndex);
+    int c = getopt_long (argc, argv, "vhf:s:e:qp", cmdLineOptions, &optionIndex);
     if( c == -1 ) break;
     switch( c ) {
     case 'h':
@@ -121,72 +117,21 @@ void tmo_mantiuk06(int argc, char * argv[])
     case 'v':
       verbose = true;
       break;
-    case 'b':
-      bcg = true;
-      break;
-    case 'e':
-      cont_eq = true;
-      scaleFactor = 0.0f - (float)strtod( optarg, NULL );
-      if( scaleFactor > 0.0f )
-        throw pfs::Exception("incorrect contrast scale factor, accepted range is any positive number");
-      break;
-    case 's':
-      saturationFactor = (float)strtod( optarg, NULL );
-      if( saturationFactor < 0.0f || saturationFactor > 2.0f )
-        throw pfs::Exception("incorrect saturation factor, accepted range is (0..2)");
-      break;
-    case 'f':
-      cont_map = true;
-      scaleFactor = (float)strtod( optarg, NULL );
-      if( scaleFactor < 0.0f || scaleFactor > 1.0f )
-        throw pfs::Exception("incorrect contrast scale factor, accepted range is (0..1)");
-      break;
-//     case 'i':
-//       interpolate_method = atoi( optarg );
-//       if (interpolate_method < 1 || interpolate_method > 3)
-//         throw pfs::Exception("incorrect interpolation method, accepted values are 1, 2 or 3.");
-//       break;
-//     case 'm':
-//       itmax = atoi( optarg );
-//       if (itmax < 1)
-//         throw pfs::Exception("incorrect maximum number of iterations.");
-//       break;
-//     case 't':
-//       tol = (float)strtod( optarg, NULL );
-//       if( tol < 0.0f || tol > 1.0f )
-//         throw pfs::Exception("incorrect convergence tolerance, accepted range is (0..1)");
-//      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  if( cont_eq && cont_map )
-    throw pfs::Exception( "the 'factor' parameter cannot be used in combination with contrast equalization" );
-
-  if( scaleFactor < 0 ) {
-    VERBOSE_STR << "algorithm: contrast equalization" << endl;
-    VERBOSE_STR << "contrast scale factor = " << -scaleFactor << endl;
-  } else {
-    VERBOSE_STR << "algorithm: contrast mapping" << endl;
-    VERBOSE_STR << "contrast scale factor = " << scaleFactor << endl;
-  }
-  
-  VERBOSE_STR << "saturation factor = " << saturationFactor << endl;
-  
-  if (bcg)
-    {
-      VERBOSE_STR << "using biconjugate gradients (itmax = " << itmax << ", tol = " << tol << ")." << endl;
-    }
-  else
-    {
-      VERBOSE_STR << "using conjugate gradients (itmax = " << itmax << ", tol = " << tol << ")." << endl;
-    }   
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "mantiuk06", 1, 1, tmo_options );
 
   pfs::DOMIO pfsio;
-	
+  pfstmo::Context *tmo = NULL;
+
   while( true ) {
     pfs::Frame *frame = pfsio.readFrame( stdin );
     if( frame == NULL )
@@ -195,22 +140,26 @@ void tmo_mantiuk06(int argc, char * argv[])
     pfs::Channel *inX, *inY, *inZ;
 	
     frame->getXYZChannels(inX, inY, inZ);
+    if( inY==NULL || inX==NULL || inZ==NULL )
+      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
+
+    // buffers are reused for all frames of the same size
     int cols = frame->getWidth();
     int rows = frame->getHeight();
+    if( tmo == NULL || tmo->getWidth() != cols || tmo->getHeight() != rows ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "mantiuk06", cols, rows, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
+    }
 
-    pfs::Array2DImpl R( cols, rows );
-  
-    pfs::transformColorSpace( pfs::CS_XYZ, inX, inY, inZ, pfs::CS_RGB, inX, &R, inZ );
-
-    tmo_mantiuk06_contmap( cols, rows, inX->getRawData(), R.getRawData(), inZ->getRawData(), inY->getRawData(),
-      scaleFactor, saturationFactor, bcg, itmax, tol, progress_report );	
-
-    pfs::transformColorSpace( pfs::CS_RGB, inX, &R, inZ, pfs::CS_XYZ, inX, inY, inZ );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
+    tmo->process( inX->getRawData(), inY->getRawData(), inZ->getRawData(), progress_report );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
   
     pfsio.writeFrame( frame, stdout );
     pfsio.freeFrame(frame);
   }
+  delete tmo;
 }
 
 
@@ -44,6 +44,7 @@
 #include <gsl/gsl_blas.h>
 #include <gsl/gsl_interp.h>
 #include "cqp/gsl_cqp.h"
+#include "pointwise.h"
 
 #include <config.h>
 
@@ -115,7 +116,8 @@ inline float safe_log10( float x, const float min_x = MIN_PHVAL, const float max
 float min_positive( const float *x, size_t len )
 {
   float min_val = MAX_PHVAL;
-  for( int k=0; k < len; k++ )
+  #pragma omp parallel for reduction(min:min_val) schedule(static)
+  for( int k=0; k < (int)len; k++ )
     if( unlikely(x[k] < min_val && x[k] > 0) )
       min_val = x[k];
 
@@ -184,7 +186,7 @@ public:
       delete []y_i;
   }
 
-  double interp( double x )
+  double interp( double x ) const
   {
     const double ind_f = (x - x_i[0])/delta;
     const size_t ind_low = (size_t)(ind_f);
@@ -242,6 +244,7 @@ void compute_gaussian_level( const int width, const int height, const pfstmo::Ar
   float* out_raw = out.getRawData();
 
   // Filter rows
+  #pragma omp parallel for schedule(static)
   for( int r=0; r < height; r++ ) {
     for( int c=0; c < width; c++ ) {
       float sum = 0;
@@ -257,18 +260,22 @@ void compute_gaussian_level( const int width, const int height, const pfstmo::Ar
     }    
   }
     
-  // Filter columns
-  for( int c=0; c < width; c++ ) {
-    for( int r=0; r < height; r++ ) {
+  // Filter columns (row by row to access memory sequentially)
+  #pragma omp parallel for schedule(static)
+  for( int r=0; r < height; r++ ) {
+    const float *rows[kernel_len];
+    for( int j=0; j< kernel_len; j++ ) {
+      int l = (j-kernel_len_2)*step+r;
+      if( unlikely(l < 0) )
+        l = -l;
+      if( unlikely(l >= height) )
+        l = 2*height - 2 - l;
+      rows[j] = temp_raw + l*width;
+    }
+    for( int c=0; c < width; c++ ) {
       float sum = 0;
-      for( int j=0; j< kernel_len; j++ ) {
-        int l = (j-kernel_len_2)*step+r;
-        if( unlikely(l < 0) )
-          l = -l;
-        if( unlikely(l >= height) )
-          l = 2*height - 2 - l;
-        sum += temp_raw[l*width+c] * kernel[j];
-      }
+      for( int j=0; j< kernel_len; j++ )
+        sum += rows[j][c] * kernel[j];
       out_raw[r*width+c] = sum;
     }    
   }    
@@ -308,7 +315,7 @@ class conditional_density: public datmoConditionalDensity
 {
 public:
   static const double l_min, l_max, delta;
-  static double x_scale[X_COUNT];    // input log luminance scale
+  double x_scale[X_COUNT];    // input log luminance scale
   double *g_scale;    // contrast scale
   double *f_scale;    // frequency scale
   
@@ -342,10 +349,8 @@ public:
     C = new double[x_count*g_count*f_count];
     memset( C, 0, x_count*g_count*f_count*sizeof(double) );
 
-    if( x_scale[0] == 0 ) {
-      for( int i=0; i<x_count; i++ )
-        x_scale[i] = l_min + delta*i;
-    }
+    for( int i=0; i<x_count; i++ )
+      x_scale[i] = l_min + delta*i;
 
     for( int i=0; i<g_count; i++ )
       g_scale[i] = -g_max + delta*i;
@@ -375,10 +380,10 @@ datmoConditionalDensity::~datmoConditionalDensity()
 }
 
 const double conditional_density::l_min = -8.f, conditional_density::l_max = 8.f, conditional_density::delta = 0.1f;
-double conditional_density::x_scale[X_COUNT] = { 0 };    // input log luminance scale
 
 
-std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int width, int height, const float *L, pfstmo_progress_callback progress_cb )
+std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int width, int height, const float *L, pfstmo_progress_callback progress_cb,
+  double max_error, double *error_bound )
 {
   if( progress_cb != NULL ) {
     progress_cb( 0 );
@@ -400,12 +405,28 @@ std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int wi
   const float min_val = std::max( min_positive( L, pix_count ), MIN_PHVAL );
   
   // Compute log10 of an image 
+  #pragma omp parallel for schedule(static)
   for( int i=0; i < pix_count; i++ )
     (*LP_high)(i) = safe_log10( L[i], min_val );
 
+  // Subsampling: the standard error of a histogram bin estimated from
+  // n independent samples is sqrt(p(1-p)/n) <= 1/(2*sqrt(n)). Take one
+  // pixel at a pseudo-random position from each block of 'stride'
+  // pixels so that this bound does not exceed max_error.
+  int stride = 1;
+  if( max_error > 0 ) {
+    const double samples_needed = ceil( 1. / (4.*max_error*max_error) );
+    stride = std::max( 1, (int)(pix_count / samples_needed) );
+  }
+  const int sample_count = pix_count / stride;
+  if( error_bound != NULL )
+    *error_bound = 0.5 / sqrt( (double)sample_count );
+
   bool warn_out_of_range = false;
   C->total = 0;
   
+  const int hist_size = C->x_count*C->g_count;
+  
   for( int f=0; f<C->f_count; f++ ) {
       
     compute_gaussian_level( width, height, *LP_high, *LP_low, f, temp );
@@ -418,24 +439,58 @@ std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int wi
     const int gi_tp = C->g_count/2+1;
     const int gi_tn = C->g_count/2-1;
     const int gi_t = C->g_count/2;
-    for( int i=0; i < pix_count; i++ ) {
-      float g = (*LP_high)(i) - (*LP_low)(i); // Compute band-pass
-      int x_i = round_int( ((*LP_low)(i) - C->l_min)/C->delta );
-      if( unlikely(x_i < 0 || x_i >= C->x_count) ) {
-        warn_out_of_range = true;
-        continue;
-      }
-      int g_i = round_int( (g + C->g_max) / C->delta );
-      if( unlikely(g_i < 0 || g_i >= C->g_count) )
-        continue;
+    double *C_f = &(*C)(0,0,f);
+    const float *LP_high_raw = LP_high->getRawData();
+    const float *LP_low_raw = LP_low->getRawData();
+
+    // Each thread fills its own histogram, which are summed at the
+    // end. The counts are integers so the result does not depend on the
+    // number of threads.
+    #pragma omp parallel
+    {
+      double *hist = new double[hist_size];
+      memset( hist, 0, hist_size*sizeof(double) );
+      bool out_of_range = false;
+
+      #pragma omp for schedule(static)
+      for( int k=0; k < sample_count; k++ ) {
+        int i = k;
+        if( stride > 1 )
+          i = k*stride + (int)(((unsigned int)k*2654435761u + (unsigned int)f*40503u) >> 8) % stride;
         
-      if( g > thr && g < C->delta/2 ) {
-        // above the threshold + 
-        (*C)(x_i,gi_tp,f)++;
-      } else if( g < -thr && g > -C->delta/2 ) {
-        // above the threshold -
-        (*C)(x_i,gi_tn,f)++;          
-      } else (*C)(x_i,g_i,f)++;        
+        float g = LP_high_raw[i] - LP_low_raw[i]; // Compute band-pass
+        int x_i = round_int( (LP_low_raw[i] - C->l_min)/C->delta );
+        if( unlikely(x_i < 0 || x_i >= C->x_count) ) {
+          out_of_range = true;
+          continue;
+        }
+        int g_i = round_int( (g + C->g_max) / C->delta );
+        if( unlikely(g_i < 0 || g_i >= C->g_count) )
+          continue;
+        
+        if( g > thr && g < C->delta/2 ) {
+          // above the threshold + 
+          g_i = gi_tp;
+        } else if( g < -thr && g > -C->delta/2 ) {
+          // above the threshold -
+          g_i = gi_tn;
+        }
+        hist[x_i + g_i*C->x_count]++;
+      }
+
+      #pragma omp critical
+      {
+        for( int i=0; i < hist_size; i++ )
+          C_f[i] += hist[i];
+        warn_out_of_range |= out_of_range;
+      }
+      delete [] hist;
+    }
+
+    if( stride > 1 ) {
+      // Scale the counts as if all pixels were used
+      for( int i=0; i < hist_size; i++ )
+        C_f[i] *= (double)stride;
     }
 
     for( int i = 0; i < C->x_count; i++ ) {      
@@ -486,6 +541,10 @@ std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int wi
 
 // =============== Quadratic programming solver ==============
 
+// Uncomment to compare the solutions of solve_tonecurve_qp() with the
+// generic GSL CQP minimizer (for debugging purposes only)
+//#define DATMO_VALIDATE_QP
+
 const static gsl_matrix null_matrix = {0};          
 const static gsl_vector null_vector = {0};          
 
@@ -584,6 +643,268 @@ int solve( gsl_matrix *Q, gsl_vector *q, gsl_matrix *C, gsl_vector *d, gsl_vecto
   return GSL_SUCCESS;
 }
 
+/**
+ * Workspace for solve_tonecurve_qp(). It is allocated once for all
+ * iterations of optimize_tonecurve() so that the solver does not touch
+ * the heap.
+ */
+class tonecurve_qp_workspace
+{
+  double *buf;
+public:
+  const int n;
+  double *M;                    // H + X^-1*Z (n x n), replaced with its Cholesky factor
+  double *u;                    // M^-1*e
+  double u_sum;                 // e'*u
+  double *x, *z;                // current solution and multipliers for x>=0
+  double *r_d, *r_xz;           // dual and complementarity residuals
+  double *dx, *dz, *dx_aff, *dz_aff;
+
+  tonecurve_qp_workspace( int n ) : n( n )
+  {
+    buf = new double[n*n + 9*n];
+    M = buf;
+    double *v = buf + n*n;
+    u = v; v += n;
+    x = v; v += n;
+    z = v; v += n;
+    r_d = v; v += n;
+    r_xz = v; v += n;
+    dx = v; v += n;
+    dz = v; v += n;
+    dx_aff = v; v += n;
+    dz_aff = v;
+  }
+
+  ~tonecurve_qp_workspace()
+  {
+    delete [] buf;
+  }
+};
+
+/**
+ * In-place Cholesky decomposition of a symmetric positive definite
+ * matrix. Only the lower triangle of M is used and overwritten.
+ *
+ * @return false if the matrix is not positive definite
+ */
+static bool cholesky_decomp( double *M, const int n )
+{
+  for( int j=0; j < n; j++ ) {
+    double *Mj = M + j*n;
+    double d = Mj[j];
+    for( int k=0; k < j; k++ )
+      d -= Mj[k]*Mj[k];
+    if( !(d > 0) )
+      return false;
+    d = sqrt( d );
+    Mj[j] = d;
+    for( int i=j+1; i < n; i++ ) {
+      double *Mi = M + i*n;
+      double sum = Mi[j];
+      for( int k=0; k < j; k++ )
+        sum -= Mi[k]*Mj[k];
+      Mi[j] = sum / d;
+    }
+  }
+  return true;
+}
+
+/**
+ * Solve L*L'*x = b, where L is the factor found by cholesky_decomp().
+ * b is replaced with the solution.
+ */
+static void cholesky_solve( const double *L, const int n, double *b )
+{
+  for( int i=0; i < n; i++ ) {
+    const double *Li = L + i*n;
+    double sum = b[i];
+    for( int k=0; k < i; k++ )
+      sum -= Li[k]*b[k];
+    b[i] = sum / Li[i];
+  }
+  for( int i=n-1; i >= 0; i-- ) {
+    double sum = b[i];
+    for( int k=i+1; k < n; k++ )
+      sum -= L[k*n+i]*b[k];
+    b[i] = sum / L[i*n+i];
+  }
+}
+
+/**
+ * Solve the reduced Newton system of solve_tonecurve_qp() for the
+ * complementarity residuals ws->r_xz and r_sw:
+ *
+ *   [ H + X^-1*Z   e    ] [dx]   [ -r_d - X^-1*r_xz ]
+ *   [ e'         -s/w   ] [dw] = [ r_sw/w - r_p      ]
+ *
+ * The Cholesky factor of H + X^-1*Z must be already in ws->M and
+ * M^-1*e in ws->u. The bordered form stays well conditioned when the
+ * sum constraint becomes active (s -> 0).
+ */
+static void tonecurve_qp_newton_step( tonecurve_qp_workspace *ws, const double s, const double w,
+  const double r_p, const double r_sw, double *dx, double *dz, double &ds, double &dw )
+{
+  const int n = ws->n;
+  const double *x = ws->x, *z = ws->z;
+
+  for( int i=0; i < n; i++ )
+    dx[i] = -ws->r_d[i] - ws->r_xz[i]/x[i];
+  cholesky_solve( ws->M, n, dx );
+  double sum_y = 0;
+  for( int i=0; i < n; i++ )
+    sum_y += dx[i];
+
+  dw = (sum_y - r_sw/w + r_p) / (ws->u_sum + s/w);
+
+  double sum_dx = 0;
+  for( int i=0; i < n; i++ ) {
+    dx[i] -= dw*ws->u[i];
+    dz[i] = -(ws->r_xz[i] + z[i]*dx[i]) / x[i];
+    sum_dx += dx[i];
+  }
+  ds = -sum_dx - r_p;
+}
+
+/**
+ * The largest step alpha <= alpha_max such that v + alpha*dv >= 0.
+ */
+static inline double max_step( const double *v, const double *dv, const int n, double alpha_max )
+{
+  for( int i=0; i < n; i++ )
+    if( dv[i] < 0 )
+      alpha_max = std::min( alpha_max, -v[i]/dv[i] );
+  return alpha_max;
+}
+
+/**
+ * Solver for the quadratic programming problem of
+ * optimize_tonecurve():
+ *
+ *   minimize 0.5*x'*H*x + f'*x  subject to  x >= 0,  sum(x) <= d
+ *
+ * This is the same problem that is solved by solve() with the
+ * generic GSL CQP minimizer, but the structure of the constraints
+ * (non-negativity plus a single sum constraint) is exploited. The
+ * Mehrotra predictor-corrector primal-dual interior point method
+ * reduces each step to a single n x n positive definite system:
+ *
+ *   (H + X^-1*Z + w/s*e*e') dx = rhs
+ *
+ * where s is the slack of the sum constraint and w its multiplier
+ * (solved in the bordered form, see tonecurve_qp_newton_step()).
+ * H + X^-1*Z is factorized once per iteration with a dense Cholesky
+ * decomposition and reused for both predictor and corrector
+ * steps. The convergence criteria are the same as for solve().
+ *
+ * @param x the solution. Left unchanged if the solver did not converge.
+ * @return PFSTMO_OK if the solution was found, PFSTMO_ERROR otherwise
+ */
+int solve_tonecurve_qp( const gsl_matrix *H, const gsl_vector *f, const double d,
+  gsl_vector *x_out, tonecurve_qp_workspace *ws )
+{
+  const int n = ws->n;
+  const int max_iter = 100;
+  const double eps_gap = 1e-10, eps_residuals = 1e-10;
+  double *x = ws->x, *z = ws->z;
+
+  // data_norm = ||H, f, d, constraints||_inf, as in mg_pdip
+  double data_norm = std::max( 1., d );
+  for( int i=0; i < n; i++ ) {
+    const double *Hi = H->data + i*H->tda;
+    for( int j=0; j < n; j++ )
+      data_norm = std::max( data_norm, fabs( Hi[j] ) );
+    data_norm = std::max( data_norm, fabs( gsl_vector_get( f, i ) ) );
+  }
+
+  // Strictly feasible starting point
+  for( int i=0; i < n; i++ ) {
+    x[i] = d/(2*n);
+    z[i] = 1;
+  }
+  double s = d/2, w = 1;
+
+  for( int it=0; it < max_iter; it++ ) {
+
+    // Residuals: r_d = H*x + f - z + w*e, r_p = s - d + e'*x
+    double sum_x = 0, xz = 0, residuals_norm = 0;
+    for( int i=0; i < n; i++ ) {
+      const double *Hi = H->data + i*H->tda;
+      double r = gsl_vector_get( f, i ) - z[i] + w;
+      for( int j=0; j < n; j++ )
+        r += Hi[j]*x[j];
+      ws->r_d[i] = r;
+      residuals_norm = std::max( residuals_norm, fabs( r ) );
+      sum_x += x[i];
+      xz += x[i]*z[i];
+    }
+    const double r_p = s - d + sum_x;
+    residuals_norm = std::max( residuals_norm, fabs( r_p ) );
+    const double mu = (xz + s*w) / (n+1); // duality gap
+
+    if( mu <= eps_gap && residuals_norm <= eps_residuals*data_norm ) {
+      for( int i=0; i < n; i++ )
+        gsl_vector_set( x_out, i, x[i] );
+      return PFSTMO_OK;
+    }
+
+    // M = H + X^-1*Z (lower triangle)
+    for( int i=0; i < n; i++ ) {
+      const double *Hi = H->data + i*H->tda;
+      double *Mi = ws->M + i*n;
+      for( int j=0; j <= i; j++ )
+        Mi[j] = Hi[j];
+      Mi[i] += z[i]/x[i];
+    }
+    if( !cholesky_decomp( ws->M, n ) )
+      break;
+    ws->u_sum = 0;
+    for( int i=0; i < n; i++ )
+      ws->u[i] = 1;
+    cholesky_solve( ws->M, n, ws->u );
+    for( int i=0; i < n; i++ )
+      ws->u_sum += ws->u[i];
+
+    // Predictor (affine scaling) step
+    for( int i=0; i < n; i++ )
+      ws->r_xz[i] = x[i]*z[i];
+    double ds_aff, dw_aff;
+    tonecurve_qp_newton_step( ws, s, w, r_p, s*w, ws->dx_aff, ws->dz_aff, ds_aff, dw_aff );
+
+    double alpha = max_step( x, ws->dx_aff, n, 1. );
+    alpha = max_step( z, ws->dz_aff, n, alpha );
+    alpha = max_step( &s, &ds_aff, 1, alpha );
+    alpha = max_step( &w, &dw_aff, 1, alpha );
+
+    double mu_aff = (s + alpha*ds_aff)*(w + alpha*dw_aff);
+    for( int i=0; i < n; i++ )
+      mu_aff += (x[i] + alpha*ws->dx_aff[i])*(z[i] + alpha*ws->dz_aff[i]);
+    mu_aff /= (n+1);
+    const double sigma = pow( mu_aff/mu, 3 );
+
+    // Corrector step
+    for( int i=0; i < n; i++ )
+      ws->r_xz[i] = x[i]*z[i] + ws->dx_aff[i]*ws->dz_aff[i] - sigma*mu;
+    double ds, dw;
+    tonecurve_qp_newton_step( ws, s, w, r_p, s*w + ds_aff*dw_aff - sigma*mu, ws->dx, ws->dz, ds, dw );
+
+    alpha = max_step( x, ws->dx, n, 1./0.995 );
+    alpha = max_step( z, ws->dz, n, alpha );
+    alpha = max_step( &s, &ds, 1, alpha );
+    alpha = max_step( &w, &dw, 1, alpha );
+    alpha *= 0.995;             // stay in the interior
+
+    for( int i=0; i < n; i++ ) {
+      x[i] += alpha*ws->dx[i];
+      z[i] += alpha*ws->dz[i];
+    }
+    s += alpha*ds;
+    w += alpha*dw;
+  }
+
+  return PFSTMO_ERROR;
+}
+
 
 
 // =============== HVS functions ==============
@@ -739,9 +1060,13 @@ void compute_y( double *y, const gsl_vector *x, int *skip_lut, int x_count, int
  *
  * @param y output luminance value for the nodes C->x_scale. y must be
  * a pre-allocated array and has the same size as C->x_scale.
+ * @param y_init tone-curve used as the starting point of the
+ * iterations (e.g. the solution for the previous frame) or NULL to
+ * start from a linear tone-curve. Must have the same size as y.
  */
 int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *dm, DisplaySize *ds,
-  float enh_factor, double *y, const float white_y, pfstmo_progress_callback progress_cb = NULL, datmoVisualModel visual_model = vm_full, double scene_l_adapt = 1000 ) {
+  float enh_factor, double *y, const float white_y, pfstmo_progress_callback progress_cb = NULL, datmoVisualModel visual_model = vm_full, double scene_l_adapt = 1000,
+  const double *y_init = NULL ) {
   
   conditional_density *C = (conditional_density*)C_pub;
   
@@ -822,6 +1147,7 @@ int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *dm, Dis
 // all intervals must be >=0
 // sum of intervals must be equal to a displayable dynamic range
 
+#ifdef DATMO_VALIDATE_QP
   // Ale = [eye(interval_count); -ones(1,interval_count)];
   
   auto_matrix Ale(gsl_matrix_calloc(L+1, L));
@@ -832,6 +1158,8 @@ int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *dm, Dis
   // ble = [zeros(interval_count,1); -d_dr];
   auto_vector ble(gsl_vector_calloc(L+1));
   gsl_vector_set( ble, L, -d_dr );  
+  auto_vector x_ref(gsl_vector_alloc(L));
+#endif
  
   auto_matrix A(gsl_matrix_calloc(M, L));
   auto_vector B(gsl_vector_alloc(M));
@@ -935,8 +1263,20 @@ int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *dm, Dis
   auto_vector K(gsl_vector_alloc(M));
   auto_vector x(gsl_vector_alloc(L));
   auto_vector x_old(gsl_vector_alloc(L));
+  tonecurve_qp_workspace qp_ws( L );
 
-  gsl_vector_set_all( x, d_dr/L );
+  if( y_init != NULL ) {
+    // Warm start: recover the node distances from the given tone-curve
+    // (inverse of compute_y())
+    for( int l = 0; l < C->x_count-1; l++ ) {
+      if( skip_lut[l] == -1 )
+        continue;
+      int j;
+      for( j = l+1; j < (C->x_count-1) && skip_lut[j] == -1; j++ );
+      gsl_vector_set( x, skip_lut[l], std::max( 0., y_init[j] - y_init[l] ) );
+    }
+  } else
+    gsl_vector_set_all( x, d_dr/L );
 
 
   int max_iter = 200;
@@ -980,7 +1320,21 @@ int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *dm, Dis
 
     gsl_vector_memcpy( x_old, x );
     
-    solve( H, f, Ale, ble, x );
+#ifdef DATMO_VALIDATE_QP
+    gsl_vector_memcpy( x_ref, x );
+    solve( H, f, Ale, ble, x_ref );
+#endif
+
+    solve_tonecurve_qp( H, f, d_dr, x, &qp_ws );
+
+#ifdef DATMO_VALIDATE_QP
+    {
+      double max_diff = 0;
+      for( int i=0; i < L; i++ )
+        max_diff = std::max( max_diff, fabs( gsl_vector_get(x,i) - gsl_vector_get(x_ref,i) ) );
+      fprintf( stderr, "QP solution: max. difference from GSL CQP: %g\n", max_diff );
+    }
+#endif
 
     // Check for convergence
     double min_delta = (C->x_scale[1]-C->x_scale[0])/10.; // minimum acceptable change
@@ -1038,14 +1392,136 @@ int datmo_tonemap( float *R_out, float *G_out, float *B_out, int width, int heig
 int datmo_compute_tone_curve( datmoToneCurve *tc, datmoConditionalDensity *cond_dens,
   DisplayFunction *df, DisplaySize *ds, const float enh_factor, 
   const float white_y, pfstmo_progress_callback progress_cb, 
-  datmoVisualModel visualModel, double scene_l_adapt  )
+  datmoVisualModel visualModel, double scene_l_adapt, datmoWarmStart *warm_start )
 {
   conditional_density *C = (conditional_density*)cond_dens;
   tc->init( C->x_count, C->x_scale );
-  return optimize_tonecurve( cond_dens, df, ds, enh_factor, tc->y_i, white_y, progress_cb, visualModel, scene_l_adapt );
+  if( warm_start == NULL )
+    return optimize_tonecurve( cond_dens, df, ds, enh_factor, tc->y_i, white_y, progress_cb, visualModel, scene_l_adapt );
+
+  const size_t C_size = C->x_count*C->g_count*C->f_count;
+  const double params[6] = { enh_factor, white_y, (double)visualModel, scene_l_adapt,
+                             df->display( 0.f ), df->display( 1.f ) };
+
+  // The previous solution can be reused only if it was computed for
+  // the same problem
+  bool compatible = warm_start->y_prev != NULL &&
+    warm_start->C_size == C_size && warm_start->y_size == (size_t)C->x_count;
+  for( int i=0; compatible && i < 6; i++ )
+    if( warm_start->params[i] != params[i] )
+      compatible = false;
+
+  double *C_norm = new double[C_size];
+  double sum = 0;
+  for( size_t i=0; i < C_size; i++ )
+    sum += C->C[i];
+  const double norm = sum > 0 ? 1./sum : 0;
+  for( size_t i=0; i < C_size; i++ )
+    C_norm[i] = C->C[i]*norm;
+
+  if( compatible && sum > 0 ) {
+    // Total variation distance to the last optimized frame. Skipped
+    // frames are not stored so that slow drifts are not accumulated.
+    double dist = 0;
+    for( size_t i=0; i < C_size; i++ )
+      dist += fabs( C_norm[i] - warm_start->C_prev[i] );
+    if( 0.5*dist < warm_start->tolerance ) {
+      memcpy( tc->y_i, warm_start->y_prev, C->x_count*sizeof(double) );
+      delete [] C_norm;
+      warm_start->frames_skipped++;
+      if( progress_cb != NULL )
+        progress_cb( 95 );
+      return PFSTMO_OK;
+    }
+  }
+
+  int res = optimize_tonecurve( cond_dens, df, ds, enh_factor, tc->y_i, white_y, progress_cb, visualModel, scene_l_adapt,
+    compatible ? warm_start->y_prev : NULL );
+  if( res != PFSTMO_OK ) {
+    delete [] C_norm;
+    warm_start->reset();
+    return res;
+  }
+
+  delete [] warm_start->C_prev;
+  warm_start->C_prev = C_norm;
+  warm_start->C_size = C_size;
+  if( warm_start->y_size != (size_t)C->x_count ) {
+    delete [] warm_start->y_prev;
+    warm_start->y_prev = new double[C->x_count];
+    warm_start->y_size = C->x_count;
+  }
+  memcpy( warm_start->y_prev, tc->y_i, C->x_count*sizeof(double) );
+  memcpy( warm_start->params, params, sizeof(params) );
+  warm_start->frames_optimized++;
+
+  return PFSTMO_OK;
+}
+
+datmoWarmStart::datmoWarmStart( float tolerance ) : tolerance( tolerance ),
+  C_prev( NULL ), C_size( 0 ), y_prev( NULL ), y_size( 0 ),
+  frames_skipped( 0 ), frames_optimized( 0 )
+{
+}
+
+datmoWarmStart::~datmoWarmStart()
+{
+  reset();
 }
 
+void datmoWarmStart::reset()
+{
+  delete [] C_prev;
+  delete [] y_prev;
+  C_prev = y_prev = NULL;
+  C_size = y_size = 0;
+}
+
+
 
+namespace
+{
+  /// Applies the tone curve LUT to the luminance, preserving the saturation
+  struct ToneCurveKernel
+  {
+    float *R_out, *G_out, *B_out;
+    const float *R_in, *G_in, *B_in, *L_in;
+    const UniformArrayLUT *tc_lut;
+    float saturation_factor;
+
+    void operator()( int begin, int end ) const
+    {
+      for( int i=begin; i < end; i++ ) {
+        float L_fix = clamp_channel(L_in[i]);
+        const float luma = tc_lut->interp( log10(L_fix) );
+        R_out[i] = pow( clamp_channel(R_in[i]/L_fix), saturation_factor ) * luma;
+        G_out[i] = pow( clamp_channel(G_in[i]/L_fix), saturation_factor ) * luma;
+        B_out[i] = pow( clamp_channel(B_in[i]/L_fix), saturation_factor ) * luma;
+      }
+    }
+  };
+
+  /// Applies the tone curve LUT with the tone-level color correction
+  struct ToneCurveCCKernel
+  {
+    float *R_out, *G_out, *B_out;
+    const float *R_in, *G_in, *B_in, *L_in;
+    const UniformArrayLUT *tc_lut, *cc_lut;
+    DisplayFunction *df;
+
+    void operator()( int begin, int end ) const
+    {
+      for( int i=begin; i < end; i++ ) {
+        float L_fix = clamp_channel(L_in[i]);
+        const float L_out = tc_lut->interp( log10(L_fix) );
+        const float s = cc_lut->interp( log10(L_fix) ); // color correction
+        R_out[i] = df->inv_display(powf(clamp_channel(R_in[i]/L_fix), s) * L_out);
+        G_out[i] = df->inv_display(powf(clamp_channel(G_in[i]/L_fix), s) * L_out);
+        B_out[i] = df->inv_display(powf(clamp_channel(B_in[i]/L_fix), s) * L_out);
+      }
+    }
+  };
+}
 
 int datmo_apply_tone_curve( float *R_out, float *G_out, float *B_out, int width, int height,
   const float *R_in, const float *G_in, const float *B_in, const float *L_in, datmoToneCurve *tc,
@@ -1058,15 +1534,18 @@ int datmo_apply_tone_curve( float *R_out, float *G_out, float *B_out, int width,
     tc_lut.y_i[i] = df->inv_display( (float)pow( 10, tc->y_i[i] ) );
   }  
 
-  const size_t pix_count = width*height;
-  for( size_t i=0; i < pix_count; i++ ) {
-    float L_fix = clamp_channel(L_in[i]);
-    const float luma = tc_lut.interp( log10(L_fix) );
-    R_out[i] = pow( clamp_channel(R_in[i]/L_fix), saturation_factor ) * luma;
-    G_out[i] = pow( clamp_channel(G_in[i]/L_fix), saturation_factor ) * luma;
-    B_out[i] = pow( clamp_channel(B_in[i]/L_fix), saturation_factor ) * luma;
-    
-  }
+  // Point-wise once the LUT is known, the tiles are mapped in parallel
+  ToneCurveKernel kernel;
+  kernel.R_out = R_out;
+  kernel.G_out = G_out;
+  kernel.B_out = B_out;
+  kernel.R_in = R_in;
+  kernel.G_in = G_in;
+  kernel.B_in = B_in;
+  kernel.L_in = L_in;
+  kernel.tc_lut = &tc_lut;
+  kernel.saturation_factor = saturation_factor;
+  pfstmo::map_tiles( width*height, kernel );
 
   return PFSTMO_OK;  
 }
@@ -1096,15 +1575,18 @@ int datmo_apply_tone_curve_cc( float *R_out, float *G_out, float *B_out, int wid
   }
   cc_lut.y_i[tc->size-1] = 1;
   
-  const size_t pix_count = width*height;
-  for( size_t i=0; i < pix_count; i++ ) {
-    float L_fix = clamp_channel(L_in[i]);
-    const float L_out = tc_lut.interp( log10(L_fix) );
-    const float s = cc_lut.interp( log10(L_fix) ); // color correction
-    R_out[i] = df->inv_display(powf(clamp_channel(R_in[i]/L_fix), s) * L_out);
-    G_out[i] = df->inv_display(powf(clamp_channel(G_in[i]/L_fix), s) * L_out);
-    B_out[i] = df->inv_display(powf(clamp_channel(B_in[i]/L_fix), s) * L_out);
-  }
+  ToneCurveCCKernel kernel;
+  kernel.R_out = R_out;
+  kernel.G_out = G_out;
+  kernel.B_out = B_out;
+  kernel.R_in = R_in;
+  kernel.G_in = G_in;
+  kernel.B_in = B_in;
+  kernel.L_in = L_in;
+  kernel.tc_lut = &tc_lut;
+  kernel.cc_lut = &cc_lut;
+  kernel.df = df;
+  pfstmo::map_tiles( width*height, kernel );
 
   return PFSTMO_OK;  
 }
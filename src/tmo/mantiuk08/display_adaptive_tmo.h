@@ -103,6 +103,47 @@ public:
 };
 
 
+/**
+ * State carried between consecutive frames when tone-mapping a video
+ * sequence with datmo_compute_tone_curve(). The tone-curve found for
+ * the previous frame is used as the starting point of the iterative
+ * optimization for the next frame, which usually converges in a few
+ * iterations as the image statistics change little between frames. If
+ * the conditional density changed less than the given tolerance, the
+ * optimization is skipped altogether and the previous tone-curve is
+ * reused.
+ *
+ * The same object must not be shared between unrelated sequences.
+ */
+class datmoWarmStart
+{
+public:
+  float tolerance;              /* max. change of conditional density to skip optimization */
+
+  double *C_prev;               /* normalized conditional density of the last optimized frame */
+  size_t C_size;
+  double *y_prev;               /* tone-curve found for the last frame */
+  size_t y_size;
+  double params[6];             /* TMO parameters used for the last frame */
+
+  size_t frames_skipped;        /* statistics: frames for which the optimization was skipped */
+  size_t frames_optimized;      /* statistics: frames for which the optimization was run */
+
+  /**
+   * @param tolerance total variation distance (0-1) between the
+   * normalized conditional densities of two frames below which the
+   * tone-curve of the previous frame is reused. Set to 0 to always run
+   * the optimization (but still start from the previous solution).
+   */
+  datmoWarmStart( float tolerance = 0.01f );
+  ~datmoWarmStart();
+
+  /**
+   * Forget the previous frame, e.g. on a scene cut.
+   */
+  void reset();
+};
+
 typedef int datmoVisualModel;
 
 #define vm_none 0
@@ -162,12 +203,19 @@ int datmo_tonemap( float *R_out, float *G_out, float *B_out, int width, int heig
  * @param height image height in pixels
  * @param L input luminance map (L=0.212656*R + 0.715158*G + 0.072186*B)
  * @param progress_cb callback function for reporting progress or stopping computations.
+ * @param max_error if greater than 0, only a subset of pixels is used
+ * to estimate the statistics, so that the standard error of the
+ * estimated probabilities (assuming independent samples) is below
+ * this value. Useful for very large images. 0 - use all pixels.
+ * @param error_bound if not NULL, the upper bound on the standard error
+ * of the estimated probabilities is stored there.
  * @return pointer to conditional_density or NULL if computation was
  * aborted or an error was encountered. The conditional_density object
  * must be freed by the calling application using the 'delete'
  * statement.
  */
-std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int width, int height, const float *L, pfstmo_progress_callback progress_cb = NULL );
+std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int width, int height, const float *L, pfstmo_progress_callback progress_cb = NULL,
+  double max_error = 0, double *error_bound = NULL );
 
 
 /**
@@ -186,6 +234,8 @@ std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int wi
  * mapped to the maximum luminance of a display. If the parameter is
  * set to -1, the tone-mapper will not anchor to white (recommended for HDR images).
  * @param progress_cb callback function for reporting progress or stopping computations.
+ * @param warm_start state of the previous frame when tone-mapping
+ * video (see datmoWarmStart) or NULL to optimize from scratch.
  * @return PFSTMO_OK if tone-mapping was sucessful, PFSTMO_ABORTED if
  * it was stopped from a callback function and PFSTMO_ERROR if an
  * error was encountered.
@@ -193,7 +243,8 @@ std::auto_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int wi
 int datmo_compute_tone_curve( datmoToneCurve *tc, datmoConditionalDensity *cond_dens,
   DisplayFunction *df, DisplaySize *ds, const float enh_factor = 1.f, 
   const float white_y = -1, pfstmo_progress_callback progress_cb = NULL,
-  datmoVisualModel visualModel = vm_full, double scene_l_adapt = 1000 );
+  datmoVisualModel visualModel = vm_full, double scene_l_adapt = 1000,
+  datmoWarmStart *warm_start = NULL );
 
 /**
  * Deprectaied: use datmo_apply_tone_curve_cc()
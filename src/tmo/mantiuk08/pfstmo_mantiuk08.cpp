@@ -34,17 +34,15 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <iostream>
-#include <memory>
 
 #include <sys/time.h>
 
 #include <pfs.h>
 
-#include "display_adaptive_tmo.h"
+#include "tmo_context.h"
 
 
 #define PROG_NAME "pfstmo_mantiuk08"
@@ -75,14 +73,13 @@ public:
 using namespace std;
 
 const char *temp_file_2pass = "datmo_tone_curves.tmp";
-bool read_tone_curve( FILE *fh, datmoToneCurve *tc, double **x_scale );
 
 void printHelp()
 {
   fprintf( stderr, PROG_NAME " (" PACKAGE_STRING ") : \n"
     "\t[--display-function <df-spec>] [--display-size=<size-spec>]\n"
     "\t[--color-saturation <float>] [--contrast-enhancement <float>]\n"
-    "\t[--white-y=<float>]\n"
+    "\t[--white-y=<float>] [--warm-start <tolerance>] [--subsample <max-error>]\n"
     "\t[--verbose] [--quiet] [--help]\n"
     "See man page for more information.\n" );
 }
@@ -109,33 +106,17 @@ int progress_report( int progress )
 void tmo_mantiuk08(int argc, char * argv[])
 {
 
-  //--- default tone mapping parameters;
-  float contrast_enhance_factor = 1.f;
-  float saturation_factor = 1.f;
-  float white_y = -2.f;
-  float fps = 25;  
-  int temporal_filter = 0;
-  int itmax = 200;
-  float tol = 1e-3;
-  DisplayFunction *df = NULL;
-  DisplaySize *ds = NULL;
-  const char *output_tc = NULL;
-  datmoVisualModel visual_model = vm_full;
-  double scene_l_adapt = 1000;  
+  //--- tone mapping parameters, checked by the mantiuk08 context
+  pfstmo::Options tmo_options;
+  bool white_y_given = false;
 
   //--- process command line args
 
-  df = createDisplayFunctionFromArgs( argc, argv );
-  if( df == NULL )
-    df = new DisplayFunctionGGBA( "lcd" );
-
-  ds = createDisplaySizeFromArgs( argc, argv );
-  if( ds == NULL )
-    ds = new DisplaySize( 30.f, 0.5f );
-  
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "verbose", no_argument, NULL, 'v' },
+    { "display-function", required_argument, NULL, 'd' },
+    { "display-size", required_argument, NULL, 's' },
     { "contrast-enhancement", required_argument, NULL, 'e' },
     { "color-saturation", required_argument, NULL, 'c' },
     { "white-y", required_argument, NULL, 'y' },
@@ -143,13 +124,15 @@ void tmo_mantiuk08(int argc, char * argv[])
     { "output-tone-curve", required_argument, NULL, 'o' },
     { "visual-model", required_argument, NULL, 'm' },
     { "scene-y-adapt", required_argument, NULL, 'a' },
+    { "warm-start", required_argument, NULL, 'w' },
+    { "subsample", required_argument, NULL, 'u' },
     { "quiet", no_argument, NULL, 'q' },    
     { NULL, 0, NULL, 0 }
   };
 
   int optionIndex = 0;
   while( 1 ) {
-    int c = getopt_long (argc, argv, "vhe:c:y:t:o:qm:f:a:", cmdLineOptions, &optionIndex);
+    int c = getopt_long (argc, argv, "vhd:s:e:c:y:o:qm:f:a:w:u:", cmdLineOptions, &optionIndex);
     if( c == -1 ) break;
     switch( c ) {
     case 'h':
@@ -161,98 +144,25 @@ void tmo_mantiuk08(int argc, char * argv[])
     case 'q':
       quiet = true;
       break;
-    case 'a':
-      if( !strcmp( optarg, "auto" ) )
-        scene_l_adapt = -1;
-      else {        
-        scene_l_adapt = (float)strtod( optarg, NULL );
-        if( scene_l_adapt <= 0.0f )
-        throw pfs::Exception("incorrect scane adaptation luminance. The value must be greater than 0.");
-      }      
-      break;
-    case 'e':
-      contrast_enhance_factor = (float)strtod( optarg, NULL );
-      if( contrast_enhance_factor <= 0.0f )
-        throw pfs::Exception("incorrect contrast enhancement factor, accepted value must be a positive number");
-      break;
-    case 'c':
-      saturation_factor = (float)strtod( optarg, NULL );
-      if( saturation_factor < 0.0f || saturation_factor > 2.0f )
-        throw pfs::Exception("incorrect saturation factor, accepted range is (0..2)");
-      break;
-    case 'm':
-    {      
-      char *saveptr;
-      char *token;
-      visual_model = vm_none;
-      
-      token = strtok_r( optarg, ",:", &saveptr );
-      while( token != NULL ) {
-        
-        if( !strcmp( token, "none" ) ) {
-          visual_model = vm_none;
-        } else if( !strcmp( token, "full" ) ) {      
-          visual_model = vm_full;
-        } else if( !strcmp( token, "luminance_masking" ) ) {          
-          visual_model |= vm_luminance_masking;
-        } else if( !strcmp( token, "contrast_masking" ) ) {          
-          visual_model |= vm_contrast_masking;
-        } else if( !strcmp( token, "csf" ) ) {          
-          visual_model |= vm_csf;
-        } else 
-          throw pfs::Exception("Unrecognized visual model");
-        
-        token = strtok_r( NULL, ",:", &saveptr );
-      }      
-    }
-    
-      break;
-      
-    case 'y':
-      if( !strcmp( optarg, "none" ) )
-        white_y = -1;
-      else
-        white_y = (float)strtod( optarg, NULL );
-      if( white_y < 0.0f )
-        throw pfs::Exception("incorrect white-y value. The value must be greater than 0");
-      break;
-    case 'f':
-      fps = strtod( optarg, NULL );
-      if( fps != 25 && fps != 30 && fps != 60 )
-        throw pfs::Exception("Only 3 frame-per-seconds values are supported: 25, 30 and 60.");
-      break;
-    case 'o':
-      output_tc = optarg;
-      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    case 'y':
+      white_y_given = true;
+      // fall through
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  if( verbose ) {
-    df->print( stderr );
-    ds->print( stderr );
-    fprintf( stderr, "Frames-per-second: %g\n", fps );    
-    fprintf( stderr, "Contrast masking: %d\n", (bool)(visual_model & vm_contrast_masking) );
-    fprintf( stderr, "Luminance masking: %d\n", (bool)(visual_model & vm_luminance_masking) );
-    fprintf( stderr, "CSF: %d\n", (bool)(visual_model & vm_csf) );
-    fprintf( stderr, "Scane adaptation luminance: %g (-1 means auto)\n", scene_l_adapt );  
-  }
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "mantiuk08", 1, 1, tmo_options );
 
   Timing tm_entire;
 
-  FILE *tc_FH = NULL;
-  if( output_tc != NULL ) {
-    tc_FH = fopen( output_tc, "w" );
-    if( tc_FH == NULL )
-      throw pfs::Exception("cannot open file for writing tone-curve.");
-  }
-
-  
-  datmoTCFilter rc_filter( fps, log10(df->display(0)), log10(df->display(1)) );
   pfs::DOMIO pfsio;
+  pfstmo::Context *tmo = NULL;
 
   size_t frame_no = 0;
   while( true ) {
@@ -263,6 +173,8 @@ void tmo_mantiuk08(int argc, char * argv[])
     pfs::Channel *inX, *inY, *inZ;
 	
     frame->getXYZChannels(inX, inY, inZ);
+    if( inY==NULL || inX==NULL || inZ==NULL )
+      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
     int cols = frame->getWidth();
     int rows = frame->getHeight();
 
@@ -276,123 +188,43 @@ void tmo_mantiuk08(int argc, char * argv[])
       strcpy( frame_name, "..." );
       strncpy( frame_name+3, file_name + strlen( file_name ) - len, len+1 );
     }
-    
-
-    {
-      pfs::Array2DImpl R( cols, rows );
-  
-      pfs::transformColorSpace( pfs::CS_XYZ, inX, inY, inZ, pfs::CS_RGB, inX, &R, inZ );
-
-      if( white_y == -2.f ) {       // If not overriden by command line options
-        const char *white_y_str = frame->getTags()->getString( "WHITE_Y" );
-        if( white_y_str != NULL ) {
-          white_y = strtof( white_y_str, NULL );
-          if( white_y == 0 ) {
-            white_y = -1;
-            fprintf( stderr, PROG_NAME ": warning - wrong WHITE_Y in the input image" );        
-          }
-        }
-      }      
-      if( verbose && frame_no == 0 ) {
-        fprintf( stderr, "Luminance factor of the reference white: " );
-        if( white_y < 0 )
-          fprintf( stderr, "not specified\n" );
-        else
-          fprintf( stderr, "%g\n", white_y );      
-      }
 
-      const char *lum_data = frame->getTags()->getString("LUMINANCE");
-      if( lum_data != NULL && !strcmp( lum_data, "DISPLAY" ) && frame_no == 0 )
-        fprintf( stderr, PROG_NAME " warning: input image should be in linear (not gamma corrected) luminance factor units. Use '--linear' option with pfsin* commands.\n" );
-
-      Timing tm_cond_dens;
-        std::auto_ptr<datmoConditionalDensity> C = datmo_compute_conditional_density( cols, rows, inY->getRawData(), progress_report );
-        if( C.get() == NULL )
-          throw pfs::Exception("failed to analyse the image");
-	tm_cond_dens.report( "Conditional density" );
-
-	Timing tm_comp_tone_curve;
-        int res;
-        datmoToneCurve *tc = rc_filter.getToneCurvePtr();        
-        res = datmo_compute_tone_curve( tc, C.get(), df, ds, contrast_enhance_factor, white_y, progress_report, visual_model, scene_l_adapt );
-        if( res != PFSTMO_OK )
-          throw pfs::Exception( "failed to compute a tone-curve" );    
-
-        datmoToneCurve *tc_filt = rc_filter.filterToneCurve();
-	tm_comp_tone_curve.report( "Computing a tone-cuve" );
-        
-
-        {
-
-	  Timing tm_tonecurve;
-        int res;
-        res = datmo_apply_tone_curve_cc( inX->getRawData(), R.getRawData(), inZ->getRawData(), cols, rows,
-          inX->getRawData(), R.getRawData(), inZ->getRawData(), inY->getRawData(), tc_filt,
-          df, saturation_factor );
-        if( res != PFSTMO_OK )
-          throw pfs::Exception( "failed to tone-map an image" );
-
-	tm_tonecurve.report( "Apply tone-curve" );
-
-        if( tc_FH != NULL ) {
-          for( int i=0; i < tc_filt->size; i++ )
-            fprintf( tc_FH, "%d,%g,%g,%g\n", (int)frame_no, tc_filt->x_i[i], tc_filt->y_i[i], df->inv_display( (float)pow( 10, tc_filt->y_i[i] ) ) );
-        }
-    
-//    int res;
-//    res = datmo_tonemap( inX->getRawData(), R.getRawData(), inZ->getRawData(), cols, rows,
-//      inX->getRawData(), R.getRawData(), inZ->getRawData(), inY->getRawData(),
-//    df, ds, contrast_enhance_factor, saturation_factor, white_y, progress_report );
-        
-        progress_report( 100 );        
-
-        pfs::transformColorSpace( pfs::CS_RGB, inX, &R, inZ, pfs::CS_XYZ, inX, inY, inZ );
-        frame->getTags()->setString("LUMINANCE", "DISPLAY");
-  
-        pfsio.writeFrame( frame, stdout );
+    // the tone-curve filter is kept for all frames of the same size
+    if( tmo == NULL || tmo->getWidth() != cols || tmo->getHeight() != rows ) {
+      pfstmo::Options frame_options( tmo_options );
+      const char *white_y_str = frame->getTags()->getString( "WHITE_Y" );
+      if( !white_y_given && white_y_str != NULL ) { // If not overriden by command line options
+        float white_y = strtof( white_y_str, NULL );
+        if( white_y == 0 )
+          fprintf( stderr, PROG_NAME ": warning - wrong WHITE_Y in the input image\n" );
+        frame_options.set( "white-y", white_y > 0 ? white_y_str : "none" );
       }
-        
-      pfsio.freeFrame(frame);
+
+      delete tmo;
+      tmo = pfstmo::createContext( "mantiuk08", cols, rows, frame_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
     }
-    
+
+    const char *lum_data = frame->getTags()->getString("LUMINANCE");
+    if( lum_data != NULL && !strcmp( lum_data, "DISPLAY" ) && frame_no == 0 )
+      fprintf( stderr, PROG_NAME " warning: input image should be in linear (not gamma corrected) luminance factor units. Use '--linear' option with pfsin* commands.\n" );
+
+    tmo->process( inX->getRawData(), inY->getRawData(), inZ->getRawData(), progress_report );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
+
+    pfsio.writeFrame( frame, stdout );
+    pfsio.freeFrame(frame);
 
     frame_no++;
 
   }
 
-      
-    if( tc_FH != NULL )
-      fclose( tc_FH );
-    
-  delete df;
-  delete ds;
+  delete tmo;
 
   tm_entire.report( "Entire operation" );
 }
 
-bool read_tone_curve( FILE *fh, datmoToneCurve *tc, double **x_scale )
-{
-  int size, frame_no, read;
-  read = fscanf( fh, "%d,%d\n", &frame_no, &size );
-  if( read != 2 )
-    return false;
-  
-  if( *x_scale == NULL )
-    *x_scale = new double[size];
-
-  tc->init( size, *x_scale );
-  
-  for( int i=0; i < size; i++ ) {
-    float x, y;
-    read = fscanf( fh, "%f,%f\n", &x, &y );
-    if( read != 2 )
-      throw pfs::Exception( "missing data in the 2-pass file"  );
-    (*x_scale)[i] = x;
-    tc->y_i[i] = y;
-  }
-  return true;
-}
-
 
 
 int main( int argc, char* argv[] )
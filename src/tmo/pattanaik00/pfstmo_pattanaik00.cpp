@@ -37,11 +37,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#include "tmo_pattanaik00.h"
+#include "tmo_context.h"
 
 using namespace std;
 
@@ -51,15 +50,13 @@ class QuietException
 {
 };
 
-void multiplyChannels( pfs::Array2D* X, pfs::Array2D* Y, pfs::Array2D* Z, float mult );
-
-
 void printHelp()
 {
   fprintf( stderr, PROG_NAME " (" PACKAGE_STRING ") : \n"
     "\t[--time-dependence] [--local] \n"
     "\t[--mul <multiplier>] \n"
     "\t[--cone <val>] [--rod <val>] \n"
+    "\t[--subsample <step>] \n"
     "\t[--verbose] [--help]\n"
     "See man page for more information.\n" );
 }
@@ -68,13 +65,8 @@ void pfstmo_pattanaik00( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-  bool timedependence = false;
-  bool local = false;
-  float multiplier = 1.0f;
-  float Acone = -1.0f;
-  float Arod  = -1.0f;
-  float fps = 16.0f;
+  //--- tone mapping parameters, checked by the pattanaik00 context
+  pfstmo::Options tmo_options;
 
   //--- process command line args
   bool verbose = false;
@@ -88,12 +80,13 @@ void pfstmo_pattanaik00( int argc, char* argv[] )
     { "mul", required_argument, NULL, 'm' },
     { "cone", required_argument, NULL, 'c' },
     { "rod", required_argument, NULL, 'r' },
+    { "subsample", required_argument, NULL, 's' },
     { NULL, 0, NULL, 0 }
   };
 
   int optionIndex = 0;
   while( 1 ) {
-    int c = getopt_long (argc, argv, "hvtf:lm:c:r:", cmdLineOptions, &optionIndex);
+    int c = getopt_long (argc, argv, "hvtf:lm:c:r:s:", cmdLineOptions, &optionIndex);
     if( c == -1 ) break;
     switch( c ) {
     case 'h':
@@ -102,51 +95,19 @@ void pfstmo_pattanaik00( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 't':
-      timedependence = true;
-      break;
-    case 'l':
-      local = true;
-      break;
-    case 'f':
-      fps = (float)strtod( optarg, NULL );
-      if( fps<=0.0f )
-        throw pfs::Exception("incorrect frames per second value, should be non-zero positive");
-      break;
-    case 'm':
-      multiplier = (float)strtod( optarg, NULL );
-      if( multiplier<=0.0f )
-        throw pfs::Exception("incorrect multiplier value, should be non-zero positive");
-      break;
-    case 'c':
-      Acone = (float)strtod( optarg, NULL );
-      if( Acone<=0.0f )
-        throw pfs::Exception("incorrect cone adaptation value, should be non-zero positive");
-      if( Arod==-1.0f )
-        Arod=Acone;
-      break;
-    case 'r':
-      Arod = (float)strtod( optarg, NULL );
-      if( Arod<=0.0f )
-        throw pfs::Exception("incorrect rod adaptation value, should be non-zero positive");
-      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  VERBOSE_STR << "time-dependence: " << (timedependence ? "yes" : "no") << endl;
-  if( timedependence )
-    VERBOSE_STR << "frames per sec.: " << fps << endl;
-  VERBOSE_STR << "local:           " << (local ? "yes" : "no") << endl;
-  VERBOSE_STR << "multiplier:      " << multiplier << endl;
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "pattanaik00", 1, 1, tmo_options );
 
-   
-  VisualAdaptationModel* am = new VisualAdaptationModel();
-
-  bool firstFrame = true;
+  pfstmo::Context *tmo = NULL;
   while( true ) 
   {
     pfs::Frame *frame = pfsio.readFrame( stdin );
@@ -154,69 +115,30 @@ void pfstmo_pattanaik00( int argc, char* argv[] )
 
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y==NULL || X==NULL || Z==NULL)
       throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
         
-    // adaptation model
-    if( multiplier!=1.0f )
-      multiplyChannels( X, Y, Z, multiplier );
-
-    if( !local )
-    {
-      if( firstFrame || !timedependence )
-      {
-        if( Acone!=-1.0f )
-          am->setAdaptation(Acone,Arod);
-        else
-          am->setAdaptation(Y);
-
-        firstFrame = false;
-      }
-      else
-        am->calculateAdaptation(Y, 1.0f/fps);
-      
-      VERBOSE_STR << "adaptation cone: " << am->getAcone() << endl;
-      VERBOSE_STR << "adaptation rod:  " << am->getArod() << endl;
-      VERBOSE_STR << "bleaching cone:  " << am->getBcone() << endl;
-      VERBOSE_STR << "bleaching rod:   " << am->getBrod() << endl;
-    }
-
-    // tone mapping
+    // the adaptation state is kept for all frames of the same size
     int w = Y->getCols();
     int h = Y->getRows();
-    pfs::Array2DImpl* R = new pfs::Array2DImpl(w,h);
-    pfs::Array2DImpl* G = new pfs::Array2DImpl(w,h);
-    pfs::Array2DImpl* B = new pfs::Array2DImpl(w,h);
-
-    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, R, G, B );
-    tmo_pattanaik00( w, h, R->getRawData(), G->getRawData(), B->getRawData(), Y->getRawData(), am, local );
-    pfs::transformColorSpace( pfs::CS_RGB, R, G, B, pfs::CS_XYZ, X, Y, Z );
+    if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "pattanaik00", w, h, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
+    }
 
-    delete R;
-    delete G;
-    delete B;
+    tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
 
     //---
     pfsio.writeFrame( frame, stdout );
     pfsio.freeFrame( frame );        
   }
 
-  delete am; // delete visual adaptation model
-}
-
-void multiplyChannels( pfs::Array2D* X, pfs::Array2D* Y, pfs::Array2D* Z, float mult )
-{
-  int size = Y->getCols() * Y->getRows();
-
-  for( int i=0 ; i<size; i++ )
-  {
-    (*X)(i) *= mult;
-    (*Y)(i) *= mult;
-    (*Z)(i) *= mult;
-  }
+  delete tmo;
 }
 
 
@@ -34,13 +34,18 @@
 #include <config.h>
 
 #include <math.h>
+#include <assert.h>
+
+#include <vector>
+#include <algorithm>
 
 #include "tmo_pattanaik00.h"
 #include "pfstmo.h"
+#include "fast_math.h"
 
 
 /// sensitivity of human visual system
-float n = 0.73f;
+const float n = 0.73f;
 
 void calculateLocalAdaptation(const pfstmo::Array2D* Y, int x, int y, float& Acone, float& Arod);
 float sigma_response_rod(float I);
@@ -48,18 +53,77 @@ float sigma_response_cone(float I);
 float model_response(float I, float sigma);
 
 
+/// Range of log2 luminance covered by the response table, values
+/// outside are clamped (the responses saturate there)
+static const float LUT_LOG2_MIN = -30.0f;
+static const float LUT_LOG2_MAX = 36.0f;
+/// Number of entries in the response table
+static const int LUT_SIZE = 8192;
+
+
+/**
+ * Mapping of the scene appearance to the display, constant for a frame
+ */
+struct AppearanceMapping
+{
+  /// half-saturation constant for display
+  float display_sigma;
+  /// display luminance of white
+  float display_white;
+  /// display color saturation
+  float S_d;
+  /// scene luminance minus shift
+  float disp_x;
+  /// scene luminance to display luminance scale factor
+  float disp_y;
+  /// display luminance plus shift
+  float disp_z;
+};
+
+/**
+ * @brief Luminance dependent part of the operator
+ *
+ * The tone mapped colour is pow(c, Scolor)*Icone + Irod, where c is
+ * the ratio of the colour channel to luminance l.
+ */
+static void pixel_response( float l, float sigma_cone, float sigma_rod,
+  float Bcone, float Brod, const AppearanceMapping& am,
+  float& Icone, float& Irod, float& Scolor )
+{
+  // receptor responses
+  float Rrod = Brod*model_response(l, sigma_rod );
+  float Rcone = Bcone*model_response(l, sigma_cone );
+  float Rlum = Rrod + Rcone;
+  if( Rlum>0.0f )
+  {
+    Rrod /= Rlum;
+    Rcone /= Rlum;
+  }
+
+  Scolor = (Bcone*pow(sigma_cone,n)*n*pow(l,n))
+    / pow( pow(l,n)+pow(sigma_cone,n), 2 );
+  Scolor /= am.S_d;
+
+  // appearance model
+  float Ra = (Rlum - am.disp_x)*am.disp_y+am.disp_z;
+  Ra = (Ra<1.0f) ? ((Ra>0.0f) ? Ra : 0.0f ) : 0.9999999f;
+
+  // inverse display model
+  float I = am.display_sigma * pow(Ra/(1.0f-Ra), 1.0f/n) / am.display_white;
+
+  Icone = I*Rcone;
+  Irod = I*Rrod;
+}
+
 
 // tone mapping operator code
 void tmo_pattanaik00( unsigned int width, unsigned int height,
   float* nR, float* nG, float* nB, 
   const float* nY, VisualAdaptationModel* am, bool local )
 {  
-  ///--- initialization of parameters
+  assert(nR!=NULL && nG!=NULL && nB!=NULL && nY!=NULL);
 
-  const pfstmo::Array2D* Y = new pfstmo::Array2D(width, height, const_cast<float*>(nY));
-  pfstmo::Array2D* R = new pfstmo::Array2D(width, height, nR);
-  pfstmo::Array2D* G = new pfstmo::Array2D(width, height, nG);
-  pfstmo::Array2D* B = new pfstmo::Array2D(width, height, nB);
+  ///--- initialization of parameters
 
   /// cones level of adaptation
   float Acone = am->getAcone();
@@ -75,23 +139,22 @@ void tmo_pattanaik00( unsigned int width, unsigned int height,
   /// fraction of adaptation luminance that represents dark luminance
   float dark_factor = 32.0f/5.0f;
 
+  AppearanceMapping mapping;
+
   /// goal adaptation luminance while watching display
   float G_display=25.0f;
-  /// display luminance of white
-  float display_white = G_display*white_factor;
+  mapping.display_white = G_display*white_factor;
   /// display luminance of dark
   float display_dark = G_display/dark_factor;
-  /// half-saturation constant for display
-  float display_sigma = sigma_response_cone(G_display);
+  mapping.display_sigma = sigma_response_cone(G_display);
 
   /// reference white for display
-  float REF_Wht_display = model_response(display_white, display_sigma);
+  float REF_Wht_display = model_response(mapping.display_white, mapping.display_sigma);
   /// reference black for display
-  float REF_Blk_display = model_response(display_dark, display_sigma);
+  float REF_Blk_display = model_response(display_dark, mapping.display_sigma);
 
-  /// display color saturation
-  float S_d = (REF_Wht_display - REF_Blk_display)
-    / (log10(display_white)-log10(display_dark));
+  mapping.S_d = (REF_Wht_display - REF_Blk_display)
+    / (log10(mapping.display_white)-log10(display_dark));
 
   ///--- precalculated parameters
 
@@ -112,12 +175,9 @@ void tmo_pattanaik00( unsigned int width, unsigned int height,
   float REF_Blk_scene = Bcone*model_response(scene_dark_cone, sigma_cone)
     + Brod*model_response(scene_dark_rod, sigma_rod);
 
-  /// scene luminance minus shift
-  float disp_x = 0.0f;
-  /// scene luminance to display luminance scale factor
-  float disp_y = 1.0f;
-  /// display luminance plus shift
-  float disp_z = 0.0f;
+  mapping.disp_x = 0.0f;
+  mapping.disp_y = 1.0f;
+  mapping.disp_z = 0.0f;
 
   float scale = (REF_Wht_display-REF_Blk_display)
     / (REF_Wht_scene-REF_Blk_scene);
@@ -126,92 +186,127 @@ void tmo_pattanaik00( unsigned int width, unsigned int height,
   {
     if( REF_Wht_scene>REF_Wht_display )
     {
-      disp_x = REF_Wht_scene;
-      disp_y = scale;
-      disp_z = REF_Wht_display;
+      mapping.disp_x = REF_Wht_scene;
+      mapping.disp_y = scale;
+      mapping.disp_z = REF_Wht_display;
     }
     else if( REF_Blk_scene<REF_Blk_display )
     {
-      disp_x = REF_Blk_scene;
-      disp_y = scale;
-      disp_z = REF_Blk_display;
+      mapping.disp_x = REF_Blk_scene;
+      mapping.disp_y = scale;
+      mapping.disp_z = REF_Blk_display;
     }
   }
   else if(scale > 1.0f )
   {
     if( REF_Wht_scene>REF_Wht_display )
     {
-      disp_x = REF_Wht_scene;
-      disp_y = 1.0f;
-      disp_z = REF_Wht_display;
+      mapping.disp_x = REF_Wht_scene;
+      mapping.disp_y = 1.0f;
+      mapping.disp_z = REF_Wht_display;
     }
     else if( REF_Blk_scene<REF_Blk_display )
     {
-      disp_x = REF_Blk_scene;
-      disp_y = 1.0f;
-      disp_z = REF_Blk_display;
+      mapping.disp_x = REF_Blk_scene;
+      mapping.disp_y = 1.0f;
+      mapping.disp_z = REF_Blk_display;
     }
   }
 
   ///--- tone map image
 
-  int im_width = Y->getCols();
-  int im_height = Y->getRows();
-  for( int y=0 ; y<im_height ; y++ )
-  {
-    for( int x=0 ; x<im_width ; x++ )
-    {
-      float l = (*Y)(x,y);
-      float r = (*R)(x,y)/l;
-      float g = (*G)(x,y)/l;
-      float b = (*B)(x,y)/l;
+  const int im_width = width;
+  const int im_height = height;
 
-      if( local )
-      {
-        calculateLocalAdaptation(Y,x,y,Acone,Arod);
-        Bcone = 2e6/(2e6+Acone);
-        Brod = 0.04f/(0.04f+Arod);
-        
-        sigma_cone = sigma_response_cone(Acone);
-        sigma_rod = sigma_response_rod(Arod);
-      }
+  if( local )
+  {
+    // adaptation changes from pixel to pixel
+    const pfstmo::Array2D Y(width, height, const_cast<float*>(nY));
 
-      // receptor responses
-      float Rrod = Brod*model_response(l, sigma_rod );
-      float Rcone = Bcone*model_response(l, sigma_cone );
-      float Rlum = Rrod + Rcone;
-      if( Rlum>0.0f )
+    #pragma omp parallel for schedule(dynamic,16)
+    for( int y=0 ; y<im_height ; y++ )
+    {
+      for( int x=0 ; x<im_width ; x++ )
       {
-	Rrod /= Rlum;
-	Rcone /= Rlum;
+        const int i = y*im_width + x;
+        const float l = nY[i];
+
+        float Acone_local, Arod_local;
+        calculateLocalAdaptation(&Y,x,y,Acone_local,Arod_local);
+        const float Bcone_local = 2e6/(2e6+Acone_local);
+        const float Brod_local = 0.04f/(0.04f+Arod_local);
+
+        float Icone, Irod, Scolor;
+        pixel_response( l, sigma_response_cone(Acone_local),
+          sigma_response_rod(Arod_local), Bcone_local, Brod_local, mapping,
+          Icone, Irod, Scolor );
+
+        // apply new luminance; black pixels stay black, as in the
+        // global version
+        float r = pow( nR[i]/l, Scolor )*Icone + Irod;
+        float g = pow( nG[i]/l, Scolor )*Icone + Irod;
+        float b = pow( nB[i]/l, Scolor )*Icone + Irod;
+        const bool black = !(l > 0.0f);
+        r = pfstmo::select( black, 0.0f, r );
+        g = pfstmo::select( black, 0.0f, g );
+        b = pfstmo::select( black, 0.0f, b );
+
+        nR[i] = (r<1.0f) ? ((r>0.0f) ? r : 0.0f) : 1.0f;
+        nG[i] = (g<1.0f) ? ((g>0.0f) ? g : 0.0f) : 1.0f;
+        nB[i] = (b<1.0f) ? ((b>0.0f) ? b : 0.0f) : 1.0f;
       }
-      
-      float Scolor = (Bcone*pow(sigma_cone,n)*n*pow(l,n))
-	/ pow( pow(l,n)+pow(sigma_cone,n), 2 );
-      Scolor /= S_d;
-
-      // appearance model
-      float Ra = (Rlum - disp_x)*disp_y+disp_z;
-      Ra = (Ra<1.0f) ? ((Ra>0.0f) ? Ra : 0.0f ) : 0.9999999f;
-
-      // inverse display model
-      float I = display_sigma * pow(Ra/(1.0f-Ra), 1.0f/n) / display_white;
-
-      // apply new luminance
-      r = pow( r, Scolor )*I*Rcone + I*Rrod;
-      g = pow( g, Scolor )*I*Rcone + I*Rrod;
-      b = pow( b, Scolor )*I*Rcone + I*Rrod;
-
-      (*R)(x,y) = (r<1.0f) ? ((r>0.0f) ? r : 0.0f) : 1.0f;
-      (*G)(x,y) = (g<1.0f) ? ((g>0.0f) ? g : 0.0f) : 1.0f;
-      (*B)(x,y) = (b<1.0f) ? ((b>0.0f) ? b : 0.0f) : 1.0f;
     }
+    return;
+  }
+
+  // The adaptation state is constant within the frame, so the
+  // luminance dependent terms are tabulated over log2 luminance and
+  // linearly interpolated. Each table entry holds Icone, Irod and
+  // Scolor.
+  std::vector<float> lut( 3*(LUT_SIZE+1) );
+  const float lut_step = (LUT_LOG2_MAX-LUT_LOG2_MIN) / (LUT_SIZE-1);
+  #pragma omp parallel for schedule(static)
+  for( int k=0 ; k<LUT_SIZE ; k++ )
+    pixel_response( exp2( LUT_LOG2_MIN + k*lut_step ), sigma_cone, sigma_rod,
+      Bcone, Brod, mapping, lut[3*k], lut[3*k+1], lut[3*k+2] );
+  // guard entry for the interpolation at the upper end
+  for( int c=0 ; c<3 ; c++ )
+    lut[3*LUT_SIZE+c] = lut[3*(LUT_SIZE-1)+c];
+
+  const float *lut_data = &lut[0];
+  const float inv_lut_step = 1.0f / lut_step;
+  const int size = im_width*im_height;
+
+  #pragma omp parallel for simd schedule(static)
+  for( int i=0 ; i<size ; i++ )
+  {
+    const float l = nY[i];
+
+    // table position, clamped to [0, LUT_SIZE-1]
+    float pos = (pfstmo::fast_log2( l ) - LUT_LOG2_MIN) * inv_lut_step;
+    pos = (pos > 0.0f) ? pos : 0.0f;
+    pos = (pos < LUT_SIZE-1) ? pos : LUT_SIZE-1;
+    const int k = (int)pos;
+    const float t = pos - k;
+    const float *e = lut_data + 3*k;
+    const float Icone = e[0] + t*(e[3]-e[0]);
+    const float Irod = e[1] + t*(e[4]-e[1]);
+    const float Scolor = e[2] + t*(e[5]-e[2]);
+
+    // apply new luminance; black pixels stay black
+    const float inv_l = 1.0f / l;
+    float r = pfstmo::fast_pow( nR[i]*inv_l, Scolor )*Icone + Irod;
+    float g = pfstmo::fast_pow( nG[i]*inv_l, Scolor )*Icone + Irod;
+    float b = pfstmo::fast_pow( nB[i]*inv_l, Scolor )*Icone + Irod;
+    const bool black = !(l > 0.0f);
+    r = pfstmo::select( black, 0.0f, r );
+    g = pfstmo::select( black, 0.0f, g );
+    b = pfstmo::select( black, 0.0f, b );
+
+    nR[i] = (r<1.0f) ? ((r>0.0f) ? r : 0.0f) : 1.0f;
+    nG[i] = (g<1.0f) ? ((g>0.0f) ? g : 0.0f) : 1.0f;
+    nB[i] = (b<1.0f) ? ((b>0.0f) ? b : 0.0f) : 1.0f;
   }
-    
-  delete B;
-  delete G;
-  delete R;
-  delete Y;
 }
 
 ///////////////////////////////////////////////////////////
@@ -272,7 +367,7 @@ void calculateLocalAdaptation(const pfstmo::Array2D* Y, int x, int y, float& Aco
   int height = Y->getRows();
   
   int kernel_size = 4;
-  static float LOG5 = log(5);
+  static const float LOG5 = log(5);
   float logLc = log((*Y)(x,y))/LOG5;
 
   float pix_num = 0.0;
@@ -298,11 +393,16 @@ void calculateLocalAdaptation(const pfstmo::Array2D* Y, int x, int y, float& Aco
 
 ///////////////////////////////////////////////////////////
 
-VisualAdaptationModel::VisualAdaptationModel()
+VisualAdaptationModel::VisualAdaptationModel() : subsample(1)
 {
   setAdaptation(60.0f, 60.0f);
 }
 
+void VisualAdaptationModel::setSubsampling(int step)
+{
+  subsample = (step>1) ? step : 1;
+}
+
 void VisualAdaptationModel::calculateAdaptation(float Gcone, float Grod, float dt)
 {
   // Visual adaptation model for cones
@@ -370,12 +470,26 @@ void VisualAdaptationModel::setAdaptation(pfs::Array2D *Y)
 
 float VisualAdaptationModel::calculateLogAvgLuminance( pfs::Array2D* Y )
 {
-  float avLum = 0.0f;
-
-  int size = Y->getCols() * Y->getRows();
-  for( int i=0 ; i<size; i++ )
+  const int width = Y->getCols();
+  const int height = Y->getRows();
+
+  // every subsample-th pixel in both directions, centered in its block;
+  // the offset is clamped so that a step larger than the image still
+  // samples at least one row and column
+  const int offset_x = std::min( (subsample-1)/2, width-1 );
+  const int offset_y = std::min( (subsample-1)/2, height-1 );
+  const int rows = (height-offset_y + subsample-1) / subsample;
+  const int cols = (width-offset_x + subsample-1) / subsample;
+
+  double avLum = 0.0;
+  #pragma omp parallel for schedule(static) reduction(+:avLum)
+  for( int j=0 ; j<rows ; j++ )
   {
-    avLum += log( (*Y)(i) + 1e-4 );
+    const int y = offset_y + j*subsample;
+    double row_sum = 0.0;
+    for( int i=0 ; i<cols ; i++ )
+      row_sum += pfstmo::fast_log2( (*Y)(offset_x + i*subsample, y) + 1e-4f );
+    avLum += row_sum;
   }
-  return (exp(avLum/size ) - 1e-4);
+  return (exp2(avLum/((double)rows*cols)) - 1e-4);
 }
@@ -77,6 +77,9 @@ private:
   /// rod's bleaching term
   float Brod;
 
+  /// pixel step of the luminance statistics
+  int subsample;
+
   /// calculate logarithmic average of Y
   float calculateLogAvgLuminance( pfs::Array2D* Y );
 
@@ -120,6 +123,17 @@ public:
    */
   void setAdaptation(pfs::Array2D *Y);
 
+  /**
+   * @brief Compute the luminance statistics from a subset of pixels
+   *
+   * Only every step-th pixel of every step-th row is used for the
+   * logarithmic average luminance, which reduces the cost of the
+   * statistics step^2 times. The default step 1 uses all pixels.
+   *
+   * @param step pixel step in both directions
+   */
+  void setSubsampling(int step);
+
   /// Get cone adaptation level
   float getAcone()
   { return Acone; };
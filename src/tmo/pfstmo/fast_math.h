@@ -0,0 +1,141 @@
+/**
+ * @brief Fast approximations of log2, exp2 and pow for point-wise operators
+ *
+ * The functions are branch-free, so that loops calling them can be
+ * vectorized by the compiler.
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+#ifndef PFSTMO_FAST_MATH_H
+#define PFSTMO_FAST_MATH_H
+
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+
+namespace pfstmo
+{
+  /**
+   * Branch-free cond ? a : b. gcc does not if-convert floating point
+   * selects when trapping math is enabled, which prevents vectorization
+   * of loops with conditionally updated values; the select is done on
+   * the bit patterns instead.
+   */
+  inline float select( bool cond, float a, float b )
+  {
+    int32_t a_bits, b_bits;
+    memcpy( &a_bits, &a, sizeof(a_bits) );
+    memcpy( &b_bits, &b, sizeof(b_bits) );
+    const int32_t mask = -(int32_t)cond;
+    a_bits = (a_bits & mask) | (b_bits & ~mask);
+    float r;
+    memcpy( &r, &a_bits, sizeof(r) );
+    return r;
+  }
+
+  /**
+   * Base-2 logarithm. The mantissa is reduced to [sqrt(1/2), sqrt(2))
+   * and log2(m) = 2/ln(2)*atanh((m-1)/(m+1)) is evaluated with the
+   * first four terms of the series (truncation error below 5e-8). The
+   * absolute error is below 2e-7 plus half an ulp of the result.
+   *
+   * Non-positive values and denormals are treated as FLT_MIN (log2 =
+   * -126). The range reduction uses integer operations only, as
+   * floating point selects prevent vectorization when trapping math is
+   * enabled (the default in gcc).
+   */
+  inline float fast_log2( float x )
+  {
+    int32_t bits;
+    memcpy( &bits, &x, sizeof(bits) );
+    bits = bits < 0x00800000 ? 0x00800000 : bits; // FLT_MIN
+
+    const int32_t mant = bits & 0x007fffff;
+    const int32_t adj = mant > 0x003504f3;        // m > sqrt(2)
+    const int32_t e = (bits >> 23) - 127 + adj;
+    bits = mant | (0x3f800000 - (adj << 23));
+    float m;
+    memcpy( &m, &bits, sizeof(m) );
+
+    const float t = (m-1.f)/(m+1.f);
+    const float t2 = t*t;
+    return (float)e + t*(2.88539008f + t2*(0.961796694f + t2*(0.577078016f + t2*0.412198583f)));
+  }
+
+  /**
+   * Base-2 exponent. The argument is split into an integer and a
+   * fraction f in [-0.5, 0.5]; 2^f is evaluated with the Taylor
+   * polynomial of degree 7 (truncation error below 6e-9). The relative
+   * error is below 1.5e-7.
+   *
+   * The result is clamped to [2^-126, 2^127]. NaN is not propagated.
+   */
+  inline float fast_exp2( float x )
+  {
+    // |x| <= 128 (clamped on the bit pattern, see fast_log2())
+    int32_t xbits;
+    memcpy( &xbits, &x, sizeof(xbits) );
+    int32_t abs_bits = xbits & 0x7fffffff;
+    abs_bits = abs_bits < 0x43000000 ? abs_bits : 0x43000000;
+    xbits = (xbits & ~0x7fffffff) | abs_bits;
+    memcpy( &x, &xbits, sizeof(x) );
+
+    // Round to the nearest integer by adding 1.5*2^23
+    const float t = x + 12582912.f;
+    int32_t k;
+    memcpy( &k, &t, sizeof(k) );
+    k = (k & 0x007fffff) - 0x00400000;
+    const float f = x - (t - 12582912.f);
+    k = k < 127 ? k : 127;
+    k = k > -126 ? k : -126;
+
+    const float p = 1.f + f*(0.693147181f + f*(0.240226507f + f*(0.0555041087f +
+      f*(0.00961812911f + f*(0.00133335581f + f*(0.000154035304f + f*0.0000152527338f))))));
+
+    const int32_t bits = (k + 127) << 23;
+    float s;
+    memcpy( &s, &bits, sizeof(s) );
+    return p*s;
+  }
+
+  /**
+   * log2(1+x) for x >= 0. The rounding error of 1+x is added back as a
+   * first order correction, so that the relative error stays below
+   * 5e-7 also for small x, where log2(1+x) evaluated directly loses up
+   * to 1.2e-7/x of relative accuracy.
+   */
+  inline float fast_log2_1p( float x )
+  {
+    const float u = 1.f + x;
+    const float c = x - (u - 1.f);  // exact for x < 1, negligible above
+    return fast_log2( u ) + c/u*1.44269504f;
+  }
+
+  /**
+   * x^y for x > 0 computed as exp2(y*log2(x)). The relative error is
+   * below 4e-7 + 1.2e-7*|y*log2(x)|, where the second term comes from
+   * rounding the exponent to single precision. Non-positive x is
+   * treated as FLT_MIN.
+   */
+  inline float fast_pow( float x, float y )
+  {
+    return fast_exp2( y*fast_log2( x ) );
+  }
+}
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * @brief Serialization of the FFTW planner
+ *
+ * Only fftw(f)_execute is thread-safe in FFTW; creating and destroying
+ * plans (and fftw_plan_with_nthreads) modify the global state of the
+ * planner. The operators that use FFTW create their plans while a
+ * FFTWPlannerLock is held, so that several tone mapping contexts can
+ * run in different threads of one process.
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+#ifndef PFSTMO_FFTW_LOCK_H
+#define PFSTMO_FFTW_LOCK_H
+
+#include <pthread.h>
+
+namespace pfstmo
+{
+  /**
+   * @return the process-wide mutex guarding the FFTW planner
+   */
+  inline pthread_mutex_t *getFFTWPlannerMutex()
+  {
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    return &mutex;
+  }
+
+  /**
+   * Holds the FFTW planner mutex for the lifetime of the object.
+   */
+  class FFTWPlannerLock
+  {
+  public:
+    FFTWPlannerLock()
+    {
+      pthread_mutex_lock( getFFTWPlannerMutex() );
+    }
+
+    ~FFTWPlannerLock()
+    {
+      pthread_mutex_unlock( getFFTWPlannerMutex() );
+    }
+
+  private:
+    FFTWPlannerLock( const FFTWPlannerLock& );
+    FFTWPlannerLock& operator=( const FFTWPlannerLock& );
+  };
+}
+
+#endif
@@ -0,0 +1,814 @@
+/**
+ * @brief Tone map a set of HDR images in a single process
+ *
+ * Each image is decoded, tone mapped and encoded by one of a pool of
+ * worker threads, so that decoding, tone mapping and encoding of
+ * different images overlap. The number of images in flight is bounded
+ * by the number of workers and by a memory ceiling.
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <config.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#ifdef HAVE_OpenMP
+#include <omp.h>
+#endif
+
+#include <pfs.h>
+
+#include "tmo_context.h"
+#include "rgbeio.h"
+#ifdef HAVE_OPENEXR
+#include "exrio.h"
+#endif
+#ifdef HAVE_TIFF
+#include "hdrtiffio.h"
+#endif
+#ifdef HAVE_NETPBM
+#include "ppmio.h"
+#endif
+
+#define PROG_NAME "pfstmo_batch"
+
+using namespace std;
+
+class QuietException
+{
+};
+
+void printHelp()
+{
+  fprintf( stderr, PROG_NAME " (" PACKAGE_VERSION ") : \n"
+    "\t --tmo <name> [--tmo-options <options>] [--format <ext>]\n"
+    "\t [--output-dir <dir>] [--jobs <n>] [--threads <n>] [--memory-limit <MB>]\n"
+    "\t [--srgb] [--gamma <val>] [--radiance] [--verbose] [--help] <file> ...\n"
+    "See man page for more information. \n" );
+}
+
+// Approximate peak memory use per pixel: the frame (3 floats) plus the
+// working buffers of a typical operator
+static const size_t BYTES_PER_PIXEL = 16*sizeof(float);
+
+enum FileFormat { FMT_UNKNOWN, FMT_PFS, FMT_RGBE, FMT_EXR, FMT_TIFF, FMT_PPM };
+
+static FileFormat formatFromExtension( const char *ext )
+{
+  if( !strcasecmp( ext, "pfs" ) )
+    return FMT_PFS;
+  if( !strcasecmp( ext, "hdr" ) || !strcasecmp( ext, "pic" ) )
+    return FMT_RGBE;
+  if( !strcasecmp( ext, "exr" ) )
+    return FMT_EXR;
+  if( !strcasecmp( ext, "tif" ) || !strcasecmp( ext, "tiff" ) )
+    return FMT_TIFF;
+  if( !strcasecmp( ext, "ppm" ) || !strcasecmp( ext, "pnm" ) )
+    return FMT_PPM;
+  return FMT_UNKNOWN;
+}
+
+static bool isFormatCompiled( FileFormat format )
+{
+  switch( format ) {
+  case FMT_PFS:
+  case FMT_RGBE:
+    return true;
+#ifdef HAVE_OPENEXR
+  case FMT_EXR:
+    return true;
+#endif
+#ifdef HAVE_TIFF
+  case FMT_TIFF:
+    return true;
+#endif
+#ifdef HAVE_NETPBM
+  case FMT_PPM:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+static double getTime()
+{
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+/**
+ * Opens a file and closes it when going out of scope.
+ */
+class AutoFile
+{
+public:
+  FILE *fh;
+
+  AutoFile( const char *fileName, const char *mode )
+  {
+    fh = fopen( fileName, mode );
+    if( fh == NULL ) {
+      std::string msg = std::string( "cannot open file '" ) + fileName + "'";
+      throw pfs::Exception( msg.c_str() );
+    }
+  }
+
+  ~AutoFile()
+  {
+    fclose( fh );
+  }
+
+private:
+  AutoFile( const AutoFile& );
+  AutoFile& operator=( const AutoFile& );
+};
+
+/**
+ * Input image. The header is read when the image is opened, so that
+ * its size is known before the pixels are decoded.
+ */
+class ImageInput
+{
+public:
+  virtual ~ImageInput()
+  {
+  }
+
+  int getWidth() const
+  {
+    return width;
+  }
+
+  int getHeight() const
+  {
+    return height;
+  }
+
+  /**
+   * Decode the pixels into a new frame with XYZ channels and the
+   * LUMINANCE tag set.
+   */
+  virtual pfs::Frame *read( pfs::DOMIO &pfsio ) = 0;
+
+protected:
+  int width, height;
+};
+
+class PFSInput : public ImageInput
+{
+  AutoFile file;
+public:
+  PFSInput( const char *fileName ) : file( fileName, "rb" )
+  {
+    if( fscanf( file.fh, "PFS1\n%d %d", &width, &height ) != 2 )
+      throw pfs::Exception( "not a PFS file" );
+    rewind( file.fh );
+  }
+
+  pfs::Frame *read( pfs::DOMIO &pfsio )
+  {
+    pfs::Frame *frame = pfsio.readFrame( file.fh );
+    if( frame == NULL )
+      throw pfs::Exception( "empty PFS stream" );
+    pfs::Channel *X, *Y, *Z;
+    frame->getXYZChannels( X, Y, Z );
+    if( X == NULL ) {
+      pfsio.freeFrame( frame );
+      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
+    }
+    return frame;
+  }
+};
+
+class RGBEInput : public ImageInput
+{
+  AutoFile file;
+  RGBEReader reader;
+public:
+  RGBEInput( const char *fileName, bool radiance_compatibility ) :
+    file( fileName, "rb" ), reader( file.fh, radiance_compatibility )
+  {
+    width = reader.getWidth();
+    height = reader.getHeight();
+  }
+
+  pfs::Frame *read( pfs::DOMIO &pfsio )
+  {
+    pfs::Frame *frame = pfsio.createFrame( width, height );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+    reader.readImage( X, Y, Z );
+    pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    frame->getTags()->setString( "LUMINANCE", "RELATIVE" );
+    return frame;
+  }
+};
+
+#ifdef HAVE_OPENEXR
+class EXRInput : public ImageInput
+{
+  OpenEXRReader reader;
+public:
+  EXRInput( const char *fileName ) : reader( fileName )
+  {
+    width = reader.getWidth();
+    height = reader.getHeight();
+  }
+
+  pfs::Frame *read( pfs::DOMIO &pfsio )
+  {
+    pfs::Frame *frame = pfsio.createFrame( width, height );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+    reader.readImage( X, Y, Z );
+    pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    frame->getTags()->setString( "LUMINANCE", "RELATIVE" );
+    return frame;
+  }
+};
+#endif
+
+#ifdef HAVE_TIFF
+class TIFFInput : public ImageInput
+{
+  HDRTiffReader reader;
+public:
+  TIFFInput( const char *fileName ) : reader( fileName )
+  {
+    width = reader.getWidth();
+    height = reader.getHeight();
+  }
+
+  pfs::Frame *read( pfs::DOMIO &pfsio )
+  {
+    pfs::Frame *frame = pfsio.createFrame( width, height );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+    reader.readImage( X, Y, Z );
+    if( !reader.isColorspaceXYZ() )
+      pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    frame->getTags()->setString( "LUMINANCE",
+      reader.isRelative() ? "RELATIVE" : "DISPLAY" );
+    return frame;
+  }
+};
+#endif
+
+#ifdef HAVE_NETPBM
+class PPMInput : public ImageInput
+{
+  AutoFile file;
+  PPMReader reader;
+public:
+  PPMInput( const char *fileName ) :
+    file( fileName, "rb" ), reader( PROG_NAME, file.fh )
+  {
+    width = reader.getWidth();
+    height = reader.getHeight();
+  }
+
+  pfs::Frame *read( pfs::DOMIO &pfsio )
+  {
+    pfs::Frame *frame = pfsio.createFrame( width, height );
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels( X, Y, Z );
+    // Display-referred as with pfsinppm; only the first image is read
+    reader.readImage( X, Y, Z );
+    pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+    frame->getTags()->setString( "LUMINANCE", "DISPLAY" );
+    frame->getTags()->setString( "WHITE_Y", "1" );
+    return frame;
+  }
+};
+#endif
+
+static ImageInput *openInput( const char *fileName, FileFormat format,
+  bool radiance_compatibility )
+{
+  switch( format ) {
+  case FMT_PFS:
+    return new PFSInput( fileName );
+  case FMT_RGBE:
+    return new RGBEInput( fileName, radiance_compatibility );
+#ifdef HAVE_OPENEXR
+  case FMT_EXR:
+    return new EXRInput( fileName );
+#endif
+#ifdef HAVE_TIFF
+  case FMT_TIFF:
+    return new TIFFInput( fileName );
+#endif
+#ifdef HAVE_NETPBM
+  case FMT_PPM:
+    return new PPMInput( fileName );
+#endif
+  default:
+    throw pfs::Exception( "unsupported input file format" );
+  }
+}
+
+
+struct BatchOptions
+{
+  const char *tmo;
+  const char *tmo_options;
+  const char *output_dir;
+  const char *out_ext;
+  FileFormat out_format;
+  bool srgb;
+  float gamma;
+  bool radiance_compatibility;
+  int jobs;
+  int threads;                  // OpenMP threads per job
+  size_t memory_limit;          // bytes, 0 - unlimited
+  bool verbose;
+};
+
+/**
+ * Tone mapping contexts of one worker. A context keeps its working
+ * buffers (and FFT plans) between the files of the same size, so a few
+ * sizes are kept, e.g. landscape and portrait shots of one camera; the
+ * least recently used one is dropped for a new size.
+ */
+class ContextCache
+{
+  static const size_t MAX_CONTEXTS = 2;
+
+  const BatchOptions &opt;
+  std::vector<pfstmo::Context*> contexts;     // most recently used first
+
+public:
+  ContextCache( const BatchOptions &opt ) : opt( opt )
+  {
+  }
+
+  ~ContextCache()
+  {
+    for( size_t i = 0; i < contexts.size(); i++ )
+      delete contexts[i];
+  }
+
+  /**
+   * @return context for the frame size; the files are unrelated
+   * images, so the temporal state of a reused context is reset
+   */
+  pfstmo::Context *get( int width, int height )
+  {
+    for( size_t i = 0; i < contexts.size(); i++ ) {
+      pfstmo::Context *tmo = contexts[i];
+      if( tmo->getWidth() == width && tmo->getHeight() == height ) {
+        contexts.erase( contexts.begin()+i );
+        contexts.insert( contexts.begin(), tmo );
+        tmo->reset();
+        return tmo;
+      }
+    }
+    if( contexts.size() >= MAX_CONTEXTS ) {
+      delete contexts.back();
+      contexts.pop_back();
+    }
+    pfstmo::Context *tmo = pfstmo::createContext( opt.tmo, width, height, opt.tmo_options );
+    contexts.insert( contexts.begin(), tmo );
+    return tmo;
+  }
+
+private:
+  ContextCache( const ContextCache& );
+  ContextCache& operator=( const ContextCache& );
+};
+
+/**
+ * Pool of workers processing the files in order of the command line.
+ */
+class Batch
+{
+  const BatchOptions &opt;
+  const std::vector<const char*> &files;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t memory_released;
+  size_t next_file;
+  size_t memory_used;
+  int failed_count;
+
+public:
+  Batch( const BatchOptions &opt, const std::vector<const char*> &files ) :
+    opt( opt ), files( files ), next_file( 0 ), memory_used( 0 ),
+    failed_count( 0 )
+  {
+    pthread_mutex_init( &mutex, NULL );
+    pthread_cond_init( &memory_released, NULL );
+  }
+
+  ~Batch()
+  {
+    pthread_cond_destroy( &memory_released );
+    pthread_mutex_destroy( &mutex );
+  }
+
+  /**
+   * @return number of files that could not be processed
+   */
+  int run()
+  {
+    const int jobs = std::min( (size_t)opt.jobs, files.size() );
+    std::vector<pthread_t> workers( jobs );
+    int started = 0;
+    for( ; started < jobs; started++ )
+      if( pthread_create( &workers[started], NULL, workerMain, this ) != 0 )
+        break;
+    if( started == 0 )
+      throw pfs::Exception( "cannot create worker threads" );
+    for( int i = 0; i < started; i++ )
+      pthread_join( workers[i], NULL );
+    return failed_count;
+  }
+
+private:
+  static void *workerMain( void *arg )
+  {
+    Batch *batch = (Batch*)arg;
+#ifdef HAVE_OpenMP
+    omp_set_num_threads( batch->opt.threads );
+#endif
+    pfs::DOMIO pfsio;
+    ContextCache contexts( batch->opt );
+    const char *fileName;
+    while( (fileName = batch->nextFile()) != NULL ) {
+      try {
+        batch->processFile( fileName, pfsio, contexts );
+      }
+      catch( pfs::Exception ex ) {
+        batch->reportFailure( fileName, ex.getMessage() );
+      }
+      catch( std::exception &ex ) {
+        batch->reportFailure( fileName, ex.what() );
+      }
+    }
+    return NULL;
+  }
+
+  const char *nextFile()
+  {
+    pthread_mutex_lock( &mutex );
+    const char *fileName = next_file < files.size() ? files[next_file++] : NULL;
+    pthread_mutex_unlock( &mutex );
+    return fileName;
+  }
+
+  void reportFailure( const char *fileName, const char *msg )
+  {
+    pthread_mutex_lock( &mutex );
+    failed_count++;
+    fprintf( stderr, PROG_NAME " error: %s: %s\n", fileName, msg );
+    pthread_mutex_unlock( &mutex );
+  }
+
+  /**
+   * Wait until the image fits within the memory limit. An image larger
+   * than the limit is processed when no other image is in flight.
+   */
+  void reserveMemory( size_t bytes )
+  {
+    pthread_mutex_lock( &mutex );
+    while( opt.memory_limit != 0 && memory_used != 0 &&
+      memory_used + bytes > opt.memory_limit )
+      pthread_cond_wait( &memory_released, &mutex );
+    memory_used += bytes;
+    pthread_mutex_unlock( &mutex );
+  }
+
+  void releaseMemory( size_t bytes )
+  {
+    pthread_mutex_lock( &mutex );
+    memory_used -= bytes;
+    pthread_cond_broadcast( &memory_released );
+    pthread_mutex_unlock( &mutex );
+  }
+
+  std::string outputFileName( const char *inFileName ) const
+  {
+    std::string name( inFileName );
+    const size_t slash = name.find_last_of( '/' );
+    std::string dir = ".";
+    if( slash != std::string::npos ) {
+      dir = name.substr( 0, slash );
+      name = name.substr( slash+1 );
+    }
+    const size_t dot = name.find_last_of( '.' );
+    if( dot != std::string::npos && dot > 0 )
+      name = name.substr( 0, dot );
+    if( opt.output_dir != NULL )
+      dir = opt.output_dir;
+    return dir + "/" + name + "." + opt.out_ext;
+  }
+
+  void processFile( const char *fileName, pfs::DOMIO &pfsio, ContextCache &contexts )
+  {
+    const char *ext = strrchr( fileName, '.' );
+    const FileFormat in_format = ext == NULL ? FMT_UNKNOWN : formatFromExtension( ext+1 );
+    if( in_format == FMT_UNKNOWN || !isFormatCompiled( in_format ) )
+      throw pfs::Exception( "unsupported input file format" );
+
+    const std::string outFileName = outputFileName( fileName );
+    if( outFileName == fileName )
+      throw pfs::Exception( "output file would overwrite the input file" );
+
+    ImageInput *input = openInput( fileName, in_format, opt.radiance_compatibility );
+    const int width = input->getWidth(), height = input->getHeight();
+    const size_t bytes = (size_t)width*height*BYTES_PER_PIXEL;
+    reserveMemory( bytes );
+    const double t_start = getTime();
+
+    pfs::Frame *frame = NULL;
+    try {
+      frame = input->read( pfsio );
+      delete input;
+      input = NULL;
+      const double t_decoded = getTime();
+
+      pfs::Channel *X, *Y, *Z;
+      frame->getXYZChannels( X, Y, Z );
+      pfstmo::Context *tmo = contexts.get( width, height );
+      const int res = tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+      if( res != PFSTMO_OK )
+        throw pfs::Exception( "tone mapping failed" );
+      frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
+      const double t_mapped = getTime();
+
+      writeOutput( outFileName.c_str(), frame, pfsio );
+      pfsio.freeFrame( frame );
+      frame = NULL;
+      const double t_encoded = getTime();
+
+      if( opt.verbose ) {
+        pthread_mutex_lock( &mutex );
+        fprintf( stderr, PROG_NAME ": %s -> %s (%dx%d): decode %.3fs, tone map %.3fs, encode %.3fs\n",
+          fileName, outFileName.c_str(), width, height, t_decoded-t_start,
+          t_mapped-t_decoded, t_encoded-t_mapped );
+        pthread_mutex_unlock( &mutex );
+      }
+    }
+    catch( ... ) {
+      delete input;
+      if( frame != NULL )
+        pfsio.freeFrame( frame );
+      releaseMemory( bytes );
+      throw;
+    }
+    releaseMemory( bytes );
+  }
+
+  static void applyGamma( pfs::Channel *array, const float exponent )
+  {
+    float *data = array->getRawData();
+    const int imgSize = array->getRows()*array->getCols();
+    #pragma omp parallel for schedule(static)
+    for( int index = 0; index < imgSize ; index++ ) {
+      const float v = data[index] < 0 ? 0 : data[index];
+      data[index] = powf( v, exponent );
+    }
+  }
+
+  /**
+   * Encode the tone mapped frame. The gamma correction is that of
+   * pfsgamma, the colour conversions those of the pfsout* programs.
+   */
+  void writeOutput( const char *fileName, pfs::Frame *frame, pfs::DOMIO &pfsio )
+  {
+    pfs::Channel *X, *Y, *Z;
+    frame->getXYZChannels( X, Y, Z );
+
+    if( opt.gamma != 1.0f ) {
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+      applyGamma( X, 1/opt.gamma );
+      applyGamma( Y, 1/opt.gamma );
+      applyGamma( Z, 1/opt.gamma );
+      pfs::transformColorSpace( pfs::CS_RGB, X, Y, Z, pfs::CS_XYZ, X, Y, Z );
+      if( opt.gamma > 1.0f )
+        frame->getTags()->setString( "LUMINANCE", "DISPLAY" );
+    }
+
+    if( opt.out_format == FMT_PFS ) {
+      AutoFile file( fileName, "wb" );
+      pfsio.writeFrame( frame, file.fh );
+      return;
+    }
+
+    if( opt.out_format != FMT_RGBE && opt.srgb )
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_SRGB, X, Y, Z );
+    else
+      pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, X, Y, Z );
+
+    switch( opt.out_format ) {
+    case FMT_RGBE:
+    {
+      AutoFile file( fileName, "wb" );
+      RGBEWriter writer( file.fh, opt.radiance_compatibility );
+      writer.writeImage( X, Y, Z );
+      break;
+    }
+#ifdef HAVE_OPENEXR
+    case FMT_EXR:
+    {
+      OpenEXRWriter writer( fileName );
+      writer.writeImage( X, Y, Z );
+      break;
+    }
+#endif
+#ifdef HAVE_TIFF
+    case FMT_TIFF:
+    {
+      AutoFile file( fileName, "wb" );
+      HDRTiffWriter writer( file.fh );
+      writer.writeImage( X, Y, Z );
+      break;
+    }
+#endif
+#ifdef HAVE_NETPBM
+    case FMT_PPM:
+    {
+      AutoFile file( fileName, "wb" );
+      PPMWriter writer( PROG_NAME, file.fh, 8 );
+      writer.writeImage( X, Y, Z );
+      break;
+    }
+#endif
+    default:
+      throw pfs::Exception( "unsupported output file format" );
+    }
+  }
+};
+
+
+void batchTonemap( int argc, char* argv[] )
+{
+  BatchOptions opt;
+  opt.tmo = NULL;
+  opt.tmo_options = NULL;
+  opt.output_dir = NULL;
+  opt.out_ext = "pfs";
+  opt.srgb = false;
+  opt.gamma = 1.0f;
+  opt.radiance_compatibility = false;
+  opt.jobs = 0;
+  opt.threads = 0;
+  opt.memory_limit = 0;
+  opt.verbose = false;
+  bool verbose = false;
+
+  static struct option cmdLineOptions[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "tmo", required_argument, NULL, 't' },
+    { "tmo-options", required_argument, NULL, 'o' },
+    { "format", required_argument, NULL, 'f' },
+    { "output-dir", required_argument, NULL, 'd' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "threads", required_argument, NULL, 'n' },
+    { "memory-limit", required_argument, NULL, 'm' },
+    { "srgb", no_argument, NULL, 's' },
+    { "gamma", required_argument, NULL, 'g' },
+    { "radiance", no_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int optionIndex = 0;
+  while( 1 ) {
+    int c = getopt_long( argc, argv, "hvt:o:f:d:j:n:m:sg:r", cmdLineOptions, &optionIndex );
+    if( c == -1 ) break;
+    switch( c ) {
+    case 'h':
+      printHelp();
+      throw QuietException();
+    case 'v':
+      verbose = opt.verbose = true;
+      break;
+    case 't':
+      opt.tmo = optarg;
+      break;
+    case 'o':
+      opt.tmo_options = optarg;
+      break;
+    case 'f':
+      opt.out_ext = optarg;
+      break;
+    case 'd':
+      opt.output_dir = optarg;
+      break;
+    case 'j':
+      opt.jobs = (int)strtol( optarg, NULL, 10 );
+      if( opt.jobs < 1 )
+        throw pfs::Exception( "number of jobs must be at least 1" );
+      break;
+    case 'n':
+      opt.threads = (int)strtol( optarg, NULL, 10 );
+      if( opt.threads < 1 )
+        throw pfs::Exception( "number of threads must be at least 1" );
+      break;
+    case 'm':
+    {
+      const double limit = strtod( optarg, NULL );
+      if( limit <= 0 )
+        throw pfs::Exception( "memory limit must be positive" );
+      opt.memory_limit = (size_t)(limit*1024*1024);
+      break;
+    }
+    case 's':
+      opt.srgb = true;
+      break;
+    case 'g':
+      opt.gamma = (float)strtod( optarg, NULL );
+      if( opt.gamma <= 0 )
+        throw pfs::Exception( "gamma must be positive" );
+      break;
+    case 'r':
+      opt.radiance_compatibility = true;
+      break;
+    case '?':
+      throw QuietException();
+    case ':':
+      throw QuietException();
+    }
+  }
+
+  if( opt.tmo == NULL )
+    throw pfs::Exception( "tone mapping operator not specified (use --tmo)" );
+  opt.out_format = formatFromExtension( opt.out_ext );
+  if( opt.out_format == FMT_UNKNOWN || !isFormatCompiled( opt.out_format ) )
+    throw pfs::Exception( "unsupported output file format" );
+
+  // Validate the operator and its options once, before any file is read
+  delete pfstmo::createContext( opt.tmo, 1, 1, opt.tmo_options );
+
+  std::vector<const char*> files;
+  for( int i = optind; i < argc; i++ )
+    files.push_back( argv[i] );
+  if( files.empty() )
+    throw pfs::Exception( "no input files" );
+
+  int cpus = (int)sysconf( _SC_NPROCESSORS_ONLN );
+  if( cpus < 1 )
+    cpus = 1;
+  if( opt.jobs == 0 )
+    opt.jobs = cpus;
+  if( opt.threads == 0 )
+    opt.threads = std::max( 1, cpus / opt.jobs );
+
+  VERBOSE_STR << files.size() << " file(s), " << opt.jobs << " job(s) with "
+              << opt.threads << " thread(s) each" << std::endl;
+
+  Batch batch( opt, files );
+  const int failed = batch.run();
+  if( failed > 0 ) {
+    fprintf( stderr, PROG_NAME ": %d of %d file(s) failed\n", failed, (int)files.size() );
+    throw QuietException();
+  }
+}
+
+
+int main( int argc, char* argv[] )
+{
+  try {
+    batchTonemap( argc, argv );
+  }
+  catch( pfs::Exception ex ) {
+    fprintf( stderr, PROG_NAME " error: %s\n", ex.getMessage() );
+    return EXIT_FAILURE;
+  }
+  catch( QuietException  ex ) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,412 @@
+/**
+ * @brief Benchmark of the tone mapping operators
+ *
+ * Tone maps synthetic HDR frames of several resolutions with every
+ * operator of libpfstmo and writes the timings in JSON format. The
+ * frames are generated deterministically, so results of different
+ * builds and machines can be compared directly. Progress reports of
+ * the operators are timestamped to give the time of the individual
+ * stages.
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <config.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef HAVE_OpenMP
+#include <omp.h>
+#endif
+
+#include <pfs.h>
+
+#include "tmo_context.h"
+
+#define PROG_NAME "pfstmo_bench"
+
+class QuietException
+{
+};
+
+void printHelp()
+{
+  fprintf( stderr, PROG_NAME " (" PACKAGE_VERSION ") : \n"
+    "\t [--operators <name,...>] [--scenes <name,...>] [--sizes <MP,...>]\n"
+    "\t [--repeat <n>] [--threads <n>] [--output <file>] [--verbose] [--help]\n"
+    "Scenes: gradient, hdr-scene, noise. Default sizes: 1,12,50\n" );
+}
+
+static double getTime()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//--- Synthetic frames
+
+static const char *scene_names[] = { "gradient", "hdr-scene", "noise", NULL };
+
+/// Deterministic pseudo-random numbers in [0,1) (64-bit LCG)
+class Random
+{
+  unsigned long long state;
+public:
+  Random( unsigned long long seed ) : state( seed*2862933555777941757ULL + 3037000493ULL )
+  {
+  }
+
+  float next()
+  {
+    state = state*6364136223846793005ULL + 1442695040888963407ULL;
+    return (float)(state >> 40) * (1.0f/16777216.0f);
+  }
+};
+
+/**
+ * Fill X, Y, Z with a synthetic scene. The values are generated in
+ * linear sRGB and converted to XYZ. Each row is generated from its
+ * own random seed, so that the rows can be filled in parallel.
+ */
+static void generateScene( const char *scene, int width, int height,
+  float *X, float *Y, float *Z )
+{
+  const int scene_id = !strcmp( scene, "gradient" ) ? 0 :
+    !strcmp( scene, "hdr-scene" ) ? 1 : 2;
+
+  #pragma omp parallel for schedule(static)
+  for( int y=0 ; y<height ; y++ )
+  {
+    Random rnd( y+1 );
+    const float fy = (float)y / height;
+    for( int x=0 ; x<width ; x++ )
+    {
+      const float fx = (float)x / width;
+      float r, g, b;
+      switch( scene_id ) {
+      case 0:
+      {
+        // Luminance rising exponentially from 1e-3 to 1e4 along x,
+        // hue changing along y
+        const float l = powf( 10.0f, -3.0f + 7.0f*fx );
+        r = l * (0.5f + 0.5f*fy);
+        g = l * 0.8f;
+        b = l * (1.0f - 0.5f*fy);
+        break;
+      }
+      case 1:
+      {
+        // Sky with the sun above a dark textured ground with lit
+        // windows: about 10 orders of magnitude
+        if( fy < 0.45f ) {
+          const float dx = fx - 0.7f, dy = fy - 0.15f;
+          const float d2 = (dx*dx + dy*dy) * 400.0f;
+          const float sky = 2000.0f * (1.0f - fy) + 1e6f * expf( -d2*d2 );
+          r = sky * 0.8f;
+          g = sky * 0.9f;
+          b = sky * 1.2f;
+        } else {
+          const bool window = ((int)(fx*40) % 5 == 2) && ((int)(fy*30) % 4 == 1);
+          const float ground = window ? 50.0f : 0.01f + 2.0f*(1.0f-fy)*rnd.next();
+          r = ground * (window ? 1.2f : 0.6f);
+          g = ground * (window ? 1.0f : 0.5f);
+          b = ground * (window ? 0.6f : 0.4f);
+        }
+        break;
+      }
+      default:
+      {
+        // Log-uniform noise over 6 orders of magnitude, independent
+        // colour channels
+        r = powf( 10.0f, -2.0f + 6.0f*rnd.next() );
+        g = powf( 10.0f, -2.0f + 6.0f*rnd.next() );
+        b = powf( 10.0f, -2.0f + 6.0f*rnd.next() );
+        break;
+      }
+      }
+      const int i = x + y*width;
+      X[i] = 0.412424f*r + 0.357579f*g + 0.180464f*b;
+      Y[i] = 0.212656f*r + 0.715158f*g + 0.0721856f*b;
+      Z[i] = 0.0193324f*r + 0.119193f*g + 0.950444f*b;
+    }
+  }
+}
+
+//--- Progress timestamps
+
+struct ProgressMark
+{
+  int progress;
+  double time;
+};
+
+static double progress_start;
+static std::vector<ProgressMark> progress_marks;
+
+static int recordProgress( int progress )
+{
+  if( progress_marks.empty() || progress_marks.back().progress != progress ) {
+    ProgressMark mark = { progress, getTime() - progress_start };
+    progress_marks.push_back( mark );
+  }
+  return PFSTMO_CB_CONTINUE;
+}
+
+//--- Benchmark
+
+static std::vector<std::string> splitList( const char *list )
+{
+  std::vector<std::string> items;
+  std::string s( list );
+  size_t start = 0;
+  while( start <= s.size() ) {
+    size_t end = s.find( ',', start );
+    if( end == std::string::npos )
+      end = s.size();
+    if( end > start )
+      items.push_back( s.substr( start, end-start ) );
+    start = end+1;
+  }
+  return items;
+}
+
+struct Frame
+{
+  int width, height;
+  std::vector<float> X, Y, Z;
+
+  void resize( int w, int h )
+  {
+    width = w;
+    height = h;
+    X.resize( w*h );
+    Y.resize( w*h );
+    Z.resize( w*h );
+  }
+};
+
+void benchmark( int argc, char* argv[] )
+{
+  bool verbose = false;
+  const char *operators = NULL;
+  const char *scenes = "gradient,hdr-scene,noise";
+  const char *sizes = "1,12,50";
+  int repeat = 3;
+  int threads = 0;
+  const char *output = NULL;
+
+  static struct option cmdLineOptions[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "operators", required_argument, NULL, 'o' },
+    { "scenes", required_argument, NULL, 's' },
+    { "sizes", required_argument, NULL, 'z' },
+    { "repeat", required_argument, NULL, 'r' },
+    { "threads", required_argument, NULL, 't' },
+    { "output", required_argument, NULL, 'f' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int optionIndex = 0;
+  while( 1 ) {
+    int c = getopt_long( argc, argv, "hvo:s:z:r:t:f:", cmdLineOptions, &optionIndex );
+    if( c == -1 ) break;
+    switch( c ) {
+    case 'h':
+      printHelp();
+      throw QuietException();
+    case 'v':
+      verbose = true;
+      break;
+    case 'o':
+      operators = optarg;
+      break;
+    case 's':
+      scenes = optarg;
+      break;
+    case 'z':
+      sizes = optarg;
+      break;
+    case 'r':
+      repeat = (int)strtol( optarg, NULL, 10 );
+      if( repeat < 1 )
+        throw pfs::Exception( "number of repetitions must be at least 1" );
+      break;
+    case 't':
+      threads = (int)strtol( optarg, NULL, 10 );
+      if( threads < 1 )
+        throw pfs::Exception( "number of threads must be at least 1" );
+      break;
+    case 'f':
+      output = optarg;
+      break;
+    case '?':
+      throw QuietException();
+    case ':':
+      throw QuietException();
+    }
+  }
+
+  std::vector<std::string> op_list;
+  if( operators == NULL ) {
+    for( const char * const *name = pfstmo::getOperatorNames(); *name != NULL; name++ )
+      op_list.push_back( *name );
+  } else
+    op_list = splitList( operators );
+  // Checked before any output, so that the JSON is never left truncated
+  for( size_t o = 0; o < op_list.size(); o++ ) {
+    bool known = false;
+    for( const char * const *name = pfstmo::getOperatorNames(); *name != NULL; name++ )
+      known |= (op_list[o] == *name);
+    if( !known )
+      throw pfs::Exception( ("unknown operator: " + op_list[o]).c_str() );
+  }
+
+  std::vector<std::string> scene_list = splitList( scenes );
+  for( size_t s = 0; s < scene_list.size(); s++ ) {
+    bool known = false;
+    for( const char **name = scene_names; *name != NULL; name++ )
+      known |= (scene_list[s] == *name);
+    if( !known )
+      throw pfs::Exception( ("unknown scene: " + scene_list[s]).c_str() );
+  }
+
+  std::vector<std::string> size_strings = splitList( sizes );
+  std::vector<double> size_list;
+  for( size_t s = 0; s < size_strings.size(); s++ ) {
+    const double mp = strtod( size_strings[s].c_str(), NULL );
+    if( mp <= 0 )
+      throw pfs::Exception( "frame sizes must be positive" );
+    size_list.push_back( mp );
+  }
+
+#ifdef HAVE_OpenMP
+  if( threads > 0 )
+    omp_set_num_threads( threads );
+  threads = omp_get_max_threads();
+#else
+  threads = 1;
+#endif
+
+  FILE *out = stdout;
+  if( output != NULL ) {
+    out = fopen( output, "w" );
+    if( out == NULL )
+      throw pfs::Exception( "cannot open output file" );
+  }
+
+  fprintf( out, "{\n  \"version\": \"%s\",\n  \"threads\": %d,\n  \"repeat\": %d,\n  \"results\": [",
+    PACKAGE_VERSION, threads, repeat );
+  bool first_result = true;
+
+  Frame source, work;
+  for( size_t z = 0; z < size_list.size(); z++ ) {
+    // 3:2 aspect ratio
+    const int width = (int)(sqrt( size_list[z]*1e6*1.5 ) + 0.5);
+    const int height = (int)(size_list[z]*1e6 / width + 0.5);
+
+    for( size_t o = 0; o < op_list.size(); o++ ) {
+      const char *op = op_list[o].c_str();
+
+      // The context is created once per operator and frame size, as
+      // for a sequence; only process() is timed for each repetition
+      const double t_setup = getTime();
+      pfstmo::Context *tmo = pfstmo::createContext( op, width, height );
+      const double setup_time = getTime() - t_setup;
+
+      for( size_t s = 0; s < scene_list.size(); s++ ) {
+        source.resize( width, height );
+        generateScene( scene_list[s].c_str(), width, height, &source.X[0], &source.Y[0], &source.Z[0] );
+        VERBOSE_STR << op << ", " << scene_list[s] << ", " << width << "x" << height << std::endl;
+
+        std::vector<double> process_times;
+        std::vector<ProgressMark> best_marks;
+        for( int r = 0; r < repeat; r++ ) {
+          work = source;
+          // Every repetition tone maps the frame as a first frame
+          tmo->reset();
+
+          const double t_process = getTime();
+          progress_marks.clear();
+          progress_start = t_process;
+          const int res = tmo->process( &work.X[0], &work.Y[0], &work.Z[0], recordProgress );
+          const double t_end = getTime();
+          if( res != PFSTMO_OK ) {
+            delete tmo;
+            throw pfs::Exception( "tone mapping failed" );
+          }
+
+          process_times.push_back( t_end - t_process );
+          if( process_times.back() <= *std::min_element( process_times.begin(), process_times.end() ) )
+            best_marks = progress_marks;
+        }
+
+        std::vector<double> sorted = process_times;
+        std::sort( sorted.begin(), sorted.end() );
+
+        fprintf( out, "%s\n    { \"operator\": \"%s\", \"scene\": \"%s\", \"width\": %d, \"height\": %d,"
+          " \"megapixels\": %.3f,\n      \"setup\": %.6f, \"min\": %.6f, \"median\": %.6f, \"max\": %.6f,"
+          " \"mpixels_per_s\": %.3f,\n      \"times\": [",
+          first_result ? "" : ",", op, scene_list[s].c_str(), width, height,
+          width*(double)height*1e-6, setup_time,
+          sorted.front(), sorted[sorted.size()/2], sorted.back(),
+          width*(double)height*1e-6 / sorted.front() );
+        for( size_t r = 0; r < process_times.size(); r++ )
+          fprintf( out, "%s%.6f", r == 0 ? "" : ", ", process_times[r] );
+        // Progress timestamps of the fastest run
+        fprintf( out, "],\n      \"progress\": [" );
+        for( size_t m = 0; m < best_marks.size(); m++ )
+          fprintf( out, "%s[%d, %.6f]", m == 0 ? "" : ", ", best_marks[m].progress, best_marks[m].time );
+        fprintf( out, "] }" );
+        fflush( out );
+        first_result = false;
+      }
+      delete tmo;
+    }
+  }
+  fprintf( out, "\n  ]\n}\n" );
+
+  if( out != stdout )
+    fclose( out );
+}
+
+
+int main( int argc, char* argv[] )
+{
+  try {
+    benchmark( argc, argv );
+  }
+  catch( pfs::Exception ex ) {
+    fprintf( stderr, PROG_NAME " error: %s\n", ex.getMessage() );
+    return EXIT_FAILURE;
+  }
+  catch( QuietException  ex ) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/**
+ * @brief Two-phase parallel execution of point-wise operators
+ *
+ * Many operators are point-wise once a few global image statistics
+ * are known (maximum, log-average, histogram, ...). They run in two
+ * phases:
+ *
+ * 1. reduce_tiles() computes the statistics: each tile of the image
+ *    is accumulated into its own copy of a statistics functor, and the
+ *    copies are merged in the order of the tiles.
+ *
+ * 2. map_tiles() applies a kernel, configured with the statistics, to
+ *    all tiles in parallel.
+ *
+ * A tile is a run of TILE_PIXELS consecutive pixels of the row-major
+ * channels, small enough that the tile data of all channels stays in
+ * the cache of a core. Since the partial statistics are merged in a
+ * fixed order, the result does not depend on the number of threads.
+ *
+ * A statistics functor is copy-constructible, starts as the identity
+ * of the reduction and provides:
+ * <pre>
+ *   void add( int begin, int end );          // accumulate pixels [begin,end)
+ *   void merge( const Stats &other );        // add the partial result of a later tile
+ * </pre>
+ * A map kernel provides:
+ * <pre>
+ *   void operator()( int begin, int end ) const;   // process pixels [begin,end)
+ * </pre>
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+#ifndef PFSTMO_POINTWISE_H
+#define PFSTMO_POINTWISE_H
+
+#include <vector>
+
+namespace pfstmo
+{
+  /// Number of pixels in a tile (256kB for four float channels)
+  const int TILE_PIXELS = 16384;
+
+  inline int tile_count( int pix_count )
+  {
+    return (pix_count + TILE_PIXELS - 1) / TILE_PIXELS;
+  }
+
+  /**
+   * @brief Reduction phase: accumulate all pixels into stats
+   *
+   * @param pix_count number of pixels
+   * @param stats [in] identity of the reduction, [out] statistics of
+   * the whole image
+   * @param partial workspace for the copies of stats, one per tile. A
+   * workspace kept between frames lets functors that own buffers (such
+   * as histograms) reuse them instead of allocating for every tile.
+   */
+  template<class Stats>
+  void reduce_tiles( int pix_count, Stats &stats, std::vector<Stats> &partial )
+  {
+    const int tiles = tile_count( pix_count );
+    partial.assign( tiles, stats );
+
+    #pragma omp parallel for schedule(dynamic)
+    for( int t=0 ; t<tiles ; t++ )
+    {
+      const int begin = t*TILE_PIXELS;
+      const int end = (begin+TILE_PIXELS < pix_count) ? begin+TILE_PIXELS : pix_count;
+      partial[t].add( begin, end );
+    }
+
+    for( int t=0 ; t<tiles ; t++ )
+      stats.merge( partial[t] );
+  }
+
+  template<class Stats>
+  void reduce_tiles( int pix_count, Stats &stats )
+  {
+    std::vector<Stats> partial;
+    reduce_tiles( pix_count, stats, partial );
+  }
+
+  /**
+   * @brief Mapping phase: apply kernel to all pixels
+   *
+   * @param pix_count number of pixels
+   * @param kernel called once for every tile, concurrently
+   */
+  template<class Kernel>
+  void map_tiles( int pix_count, const Kernel &kernel )
+  {
+    const int tiles = tile_count( pix_count );
+
+    #pragma omp parallel for schedule(dynamic)
+    for( int t=0 ; t<tiles ; t++ )
+    {
+      const int begin = t*TILE_PIXELS;
+      const int end = (begin+TILE_PIXELS < pix_count) ? begin+TILE_PIXELS : pix_count;
+      kernel( begin, end );
+    }
+  }
+}
+
+#endif
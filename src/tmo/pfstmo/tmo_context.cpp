@@ -0,0 +1,1058 @@
+/**
+ * @brief Common interface to all tone mapping operators (libpfstmo)
+ *
+ * Each operator is wrapped in a Context that performs the same
+ * per-frame processing as its pfstmo_* program, but keeps the
+ * parameters, the working buffers and the inter-frame state in the
+ * object.
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <pfs.h>
+
+#include "tmo_context.h"
+
+#include "drago03/tmo_drago03.h"
+#include "durand02/tmo_durand02.h"
+#include "fattal02/tmo_fattal02.h"
+#include "mai11/compression_tmo.h"
+#include "mantiuk06/contrast_domain.h"
+#include "pattanaik00/tmo_pattanaik00.h"
+#include "reinhard02/tmo_reinhard02.h"
+#include "reinhard05/tmo_reinhard05.h"
+#ifdef HAVE_GSL
+#include "mantiuk08/display_adaptive_tmo.h"
+#endif
+#ifdef HAVE_FFTW3F
+#include "ferradans11/tmo_ferradans11.h"
+#endif
+
+using namespace std;
+
+// VERBOSE_STR (config.h) prints the messages of the verbose mode with
+// the name of the program that created the context
+#define PROG_NAME prog_name
+
+namespace pfstmo
+{
+
+//--------------------------------------------------------------------
+// Options
+
+Options::Options( const char *spec )
+{
+  if( spec == NULL )
+    return;
+  const char *p = spec;
+  while( *p != 0 ) {
+    while( *p == ' ' || *p == '\t' || *p == '\n' )
+      p++;
+    const char *end = p;
+    while( *end != 0 && *end != ' ' && *end != '\t' && *end != '\n' )
+      end++;
+    if( end == p )
+      break;
+    const string token( p, end );
+    const size_t eq = token.find( '=' );
+    if( eq == string::npos )
+      set( token.c_str(), NULL );
+    else
+      set( token.substr( 0, eq ).c_str(), token.substr( eq+1 ).c_str() );
+    p = end;
+  }
+}
+
+void Options::set( const char *name, const char *value )
+{
+  if( value == NULL ) {
+    values[name] = "";
+    switches.insert( name );
+  } else {
+    values[name] = value;
+    switches.erase( name );
+  }
+}
+
+const char *Options::get( const char *name )
+{
+  used.insert( name );
+  map<string,string>::const_iterator it = values.find( name );
+  if( it == values.end() )
+    return NULL;
+  return it->second.c_str();
+}
+
+bool Options::getSwitch( const char *name )
+{
+  if( get( name ) == NULL )
+    return false;
+  if( switches.find( name ) == switches.end() )
+    throw pfs::Exception( (string( "option '" ) + name + "' does not take a value").c_str() );
+  return true;
+}
+
+const char *Options::getString( const char *name, const char *def )
+{
+  const char *val = get( name );
+  if( val == NULL )
+    return def;
+  if( switches.find( name ) != switches.end() )
+    throw pfs::Exception( (string( "option '" ) + name + "' requires a value").c_str() );
+  return val;
+}
+
+float Options::getFloat( const char *name, float def )
+{
+  const char *val = getString( name, NULL );
+  return val == NULL ? def : (float)strtod( val, NULL );
+}
+
+int Options::getInt( const char *name, int def )
+{
+  const char *val = getString( name, NULL );
+  return val == NULL ? def : (int)strtod( val, NULL );
+}
+
+void Options::checkUnused( const char *op )
+{
+  for( map<string,string>::const_iterator it = values.begin(); it != values.end(); it++ )
+    if( used.find( it->first ) == used.end() )
+      throw pfs::Exception( (string( "unknown option '" ) + it->first + "' for " + op).c_str() );
+}
+
+
+namespace
+{
+
+//--------------------------------------------------------------------
+// Helpers
+
+/**
+ * pfs::Array2D interface to a row-major buffer owned by the caller,
+ * for the colour space transforms and operators that take pfs arrays.
+ */
+class ArrayView : public pfs::Array2D
+{
+  float *data;
+  int cols, rows;
+
+public:
+  ArrayView( int cols, int rows, float *data ) :
+    data( data ), cols( cols ), rows( rows )
+  {
+  }
+
+  int getCols() const { return cols; }
+  int getRows() const { return rows; }
+
+  float& operator()( int col, int row ) { return data[col+row*cols]; }
+  const float& operator()( int col, int row ) const { return data[col+row*cols]; }
+  float& operator()( int index ) { return data[index]; }
+  const float& operator()( int index ) const { return data[index]; }
+
+  float *getRawData() { return data; }
+};
+
+/**
+ * Reports the time of an activity (verbose mode)
+ */
+class Timing
+{
+  timeval t1;
+public:
+  Timing()
+  {
+    gettimeofday( &t1, NULL );
+  }
+
+  void report( const char *activity )
+  {
+    timeval t2;
+    gettimeofday( &t2, NULL );
+    unsigned int t = (t2.tv_sec - t1.tv_sec) * 1000000 + (t2.tv_usec - t1.tv_usec);
+    fprintf( stderr, "Activity %s took %g seconds.\n", activity, (float)t / 1000000.f );
+  }
+};
+
+/**
+ * Multiply each colour channel by L/Y (operators that only compress
+ * the luminance)
+ */
+void scaleByLuminance( int pix_count, float *X, float *Y, float *Z, const float *L )
+{
+  #pragma omp parallel for schedule(static)
+  for( int i=0 ; i<pix_count ; i++ )
+  {
+    float scale = L[i] / Y[i];
+    Y[i] *= scale;
+    X[i] *= scale;
+    Z[i] *= scale;
+  }
+}
+
+
+//--------------------------------------------------------------------
+// Operators
+
+class Drago03 : public Context
+{
+  float bias;
+  vector<float> L;
+
+public:
+  Drago03( int width, int height, Options &opt ) :
+    Context( width, height ), L( width*height )
+  {
+    bias = opt.getFloat( "bias", 0.85f );
+    if( bias<0.0f || bias>1.0f )
+      throw pfs::Exception("incorrect bias value, accepted range is (0..1)");
+  }
+
+  void printParameters()
+  {
+    VERBOSE_STR << ": bias: " << bias << endl;
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback )
+  {
+    float maxLum, avLum;
+    calculateLuminance( width, height, Y, avLum, maxLum );
+    VERBOSE_STR << ": maximum luminance: " << maxLum << endl;
+    VERBOSE_STR << ": average luminance: " << avLum << endl;
+    tmo_drago03( width, height, Y, &L[0], maxLum, avLum, bias );
+    scaleByLuminance( width*height, X, Y, Z, &L[0] );
+    return PFSTMO_OK;
+  }
+};
+
+
+class Durand02 : public Context
+{
+  float sigma_s, sigma_r, baseContrast;
+  bool original_algorithm;
+  Durand02Context tmo;
+
+public:
+  Durand02( int width, int height, Options &opt ) : Context( width, height )
+  {
+#ifdef HAVE_FFTW3F
+    sigma_s = opt.getFloat( "sigma-s", 40.0f );
+#else
+    sigma_s = opt.getFloat( "sigma-s", 8.0f );
+#endif
+    sigma_r = opt.getFloat( "sigma-r", 0.4f );
+    baseContrast = opt.getFloat( "base-contrast", 5.0f );
+    original_algorithm = opt.getSwitch( "original" );
+    if( sigma_s<=0.0f )
+      throw pfs::Exception("sigma_s value out of range, should be >0");
+    if( sigma_r<=0.0f )
+      throw pfs::Exception("sigma_r value out of range, should be >0");
+    if( baseContrast<=0.0f )
+      throw pfs::Exception("base contrast value out of range, should be >0");
+  }
+
+  void printParameters()
+  {
+    VERBOSE_STR << "sigma_s: " << sigma_s << endl;
+    VERBOSE_STR << "sigma_r: " << sigma_r << endl;
+    VERBOSE_STR << "base contrast: " << baseContrast << endl;
+#ifdef HAVE_FFTW3F
+    VERBOSE_STR << "fast bilateral filtering (fftw3)" << endl;
+#else
+    VERBOSE_STR << "conventional bilateral filtering" << endl;
+#endif
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback progress_cb )
+  {
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aX, &aY, &aZ );
+    tmo.tonemap( width, height, X, Y, Z, sigma_s, sigma_r, baseContrast, 1,
+      !original_algorithm, progress_cb );
+    pfs::transformColorSpace( pfs::CS_RGB, &aX, &aY, &aZ, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+};
+
+
+class Fattal02 : public Context
+{
+  float alpha, beta, gamma, saturation, noise;
+  int detail_level;
+  float black_point, white_point;
+  bool fftsolver;
+  vector<float> L, G;
+  Fattal02Context tmo;
+
+public:
+  Fattal02( int width, int height, Options &opt ) :
+    Context( width, height ), L( width*height ), G( width*height )
+  {
+    fftsolver = !opt.getSwitch( "multigrid" );
+#if !defined(HAVE_FFTW3) || !defined(HAVE_OpenMP)
+    // Use multigrid if FFTW lib not available
+    fftsolver = false;
+#endif
+    alpha = opt.getFloat( "alpha", 1.0f );
+    beta = opt.getFloat( "beta", 0.9f );
+    gamma = opt.getFloat( "gamma", -1.0f );
+    saturation = opt.getFloat( "saturation", 0.8f );
+    noise = opt.getFloat( "noise", -1.0f );
+    detail_level = opt.getInt( "detail-level", -1 );
+    white_point = opt.getFloat( "white-point", 0.5f );
+    black_point = opt.getFloat( "black-point", 0.1f );
+
+    if( alpha<=0.0f )
+      throw pfs::Exception("alpha value out of range, should be >0");
+    if( beta<=0.0f )
+      throw pfs::Exception("beta value out of range, should be >0");
+    if( gamma!=-1.0f && (gamma<=0.0f || gamma>=10.0) )
+      throw pfs::Exception("gamma value out of range, should be >0");
+    if( saturation<=0.0f || saturation>1.0f )
+      throw pfs::Exception("saturation value out of range, should be 0..1");
+    if( noise!=-1.0f && noise<0.0f )
+      throw pfs::Exception("noise level value out of range, should be >=0");
+    if( detail_level!=-1 && (detail_level<0 || detail_level>9) )
+      throw pfs::Exception("detail-level value out of range, should be 0..9");
+    if( white_point<0.0f || white_point>=50.0f )
+      throw pfs::Exception("white-point value out of range, should be 0..50");
+    if( black_point<0.0f || black_point>=50.0f )
+      throw pfs::Exception("black-point value out of range, should be 0..50");
+
+    if( fftsolver ) {
+      // Default params for the fftsolver
+      if( detail_level==-1 )
+        detail_level=3;
+      if( gamma==-1.0f )
+        gamma=0.8f;
+      if( noise==-1.0f )
+        noise=0.002f;
+    }
+    // adjust noise floor if not set by user
+    if( noise<0.0f )
+      noise = alpha*0.01;
+    if( detail_level==-1 )
+      detail_level=0;
+    if( gamma==-1.0f )
+      gamma=1.0f;
+  }
+
+  void printParameters()
+  {
+    VERBOSE_STR << "threshold gradient (alpha): " << alpha << endl;
+    VERBOSE_STR << "strengh of modification (beta): " << beta << endl;
+    VERBOSE_STR << "gamma: " << gamma << endl;
+    VERBOSE_STR << "noise floor: " << noise << endl;
+    VERBOSE_STR << "saturation: " << saturation << endl;
+    VERBOSE_STR << "detail level: " << detail_level << endl;
+    VERBOSE_STR << "white point: " << white_point << "%" << endl;
+    VERBOSE_STR << "black point: " << black_point << "%" << endl;
+    VERBOSE_STR << "use fft pde solver: " << fftsolver << endl;
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback )
+  {
+    tmo.tonemap( width, height, Y, &L[0], alpha, beta, gamma, noise,
+      detail_level, black_point, white_point, fftsolver );
+
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    ArrayView aG( width, height, &G[0] );   // copy for G to preserve Y
+    pfs::Array2D *R = &aX, *B = &aZ;
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, R, &aG, B );
+
+    // Color correction
+    const int pix_count = width*height;
+    for( int i=0; i < pix_count; i++ )
+    {
+      const float epsilon = 1e-4f;
+      float y = max( Y[i], epsilon );
+      float l = max( L[i], epsilon );
+      X[i] = powf( max(X[i]/y,0.f), saturation ) * l;
+      G[i] = powf( max(G[i]/y,0.f), saturation ) * l;
+      Z[i] = powf( max(Z[i]/y,0.f), saturation ) * l;
+    }
+
+    pfs::transformColorSpace( pfs::CS_RGB, R, &aG, B, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+};
+
+
+class Mai11 : public Context
+{
+  CompressionTMO tmo;
+  vector<float> R;
+
+public:
+  Mai11( int width, int height, Options & ) :
+    Context( width, height ), R( width*height )
+  {
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback progress_cb )
+  {
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    ArrayView aR( width, height, &R[0] );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aX, &aR, &aZ );
+    tmo.tonemap( X, &R[0], Z, width, height, X, &R[0], Z, Y, progress_cb );
+    if( progress_cb != NULL )
+      progress_cb( 100 );
+    pfs::transformColorSpace( pfs::CS_RGB, &aX, &aR, &aZ, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+
+  const char *getLuminanceType() const
+  {
+    return "DISPLAY";
+  }
+};
+
+
+class Mantiuk06 : public Context
+{
+  float scaleFactor, saturationFactor;
+  mantiuk06_solver solver;
+  int itmax;
+  float tol;
+  Mantiuk06Context tmo;
+  vector<float> R;
+
+public:
+  Mantiuk06( int width, int height, Options &opt ) :
+    Context( width, height ), itmax( 200 ), tol( 1e-3 ), R( width*height )
+  {
+    solver = opt.getSwitch( "precondition" ) ? MANTIUK06_PCG : MANTIUK06_CG;
+    saturationFactor = opt.getFloat( "saturation", 0.8f );
+    if( saturationFactor < 0.0f || saturationFactor > 2.0f )
+      throw pfs::Exception("incorrect saturation factor, accepted range is (0..2)");
+
+    const char *factor = opt.getString( "factor", NULL );
+    const char *equalize = opt.getString( "equalize-contrast", NULL );
+    if( factor != NULL && equalize != NULL )
+      throw pfs::Exception( "the 'factor' parameter cannot be used in combination with contrast equalization" );
+    scaleFactor = 0.1f;
+    if( equalize != NULL ) {
+      scaleFactor = 0.0f - (float)strtod( equalize, NULL );
+      if( scaleFactor > 0.0f )
+        throw pfs::Exception("incorrect contrast scale factor, accepted range is any positive number");
+    }
+    if( factor != NULL ) {
+      scaleFactor = (float)strtod( factor, NULL );
+      if( scaleFactor < 0.0f || scaleFactor > 1.0f )
+        throw pfs::Exception("incorrect contrast scale factor, accepted range is (0..1)");
+    }
+  }
+
+  void printParameters()
+  {
+    if( scaleFactor < 0 ) {
+      VERBOSE_STR << "algorithm: contrast equalization" << endl;
+      VERBOSE_STR << "contrast scale factor = " << -scaleFactor << endl;
+    } else {
+      VERBOSE_STR << "algorithm: contrast mapping" << endl;
+      VERBOSE_STR << "contrast scale factor = " << scaleFactor << endl;
+    }
+    VERBOSE_STR << "saturation factor = " << saturationFactor << endl;
+    if( solver == MANTIUK06_PCG ) {
+      VERBOSE_STR << "using preconditioned conjugate gradients (itmax = " << itmax << ", tol = " << tol << ")." << endl;
+    } else {
+      VERBOSE_STR << "using conjugate gradients (itmax = " << itmax << ", tol = " << tol << ")." << endl;
+    }
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback progress_cb )
+  {
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    ArrayView aR( width, height, &R[0] );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aX, &aR, &aZ );
+    const int res = tmo.tonemap( width, height, X, &R[0], Z, Y,
+      scaleFactor, saturationFactor, solver, itmax, tol, progress_cb );
+    pfs::transformColorSpace( pfs::CS_RGB, &aX, &aR, &aZ, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return res;
+  }
+};
+
+
+#ifdef HAVE_GSL
+class Mantiuk08 : public Context
+{
+  DisplayFunction *df;
+  DisplaySize *ds;
+  float contrast_enhance_factor, saturation_factor, white_y;
+  datmoVisualModel visual_model;
+  double scene_l_adapt;
+  double max_sampling_error;
+  float fps;
+  float warm_start_tol;
+  datmoTCFilter *rc_filter;
+  datmoWarmStart *warm_start;
+  FILE *tc_fh;                  // tone-curves of all frames (output-tone-curve)
+  int frame_no;
+  vector<float> R;
+
+  // The display model parsers take command line arguments
+  template<class T>
+  static T *createFromArg( T *(*create)( int&, char** ), const char *option, const char *spec )
+  {
+    vector<char> opt( option, option+strlen( option )+1 );
+    vector<char> arg( spec, spec+strlen( spec )+1 );
+    char name[] = "pfstmo";
+    char *argv[] = { name, &opt[0], &arg[0], NULL };
+    int argc = 3;
+    return create( argc, argv );
+  }
+
+public:
+  Mantiuk08( int width, int height, Options &opt ) :
+    Context( width, height ), df( NULL ), ds( NULL ), rc_filter( NULL ),
+    warm_start( NULL ), tc_fh( NULL ), frame_no( 0 ), R( width*height )
+  {
+    try {
+      const char *df_spec = opt.getString( "display-function", NULL );
+      if( df_spec != NULL )
+        df = createFromArg( createDisplayFunctionFromArgs, "--display-function", df_spec );
+      else
+        df = new DisplayFunctionGGBA( "lcd" );
+
+      const char *ds_spec = opt.getString( "display-size", NULL );
+      if( ds_spec != NULL )
+        ds = createFromArg( createDisplaySizeFromArgs, "--display-size", ds_spec );
+      else
+        ds = new DisplaySize( 30.f, 0.5f );
+
+      contrast_enhance_factor = opt.getFloat( "contrast-enhancement", 1.f );
+      if( contrast_enhance_factor <= 0.0f )
+        throw pfs::Exception("incorrect contrast enhancement factor, accepted value must be a positive number");
+
+      saturation_factor = opt.getFloat( "color-saturation", 1.f );
+      if( saturation_factor < 0.0f || saturation_factor > 2.0f )
+        throw pfs::Exception("incorrect saturation factor, accepted range is (0..2)");
+
+      const char *white_y_str = opt.getString( "white-y", NULL );
+      white_y = -2.f;
+      if( white_y_str != NULL ) {
+        if( !strcmp( white_y_str, "none" ) )
+          white_y = -1;
+        else
+          white_y = (float)strtod( white_y_str, NULL );
+        if( white_y < 0.0f )
+          throw pfs::Exception("incorrect white-y value. The value must be greater than 0");
+      }
+
+      fps = opt.getFloat( "fps", 25 );
+      if( fps != 25 && fps != 30 && fps != 60 )
+        throw pfs::Exception("Only 3 frame-per-seconds values are supported: 25, 30 and 60.");
+
+      visual_model = vm_full;
+      const char *vm_spec = opt.getString( "visual-model", NULL );
+      if( vm_spec != NULL ) {
+        vector<char> spec( vm_spec, vm_spec+strlen( vm_spec )+1 );
+        char *saveptr;
+        char *token;
+        visual_model = vm_none;
+        token = strtok_r( &spec[0], ",:", &saveptr );
+        while( token != NULL ) {
+          if( !strcmp( token, "none" ) ) {
+            visual_model = vm_none;
+          } else if( !strcmp( token, "full" ) ) {
+            visual_model = vm_full;
+          } else if( !strcmp( token, "luminance_masking" ) ) {
+            visual_model |= vm_luminance_masking;
+          } else if( !strcmp( token, "contrast_masking" ) ) {
+            visual_model |= vm_contrast_masking;
+          } else if( !strcmp( token, "csf" ) ) {
+            visual_model |= vm_csf;
+          } else
+            throw pfs::Exception("Unrecognized visual model");
+          token = strtok_r( NULL, ",:", &saveptr );
+        }
+      }
+
+      scene_l_adapt = 1000;
+      const char *adapt = opt.getString( "scene-y-adapt", NULL );
+      if( adapt != NULL ) {
+        if( !strcmp( adapt, "auto" ) )
+          scene_l_adapt = -1;
+        else {
+          scene_l_adapt = (float)strtod( adapt, NULL );
+          if( scene_l_adapt <= 0.0f )
+            throw pfs::Exception("incorrect scane adaptation luminance. The value must be greater than 0.");
+        }
+      }
+
+      warm_start_tol = opt.getFloat( "warm-start", -1 );
+      if( warm_start_tol != -1 && (warm_start_tol < 0.0f || warm_start_tol > 1.0f) )
+        throw pfs::Exception("incorrect warm-start tolerance, accepted range is [0..1]");
+
+      max_sampling_error = opt.getFloat( "subsample", 0 );
+      if( opt.getString( "subsample", NULL ) != NULL &&
+        (max_sampling_error <= 0 || max_sampling_error >= 0.5) )
+        throw pfs::Exception("incorrect subsampling error, accepted range is (0..0.5)");
+
+      rc_filter = new datmoTCFilter( fps, log10(df->display(0)), log10(df->display(1)) );
+      if( warm_start_tol >= 0 )
+        warm_start = new datmoWarmStart( warm_start_tol );
+
+      const char *output_tc = opt.getString( "output-tone-curve", NULL );
+      if( output_tc != NULL ) {
+        tc_fh = fopen( output_tc, "w" );
+        if( tc_fh == NULL )
+          throw pfs::Exception("cannot open file for writing tone-curve.");
+      }
+    }
+    catch( ... ) {
+      release();
+      throw;
+    }
+  }
+
+  ~Mantiuk08()
+  {
+    if( verbose && warm_start != NULL )
+      fprintf( stderr, "Tone-curve optimized for %d frames, reused for %d frames\n",
+        (int)warm_start->frames_optimized, (int)warm_start->frames_skipped );
+    release();
+  }
+
+  void release()
+  {
+    if( tc_fh != NULL )
+      fclose( tc_fh );
+    delete warm_start;
+    delete rc_filter;
+    delete ds;
+    delete df;
+  }
+
+  void printParameters()
+  {
+    df->print( stderr );
+    ds->print( stderr );
+    fprintf( stderr, "Frames-per-second: %g\n", fps );
+    fprintf( stderr, "Contrast masking: %d\n", (bool)(visual_model & vm_contrast_masking) );
+    fprintf( stderr, "Luminance masking: %d\n", (bool)(visual_model & vm_luminance_masking) );
+    fprintf( stderr, "CSF: %d\n", (bool)(visual_model & vm_csf) );
+    fprintf( stderr, "Scane adaptation luminance: %g (-1 means auto)\n", scene_l_adapt );
+    if( warm_start_tol >= 0 )
+      fprintf( stderr, "Warm start tolerance: %g\n", warm_start_tol );
+    fprintf( stderr, "Luminance factor of the reference white: " );
+    if( white_y < 0 )
+      fprintf( stderr, "not specified\n" );
+    else
+      fprintf( stderr, "%g\n", white_y );
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback progress_cb )
+  {
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    ArrayView aR( width, height, &R[0] );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aX, &aR, &aZ );
+
+    Timing tm_cond_dens;
+    double error_bound;
+    std::auto_ptr<datmoConditionalDensity> C =
+      datmo_compute_conditional_density( width, height, Y, progress_cb, max_sampling_error,
+        &error_bound );
+    if( C.get() == NULL )
+      throw pfs::Exception("failed to analyse the image");
+    if( verbose && max_sampling_error > 0 )
+      fprintf( stderr, "Standard error of the subsampled image statistics: < %g\n", error_bound );
+    if( verbose )
+      tm_cond_dens.report( "Conditional density" );
+
+    Timing tm_comp_tone_curve;
+    int res;
+    datmoToneCurve *tc = rc_filter->getToneCurvePtr();
+    res = datmo_compute_tone_curve( tc, C.get(), df, ds, contrast_enhance_factor, white_y,
+      progress_cb, visual_model, scene_l_adapt, warm_start );
+    if( res == PFSTMO_ABORTED )
+      return res;
+    if( res != PFSTMO_OK )
+      throw pfs::Exception( "failed to compute a tone-curve" );
+
+    datmoToneCurve *tc_filt = rc_filter->filterToneCurve();
+    if( verbose )
+      tm_comp_tone_curve.report( "Computing a tone-cuve" );
+
+    Timing tm_tonecurve;
+    res = datmo_apply_tone_curve_cc( X, &R[0], Z, width, height,
+      X, &R[0], Z, Y, tc_filt, df, saturation_factor );
+    if( res != PFSTMO_OK )
+      throw pfs::Exception( "failed to tone-map an image" );
+    if( verbose )
+      tm_tonecurve.report( "Apply tone-curve" );
+
+    if( tc_fh != NULL ) {
+      for( size_t i=0; i < tc_filt->size; i++ )
+        fprintf( tc_fh, "%d,%g,%g,%g\n", frame_no, tc_filt->x_i[i], tc_filt->y_i[i],
+          df->inv_display( (float)pow( 10, tc_filt->y_i[i] ) ) );
+    }
+    frame_no++;
+
+    if( progress_cb != NULL )
+      progress_cb( 100 );
+
+    pfs::transformColorSpace( pfs::CS_RGB, &aX, &aR, &aZ, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+
+  void reset()
+  {
+    datmoTCFilter *filter = new datmoTCFilter( fps, log10(df->display(0)), log10(df->display(1)) );
+    delete rc_filter;
+    rc_filter = filter;
+    if( warm_start != NULL )
+      warm_start->reset();
+  }
+
+  const char *getLuminanceType() const
+  {
+    return "DISPLAY";
+  }
+};
+#endif
+
+
+class Pattanaik00 : public Context
+{
+  bool timedependence, local;
+  float multiplier, Acone, Arod, fps;
+  int subsample;
+  VisualAdaptationModel am;
+  bool firstFrame;
+  vector<float> R, G, B;
+
+public:
+  Pattanaik00( int width, int height, Options &opt ) :
+    Context( width, height ), firstFrame( true ),
+    R( width*height ), G( width*height ), B( width*height )
+  {
+    timedependence = opt.getSwitch( "time-dependence" );
+    local = opt.getSwitch( "local" );
+    fps = opt.getFloat( "fps", 16.0f );
+    if( fps<=0.0f )
+      throw pfs::Exception("incorrect frames per second value, should be non-zero positive");
+    multiplier = opt.getFloat( "mul", 1.0f );
+    if( multiplier<=0.0f )
+      throw pfs::Exception("incorrect multiplier value, should be non-zero positive");
+    Acone = opt.getFloat( "cone", -1.0f );
+    if( Acone!=-1.0f && Acone<=0.0f )
+      throw pfs::Exception("incorrect cone adaptation value, should be non-zero positive");
+    Arod = opt.getFloat( "rod", Acone );
+    if( Arod!=-1.0f && Arod<=0.0f )
+      throw pfs::Exception("incorrect rod adaptation value, should be non-zero positive");
+    subsample = opt.getInt( "subsample", 1 );
+    if( subsample<1 )
+      throw pfs::Exception("incorrect subsampling step, should be a positive integer");
+    am.setSubsampling( subsample );
+  }
+
+  void printParameters()
+  {
+    VERBOSE_STR << "time-dependence: " << (timedependence ? "yes" : "no") << endl;
+    if( timedependence )
+      VERBOSE_STR << "frames per sec.: " << fps << endl;
+    VERBOSE_STR << "local:           " << (local ? "yes" : "no") << endl;
+    VERBOSE_STR << "multiplier:      " << multiplier << endl;
+    if( subsample>1 )
+      VERBOSE_STR << "statistics step: " << subsample << endl;
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback )
+  {
+    const int size = width*height;
+    if( multiplier!=1.0f )
+    {
+      #pragma omp parallel for schedule(static)
+      for( int i=0 ; i<size; i++ )
+      {
+        X[i] *= multiplier;
+        Y[i] *= multiplier;
+        Z[i] *= multiplier;
+      }
+    }
+
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    if( !local )
+    {
+      if( firstFrame || !timedependence )
+      {
+        if( Acone!=-1.0f )
+          am.setAdaptation( Acone, Arod );
+        else
+          am.setAdaptation( &aY );
+        firstFrame = false;
+      }
+      else
+        am.calculateAdaptation( &aY, 1.0f/fps );
+
+      VERBOSE_STR << "adaptation cone: " << am.getAcone() << endl;
+      VERBOSE_STR << "adaptation rod:  " << am.getArod() << endl;
+      VERBOSE_STR << "bleaching cone:  " << am.getBcone() << endl;
+      VERBOSE_STR << "bleaching rod:   " << am.getBrod() << endl;
+    }
+
+    ArrayView aR( width, height, &R[0] ), aG( width, height, &G[0] ), aB( width, height, &B[0] );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aR, &aG, &aB );
+    tmo_pattanaik00( width, height, &R[0], &G[0], &B[0], Y, &am, local );
+    pfs::transformColorSpace( pfs::CS_RGB, &aR, &aG, &aB, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+
+  void reset()
+  {
+    firstFrame = true;
+  }
+};
+
+
+class Reinhard02 : public Context
+{
+  struct Parameters
+  {
+    bool use_scales, temporal_coherent;
+    float key, phi;
+    int num, low, high;
+  };
+  const Parameters par;
+  Reinhard02Context tmo;
+  vector<float> L;
+
+  static Parameters parse( Options &opt )
+  {
+    Parameters par;
+    par.use_scales = opt.getSwitch( "scales" );
+    par.key = opt.getFloat( "key", 0.18f );
+    if( par.key<=0.0f || par.key>1.0f )
+      throw pfs::Exception("key value out of range, should be <0..1>");
+    par.phi = opt.getFloat( "phi", 1.0f );
+    if( par.phi<=0.0f )
+      throw pfs::Exception("phi value out of range, should be >0.0");
+    par.num = opt.getInt( "range", 8 );
+    if( par.num<1 )
+      throw pfs::Exception("range size value out of range, should be >1");
+    par.low = opt.getInt( "lower", 1 );
+    if( par.low<1 )
+      throw pfs::Exception("lower scale size out of range, should be >1");
+    par.high = opt.getInt( "upper", 43 );
+    if( par.high<1 )
+      throw pfs::Exception("upper scale size out of range, should be >1");
+    par.temporal_coherent = opt.getSwitch( "temporal-coherent" );
+    return par;
+  }
+
+public:
+  Reinhard02( int width, int height, Options &opt ) :
+    Context( width, height ), par( parse( opt ) ),
+    tmo( par.use_scales, par.key, par.phi, par.num, par.low, par.high,
+      par.temporal_coherent ),
+    L( width*height )
+  {
+  }
+
+  void printParameters()
+  {
+    VERBOSE_STR << "use scales: " << (par.use_scales ? "yes" : "no" ) << endl;
+    VERBOSE_STR << "key value: " << par.key << endl;
+    VERBOSE_STR << "phi value: " << par.phi << endl;
+    if( par.use_scales )
+    {
+      VERBOSE_STR << "number of scales: " << par.num << endl;
+      VERBOSE_STR << "lower scale size: " << par.low << endl;
+      VERBOSE_STR << "upper scale size: " << par.high << endl;
+    }
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback )
+  {
+    tmo.tonemap( width, height, Y, &L[0] );
+    scaleByLuminance( width*height, X, Y, Z, &L[0] );
+    return PFSTMO_OK;
+  }
+
+  void reset()
+  {
+    tmo.reset();
+  }
+};
+
+
+class Reinhard05 : public Context
+{
+  float brightness, chromaticadaptation, lightadaptation;
+  vector<float> R, G, B;
+
+public:
+  Reinhard05( int width, int height, Options &opt ) :
+    Context( width, height ), R( width*height ), G( width*height ), B( width*height )
+  {
+    brightness = opt.getFloat( "brightness", 0.0f );
+    if( brightness<-8.0f || brightness>8.0f )
+      throw pfs::Exception("brightness value out of range, should be <-8..8>");
+    chromaticadaptation = opt.getFloat( "chromatic", 0.5f );
+    if( chromaticadaptation<0.0f || chromaticadaptation>1.0f )
+      throw pfs::Exception("chromatic adaptation value out of range, should be <0..1>");
+    lightadaptation = opt.getFloat( "light", 0.75f );
+    if( lightadaptation<0.0f || lightadaptation>1.0f )
+      throw pfs::Exception("light adaptation value out of range, should be <0..1>");
+  }
+
+  void printParameters()
+  {
+    VERBOSE_STR << "brightness: " << brightness << endl;
+    VERBOSE_STR << "chromatic adaptation: " << chromaticadaptation << endl;
+    VERBOSE_STR << "light adaptation: " << lightadaptation << endl;
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback )
+  {
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    ArrayView aR( width, height, &R[0] ), aG( width, height, &G[0] ), aB( width, height, &B[0] );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aR, &aG, &aB );
+    tmo_reinhard05( width, height, &R[0], &G[0], &B[0], Y,
+      brightness, chromaticadaptation, lightadaptation );
+    pfs::transformColorSpace( pfs::CS_SRGB, &aR, &aG, &aB, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+};
+
+
+#ifdef HAVE_FFTW3F
+class Ferradans11 : public Context
+{
+  float rho, inv_alpha;
+  Ferradans11Context tmo;
+  vector<float> R, G, B;
+
+public:
+  Ferradans11( int width, int height, Options &opt ) :
+    Context( width, height ), R( width*height ), G( width*height ), B( width*height )
+  {
+    rho = opt.getFloat( "rho", -2 );
+    inv_alpha = opt.getFloat( "inv_alpha", 5 );
+    if( inv_alpha<=0.0f )
+      throw pfs::Exception("inv_alpha value out of range, should be >0");
+  }
+
+  int process( float *X, float *Y, float *Z, pfstmo_progress_callback )
+  {
+    ArrayView aX( width, height, X ), aY( width, height, Y ), aZ( width, height, Z );
+    ArrayView aR( width, height, &R[0] ), aG( width, height, &G[0] ), aB( width, height, &B[0] );
+    pfs::transformColorSpace( pfs::CS_XYZ, &aX, &aY, &aZ, pfs::CS_RGB, &aR, &aG, &aB );
+    tmo.tonemap( width, height, &R[0], &G[0], &B[0], rho, inv_alpha );
+    pfs::transformColorSpace( pfs::CS_SRGB, &aR, &aG, &aB, pfs::CS_XYZ, &aX, &aY, &aZ );
+    return PFSTMO_OK;
+  }
+};
+#endif
+
+
+//--------------------------------------------------------------------
+// Registry
+
+template<class T>
+Context *create( int width, int height, Options &opt )
+{
+  return new T( width, height, opt );
+}
+
+struct OperatorEntry
+{
+  const char *name;
+  Context *(*create)( int width, int height, Options &opt );
+};
+
+const OperatorEntry operators[] = {
+  { "drago03", create<Drago03> },
+  { "durand02", create<Durand02> },
+  { "fattal02", create<Fattal02> },
+#ifdef HAVE_FFTW3F
+  { "ferradans11", create<Ferradans11> },
+#endif
+  { "mai11", create<Mai11> },
+  { "mantiuk06", create<Mantiuk06> },
+#ifdef HAVE_GSL
+  { "mantiuk08", create<Mantiuk08> },
+#endif
+  { "pattanaik00", create<Pattanaik00> },
+  { "reinhard02", create<Reinhard02> },
+  { "reinhard05", create<Reinhard05> },
+  { NULL, NULL }
+};
+
+}
+
+
+Context *createContext( const char *name, int width, int height, const char *options )
+{
+  return createContext( name, width, height, Options( options ) );
+}
+
+Context *createContext( const char *name, int width, int height, const Options &options )
+{
+  if( width <= 0 || height <= 0 )
+    throw pfs::Exception( "incorrect frame size" );
+
+  for( const OperatorEntry *op = operators; op->name != NULL; op++ )
+    if( !strcmp( op->name, name ) ) {
+      Options opt( options );
+      Context *context = op->create( width, height, opt );
+      try {
+        opt.checkUnused( name );
+      }
+      catch( ... ) {
+        delete context;
+        throw;
+      }
+      return context;
+    }
+
+  throw pfs::Exception( (string( "unknown tone mapping operator: " ) + name).c_str() );
+}
+
+static vector<const char*> listOperatorNames()
+{
+  vector<const char*> names;
+  for( const OperatorEntry *op = operators; ; op++ ) {
+    names.push_back( op->name );
+    if( op->name == NULL )
+      break;
+  }
+  return names;
+}
+
+const char * const *getOperatorNames()
+{
+  static const vector<const char*> names = listOperatorNames();
+  return &names[0];
+}
+
+}
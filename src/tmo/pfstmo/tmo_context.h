@@ -0,0 +1,243 @@
+/**
+ * @brief Common interface to all tone mapping operators (libpfstmo)
+ *
+ * A context holds an operator configured with its parameters for a
+ * given frame size, together with all its working buffers and the
+ * state carried between the frames of a sequence (temporal filtering,
+ * visual adaptation). Frames are tone mapped in-process by calling
+ * process() repeatedly, which amortizes the setup cost and avoids the
+ * reallocation of the buffers for every frame:
+ *
+ * <pre>
+ *   pfstmo::Context *tmo = pfstmo::createContext( "drago03", w, h, "bias=0.9" );
+ *   while( ... )
+ *     tmo->process( X, Y, Z );
+ *   delete tmo;
+ * </pre>
+ *
+ * The pfstmo_* programs are built on the same contexts, so the result
+ * of process() is the frame written by the corresponding program.
+ *
+ * This file is a part of PFSTMO package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+#ifndef PFSTMO_TMO_CONTEXT_H
+#define PFSTMO_TMO_CONTEXT_H
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "pfstmo.h"
+
+namespace pfstmo
+{
+
+  /**
+   * @brief Parameters of an operator
+   *
+   * The options are the long command line options of the
+   * pfstmo_<name> program, given as name and value, or just the name
+   * for switches. Each operator reads and checks its options when its
+   * context is created.
+   */
+  class Options
+  {
+    std::map<std::string,std::string> values;
+    std::set<std::string> switches;     // given without a value
+    std::set<std::string> used;
+
+    const char *get( const char *name );
+
+  public:
+    /**
+     * @param spec white-space separated list of name=value pairs (or
+     * just the name for switches), e.g. "scales key=0.25"; may be NULL
+     */
+    Options( const char *spec = NULL );
+
+    /**
+     * @brief Set an option, replacing the value given before
+     *
+     * @param value value of the option or NULL for a switch
+     */
+    void set( const char *name, const char *value );
+
+    /**
+     * @brief Set the option returned by getopt_long()
+     *
+     * @param table long options of the program (struct option)
+     * @param c value returned by getopt_long(), looked up in the table
+     * @param arg optarg, NULL for switches
+     */
+    template<class LongOption>
+    void set( const LongOption *table, int c, const char *arg )
+    {
+      for( ; table->name != NULL; table++ )
+        if( table->flag == NULL && table->val == c ) {
+          set( table->name, arg );
+          return;
+        }
+    }
+
+    bool getSwitch( const char *name );
+    const char *getString( const char *name, const char *def );
+    float getFloat( const char *name, float def );
+    int getInt( const char *name, int def );
+
+    /**
+     * @throws pfs::Exception an option that was not read by the
+     * operator op
+     */
+    void checkUnused( const char *op );
+  };
+
+  /**
+   * @brief Tone mapping operator bound to a frame size
+   *
+   * Contexts are independent of each other and can be used
+   * concurrently from different threads; the operators based on FFTW
+   * serialize the creation of their plans (see fftw_lock.h). A single
+   * context must not be used from several threads at the same time.
+   */
+  class Context
+  {
+  public:
+    virtual ~Context()
+    {
+    }
+
+    /**
+     * @brief Tone map one frame in-place
+     *
+     * @param X, Y, Z [in] linear XYZ channels (Y in cd/m^2 or relative
+     * units), [out] tone mapped XYZ channels; getWidth()*getHeight()
+     * pixels each, row-major
+     * @param progress_cb reports the progress, for the operators that
+     * support it; may be NULL
+     * @return PFSTMO_OK or PFSTMO_ABORTED if aborted by progress_cb
+     */
+    virtual int process( float *X, float *Y, float *Z,
+      pfstmo_progress_callback progress_cb = NULL ) = 0;
+
+    /**
+     * @return value of the LUMINANCE tag of the tone mapped frame,
+     * "RELATIVE" or "DISPLAY"
+     */
+    virtual const char *getLuminanceType() const
+    {
+      return "RELATIVE";
+    }
+
+    /**
+     * @brief Forget the state carried from frame to frame
+     *
+     * Temporal filtering and adaptation start anew with the next
+     * frame, as in a newly created context, e.g. when the context is
+     * reused for an unrelated image. The working buffers are kept.
+     */
+    virtual void reset()
+    {
+    }
+
+    /**
+     * @brief Print the messages of the verbose mode of the pfstmo_*
+     * programs to stderr
+     *
+     * The parameters of the operator are printed at once, the
+     * statistics of each frame by process().
+     *
+     * @param prog_name beginning of each message
+     */
+    void setVerbose( const char *prog_name )
+    {
+      verbose = true;
+      this->prog_name = prog_name;
+      printParameters();
+    }
+
+    int getWidth() const
+    {
+      return width;
+    }
+
+    int getHeight() const
+    {
+      return height;
+    }
+
+  protected:
+    Context( int width, int height ) : width( width ), height( height ),
+      verbose( false )
+    {
+    }
+
+    /**
+     * @brief Print the parameters of the operator (verbose mode)
+     */
+    virtual void printParameters()
+    {
+    }
+
+    const int width, height;
+    bool verbose;
+    std::string prog_name;
+
+  private:
+    Context( const Context& );
+    Context& operator=( const Context& );
+  };
+
+  /**
+   * @brief Create a context for the given operator
+   *
+   * The options are given as a white-space separated list of
+   * name=value pairs (or just the name for switches), where the names
+   * are the long command line options of the pfstmo_<name> program,
+   * for example "scales key=0.25" for reinhard02. Options that are not
+   * given take the same default values as in the program.
+   *
+   * @param name operator name as returned by getOperatorNames(),
+   * e.g. "drago03"
+   * @param width frame width
+   * @param height frame height
+   * @param options operator options, may be NULL
+   * @return new context, to be deleted by the caller
+   * @throws pfs::Exception unknown operator, unknown option or option
+   * value out of range
+   */
+  Context *createContext( const char *name, int width, int height,
+    const char *options = NULL );
+
+  /**
+   * @brief Create a context for the given operator
+   *
+   * As above, with the options already parsed, e.g. from the command
+   * line of a program.
+   */
+  Context *createContext( const char *name, int width, int height,
+    const Options &options );
+
+  /**
+   * @return NULL terminated list of the names of the operators
+   * compiled into the library
+   */
+  const char * const *getOperatorNames();
+
+}
+
+#endif
@@ -37,11 +37,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#include "tmo_reinhard02.h"
+#include "tmo_context.h"
 
 using namespace std;
 
@@ -69,14 +68,8 @@ void pfstmo_reinhard02( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-  float key = 0.18;
-  float phi = 1.0;
-  int num = 8;
-  int low = 1;
-  int high = 43;
-  bool use_scales = false;
-  bool temporal_coherent = false;  
+  //--- tone mapping parameters, checked by the reinhard02 context
+  pfstmo::Options tmo_options;
 
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
@@ -102,57 +95,19 @@ void pfstmo_reinhard02( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 's':
-      use_scales = true;
-      break;
-    case 'k':
-      key = (float)strtod( optarg, NULL );
-      if( key<=0.0f || key>1.0f )
-        throw pfs::Exception("key value out of range, should be <0..1>");
-      break;
-    case 'p':
-      phi = (float)strtod( optarg, NULL );
-      if( phi<=0.0f )
-        throw pfs::Exception("phi value out of range, should be >0.0");
-      break;
-    case 'r':
-      num = (int)strtod( optarg, NULL );
-      if( num<1 )
-        throw pfs::Exception("range size value out of range, should be >1");
-      break;
-    case 'l':
-      low = (int)strtod( optarg, NULL );
-      if( low<1 )
-        throw pfs::Exception("lower scale size out of range, should be >1");
-      break;
-    case 'u':
-      high = (int)strtod( optarg, NULL );
-      if( high<1 )
-        throw pfs::Exception("upper scale size out of range, should be >1");
-      break;
-    case 't':
-      temporal_coherent = true;
-      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  VERBOSE_STR << "use scales: " << (use_scales ? "yes" : "no" ) << endl;
-  VERBOSE_STR << "key value: " << key << endl;
-  VERBOSE_STR << "phi value: " << phi << endl;
-  if( use_scales )
-  {
-    VERBOSE_STR << "number of scales: " << num << endl;
-    VERBOSE_STR << "lower scale size: " << low << endl;
-    VERBOSE_STR << "upper scale size: " << high << endl;
-#ifndef HAVE_ZFFT
-    VERBOSE_STR << "approximate implementation of scales" << endl;
-#endif
-  }
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "reinhard02", 1, 1, tmo_options );
 
+  pfstmo::Context *tmo = NULL;
   while( true ) 
   {
     pfs::Frame *frame = pfsio.readFrame( stdin );
@@ -160,34 +115,29 @@ void pfstmo_reinhard02( int argc, char* argv[] )
 
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y==NULL || X==NULL || Z==NULL)
       throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
         
-    // tone mapping
+    // the temporal state is kept for all frames of the same size
     int w = Y->getCols();
     int h = Y->getRows();
-    pfs::Array2DImpl* L = new pfs::Array2DImpl(w,h);
-
-    tmo_reinhard02( w, h, Y->getRawData(), L->getRawData(), use_scales, key, phi, num, low, high, temporal_coherent );
-
-    for( int x=0 ; x<w ; x++ )
-      for( int y=0 ; y<h ; y++ )
-      {
-        float scale = (*L)(x,y) / (*Y)(x,y);
-        (*Y)(x,y) *= scale;
-        (*X)(x,y) *= scale;
-        (*Z)(x,y) *= scale;
-      }
+    if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "reinhard02", w, h, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
+    }
 
-    delete L;
+    tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
 
     //---
     pfsio.writeFrame( frame, stdout );
     pfsio.freeFrame( frame );        
   }
+  delete tmo;
 }
 
 int main( int argc, char* argv[] )
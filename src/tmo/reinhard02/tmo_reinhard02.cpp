@@ -2,7 +2,7 @@
  * @file tmo_reinhard02.cpp
  * @brief Tone map luminance channel using Reinhard02 model
  *
- * Implementation courtesy of Erik Reinhard. 
+ * Implementation courtesy of Erik Reinhard.
  *
  * Original source code note:
  * Tonemap.c  University of Utah / Erik Reinhard / October 2001
@@ -20,551 +20,387 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <assert.h>
 
-#include "pfstmo.h"
-
-#ifdef HAVE_ZFFT
-#include <fft.h>
-#else
-// if no zfft library compile approximate sollution
-#define APPROXIMATE
-#endif
-
-//--- from defines.h
-typedef struct {
-  int     xmax, ymax;     /* image dimensions */
-} CVTS;
-
-typedef double  COLOR[3];       /* red, green, blue (or X,Y,Z) */
-//--- end of defines.h
-
-
-static int       width, height, scale;
-static COLOR   **image;
-static double ***convolved_image;
-static double    sigma_0, sigma_1;
-double         **luminance;
+#include <algorithm>
 
-static double    k                = 1. / (2. * 1.4142136);
-static double    key              = 0.18;
-static double    threshold        = 0.05;
-static double    phi              = 8.;
-static double    white            = 1e20;
-static int       scale_low        = 1;
-static int       scale_high       = 43;  // 1.6^8 = 43
-static int       range            = 8;
-static int       use_scales       = 0;
-static int       use_border       = 0;
-static CVTS      cvts             = {0, 0};
-
-static bool temporal_coherent;
-
-#ifdef APPROXIMATE
-extern int PyramidHeight; // set by build_pyramid, defines actual pyramid size
-extern double V1 (int x, int y, int level);
-extern void build_pyramid (double **luminance, int image_width, int image_height);
-extern void clean_pyramid ();
-#else
+#include "pfstmo.h"
+#include "fast_math.h"
+#include "tmo_reinhard02.h"
 
-static zomplex **filter_fft;
-static zomplex  *image_fft, *coeff;
 
-#define V1(x,y,i)        (convolved_image[i][x][y])
+/// Gaussian of scale s has the standard deviation k*s/sqrt(2) = s/4
+static const double k = 1. / (2. * 1.4142136);
 
-#endif
+/// Recursive filtering is used for the standard deviations above this
+/// value, smaller ones are convolved with a truncated kernel. The
+/// recursive filter deviates from the Gaussian by a few percent of its
+/// peak, so it is kept for scales beyond the default range (up to s=43).
+static const double IIR_MIN_SIGMA = 8.0;
 
-#define SIGMA_I(i)       (sigma_0 + ((double)i/(double)range)*(sigma_1 - sigma_0))
-#define S_I(i)           (exp (SIGMA_I(i)))
-#define V2(x,y,i)        (V1(x,y,i+1))
-#define ACTIVITY(x,y,i)  ((V1(x,y,i) - V2(x,y,i)) / (((key * pow (2., phi))/(S_I(i)*S_I(i))) + V1(x,y,i)))
+/// Block of columns processed together in the vertical filter passes
+static const int COLUMN_BLOCK = 64;
 
 
+/*
+ * Separable Gaussian filters. All filters replicate the border pixels.
+ */
 
 /**
- * Used to achieve temporal coherence
+ * Convolution with the Gaussian integrated over the pixel area (as in
+ * the original FFT implementation), truncated at 3 standard deviations
+ * and normalized.
  */
-template<class T>
-class TemporalSmoothVariable
+static void gaussian_fir( const float *in, float *out, float *tmp,
+  int width, int height, double sigma )
 {
-//  const int hist_length = 100;
-  T value;
-
-  T getThreshold( T luminance )
-  {
-    return 0.01 * luminance;
-  }
-  
-public:
-  TemporalSmoothVariable() : value( -1 )
+  const int radius = std::max( 1, (int)ceil( 3.*sigma ) );
+  std::vector<float> kernel( 2*radius+1 );
+  const double a = 1. / (sqrt(2.) * sigma);
+  double sum = 0.;
+  for( int t=-radius ; t<=radius ; t++ )
   {
+    const double w = erf( a*(t+.5) ) - erf( a*(t-.5) );
+    kernel[t+radius] = w;
+    sum += w;
   }
-  
-  void set( T new_value )
+  for( int t=0 ; t<2*radius+1 ; t++ )
+    kernel[t] /= sum;
+  const float *kc = &kernel[radius];
+
+  // horizontal pass on rows padded with the border values
+  #pragma omp parallel
   {
-    if( value == -1 )
-      value = new_value;
-    else {
-      T delta = new_value - value;
-      const T threshold = getThreshold( (new_value + value)/2 );
-      if( delta > threshold ) delta = threshold;
-      else if( delta < -threshold ) delta = -threshold;
-      value += delta;
+    std::vector<float> padded( width + 2*radius );
+    #pragma omp for schedule(static)
+    for( int y=0 ; y<height ; y++ )
+    {
+      const float *in_row = in + y*width;
+      float *tmp_row = tmp + y*width;
+      std::fill( padded.begin(), padded.begin()+radius, in_row[0] );
+      std::copy( in_row, in_row+width, padded.begin()+radius );
+      std::fill( padded.end()-radius, padded.end(), in_row[width-1] );
+      const float *pc = &padded[radius];
+      for( int x=0 ; x<width ; x++ )
+        tmp_row[x] = 0.f;
+      for( int t=-radius ; t<=radius ; t++ )
+      {
+        const float w = kc[t];
+        #pragma omp simd
+        for( int x=0 ; x<width ; x++ )
+          tmp_row[x] += w*pc[x+t];
+      }
     }
   }
-  
-  T get() const
-  {
-    return value;
-  }  
-};
 
-
-static TemporalSmoothVariable<double> avg_luminance, max_luminance;
-
-
-/*
- * Kaiser-Bessel stuff
- */
-
-static double   alpha = 2.;         /* Kaiser-Bessel window parameter   */
-static double   bbeta;              /* Will contain bessel (PI * alpha) */
-
-/*
- * Modified zeroeth order bessel function of the first kind
- */
-
-double bessel (double x)
-{
-  const double f = 1e-9;
-  int          n = 1;
-  double       s = 1.;
-  double       d = 1.;
-
-  double t;
-
-  while (d > f * s)
+  // vertical pass, whole rows at once
+  #pragma omp parallel for schedule(static)
+  for( int y=0 ; y<height ; y++ )
   {
-    t = x / (2. * n);
-    n++;
-    d *= t * t;
-    s += d;
+    float *out_row = out + y*width;
+    for( int x=0 ; x<width ; x++ )
+      out_row[x] = 0.f;
+    for( int t=-radius ; t<=radius ; t++ )
+    {
+      const float *tmp_row = tmp + std::min( std::max( y+t, 0 ), height-1 )*width;
+      const float w = kc[t];
+      #pragma omp simd
+      for( int x=0 ; x<width ; x++ )
+        out_row[x] += w*tmp_row[x];
+    }
   }
-  return s;
-}
-
-/*
- * Initialiser for Kaiser-Bessel computations
- */
-
-void compute_bessel ()
-{
-  bbeta = bessel (M_PI * alpha);
-}
-
-/*
- * Kaiser-Bessel function with window length M and parameter beta = 2.
- * Window length M = min (width, height) / 2
- */
-
-double kaiserbessel (double x, double y, double M)
-{
-  double d = 1. - ((x*x + y*y) / (M * M));
-  if (d <= 0.)
-    return 0.;
-  return bessel (M_PI * alpha * sqrt (d)) / bbeta;
 }
 
 
-/*
- * FFT functions
+/**
+ * Recursive Gaussian filter:
+ * I.T. Young and L.J. van Vliet. Recursive implementation of the
+ * Gaussian filter. Signal Processing 44(2), 1995.
+ *
+ * The cost does not depend on sigma. The causal pass starts from the
+ * steady state of the border value. The anti-causal pass starts from
+ * the exact response to the replicated border (as proposed by
+ * B. Triggs and M. Sdika, IEEE Trans. Signal Processing 54(6), 2006);
+ * the 3x3 matrix mapping the last causal outputs to it is found by
+ * running the filter on unit impulses.
  */
-#ifdef HAVE_ZFFT
-
-void initialise_fft (int width, int height)
-{
-  coeff = zfft2di (width, height, NULL);
-}
-
-void compute_fft (zomplex *array, int width, int height)
-{
-  zfft2d (-1, width, height, array, width, coeff);
-}
-
-void compute_inverse_fft (zomplex *array, int width, int height)
+class RecursiveGaussian
 {
-  zfft2d (1, width, height, array, width, coeff);
-}
-
-
-// Compute Gaussian blurred images
-void gaussian_filter (zomplex *filter, double scale, double k )
-{
-  int    x, y;
-  double x1, y1, s;
-  double a = 1. / (k * scale);
-  double c = 1. / 4.;
+public:
+  float B, b1, b2, b3;
+  float M[3][3];
 
-  for (y = 0; y < cvts.ymax; y++)
+  RecursiveGaussian( double sigma )
   {
-    y1 = (y >= cvts.ymax / 2) ? y - cvts.ymax : y;
-    s  = erf (a * (y1 - .5)) - erf (a * (y1 + .5));
-    for (x = 0; x < cvts.xmax; x++)
+    // variance of the pixel-integrated Gaussian, see gaussian_fir()
+    sigma = sqrt( sigma*sigma + 1./12. );
+    const double q = 0.98711*sigma - 0.96330;
+    const double q2 = q*q, q3 = q2*q;
+    const double c0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+    const double c1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+    const double c2 = -(1.4281*q2 + 1.26661*q3);
+    const double c3 = 0.422205*q3;
+    b1 = c1/c0;
+    b2 = c2/c0;
+    b3 = c3/c0;
+    B = 1. - (c1+c2+c3)/c0;
+
+    // e[0..2] are the last three causal outputs (minus the border
+    // value), the rest is their continuation past the border
+    const int len = (int)(10.*sigma) + 64;
+    std::vector<double> e( len ), r( len+3 );
+    for( int j=0 ; j<3 ; j++ )
     {
-      x1 = (x >= cvts.xmax / 2) ? x - cvts.xmax : x;
-      filter[y*cvts.xmax + x].re = s * (erf (a * (x1 - .5)) - erf (a * (x1 + .5))) * c;
-      filter[y*cvts.xmax + x].im = 0.;
+      std::fill( e.begin(), e.end(), 0. );
+      e[2-j] = 1.;
+      for( int n=3 ; n<len ; n++ )
+        e[n] = b1*e[n-1] + b2*e[n-2] + b3*e[n-3];
+      std::fill( r.begin(), r.end(), 0. );
+      for( int n=len-1 ; n>=2 ; n-- )
+        r[n] = B*e[n] + b1*r[n+1] + b2*r[n+2] + b3*r[n+3];
+      for( int i=0 ; i<3 ; i++ )
+        M[i][j] = r[2+i];
     }
   }
-}
 
-void build_gaussian_fft ()
-{
-  int    i;
-  double length    = cvts.xmax * cvts.ymax;
-  double fft_scale = 1. / sqrt (length);
-  filter_fft      = (zomplex**) calloc (range, sizeof (zomplex*));
-
-  for (scale = 0; scale < range; scale++)
+  /// in-place filtering of n values spaced by stride
+  void filter( float *p, int n, int stride ) const
   {
-    fprintf (stderr, "Computing FFT of Gaussian at scale %i (size %i x %i)%c", 
-	     scale, cvts.xmax, cvts.ymax, (char)13);
-    filter_fft[scale] = (zomplex*) calloc (length, sizeof (zomplex));
-    gaussian_filter (filter_fft[scale], S_I(scale), k);
-    compute_fft     (filter_fft[scale], cvts.xmax, cvts.ymax);
-    for (i = 0; i < length; i++)
+    const float u = p[(n-1)*stride];
+
+    // causal
+    float w1 = p[0], w2 = p[0], w3 = p[0];
+    for( int i=0 ; i<n ; i++ )
     {
-      filter_fft[scale][i].re *= fft_scale;
-      filter_fft[scale][i].im *= fft_scale;
+      const float w = B*p[i*stride] + b1*w1 + b2*w2 + b3*w3;
+      p[i*stride] = w;
+      w3 = w2; w2 = w1; w1 = w;
     }
-  }
-  fprintf (stderr, "\n");
-}
 
-void build_image_fft ()
-{
-  int    i, x, y;
-  double length    = cvts.xmax * cvts.ymax;
-  double fft_scale = 1. / sqrt (length);
-
-  fprintf (stderr, "Computing image FFT\n");
-  image_fft = (zomplex*) calloc (length, sizeof (zomplex));
-
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-      image_fft[y*cvts.xmax + x].re = luminance[y][x];
-
-  compute_fft (image_fft, cvts.xmax, cvts.ymax);
-  for (i = 0; i < length; i++)
-  {
-    image_fft[i].re *= fft_scale;
-    image_fft[i].im *= fft_scale;
+    // anti-causal
+    float e[3];
+    for( int j=0 ; j<3 ; j++ )
+      e[j] = p[std::max( n-1-j, 0 )*stride] - u;
+    float y[3];
+    for( int i=0 ; i<3 ; i++ )
+      y[i] = u + M[i][0]*e[0] + M[i][1]*e[1] + M[i][2]*e[2];
+    p[(n-1)*stride] = y[0];
+    w1 = y[0]; w2 = y[1]; w3 = y[2];
+    for( int i=n-2 ; i>=0 ; i-- )
+    {
+      const float w = B*p[i*stride] + b1*w1 + b2*w2 + b3*w3;
+      p[i*stride] = w;
+      w3 = w2; w2 = w1; w1 = w;
+    }
   }
-}
 
-void convolve_filter (int scale, zomplex *convolution_fft)
-{
-  int i, x, y;
-
-  for (i = 0; i < cvts.xmax * cvts.ymax; i++)
+  /// in-place filtering of the columns [x0,x1) of an image
+  void filterColumns( float *p, int width, int height, int x0, int x1 ) const
   {
-    convolution_fft[i].re = image_fft[i].re * filter_fft[scale][i].re -
-                            image_fft[i].im * filter_fft[scale][i].im;
-    convolution_fft[i].im = image_fft[i].re * filter_fft[scale][i].im +
-                            image_fft[i].im * filter_fft[scale][i].re;
+    const int n = x1-x0;
+    const float *first = p + x0;
+    const float *last = p + (height-1)*width + x0;
+    std::vector<float> u( last, last+n );
+    std::vector<float> h1( first, first+n ), h2( first, first+n ), h3( first, first+n );
+
+    // causal
+    for( int y=0 ; y<height ; y++ )
+    {
+      float *row = p + y*width + x0;
+      #pragma omp simd
+      for( int x=0 ; x<n ; x++ )
+      {
+        const float w = B*row[x] + b1*h1[x] + b2*h2[x] + b3*h3[x];
+        row[x] = w;
+        h3[x] = h2[x]; h2[x] = h1[x]; h1[x] = w;
+      }
+    }
+
+    // anti-causal
+    const float *e0 = p + (height-1)*width + x0;
+    const float *e1 = p + std::max( height-2, 0 )*width + x0;
+    const float *e2 = p + std::max( height-3, 0 )*width + x0;
+    for( int x=0 ; x<n ; x++ )
+    {
+      const float d0 = e0[x]-u[x], d1 = e1[x]-u[x], d2 = e2[x]-u[x];
+      h1[x] = u[x] + M[0][0]*d0 + M[0][1]*d1 + M[0][2]*d2;
+      h2[x] = u[x] + M[1][0]*d0 + M[1][1]*d1 + M[1][2]*d2;
+      h3[x] = u[x] + M[2][0]*d0 + M[2][1]*d1 + M[2][2]*d2;
+    }
+    std::copy( h1.begin(), h1.end(), p + (height-1)*width + x0 );
+    for( int y=height-2 ; y>=0 ; y-- )
+    {
+      float *row = p + y*width + x0;
+      #pragma omp simd
+      for( int x=0 ; x<n ; x++ )
+      {
+        const float w = B*row[x] + b1*h1[x] + b2*h2[x] + b3*h3[x];
+        row[x] = w;
+        h3[x] = h2[x]; h2[x] = h1[x]; h1[x] = w;
+      }
+    }
   }
-  compute_inverse_fft (convolution_fft, cvts.xmax, cvts.ymax);
-  i = 0;
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-      convolved_image[scale][x][y] = convolution_fft[i++].re;
-}
+};
 
-void compute_fourier_convolution ()
+static void gaussian_iir( const float *in, float *out,
+  int width, int height, double sigma )
 {
-  int x;
-  zomplex *convolution_fft;
-
-  initialise_fft     (cvts.xmax, cvts.ymax);
-  build_image_fft    ();
-  build_gaussian_fft ();
-  convolved_image =  (double ***) malloc (range * sizeof (double **));
+  const RecursiveGaussian g( sigma );
 
-  convolution_fft =  (zomplex *) calloc (cvts.xmax * cvts.ymax, sizeof (zomplex));
-  for (scale = 0; scale < range; scale++)
+  #pragma omp parallel for schedule(static)
+  for( int y=0 ; y<height ; y++ )
   {
-    fprintf (stderr, "Computing convolved image at scale %i%c", scale, (char)13);
-    convolved_image[scale] = (double **) malloc (cvts.xmax * sizeof (double *));
-    for (x = 0; x < cvts.xmax; x++)
-      convolved_image[scale][x] = (double *) malloc (cvts.ymax * sizeof (double));
-    convolve_filter (scale, convolution_fft);
-    free (filter_fft[scale]);
+    std::copy( in + y*width, in + (y+1)*width, out + y*width );
+    g.filter( out + y*width, width, 1 );
   }
-  fprintf (stderr, "\n");
-  free (convolution_fft);
-  free (image_fft);
-}
-
-#endif // #ifdef HAVE_ZFFT
-
 
-
-/*
- * Tonemapping routines
- */
-
-double get_maxvalue ()
-{
-  double max = 0.;
-  int    x, y;
-
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-      max = (max < image[y][x][0]) ? image[y][x][0] : max;
-  return max;
+  const int blocks = (width + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+  #pragma omp parallel for schedule(static)
+  for( int b=0 ; b<blocks ; b++ )
+    g.filterColumns( out, width, height, b*COLUMN_BLOCK,
+      std::min( (b+1)*COLUMN_BLOCK, width ) );
 }
 
-void tonemap_image ()
+static void gaussian_blur( const float *in, float *out, float *tmp,
+  int width, int height, double sigma )
 {
-  double Lmax2;
-  int    x, y;
-  int    scale, prefscale;
-
-  if (white < 1e20)
-    Lmax2 = white * white;
+  if( sigma < IIR_MIN_SIGMA )
+    gaussian_fir( in, out, tmp, width, height, sigma );
   else
-  {
-    if( temporal_coherent ) {
-      max_luminance.set( get_maxvalue() );
-      Lmax2 = max_luminance.get();
-    } else Lmax2  = get_maxvalue();
-    Lmax2 *= Lmax2;
-  }
-
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-    {
-      if (use_scales)
-      {
-	prefscale = range - 1;
-	for (scale = 0; scale < range - 1; scale++)
-	  if ( scale >= PyramidHeight || fabs (ACTIVITY(x,y,scale)) > threshold)
-	  {
-	    prefscale = scale;
-	    break;
-	  }
-	image[y][x][0] /= 1. + V1(x,y,prefscale);
-      }
-      else
-	image[y][x][0] = image[y][x][0] * (1. + (image[y][x][0] / Lmax2)) / (1. + image[y][x][0]);
-      // image[y][x][0] /= (1. + image[y][x][0]);
-    }
+    gaussian_iir( in, out, width, height, sigma );
 }
 
+
 /*
- * Miscellaneous functions
+ * Tonemapping routines
  */
 
-void clamp_image ()
+Reinhard02Context::Reinhard02Context( bool use_scales, float key, float phi,
+  int num, int low, int high, bool temporal_coherent ) :
+  use_scales( use_scales ), key( key ), phi( phi ), range( num ),
+  threshold( 0.05 ), white( 1e20 ), temporal_coherent( temporal_coherent )
 {
-  int x, y;
-
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-    {
-      image[y][x][0] = (image[y][x][0] > 1.) ? 1. : image[y][x][0];
-      image[y][x][1] = (image[y][x][1] > 1.) ? 1. : image[y][x][1];
-      image[y][x][2] = (image[y][x][2] > 1.) ? 1. : image[y][x][2];
-    }
+  sigma_0 = log( (double)low );
+  sigma_1 = log( (double)high );
 }
 
-double log_average ()
+void Reinhard02Context::reset()
 {
-  int    x, y;
-  double sum = 0.;
-
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-      sum += log (0.00001 + luminance[y][x]);
-  return exp (sum / (double)(cvts.xmax * cvts.ymax));
-}
-
-void scale_to_midtone ()
-{
-  int    x, y, u, v, d;
-  double factor;
-  double scale_factor;
-  double low_tone    = key / 3.;
-  int    border_size = (cvts.xmax < cvts.ymax) ? int(cvts.xmax / 5.) : int(cvts.ymax / 5.);
-  int    hw          = cvts.xmax >> 1;
-  int    hh          = cvts.ymax >> 1;
-
-  double avg;
-  if( temporal_coherent ) {
-    avg_luminance.set( log_average() );
-    avg = avg_luminance.get();
-  } else avg = log_average();
-  
-  scale_factor = 1.0 / avg;
-  for (y = 0; y < cvts.ymax; y++)
-    for (x = 0; x < cvts.xmax; x++)
-    {
-      if (use_border)
-      {
-	u              = (x > hw) ? cvts.xmax - x : x;
-	v              = (y > hh) ? cvts.ymax - y : y;
-	d              = (u < v) ? u : v;	
-	factor         = (d < border_size) ? (key - low_tone) * 
-	                  kaiserbessel (border_size - d, 0, border_size) + 
-                          low_tone : key;
-      }
-      else
-	factor         = key;
-      image[y][x][0]  *= scale_factor * factor;
-      luminance[y][x] *= scale_factor * factor;
-    }
+  avg_luminance = TemporalSmoothVariable<double>();
+  max_luminance = TemporalSmoothVariable<double>();
 }
 
-void copy_luminance ()
+/// size in pixels of the scale i
+double Reinhard02Context::scaleSize( int i ) const
 {
-  int x, y;
-
-  for (x = 0; x < cvts.xmax; x++)
-    for (y = 0; y < cvts.ymax; y++)
-      luminance[y][x] = image[y][x][0];
+  return exp( sigma_0 + ((double)i/(double)range)*(sigma_1 - sigma_0) );
 }
 
-/*
- * Memory allocation
+/**
+ * Finds the local adaptation luminance: the largest scale around each
+ * pixel at which the center-surround activity stays below threshold.
+ * The scales are computed one at a time, so only two of them are kept
+ * in memory.
  */
-void allocate_memory ()
+void Reinhard02Context::localAdaptation( int width, int height )
 {
-  int y;
+  const int size = width*height;
+  scale_cur.resize( size );
+  scale_next.resize( size );
+  blur_tmp.resize( size );
+  adaptation.resize( size );
+  selected.assign( size, 0 );
 
-  luminance = (double **) malloc (cvts.ymax * sizeof (double *));
-  image     = (COLOR **) malloc (cvts.ymax * sizeof (COLOR *));
-  for (y = 0; y < cvts.ymax; y++)
-  {
-    luminance[y] = (double *) malloc (cvts.xmax * sizeof (double));
-    image[y]     = (COLOR *) malloc (cvts.xmax * sizeof (COLOR));
-  }
-}
-
-void deallocate_memory ()
-{
-  int y;
+  gaussian_blur( &luminance[0], &scale_cur[0], &blur_tmp[0], width, height,
+    k*scaleSize( 0 )/sqrt(2.) );
 
-  for (y = 0; y < cvts.ymax; y++)
+  for( int scale=0 ; scale<range-1 ; scale++ )
   {
-    free(luminance[y]);
-    free(image[y]);
-  }
-  free( luminance );
-  free( image );
-}
+    gaussian_blur( &luminance[0], &scale_next[0], &blur_tmp[0], width, height,
+      k*scaleSize( scale+1 )/sqrt(2.) );
 
+    const double s = scaleSize( scale );
+    const float norm = (key * pow( 2., phi )) / (s*s);
+    const float *V1 = &scale_cur[0];
+    const float *V2 = &scale_next[0];
 
-void dynamic_range ()
-{
-  int x, y;
-  double minval =  1e20;
-  double maxval = -1e20;
+    #pragma omp parallel for schedule(static)
+    for( int y=0 ; y<height ; y++ )
+      for( int x=y*width ; x<(y+1)*width ; x++ )
+      {
+        const float activity = (V1[x] - V2[x]) / (norm + V1[x]);
+        if( !selected[x] && fabsf( activity ) > threshold )
+        {
+          adaptation[x] = V1[x];
+          selected[x] = 1;
+        }
+      }
 
-  for (x = 0; x < cvts.xmax; x++)
-    for (y = 0; y < cvts.ymax; y++)
-    {
-      if ((luminance[y][x] < minval) &&
-	  (luminance[y][x] > 0.0))
-	minval = luminance[y][x];
-      if (luminance[y][x] > maxval)
-	maxval = luminance[y][x];
-    }
-  fprintf (stderr, "\tRange of values  = %9.8f - %9.8f\n", minval, maxval);
-  fprintf (stderr, "\tDynamic range    = %i:1\n", (int)(maxval/minval));
-}
+    scale_cur.swap( scale_next );
+  }
 
-void print_parameter_settings ()
-{
-  fprintf (stderr, "\tImage size       = %i %i\n", cvts.xmax, cvts.ymax);
-  fprintf (stderr, "\tLowest scale     = %i pixels\t\t(-low <integer>)\n", scale_low);
-  fprintf (stderr, "\tHighest scale    = %i pixels\t\t(-high <integer>)\n", scale_high);
-  fprintf (stderr, "\tNumber of scales = %i\t\t\t(-num <integer>)\n", range);
-  fprintf (stderr, "\tScale spacing    = %f\n", S_I(1) / S_I(0));
-  fprintf (stderr, "\tKey value        = %f\t\t(-key <float>)\n", key);
-  fprintf (stderr, "\tWhite value      = %f\t\t(-white <float>)\n", white);
-  fprintf (stderr, "\tPhi              = %f\t\t(-phi <float>)\n", phi);
-  fprintf (stderr, "\tThreshold        = %f\t\t(-threshold <float>)\n", threshold);
-  dynamic_range ();
+  // pixels with no activity above threshold adapt to the largest scale
+  #pragma omp parallel for schedule(static)
+  for( int i=0 ; i<size ; i++ )
+    if( !selected[i] )
+      adaptation[i] = scale_cur[i];
 }
 
-/*
- * @brief Photographic tone-reproduction
- *
- * @param Y input luminance
- * @param L output tonemapped intensities
- * @param use_scales true: local version, false: global version of TMO
- * @param key maps log average luminance to this value (default: 0.18)
- * @param phi sharpening parameter (defaults to 1 - no sharpening)
- * @param num number of scales to use in computation (default: 8)
- * @param low size in pixels of smallest scale (should be kept at 1)
- * @param high size in pixels of largest scale (default 1.6^8 = 43)
- */
-void tmo_reinhard02(
-  unsigned int width, unsigned int height,
-  const float *nY, float *nL, 
-  bool use_scales, float key, float phi, 
-  int num, int low, int high, bool temporal_coherent )
+void Reinhard02Context::tonemap( unsigned int width, unsigned int height,
+  const float *nY, float *nL )
 {
-  const pfstmo::Array2D* Y = new pfstmo::Array2D(width, height, const_cast<float*>(nY));
-  pfstmo::Array2D* L = new pfstmo::Array2D(width, height, nL);
+  assert( nY!=NULL && nL!=NULL );
 
-  int x,y;
+  const int size = width*height;
+  luminance.resize( size );
 
-  ::key = key;
-  ::phi = phi;
-  ::range = num;
-  ::scale_low = low;
-  ::scale_high = high;
-  ::use_scales = (use_scales) ? 1 : 0;
-  ::temporal_coherent = temporal_coherent;
-
-  cvts.xmax = Y->getCols();
-  cvts.ymax = Y->getRows();
-
-  sigma_0      = log (scale_low);
-  sigma_1      = log (scale_high);
-
-  compute_bessel();
-  allocate_memory ();
-
-  // reading image
-  for( y=0 ; y<cvts.ymax ; y++ )
-    for( x=0 ; x<cvts.xmax ; x++ )
-      image[y][x][0] = (*Y)(x,y);
+  // log average
+  double sum = 0.;
+  #pragma omp parallel for simd reduction(+:sum) schedule(static)
+  for( int i=0 ; i<size ; i++ )
+    sum += pfstmo::fast_log2( 0.00001f + nY[i] );
+  double avg = exp2( sum / (double)size );
+  if( temporal_coherent ) {
+    avg_luminance.set( avg );
+    avg = avg_luminance.get();
+  }
 
-  copy_luminance();
-  scale_to_midtone();
+  // scale to midtone
+  const float scale_factor = key / avg;
+  float max_lum = 0.f;
+  #pragma omp parallel for simd reduction(max:max_lum) schedule(static)
+  for( int i=0 ; i<size ; i++ )
+  {
+    const float l = nY[i] * scale_factor;
+    luminance[i] = l;
+    max_lum = (max_lum < l) ? l : max_lum;
+  }
 
   if( use_scales )
   {
-#ifdef APPROXIMATE
-    build_pyramid(luminance, cvts.xmax, cvts.ymax);
-#else
-    compute_fourier_convolution();
-#endif
+    localAdaptation( width, height );
+    #pragma omp parallel for simd schedule(static)
+    for( int i=0 ; i<size ; i++ )
+      nL[i] = luminance[i] / (1.f + adaptation[i]);
   }
+  else
+  {
+    double Lmax2;
+    if( white < 1e20 )
+      Lmax2 = white;
+    else if( temporal_coherent ) {
+      max_luminance.set( max_lum );
+      Lmax2 = max_luminance.get();
+    } else
+      Lmax2 = max_lum;
+    Lmax2 *= Lmax2;
 
-  tonemap_image();
-
-  // saving image
-  for( y=0 ; y<cvts.ymax ; y++ )
-    for( x=0 ; x<cvts.xmax ; x++ )
-      (*L)(x,y) = image[y][x][0];
-
-//  print_parameter_settings();
-
-  deallocate_memory();
-  clean_pyramid();
-
-  delete L;
-  delete Y;
+    const float inv_Lmax2 = 1. / Lmax2;
+    #pragma omp parallel for simd schedule(static)
+    for( int i=0 ; i<size ; i++ )
+    {
+      const float l = luminance[i];
+      nL[i] = l * (1.f + l*inv_Lmax2) / (1.f + l);
+    }
+  }
 }
@@ -10,23 +10,107 @@
 #ifndef _tmo_reinhard02_h_
 #define _tmo_reinhard02_h_
 
-/*
- * @brief Photographic tone-reproduction
+#include <vector>
+
+/**
+ * Used to achieve temporal coherence
+ */
+template<class T>
+class TemporalSmoothVariable
+{
+//  const int hist_length = 100;
+  T value;
+
+  T getThreshold( T luminance )
+  {
+    return 0.01 * luminance;
+  }
+
+public:
+  TemporalSmoothVariable() : value( -1 )
+  {
+  }
+
+  void set( T new_value )
+  {
+    if( value == -1 )
+      value = new_value;
+    else {
+      T delta = new_value - value;
+      const T threshold = getThreshold( (new_value + value)/2 );
+      if( delta > threshold ) delta = threshold;
+      else if( delta < -threshold ) delta = -threshold;
+      value += delta;
+    }
+  }
+
+  T get() const
+  {
+    return value;
+  }
+};
+
+
+/**
+ * @brief Photographic tone-reproduction [Reinhard2002]
  *
- * @param width image width
- * @param height image height
- * @param Y input luminance
- * @param L output tonemapped intensities
- * @param use_scales true: local version, false: global version of TMO
- * @param key maps log average luminance to this value (default: 0.18)
- * @param phi sharpening parameter (defaults to 1 - no sharpening)
- * @param num number of scales to use in computation (default: 8)
- * @param low size in pixels of smallest scale (should be kept at 1)
- * @param high size in pixels of largest scale (default 1.6^8 = 43)
+ * All state of the operator, including the temporal smoothing of the
+ * image statistics and the working buffers, is kept in the object, so
+ * several instances can be used concurrently. The buffers are reused
+ * when consecutive frames have the same size.
  */
-void tmo_reinhard02(unsigned int width, unsigned int height, 
-  const float *Y, float *L, 
-  bool use_scales, float key, float phi, 
-  int num, int low, int high, bool temporal_coherent );
+class Reinhard02Context
+{
+public:
+  /**
+   * @param use_scales true: local version, false: global version of TMO
+   * @param key maps log average luminance to this value (default: 0.18)
+   * @param phi sharpening parameter (defaults to 1 - no sharpening)
+   * @param num number of scales to use in computation (default: 8)
+   * @param low size in pixels of smallest scale (should be kept at 1)
+   * @param high size in pixels of largest scale (default 1.6^8 = 43)
+   * @param temporal_coherent smooth the image statistics over
+   *        consecutive frames
+   */
+  Reinhard02Context( bool use_scales, float key, float phi,
+    int num, int low, int high, bool temporal_coherent );
+
+  /**
+   * @brief Tone map one frame
+   *
+   * @param width image width
+   * @param height image height
+   * @param Y input luminance
+   * @param L output tonemapped intensities
+   */
+  void tonemap( unsigned int width, unsigned int height,
+    const float *Y, float *L );
+
+  /**
+   * @brief Forget the temporal smoothing of the previous frames
+   */
+  void reset();
+
+private:
+  bool use_scales;
+  double key;
+  double phi;
+  int range;
+  double sigma_0, sigma_1;
+  double threshold;
+  double white;
+  bool temporal_coherent;
+
+  TemporalSmoothVariable<double> avg_luminance, max_luminance;
+
+  // working buffers
+  std::vector<float> luminance;
+  std::vector<float> scale_cur, scale_next, blur_tmp;
+  std::vector<float> adaptation;
+  std::vector<unsigned char> selected;
+
+  double scaleSize( int i ) const;
+  void localAdaptation( int width, int height );
+};
 
 #endif /* _tmo_reinhard02_h_ */
@@ -37,11 +37,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
-#include <math.h>
 
 #include <pfs.h>
 
-#include "tmo_reinhard05.h"
+#include "tmo_context.h"
 
 using namespace std;
 
@@ -66,10 +65,8 @@ void pfstmo_reinhard05( int argc, char* argv[] )
 {
   pfs::DOMIO pfsio;
 
-  //--- default tone mapping parameters;
-  float brightness = 0.0f;
-  float chromaticadaptation = 0.5f;
-  float lightadaptation = 0.75f;
+  //--- tone mapping parameters, checked by the reinhard05 context
+  pfstmo::Options tmo_options;
 
   static struct option cmdLineOptions[] = {
     { "help", no_argument, NULL, 'h' },
@@ -91,32 +88,19 @@ void pfstmo_reinhard05( int argc, char* argv[] )
     case 'v':
       verbose = true;
       break;
-    case 'b':
-      brightness = (float)strtod( optarg, NULL );
-      if( brightness<-8.0f || brightness>8.0f )
-        throw pfs::Exception("brightness value out of range, should be <-8..8>");
-      break;
-    case 'c':
-      chromaticadaptation = (float)strtod( optarg, NULL );
-      if( chromaticadaptation<0.0f || chromaticadaptation>1.0f )
-        throw pfs::Exception("chromatic adaptation value out of range, should be <0..1>");
-      break;
-    case 'l':
-      lightadaptation = (float)strtod( optarg, NULL );
-      if( lightadaptation<0.0f || lightadaptation>1.0f )
-        throw pfs::Exception("light adaptation value out of range, should be <0..1>");
-      break;
     case '?':
       throw QuietException();
     case ':':
       throw QuietException();
+    default:
+      tmo_options.set( cmdLineOptions, c, optarg );
     }
   }
 
-  VERBOSE_STR << "brightness: " << brightness << endl;
-  VERBOSE_STR << "chromatic adaptation: " << chromaticadaptation << endl;
-  VERBOSE_STR << "light adaptation: " << lightadaptation << endl;
+  // report wrong parameters before reading any frame
+  delete pfstmo::createContext( "reinhard05", 1, 1, tmo_options );
 
+  pfstmo::Context *tmo = NULL;
   while( true ) 
   {
     pfs::Frame *frame = pfsio.readFrame( stdin );
@@ -124,32 +108,29 @@ void pfstmo_reinhard05( int argc, char* argv[] )
 
     pfs::Channel *X, *Y, *Z;
     frame->getXYZChannels( X, Y, Z );
-    frame->getTags()->setString("LUMINANCE", "RELATIVE");
     //---
 
     if( Y==NULL || X==NULL || Z==NULL)
       throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
         
-    // tone mapping
+    // buffers are reused for all frames of the same size
     int w = Y->getCols();
     int h = Y->getRows();
-    pfs::Array2DImpl* R = new pfs::Array2DImpl(w,h);
-    pfs::Array2DImpl* G = new pfs::Array2DImpl(w,h);
-    pfs::Array2DImpl* B = new pfs::Array2DImpl(w,h);
-
-    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, R, G, B );
-
-    tmo_reinhard05(w, h, R->getRawData(), G->getRawData(), B->getRawData(), Y->getRawData(), brightness, chromaticadaptation, lightadaptation );
-    pfs::transformColorSpace( pfs::CS_SRGB, R, G, B, pfs::CS_XYZ, X, Y, Z );
+    if( tmo == NULL || tmo->getWidth() != w || tmo->getHeight() != h ) {
+      delete tmo;
+      tmo = pfstmo::createContext( "reinhard05", w, h, tmo_options );
+      if( verbose )
+        tmo->setVerbose( PROG_NAME );
+    }
 
-    delete R;
-    delete G;
-    delete B;
+    tmo->process( X->getRawData(), Y->getRawData(), Z->getRawData() );
+    frame->getTags()->setString( "LUMINANCE", tmo->getLuminanceType() );
 
     //---
     pfsio.writeFrame( frame, stdout );
     pfsio.freeFrame( frame );        
   }
+  delete tmo;
 }
 
 int main( int argc, char* argv[] )
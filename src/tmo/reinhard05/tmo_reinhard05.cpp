@@ -38,116 +38,224 @@
 
 #include "tmo_reinhard05.h"
 #include "pfstmo.h"
+#include "fast_math.h"
+#include "pointwise.h"
 
 #include <assert.h>
 
 
-void tmo_reinhard05(unsigned int width, unsigned int height,
-  float* nR, float* nG, float* nB, 
-  const float* nY, float br, float ca, float la )
+/**
+ * Photoreceptor equation for a single colour channel. Pixels of zero
+ * value are passed through.
+ *
+ * The pow() is evaluated with pfstmo::fast_pow(). Its relative error
+ * for m <= 1 is below 4e-7 + 1.2e-7*|log2(f*Ia)|, which is at most
+ * 1.6e-5 and about 3e-6 for adaptation levels between 1e-6 and 1e6.
+ * The relative error of the compressed value is bounded by the same
+ * number.
+ */
+static inline float photoreceptor( float col, float l, float Ig,
+  float f, float m, float ca, float la )
 {
-  const pfstmo::Array2D* Y = new pfstmo::Array2D(width, height, const_cast<float*>(nY));
-  pfstmo::Array2D* R = new pfstmo::Array2D(width, height, nR);
-  pfstmo::Array2D* G = new pfstmo::Array2D(width, height, nG);
-  pfstmo::Array2D* B = new pfstmo::Array2D(width, height, nB);
-
-  float max_lum = (*Y)(0);
-  float min_lum = (*Y)(0);
-  float world_lum = 0.0;
-  float Cav[] = { 0.0f, 0.0f, 0.0f};
-  float Lav = 0.0f;
-  int im_width = Y->getCols();
-  int im_height = Y->getRows();
-  int im_size = im_width * im_height;
-
-  for( int i=1 ; i<im_size ; i++ )
+  // local light adaptation
+  const float Il = ca * col + (1-ca)*l;
+  // interpolated light adaptation (Ig is the global light adaptation)
+  const float Ia = la*Il + (1-la)*Ig;
+  const float compressed = col / (col + pfstmo::fast_pow(f*Ia, m));
+  return pfstmo::select( col != 0.0f, compressed, col );
+}
+
+
+namespace
+{
+  /// Statistics of the input image
+  struct ImageStats
   {
-    float lum = (*Y)(i);
-    max_lum = (max_lum > lum) ? max_lum : lum;
-    min_lum = (min_lum < lum) ? min_lum : lum;
-    world_lum += log(2.3e-5+lum);
-    Cav[0] += (*R)(i);
-    Cav[1] += (*G)(i);
-    Cav[2] += (*B)(i);
-    Lav += lum;
-  }
-  world_lum /= im_size;
-  Cav[0] /= im_size;
-  Cav[1] /= im_size;
-  Cav[2] /= im_size;
-  Lav /= im_size;
+    const float *R, *G, *B, *Y;
+    float max_lum, min_lum;
+    double world_lum;
+    double sum_r, sum_g, sum_b, sum_lum;
 
-  //--- tone map image
-  max_lum = log( max_lum );
-  min_lum = log( min_lum );
+    ImageStats( const float* R, const float* G, const float* B, const float* Y ) :
+      R(R), G(G), B(B), Y(Y), max_lum(Y[0]), min_lum(Y[0]), world_lum(0.0),
+      sum_r(0.0), sum_g(0.0), sum_b(0.0), sum_lum(0.0)
+    {
+    }
 
-  // image key
-  float k = (max_lum - world_lum) / (max_lum - min_lum);
-  // image contrast based on key value
-  float m = 0.3f+0.7f*pow(k,1.4f);
-  // image brightness
-  float f = exp(-br);
+    void add( int begin, int end )
+    {
+      float t_max = max_lum, t_min = min_lum;
+      double t_world = 0.0, t_r = 0.0, t_g = 0.0, t_b = 0.0, t_lum = 0.0;
+      #pragma omp simd reduction(max:t_max) reduction(min:t_min) \
+        reduction(+:t_world,t_r,t_g,t_b,t_lum)
+      for( int i=begin ; i<end ; i++ )
+      {
+        const float lum = Y[i];
+        t_max = (t_max > lum) ? t_max : lum;
+        t_min = (t_min < lum) ? t_min : lum;
+        t_world += pfstmo::fast_log2(2.3e-5f+lum);
+        t_r += R[i];
+        t_g += G[i];
+        t_b += B[i];
+        t_lum += lum;
+      }
+      max_lum = t_max;
+      min_lum = t_min;
+      world_lum += t_world;
+      sum_r += t_r;
+      sum_g += t_g;
+      sum_b += t_b;
+      sum_lum += t_lum;
+    }
 
-  float max_col = 0.0f;
-  float min_col = 1.0f;
+    void merge( const ImageStats& o )
+    {
+      max_lum = (max_lum > o.max_lum) ? max_lum : o.max_lum;
+      min_lum = (min_lum < o.min_lum) ? min_lum : o.min_lum;
+      world_lum += o.world_lum;
+      sum_r += o.sum_r;
+      sum_g += o.sum_g;
+      sum_b += o.sum_b;
+      sum_lum += o.sum_lum;
+    }
+  };
 
-  int x,y;
-  for( y=0 ; y<im_height ; y++ )
+  /**
+   * Applies the photoreceptor equation in-place. Pixels of zero
+   * luminance are left unchanged.
+   */
+  struct PhotoreceptorKernel
   {
-    for( x=0 ; x<im_width ; x++ )
+    float *R, *G, *B;
+    const float *Y;
+    float Ig[3];
+    float f, m, ca, la;
+
+    void operator()( int begin, int end ) const
     {
-      float l = (*Y)(x,y);
-      float col;
-      if( l != 0.0f )
+      #pragma omp simd
+      for( int i=begin ; i<end ; i++ )
       {
-        for( int c=0 ; c<3 ; c++ )
-        {
-          switch(c)
-          {
-          case 0: col = (*R)(x,y); break;
-          case 1: col = (*G)(x,y); break;
-          case 2: col = (*B)(x,y); break;
-          };
-
-          if( col!=0.0f)
-          {
-            // local light adaptation
-            float Il = ca * col + (1-ca)*l;
-            // global light adaptation
-            float Ig = ca*Cav[c] + (1-ca)*Lav;
-            // interpolated light adaptation
-            float Ia = la*Il + (1-la)*Ig;
-            // photoreceptor equation
-            col /= col + pow(f*Ia, m);
-          }
-        
-          max_col = (col>max_col) ? col : max_col;
-          min_col = (col<min_col) ? col : min_col;
-
-          switch(c)
-          {
-          case 0: (*R)(x,y) = col; break;
-          case 1: (*G)(x,y) = col; break;
-          case 2: (*B)(x,y) = col; break;
-          };
-        }
+        const float l = Y[i];
+        const bool mapped = (l != 0.0f);
+        R[i] = pfstmo::select( mapped, photoreceptor( R[i], l, Ig[0], f, m, ca, la ), R[i] );
+        G[i] = pfstmo::select( mapped, photoreceptor( G[i], l, Ig[1], f, m, ca, la ), G[i] );
+        B[i] = pfstmo::select( mapped, photoreceptor( B[i], l, Ig[2], f, m, ca, la ), B[i] );
       }
     }
-  }
+  };
 
-  //--- normalize intensities
-  for( y=0 ; y<im_height ; y++ )
+  /**
+   * Range of the photoreceptor response for the normalization. Pixels
+   * of zero luminance do not take part in the normalization.
+   */
+  struct ColorRangeStats
+  {
+    const float *R, *G, *B, *Y;
+    float max_col, min_col;
+
+    void add( int begin, int end )
+    {
+      float t_max = max_col, t_min = min_col;
+      #pragma omp simd reduction(max:t_max) reduction(min:t_min)
+      for( int i=begin ; i<end ; i++ )
+      {
+        const float r = R[i], g = G[i], b = B[i];
+        const bool mapped = (Y[i] != 0.0f);
+        float px_max = (r > g) ? r : g;
+        px_max = (px_max > b) ? px_max : b;
+        float px_min = (r < g) ? r : g;
+        px_min = (px_min < b) ? px_min : b;
+        t_max = (mapped & (px_max > t_max)) ? px_max : t_max;
+        t_min = (mapped & (px_min < t_min)) ? px_min : t_min;
+      }
+      max_col = t_max;
+      min_col = t_min;
+    }
+
+    void merge( const ColorRangeStats& o )
+    {
+      max_col = (max_col > o.max_col) ? max_col : o.max_col;
+      min_col = (min_col < o.min_col) ? min_col : o.min_col;
+    }
+  };
+
+  struct NormalizeKernel
   {
-    for( x=0 ; x<im_width ; x++ )
+    float *R, *G, *B;
+    float min_col, scale;
+
+    void operator()( int begin, int end ) const
     {
-      (*R)(x,y) = ((*R)(x,y)-min_col)/(max_col-min_col);
-      (*G)(x,y) = ((*G)(x,y)-min_col)/(max_col-min_col);
-      (*B)(x,y) = ((*B)(x,y)-min_col)/(max_col-min_col);
+      #pragma omp simd
+      for( int i=begin ; i<end ; i++ )
+      {
+        R[i] = (R[i]-min_col)*scale;
+        G[i] = (G[i]-min_col)*scale;
+        B[i] = (B[i]-min_col)*scale;
+      }
     }
-  }
+  };
+}
 
-  delete B;
-  delete G;
-  delete R;
-  delete Y;
+
+void tmo_reinhard05(unsigned int width, unsigned int height,
+  float* nR, float* nG, float* nB, 
+  const float* nY, float br, float ca, float la )
+{
+  assert(nR!=NULL && nG!=NULL && nB!=NULL && nY!=NULL);
+
+  const int im_size = width * height;
+
+  //--- image statistics, single parallel pass
+  ImageStats stats( nR, nG, nB, nY );
+  pfstmo::reduce_tiles( im_size, stats );
+
+  // fast_log2 returns base-2 logarithms
+  const double world_lum = stats.world_lum * M_LN2 / im_size;
+  const float Cav[] = { (float)(stats.sum_r/im_size), (float)(stats.sum_g/im_size),
+                        (float)(stats.sum_b/im_size) };
+  const float Lav = (float)(stats.sum_lum/im_size);
+
+  //--- tone map image
+  const float max_lum = log( stats.max_lum );
+  const float min_lum = log( stats.min_lum );
+
+  // image key
+  float k = (max_lum - world_lum) / (max_lum - min_lum);
+
+  PhotoreceptorKernel pr;
+  pr.R = nR;
+  pr.G = nG;
+  pr.B = nB;
+  pr.Y = nY;
+  // image contrast based on key value
+  pr.m = 0.3f+0.7f*pow(k,1.4f);
+  // image brightness
+  pr.f = exp(-br);
+  pr.ca = ca;
+  pr.la = la;
+  // global light adaptation
+  for( int c=0 ; c<3 ; c++ )
+    pr.Ig[c] = ca*Cav[c] + (1-ca)*Lav;
+  pfstmo::map_tiles( im_size, pr );
+
+  //--- range of the response
+  ColorRangeStats range;
+  range.R = nR;
+  range.G = nG;
+  range.B = nB;
+  range.Y = nY;
+  range.max_col = 0.0f;
+  range.min_col = 1.0f;
+  pfstmo::reduce_tiles( im_size, range );
+
+  //--- normalize intensities
+  NormalizeKernel normalize;
+  normalize.R = nR;
+  normalize.G = nG;
+  normalize.B = nB;
+  normalize.min_col = range.min_col;
+  normalize.scale = 1.0f / (range.max_col-range.min_col);
+  pfstmo::map_tiles( im_size, normalize );
 }